@@ -0,0 +1,105 @@
+#include "Arduino.h"
+#include "adcSampler.h"
+
+//////////////////////////////////////////////////////////
+// ADC SAMPLER (os_timer driven)
+//////////////////////////////////////////////////////////
+AdcSampler :: AdcSampler(VoltageSensor* sensor) {
+  _sensor = sensor;
+  _samplePeriodMs = 0;
+  _running = false;
+  _tripHandler = nullptr;
+  _tripArg = nullptr;
+  _tripLevel = -1;
+  _tripSamples = 1;
+  _belowCount = 0;
+  _tripped = false;
+  _tripRaw = 0;
+  os_timer_disarm(&_timer);
+  os_timer_setfn(&_timer, &AdcSampler::_onTimer, this);
+}
+
+void AdcSampler :: begin(unsigned long samplePeriodMs) {
+  // os_timer resolution is 1 ms
+  _samplePeriodMs = samplePeriodMs > 0 ? samplePeriodMs : 1;
+  os_timer_disarm(&_timer);
+  os_timer_arm(&_timer, _samplePeriodMs, true);
+  _running = true;
+}
+
+void AdcSampler :: stop() {
+  os_timer_disarm(&_timer);
+  _running = false;
+}
+
+bool AdcSampler :: read(AdcSample& sample) {
+  return _ring.pop(sample);
+}
+
+uint16_t AdcSampler :: available() {
+  return _ring.available();
+}
+
+unsigned long AdcSampler :: getOverflowCount() {
+  return _ring.getOverflowCount();
+}
+
+void AdcSampler :: setTripHandler(TripHandler handler, void* arg) {
+  _tripHandler = handler;
+  _tripArg = arg;
+}
+
+void AdcSampler :: setTripLevel(int rawLevel, uint8_t tripSamples) {
+  _tripSamples = tripSamples > 0 ? tripSamples : 1;
+  _belowCount = 0;
+  _tripLevel = rawLevel;
+}
+
+void AdcSampler :: clearTrip() {
+  _belowCount = 0;
+  _tripped = false;
+}
+
+void AdcSampler :: _onTimer(void* arg) {
+  static_cast<AdcSampler*>(arg)->sampleNow();
+}
+
+void AdcSampler :: sampleNow() {
+  AdcSample sample;
+  sample.raw = (uint16_t)_sensor->readRaw();
+  _ring.push(sample);
+  _checkTrip(sample.raw);
+}
+
+uint16_t AdcSampler :: sampleBurst(uint8_t count) {
+  AdcSample sample;
+  uint32_t sum = 0;
+  count = count > 0 ? count : 1;
+  for (uint8_t i = 0; i < count; i++) {
+    sample.raw = (uint16_t)_sensor->readRaw();
+    _ring.push(sample);
+    sum += sample.raw;
+  }
+  uint16_t mean = (uint16_t)(sum / count);
+  _checkTrip(mean);
+  return mean;
+}
+
+void AdcSampler :: _checkTrip(uint16_t raw) {
+  // Fast trip path: consecutive low readings act immediately
+  if (_tripLevel < 0 || _tripped) {
+    return;
+  }
+  if ((int)raw < _tripLevel) {
+    if (++_belowCount >= _tripSamples) {
+      _tripped = true;
+      _tripRaw = raw;
+      if (_tripHandler) {
+        _tripHandler(_tripArg);
+      }
+    }
+  } else {
+    _belowCount = 0;
+  }
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,131 @@
+#ifndef adcSampler_h
+#define adcSampler_h
+
+#include "Arduino.h"
+#include "basicHardware.h"
+
+extern "C" {
+#include "user_interface.h"
+}
+
+//////////////////////////////////////////////////////////
+// SAMPLE RING (single producer / single consumer)
+//////////////////////////////////////////////////////////
+// Lock-free as long as exactly one context pushes and one pops.
+// CAPACITY must be a power of two; indices run freely and wrap.
+template <typename T, uint16_t CAPACITY>
+class SampleRing {
+  public:
+    SampleRing() {
+      _head = 0;
+      _tail = 0;
+      _overflowCount = 0;
+    }
+
+    // Producer side. Drops the sample (and counts it) when full.
+    bool push(T value) {
+      uint16_t head = _head;
+      if ((uint16_t)(head - _tail) >= CAPACITY) {
+        _overflowCount++;
+        return false;
+      }
+      _buffer[head & MASK] = value;
+      _barrier(); // Publish the slot before the index
+      _head = head + 1;
+      return true;
+    }
+
+    // Consumer side
+    bool pop(T& value) {
+      uint16_t tail = _tail;
+      if (tail == _head) {
+        return false;
+      }
+      value = _buffer[tail & MASK];
+      _barrier(); // Finish reading the slot before releasing it
+      _tail = tail + 1;
+      return true;
+    }
+
+    uint16_t available() { return (uint16_t)(_head - _tail); }
+    unsigned long getOverflowCount() { return _overflowCount; }
+
+  private:
+    static const uint16_t MASK = CAPACITY - 1;
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "SampleRing capacity must be a power of two");
+
+    T _buffer[CAPACITY];
+    volatile uint16_t _head; // Written only by the producer
+    volatile uint16_t _tail; // Written only by the consumer
+    volatile unsigned long _overflowCount;
+
+    static inline void _barrier() { __asm__ __volatile__("" ::: "memory"); }
+};
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// ADC SAMPLER (os_timer driven)
+//////////////////////////////////////////////////////////
+// Reads the voltage sensor from an os_timer callback at a fixed period
+// and queues raw ADC counts for loop() to consume. The callback runs in
+// system context, which gets the CPU whenever loop() yields (delay(),
+// yield()), so sampling keeps going through the delay at the end of
+// loop().
+//
+// A trip level can be armed: after tripSamples consecutive readings
+// below it the trip handler is called straight from the timer callback,
+// so the worst-case reaction is tripSamples sample periods regardless of
+// what loop() is doing. The trip latches until clearTrip(). Back-to-back
+// bursts (sampleBurst) count as one reading: samples microseconds apart
+// would otherwise let a dip of a few milliseconds trip the relay.
+struct AdcSample {
+  uint16_t raw; // Samples are consumed in order, no timestamp needed
+};
+static_assert(sizeof(AdcSample) == 2, "AdcSample is one 2-byte ring entry");
+
+class AdcSampler {
+  public:
+    typedef void (*TripHandler)(void* arg);
+    static const uint16_t RING_CAPACITY = 128;
+
+    AdcSampler(VoltageSensor* sensor);
+
+    void begin(unsigned long samplePeriodMs);
+    void stop();
+    bool isRunning() { return _running; }
+    void sampleNow(); // Take one sample from loop context (timer stopped, e.g. in light sleep mode)
+    uint16_t sampleBurst(uint8_t count); // count samples back to back, one trip evaluation on their mean; returns the mean
+
+    bool read(AdcSample& sample); // Pop the oldest queued sample
+    uint16_t available();
+    unsigned long getOverflowCount();
+    unsigned long getSamplePeriodMs() { return _samplePeriodMs; }
+
+    void setTripHandler(TripHandler handler, void* arg);
+    void setTripLevel(int rawLevel, uint8_t tripSamples); // Trip when raw < rawLevel; -1 disables
+    bool isTripped() { return _tripped; }
+    uint16_t getTripRaw() { return _tripRaw; }
+    void clearTrip();
+
+  private:
+    VoltageSensor* _sensor;
+    SampleRing<AdcSample, RING_CAPACITY> _ring;
+    os_timer_t _timer;
+    unsigned long _samplePeriodMs;
+    bool _running;
+
+    TripHandler _tripHandler;
+    void* _tripArg;
+    volatile int _tripLevel;
+    volatile uint8_t _tripSamples;
+    volatile uint8_t _belowCount;
+    volatile bool _tripped;
+    volatile uint16_t _tripRaw;
+
+    static void _onTimer(void* arg);
+    void _checkTrip(uint16_t raw);
+};
+//////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,90 @@
+#include "Arduino.h"
+#include "Wire.h"
+#include "bankHardware.h"
+
+
+//////////////////////////////////////////////////////////
+// ADS1115 / ADS1015 (I2C ADC)
+//////////////////////////////////////////////////////////
+Ads1x15 :: Ads1x15(uint8_t address, bool isAds1015) {
+  _address = address;
+  _isAds1015 = isAds1015;
+}
+
+bool Ads1x15 :: startConversion(uint8_t input) {
+  uint16_t config = CONFIG_START | CONFIG_MUX_SINGLE | ((uint16_t)(input & 0x03) << 12) |
+    CONFIG_PGA_4096 | CONFIG_SINGLE_SHOT | CONFIG_RATE_FASTEST | CONFIG_NO_COMPARATOR;
+  Wire.beginTransmission(_address);
+  Wire.write(REGISTER_CONFIG);
+  Wire.write((uint8_t)(config >> 8));
+  Wire.write((uint8_t)(config & 0xFF));
+  return Wire.endTransmission() == 0;
+}
+
+bool Ads1x15 :: readMillivolts(uint16_t& millivolts) {
+  Wire.beginTransmission(_address);
+  Wire.write(REGISTER_CONVERSION);
+  if (Wire.endTransmission() != 0 || Wire.requestFrom(_address, (uint8_t)2) != 2) {
+    return false;
+  }
+  int16_t counts = (int16_t)((Wire.read() << 8) | Wire.read());
+  millivolts = counts > 0 ? (uint16_t)(counts >> 3) : 0; // 0.125 mV per count
+  return true;
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// ANALOG MUX (CD74HC4051 on A0)
+//////////////////////////////////////////////////////////
+AnalogMux :: AnalogMux(Pin* adcPin, Pin* select0, Pin* select1, Pin* select2) {
+  _adcPin = adcPin;
+  _select[0] = select0;
+  _select[1] = select1;
+  _select[2] = select2;
+  _adcPin->setPinMode(INPUT);
+  for (uint8_t i = 0; i < 3; i++) {
+    _select[i]->setPinMode(OUTPUT);
+  }
+}
+
+bool AnalogMux :: startConversion(uint8_t input) {
+  for (uint8_t i = 0; i < 3; i++) {
+    _select[i]->doDigitalWrite((input >> i) & 1 ? HIGH : LOW);
+  }
+  return true;
+}
+
+bool AnalogMux :: readMillivolts(uint16_t& millivolts) {
+  millivolts = (uint16_t)(((uint32_t)_adcPin->doAnalogRead() * ADC_FULL_SCALE_MILLIVOLTS + 511) / 1023);
+  return true;
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// PCF8574 (I2C GPIO expander)
+//////////////////////////////////////////////////////////
+Pcf8574 :: Pcf8574(uint8_t address) {
+  _address = address;
+  _port = 0xFF; // Power-on state
+  _stale = false;
+}
+
+bool Pcf8574 :: write(uint8_t bit, uint8_t level) {
+  uint8_t port = level ? (_port | (1 << bit)) : (_port & ~(1 << bit));
+  return writePort(port);
+}
+
+bool Pcf8574 :: writePort(uint8_t port) {
+  _port = port;
+  return resend();
+}
+
+bool Pcf8574 :: resend() {
+  Wire.beginTransmission(_address);
+  Wire.write(_port);
+  _stale = Wire.endTransmission() != 0;
+  return !_stale;
+}
+//////////////////////////////////////////////////////////
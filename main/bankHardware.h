@@ -0,0 +1,119 @@
+#ifndef bankHardware_h
+#define bankHardware_h
+
+#include "Arduino.h"
+#include "basicHardware.h"
+
+//////////////////////////////////////////////////////////
+// BANK ADC
+//////////////////////////////////////////////////////////
+// One conversion at a time: startConversion() selects an input and
+// starts it, readMillivolts() fetches the result once getConversionUs()
+// has passed. Millivolts are at the ADC input, before the bank's divider.
+class BankAdc {
+  public:
+    virtual bool startConversion(uint8_t input) = 0; // false when the ADC did not answer
+    virtual bool readMillivolts(uint16_t& millivolts) = 0; // Last conversion; false when the ADC did not answer
+    virtual unsigned long getConversionUs() = 0;
+    virtual uint8_t getInputCount() = 0;
+};
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// ADS1115 / ADS1015 (I2C ADC)
+//////////////////////////////////////////////////////////
+// Single-shot conversions of AIN0..AIN3 against GND at the fastest
+// data rate (860 SPS / 3300 SPS) and the +-4.096 V range, on the same
+// I2C bus as the LCD. Both chips return 0.125 mV per count in the
+// conversion register (the ADS1015 keeps its 12 bits left-aligned).
+// Inputs must stay below the chip's supply (3.3 V on the D1 Mini).
+class Ads1x15 : public BankAdc {
+  public:
+    Ads1x15(uint8_t address = 0x48, bool isAds1015 = false);
+
+    bool startConversion(uint8_t input);
+    bool readMillivolts(uint16_t& millivolts);
+    unsigned long getConversionUs() { return _isAds1015 ? 334 : 1280; } // Data rate period plus the 10% oscillator tolerance
+    uint8_t getInputCount() { return 4; }
+
+  private:
+    static const uint8_t REGISTER_CONVERSION = 0x00;
+    static const uint8_t REGISTER_CONFIG = 0x01;
+    static const uint16_t CONFIG_START = 0x8000;       // OS: start a single conversion
+    static const uint16_t CONFIG_MUX_SINGLE = 0x4000;  // AINx against GND, x in bits 12..13
+    static const uint16_t CONFIG_PGA_4096 = 0x0200;    // +-4.096 V
+    static const uint16_t CONFIG_SINGLE_SHOT = 0x0100;
+    static const uint16_t CONFIG_RATE_FASTEST = 0x00E0; // 860 SPS (ADS1115), 3300 SPS (ADS1015)
+    static const uint16_t CONFIG_NO_COMPARATOR = 0x0003;
+
+    uint8_t _address;
+    bool _isAds1015;
+};
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// ANALOG MUX (CD74HC4051 on A0)
+//////////////////////////////////////////////////////////
+// Up to 8 banks through one 8:1 analog multiplexer in front of A0. The
+// select lines are switched in startConversion(); the ESP8266 ADC reads
+// at once, so a conversion is only the mux settle time.
+class AnalogMux : public BankAdc {
+  public:
+    AnalogMux(Pin* adcPin, Pin* select0, Pin* select1, Pin* select2);
+
+    bool startConversion(uint8_t input);
+    bool readMillivolts(uint16_t& millivolts);
+    unsigned long getConversionUs() { return 20; } // Switch settle, well under one sample period
+    uint8_t getInputCount() { return 8; }
+
+  private:
+    static const uint16_t ADC_FULL_SCALE_MILLIVOLTS = 3300; // A0 of the D1 Mini, as VoltageSensor
+    Pin* _adcPin;
+    Pin* _select[3];
+};
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// PCF8574 (I2C GPIO expander)
+//////////////////////////////////////////////////////////
+// Eight quasi-bidirectional outputs written as one port byte. All pins
+// are high after power-on, which keeps active-low relay modules open
+// until the firmware decides.
+class Pcf8574 {
+  public:
+    Pcf8574(uint8_t address = 0x20);
+
+    bool write(uint8_t bit, uint8_t level); // Sends the whole port; false when the expander did not answer
+    bool writePort(uint8_t port);
+    bool resend(); // Send the port again
+    bool isStale() { return _stale; } // Last write failed: the outputs may not match getPort()
+    uint8_t getPort() { return _port; }
+
+  private:
+    uint8_t _address;
+    uint8_t _port;
+    bool _stale;
+};
+
+// One expander output with the pin calls RelayT, LEDT and the rest use
+class ExpanderPin {
+  public:
+    ExpanderPin() : _expander(nullptr), _bit(0) {}
+    ExpanderPin(Pcf8574* expander, uint8_t bit) : _expander(expander), _bit(bit) {}
+
+    void setPinMode(uint8_t mode) {} // Quasi-bidirectional: always an output that can be pulled high
+    void doDigitalWrite(uint8_t val) { _expander->write(_bit, val); }
+    int doDigitalRead() { return (_expander->getPort() >> _bit) & 1; } // Level last written
+    bool attachEdgeInterrupt(void (*handler)(void*), void* arg) { return false; }
+    uint8_t getPinAddress() { return _bit; }
+
+  private:
+    Pcf8574* _expander;
+    uint8_t _bit;
+};
+//////////////////////////////////////////////////////////
+
+#endif
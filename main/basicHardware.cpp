@@ -2,6 +2,7 @@
 #include "LiquidCrystal_I2C.h"
 #include "Wire.h"
 #include "basicHardware.h"
+#include "systemClock.h"
 
 
 //////////////////////////////////////////////////////////
@@ -13,7 +14,7 @@ PinNative :: PinNative(uint8_t pinAddress) {
 void PinNative :: setPinMode(uint8_t mode) {
   pinMode(_pinAddress, mode);
 }
-void PinNative :: doDigitalWrite(uint8_t val) {
+void IRAM_ATTR PinNative :: doDigitalWrite(uint8_t val) {
   digitalWrite(_pinAddress, val);
 }
 int PinNative :: doDigitalRead() {
@@ -23,132 +24,191 @@ int PinNative :: doDigitalRead() {
 int PinNative :: doAnalogRead() {
   return analogRead(_pinAddress);
 }
+
+bool PinNative :: attachEdgeInterrupt(void (*handler)(void*), void* arg) {
+  int interrupt = digitalPinToInterrupt(_pinAddress);
+  if (interrupt == NOT_AN_INTERRUPT) {
+    return false;
+  }
+  attachInterruptArg(interrupt, handler, arg, CHANGE);
+  return true;
+}
 //////////////////////////////////////////////////////////
 
 
 //////////////////////////////////////////////////////////
 // SWITCH
 //////////////////////////////////////////////////////////
-Switch :: Switch(Pin* pin) {
-
-  _pin = pin;
-  _pin->setPinMode(INPUT_PULLUP);
+SwitchDebouncer :: SwitchDebouncer(unsigned long debounceMs, unsigned long longPressMs) {
+  _interruptDriven = false;
+  _debounceMs = debounceMs;
+  _longPressMs = longPressMs;
+  _lastEdgeMs = SystemClock::millis() - debounceMs; // The first edge starts a burst
+  _burstCount = 0;
+  _seenBurstCount = 0;
+  _lastRawPressed = false;
+  _isLevelMismatch = false;
+  _levelMismatchMs = 0;
+  _stablePressed = false;
+  _pressStartMs = 0;
+  _longPressReported = false;
+  _eventCount = 0;
+}
+
+void SwitchDebouncer :: _begin(bool pressed) {
+  _lastRawPressed = pressed;
+  _stablePressed = pressed;
+  _longPressReported = pressed; // A button held at boot is not a gesture
+}
+
+void IRAM_ATTR SwitchDebouncer :: _onEdge(void* arg) {
+  SwitchDebouncer* self = static_cast<SwitchDebouncer*>(arg);
+  self->_recordEdge(SystemClock::millis());
+}
+
+void IRAM_ATTR SwitchDebouncer :: _recordEdge(unsigned long nowMs) {
+  // Contact bounce stays within the debounce time: one burst per transition
+  if (nowMs - _lastEdgeMs >= _debounceMs) {
+    _burstCount++;
+  }
+  _lastEdgeMs = nowMs;
 }
 
-bool Switch :: isPressed() {
-  return _pin->doDigitalRead() == LOW;
+bool SwitchDebouncer :: isPressed() {
+  return _stablePressed;
 }
-//////////////////////////////////////////////////////////
 
+void SwitchDebouncer :: _update(bool pressed) {
+  unsigned long nowMs = SystemClock::millis();
+  
+  if (!_interruptDriven && pressed != _lastRawPressed) {
+    // Polling fallback: synthesize edges from level changes
+    _lastRawPressed = pressed;
+    _recordEdge(nowMs);
+  }
+  
+  // The level was read first: an edge after that shows up in the counters below
+  uint16_t burstCount = _burstCount;
+  unsigned long lastEdgeMs = _lastEdgeMs;
+  
+  if (nowMs - lastEdgeMs >= _debounceMs) {
+    // Line has been quiet for the debounce time: its level is the new state
+    uint16_t bursts = burstCount - _seenBurstCount;
+    _seenBurstCount = burstCount;
+    bool changed = pressed != _stablePressed;
+    uint8_t transitions = 0;
+    
+    if (bursts > 0) {
+      // Several transitions happen between two updates (release and press
+      // again, or a whole press); the level tells which count is right
+      transitions = bursts > MAX_TRANSITIONS ? MAX_TRANSITIONS : bursts;
+      if ((transitions & 1) != (changed ? 1 : 0)) {
+        transitions = transitions > 0 ? transitions - 1 : 1;
+      }
+      _isLevelMismatch = false;
+    } else if (!changed) {
+      _isLevelMismatch = false;
+    } else if (!_isLevelMismatch) {
+      // No edge but a different level: the interrupt missed it. Debounce
+      // the level itself instead of waiting for an edge that never comes
+      _isLevelMismatch = true;
+      _levelMismatchMs = nowMs;
+    } else if (nowMs - _levelMismatchMs >= _debounceMs) {
+      transitions = 1;
+      lastEdgeMs = _levelMismatchMs;
+      _isLevelMismatch = false;
+    }
+    
+    for (uint8_t i = 0; i < transitions; i++) {
+      _onStableChange(!_stablePressed, lastEdgeMs);
+    }
+  }
+  
+  if (_stablePressed && !_longPressReported && nowMs - _pressStartMs >= _longPressMs) {
+    _longPressReported = true;
+    _pushEvent(EVENT_LONG_PRESS);
+  }
+}
 
-//////////////////////////////////////////////////////////
-// RELAY
-//////////////////////////////////////////////////////////
-Relay :: Relay(Pin* controlPin) {
-  _controlPin = controlPin;
-  _controlPin->setPinMode(OUTPUT);
-  _controlPin->doDigitalWrite(HIGH); // Start with relay disconnected (inverted logic)
+void SwitchDebouncer :: _onStableChange(bool pressed, unsigned long nowMs) {
+  _stablePressed = pressed;
+  if (pressed) {
+    _pressStartMs = nowMs;
+    _longPressReported = false;
+  } else if (!_longPressReported) {
+    _pushEvent(EVENT_SHORT_PRESS);
+  }
 }
 
-void Relay :: turnOn() {
-  _controlPin->doDigitalWrite(LOW); // LOW connects the load (inverted logic)
+void SwitchDebouncer :: _pushEvent(Event event) {
+  // Keep the oldest events if nobody reads them
+  if (_eventCount < sizeof(_events) / sizeof(_events[0])) {
+    _events[_eventCount++] = event;
+  }
 }
 
-void Relay :: turnOff() {
-  _controlPin->doDigitalWrite(HIGH); // HIGH disconnects the load (inverted logic)
+SwitchDebouncer::Event SwitchDebouncer :: takeEvent() {
+  if (_eventCount == 0) {
+    return EVENT_NONE;
+  }
+  Event event = _events[0];
+  for (uint8_t i = 1; i < _eventCount; i++) {
+    _events[i - 1] = _events[i];
+  }
+  _eventCount--;
+  return event;
 }
 //////////////////////////////////////////////////////////
 
 
 //////////////////////////////////////////////////////////
-// LED
+// ADC CALIBRATION (piecewise-linear between measured points)
 //////////////////////////////////////////////////////////
-LED :: LED(Pin* pin) {
-  _pin = pin;
-  _pin->setPinMode(OUTPUT);
-  _blinking = false;
-  _blinkIntervalMs = 500;
-  _lastBlinkTimeMs = 0;
-  _currentState = false;
-  off();
-}
-
-void LED :: on() {
-  _blinking = false;
-  _currentState = true;
-  _pin->doDigitalWrite(HIGH);
-}
-
-void LED :: off() {
-  _blinking = false;
-  _currentState = false;
-  _pin->doDigitalWrite(LOW);
-}
-
-void LED :: toggle() {
-  _blinking = false;
-  _currentState = !_currentState;
-  _pin->doDigitalWrite(_currentState ? HIGH : LOW);
-}
-
-void LED :: blink(unsigned long intervalMs) {
-  _blinking = true;
-  _blinkIntervalMs = intervalMs;
-  _lastBlinkTimeMs = millis();
+AdcCalibrationTable :: AdcCalibrationTable() {
+  memset(_points, 0, sizeof(_points));
+  _count = 0;
 }
 
-void LED :: update() {
-  if (_blinking) {
-    unsigned long currentTime = millis();
-    if (currentTime - _lastBlinkTimeMs >= _blinkIntervalMs) {
-      _currentState = !_currentState;
-      _pin->doDigitalWrite(_currentState ? HIGH : LOW);
-      _lastBlinkTimeMs = currentTime;
+bool AdcCalibrationTable :: isValid(const AdcCalibrationPoint* points, uint8_t count) {
+  if (count < 2 || count > POINTS_MAX) {
+    return false;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    if (points[i].raw >= SIZE) {
+      return false;
+    }
+    if (i > 0 && (points[i].raw <= points[i - 1].raw || points[i].millivolts <= points[i - 1].millivolts)) {
+      return false;
     }
   }
+  return true;
 }
-//////////////////////////////////////////////////////////
 
+bool AdcCalibrationTable :: build(const AdcCalibrationPoint* points, uint8_t count) {
+  if (!isValid(points, count)) {
+    return false;
+  }
+  memcpy(_points, points, count * sizeof(AdcCalibrationPoint));
+  _count = count;
+  return true;
+}
 
-//////////////////////////////////////////////////////////
-// BUZZER (Piezo Buzzer)
-//////////////////////////////////////////////////////////
-Buzzer :: Buzzer(PinNative* pin) {
-  _pin = pin;
-  _pin->setPinMode(OUTPUT);
-  _isAlarming = false;
-  _alarmStartTimeMs = 0;
-  _alarmDurationMs = 0;
-  stop(); // Ensure buzzer is off initially
-}
-
-void Buzzer :: startAlarm(unsigned int frequencyHz, unsigned long durationMs) {
-  _isAlarming = true;
-  _alarmStartTimeMs = millis();
-  _alarmDurationMs = durationMs;
-  // Use tone() function - ESP8266 tone() signature: tone(uint8_t pin, unsigned int frequency)
-  // Note: ESP8266 tone() doesn't support duration parameter, so we handle it manually in update()
-  tone(_pin->getPinAddress(), frequencyHz);
-}
-
-void Buzzer :: stop() {
-  _isAlarming = false;
-  _alarmStartTimeMs = 0;
-  _alarmDurationMs = 0;
-  // Use noTone() function to stop the buzzer
-  noTone(_pin->getPinAddress());
-}
-
-void Buzzer :: update() {
-  if (_isAlarming) {
-    unsigned long currentTime = millis();
-    unsigned long elapsedMs = currentTime - _alarmStartTimeMs;
-
-    // Check if duration has elapsed (with overflow protection)
-    if (elapsedMs >= _alarmDurationMs || (currentTime < _alarmStartTimeMs)) {
-      stop();
-    }
+uint16_t AdcCalibrationTable :: millivolts(uint16_t raw) const {
+  if (_count < 2) {
+    return 0;
+  }
+  // Counts below the second point use the first segment, counts above
+  // the second to last point the last one
+  uint8_t segment = 0;
+  while (segment + 2 < _count && raw > _points[segment + 1].raw) {
+    segment++;
   }
+  const AdcCalibrationPoint& from = _points[segment];
+  const AdcCalibrationPoint& to = _points[segment + 1];
+  int32_t span = to.raw - from.raw;
+  int32_t scaled = ((int32_t)raw - from.raw) * (int32_t)(to.millivolts - from.millivolts);
+  int32_t millivolts = from.millivolts + (scaled >= 0 ? (scaled + span / 2) / span : -((-scaled + span / 2) / span));
+  return millivolts < 0 ? 0 : (millivolts > 0xFFFF ? 0xFFFF : (uint16_t)millivolts);
 }
 //////////////////////////////////////////////////////////
 
@@ -156,15 +216,13 @@ void Buzzer :: update() {
 //////////////////////////////////////////////////////////
 // VOLTAGE SENSOR (ADC with Voltage Divider)
 //////////////////////////////////////////////////////////
-const float VoltageSensor::ADC_REFERENCE_VOLTAGE = 3.3f; // WeMos D1 Mini A0 max input
-const int VoltageSensor::ADC_RESOLUTION = 1023; // 10-bit ADC
-
 // Constructor with divider ratio (no calibration)
 VoltageSensor :: VoltageSensor(Pin* pin, float dividerRatio) {
   _pin = pin;
   _dividerRatio = dividerRatio;
   _calibrationFactor = 1.0f;
   _initialized = false;
+  _initConversion();
 }
 
 // Constructor with divider ratio (with calibration)
@@ -173,6 +231,7 @@ VoltageSensor :: VoltageSensor(Pin* pin, float dividerRatio, float calibrationFa
   _dividerRatio = dividerRatio;
   _calibrationFactor = calibrationFactor;
   _initialized = false;
+  _initConversion();
 }
 
 // Constructor with resistor values (calibration factor required to avoid ambiguity)
@@ -183,6 +242,29 @@ VoltageSensor :: VoltageSensor(Pin* pin, float rTopOhms, float rBottomOhms, floa
   _dividerRatio = rTopOhms / (rTopOhms + rBottomOhms);
   _calibrationFactor = calibrationFactor;
   _initialized = false;
+  _initConversion();
+}
+
+void VoltageSensor :: setDivider(float rTopOhms, float rBottomOhms, float calibrationFactor) {
+  _dividerRatio = rTopOhms / (rTopOhms + rBottomOhms);
+  _calibrationFactor = calibrationFactor;
+  _initScale(); // Filtered readings are ADC counts: they stay valid, only their scale changes
+}
+
+void VoltageSensor :: _initScale() {
+  // Fixed-point scale for the integer millivolt API, computed once
+  _millivoltsPerCountQ16 = (uint32_t)(convertRawToVolts(ADC_RESOLUTION) * 1000.0f / ADC_RESOLUTION * 65536.0f + 0.5f);
+}
+
+void VoltageSensor :: _initConversion() {
+  _table = nullptr;
+  _initScale();
+  
+  // Filter disabled until setFilter()
+  _filter.oversampleCount = 1;
+  _filter.medianWindow = 1;
+  _filter.emaShift = 0;
+  _resetFilter();
 }
 
 bool VoltageSensor :: init() {
@@ -198,11 +280,29 @@ float VoltageSensor :: readVoltageInVolts() {
   }
   
   // Read ADC value (0-1023)
-  int adcValue = _pin->doAnalogRead();
+  return convertRawToVolts(_pin->doAnalogRead());
+}
+
+int VoltageSensor :: readRaw() {
+  if (!_initialized) {
+    return 0;
+  }
+  return _pin->doAnalogRead();
+}
+
+void VoltageSensor :: setCalibration(const AdcCalibrationTable* table) {
+  _table = table; // Filtered readings are ADC counts: they stay valid, as with setDivider()
+}
+
+float VoltageSensor :: convertRawToVolts(int raw) {
+  if (_table) {
+    raw = raw < 0 ? 0 : (raw >= AdcCalibrationTable::SIZE ? AdcCalibrationTable::SIZE - 1 : raw);
+    return _table->millivolts((uint16_t)raw) / 1000.0f;
+  }
   
   // Convert ADC reading to voltage at pin
   // ADC reading ranges from 0 to 1023, representing 0V to 3.3V
-  float pinVoltage = (adcValue / (float)ADC_RESOLUTION) * ADC_REFERENCE_VOLTAGE;
+  float pinVoltage = (raw / (float)ADC_RESOLUTION) * ADC_REFERENCE_VOLTAGE;
   
   // Convert pin voltage back to battery voltage using divider ratio
   // Battery voltage = pin voltage / divider ratio
@@ -214,52 +314,576 @@ float VoltageSensor :: readVoltageInVolts() {
   
   return batteryVoltage;
 }
+
+int VoltageSensor :: minimumRawForVoltage(float volts) {
+  if (_table) {
+    return _tableThreshold(_ceilToCounts(volts * 1000.0f), 0);
+  }
+  return thresholdCounts(volts, _dividerRatio, _calibrationFactor, 0);
+}
+
+uint16_t VoltageSensor :: thresholdForVoltage(float volts) {
+  if (_table) {
+    return _tableThreshold(_ceilToCounts(volts * 1000.0f), RAW_FRACTION_BITS);
+  }
+  return thresholdCounts(volts, _dividerRatio, _calibrationFactor, RAW_FRACTION_BITS);
+}
+
+uint16_t VoltageSensor :: millivoltsFromRaw(uint16_t raw) {
+  // raw carries RAW_FRACTION_BITS fractional bits
+  if (_table) {
+    // The entry for the whole count, plus the fraction of the step to the next
+    uint16_t index = raw >> RAW_FRACTION_BITS;
+    if (index >= AdcCalibrationTable::SIZE - 1) {
+      return _table->millivolts(AdcCalibrationTable::SIZE - 1);
+    }
+    uint16_t low = _table->millivolts(index);
+    uint32_t step = _table->millivolts(index + 1) - low;
+    return (uint16_t)(low + ((step * (raw & ((1U << RAW_FRACTION_BITS) - 1))) >> RAW_FRACTION_BITS));
+  }
+  return (uint16_t)(((uint64_t)raw * _millivoltsPerCountQ16) >> (16 + RAW_FRACTION_BITS));
+}
+
+uint16_t VoltageSensor :: _deviationMillivolts(uint16_t deviation, uint16_t raw) {
+  // A difference of counts, not a count: it takes the slope where the
+  // reading is. Through the table, converting it as a count would add
+  // the table's value near count 0
+  if (_table) {
+    uint16_t index = raw >> RAW_FRACTION_BITS;
+    if (index >= AdcCalibrationTable::SIZE - 1) {
+      index = AdcCalibrationTable::SIZE - 2;
+    }
+    uint32_t step = _table->millivolts(index + 1) - _table->millivolts(index);
+    return (uint16_t)((step * deviation) >> RAW_FRACTION_BITS);
+  }
+  return millivoltsFromRaw(deviation); // The divider is a line through 0
+}
+
+uint16_t VoltageSensor :: _tableThreshold(uint32_t millivolts, uint8_t fractionBits) {
+  // Binary search over the rising conversion; one past the top count
+  // when even 1023 stays below
+  uint16_t low = 0;
+  uint16_t high = (uint16_t)((AdcCalibrationTable::SIZE - 1) << fractionBits) + 1;
+  while (low < high) {
+    uint16_t middle = low + (high - low) / 2;
+    uint16_t converted = fractionBits == 0 ? _table->millivolts(middle) : millivoltsFromRaw(middle);
+    if (converted >= millivolts) {
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+  return low;
+}
+
+void VoltageSensor :: setFilter(const VoltageFilterConfig& config) {
+  _filter = config;
+  if (_filter.oversampleCount < 1) _filter.oversampleCount = 1;
+  if (_filter.oversampleCount > 64) _filter.oversampleCount = 64;
+  if (_filter.medianWindow < 1) _filter.medianWindow = 1;
+  if (_filter.medianWindow > MEDIAN_WINDOW_MAX) _filter.medianWindow = MEDIAN_WINDOW_MAX;
+  if ((_filter.medianWindow & 1) == 0) _filter.medianWindow--; // Median needs an odd window
+  if (_filter.emaShift > 8) _filter.emaShift = 8;
+  _resetFilter();
+}
+
+void VoltageSensor :: restartFilter() {
+  _resetFilter();
+}
+
+void VoltageSensor :: _resetFilter() {
+  _oversampleSum = 0;
+  _oversampleFill = 0;
+  _medianFill = 0;
+  _medianNext = 0;
+  _ema = 0;
+  _noise = 0;
+  _filterPrimed = false;
+}
+
+bool VoltageSensor :: filterRaw(uint16_t raw) {
+  // Stage 1: oversample and decimate
+  _oversampleSum += raw;
+  if (++_oversampleFill < _filter.oversampleCount) {
+    return false;
+  }
+  uint16_t decimated = (uint16_t)((_oversampleSum << RAW_FRACTION_BITS) / _oversampleFill);
+  _oversampleSum = 0;
+  _oversampleFill = 0;
+  
+  // Stage 2: sliding median
+  uint16_t median = _median(decimated);
+  
+  // Stage 3: EMA, seeded with the first value to avoid a ramp from zero
+  int32_t sample = (int32_t)median << (EMA_FRACTION_BITS - RAW_FRACTION_BITS);
+  if (!_filterPrimed) {
+    _ema = sample;
+    _noise = 0;
+    _filterPrimed = true;
+  } else {
+    _ema += (sample - _ema) >> _filter.emaShift;
+  }
+  
+  // Noise: running mean absolute deviation of the unfiltered decimated
+  // samples from the filter output
+  int32_t deviation = ((int32_t)decimated << (EMA_FRACTION_BITS - RAW_FRACTION_BITS)) - _ema;
+  if (deviation < 0) {
+    deviation = -deviation;
+  }
+  _noise += (deviation - _noise) >> NOISE_SHIFT;
+  return true;
+}
+
+uint16_t VoltageSensor :: _median(uint16_t decimated) {
+  if (_filter.medianWindow <= 1) {
+    return decimated;
+  }
+  _medianHistory[_medianNext] = decimated;
+  _medianNext = (_medianNext + 1) % _filter.medianWindow;
+  if (_medianFill < _filter.medianWindow) {
+    _medianFill++;
+  }
+  
+  // Insertion sort of at most MEDIAN_WINDOW_MAX values
+  uint16_t sorted[MEDIAN_WINDOW_MAX];
+  for (uint8_t i = 0; i < _medianFill; i++) {
+    uint16_t value = _medianHistory[i];
+    uint8_t j = i;
+    while (j > 0 && sorted[j - 1] > value) {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+    sorted[j] = value;
+  }
+  return sorted[_medianFill / 2];
+}
+
+VoltageReading VoltageSensor :: getFilteredReading() {
+  VoltageReading reading;
+  reading.raw = (uint16_t)(_ema >> (EMA_FRACTION_BITS - RAW_FRACTION_BITS));
+  reading.millivolts = millivoltsFromRaw(reading.raw);
+  reading.noiseMillivolts = _deviationMillivolts((uint16_t)(_noise >> (EMA_FRACTION_BITS - RAW_FRACTION_BITS)), reading.raw);
+  return reading;
+}
+
+VoltageReading VoltageSensor :: readFiltered() {
+  if (_initialized) {
+    // Read until the current decimation group completes
+    while (!filterRaw((uint16_t)_pin->doAnalogRead())) {
+    }
+  }
+  return getFilteredReading();
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// CURRENT SENSOR (INA219 / INA226 on I2C)
+//////////////////////////////////////////////////////////
+CurrentSensor :: CurrentSensor(Chip chip, uint8_t address, float shuntMilliohms) {
+  _chip = chip;
+  _address = address;
+  // uV per count / milliohms = mA per count
+  float microvoltsPerCount = chip == CHIP_INA219 ? 10.0f : 2.5f;
+  _milliampsPerCountQ16 = (int32_t)(microvoltsPerCount / shuntMilliohms * 65536.0f + 0.5f);
+}
+
+bool CurrentSensor :: init() {
+  uint16_t config = _chip == CHIP_INA219 ? INA219_CONFIG : INA226_CONFIG;
+  Wire.beginTransmission(_address);
+  Wire.write(REGISTER_CONFIG);
+  Wire.write((uint8_t)(config >> 8));
+  Wire.write((uint8_t)(config & 0xFF));
+  return Wire.endTransmission() == 0;
+}
+
+bool CurrentSensor :: readMilliamps(int32_t& milliamps) {
+  Wire.beginTransmission(_address);
+  Wire.write(REGISTER_SHUNT);
+  if (Wire.endTransmission() != 0 || Wire.requestFrom(_address, (uint8_t)2) != 2) {
+    return false;
+  }
+  int16_t counts = (int16_t)((Wire.read() << 8) | Wire.read());
+  milliamps = (int32_t)(((int64_t)counts * _milliampsPerCountQ16 + 0x8000) >> 16); // Rounded, both directions
+  return true;
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// TEMPERATURE SENSOR (DS18B20 on 1-Wire)
+//////////////////////////////////////////////////////////
+TemperatureSensor :: TemperatureSensor(uint8_t pin) : _bus(pin) {
+  _pin = pin;
+  _isConverting = false;
+  _startedMs = 0;
+}
+
+bool TemperatureSensor :: startConversion() {
+  if (!_bus.reset()) {
+    _isConverting = false;
+    return false;
+  }
+  _bus.skip();
+  _bus.write(COMMAND_CONVERT);
+  _isConverting = true;
+  _startedMs = SystemClock::millis();
+  return true;
+}
+
+bool TemperatureSensor :: isConversionDone() {
+  return _isConverting && SystemClock::millis() - _startedMs >= CONVERSION_MS;
+}
+
+bool TemperatureSensor :: readSixteenths(int16_t& sixteenths) {
+  _isConverting = false;
+  if (!_bus.reset()) {
+    return false;
+  }
+  _bus.skip();
+  _bus.write(COMMAND_READ_SCRATCHPAD);
+  uint8_t scratchpad[SCRATCHPAD_SIZE];
+  for (uint8_t i = 0; i < SCRATCHPAD_SIZE; i++) {
+    scratchpad[i] = _bus.read();
+  }
+  // A line held low reads all zeros, which passes the CRC: needs the
+  // configuration byte's fixed bits as well
+  if (OneWire::crc8(scratchpad, SCRATCHPAD_SIZE - 1) != scratchpad[SCRATCHPAD_SIZE - 1] || (scratchpad[4] & 0x9F) != 0x1F) {
+    return false;
+  }
+  int16_t value = (int16_t)((uint16_t)scratchpad[1] << 8 | scratchpad[0]);
+  if (value == POWER_ON_SIXTEENTHS) {
+    return false; // The sensor lost power since the conversion was started
+  }
+  sixteenths = value;
+  return true;
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FORMATTING
+//////////////////////////////////////////////////////////
+void formatMillivolts(uint16_t millivolts, char* buffer) {
+  uint16_t centivolts = (uint16_t)((millivolts + 5UL) / 10);
+  uint16_t volts = centivolts / 100;
+  uint8_t fraction = centivolts % 100;
+  uint8_t i = 0;
+  char digits[3];
+  uint8_t count = 0;
+  do {
+    digits[count++] = '0' + volts % 10;
+    volts /= 10;
+  } while (volts > 0 && count < sizeof(digits));
+  while (count > 0) {
+    buffer[i++] = digits[--count];
+  }
+  buffer[i++] = '.';
+  buffer[i++] = '0' + fraction / 10;
+  buffer[i++] = '0' + fraction % 10;
+  buffer[i] = '\0';
+}
+
+void formatDuration(uint32_t seconds, char* buffer) {
+  uint32_t minutes = seconds / 60;
+  uint32_t hours = minutes / 60;
+  uint8_t i = 0;
+  if (minutes == 0) {
+    buffer[i++] = '<';
+    buffer[i++] = '1';
+    buffer[i++] = 'm';
+  } else if (hours == 0) {
+    if (minutes >= 10) {
+      buffer[i++] = '0' + minutes / 10;
+    }
+    buffer[i++] = '0' + minutes % 10;
+    buffer[i++] = 'm';
+  } else if (hours < 10) {
+    minutes %= 60;
+    buffer[i++] = '0' + hours;
+    buffer[i++] = 'h';
+    buffer[i++] = '0' + minutes / 10;
+    buffer[i++] = '0' + minutes % 10;
+    buffer[i++] = 'm';
+  } else {
+    if (hours > 999) {
+      hours = 999;
+    }
+    if (hours >= 100) {
+      buffer[i++] = '0' + hours / 100;
+    }
+    buffer[i++] = '0' + hours / 10 % 10;
+    buffer[i++] = '0' + hours % 10;
+    buffer[i++] = 'h';
+  }
+  buffer[i] = '\0';
+}
 //////////////////////////////////////////////////////////
 
 
 //////////////////////////////////////////////////////////
 // DISPLAY (I2C LCD)
 //////////////////////////////////////////////////////////
-Display :: Display(uint8_t i2cAddress, uint8_t columns, uint8_t rows) {
-  _columns = columns;
-  _rows = rows;
-  _lcd = new LiquidCrystal_I2C(i2cAddress, columns, rows);
+Display :: Display(uint8_t i2cAddress, uint8_t columns, uint8_t rows) : _lcd(i2cAddress, columns, rows) {
+  _address = i2cAddress;
+  _columns = columns > MAX_COLUMNS ? MAX_COLUMNS : columns;
+  _rows = rows > MAX_ROWS ? MAX_ROWS : rows;
+  _backlightMask = PORT_BACKLIGHT; // Library default: backlight on after init()
+  _cursorCol = 0;
+  _cursorRow = 0;
+  _batchLength = 0;
+  _sendFailed = false;
+  _busClockHz = 0;
+  _busFault = false;
+  _lastRecoveryMs = 0;
+  _busErrors = 0;
+  _busRecoveries = 0;
+  _lastStats = DisplayRefreshStats();
+  _totalStats = DisplayRefreshStats();
+  _refreshCount = 0;
+  memset(_frame, ' ', sizeof(_frame));
+  invalidate();
+}
+
+void Display :: beginBus(uint32_t clockHz) {
+  // Nothing on this bus stretches the clock (PCF8574, INA219/INA226,
+  // ADS1115); with the core's 150 ms per clock, a stuck SCL would hold
+  // every transfer for ~1.5 s
+  _busClockHz = clockHz;
+  Wire.begin();
+  _applyBusSettings();
 }
 
 void Display :: init() {
-  _lcd->init();
+  // The library's power-on sequence is ~45 transfers: not sent blind
+  // into a bus that does not answer
+  if (!_probe()) {
+    _setBusFault();
+    return;
+  }
+  _lcd.init(); // Clears the LCD and homes the cursor
+  _applyBusSettings();
+  memset(_shadow, ' ', sizeof(_shadow));
+  _lcdCol = 0;
+  _lcdRow = 0;
 }
 
 void Display :: backlight() {
-  _lcd->backlight();
+  _backlightMask = PORT_BACKLIGHT;
+  if (!_busFault) {
+    _lcd.backlight();
+  }
 }
 
 void Display :: noBacklight() {
-  _lcd->noBacklight();
+  _backlightMask = 0;
+  if (!_busFault) {
+    _lcd.noBacklight();
+  }
 }
 
 void Display :: clear() {
-  _lcd->clear();
+  // Deferred: blank cells reach the LCD on the next flush(), and only
+  // where something was shown before
+  memset(_frame, ' ', sizeof(_frame));
+  _cursorCol = 0;
+  _cursorRow = 0;
 }
 
 void Display :: setCursor(uint8_t col, uint8_t row) {
-  _lcd->setCursor(col, row);
+  _cursorCol = col;
+  _cursorRow = row < _rows ? row : _rows - 1;
 }
 
 void Display :: print(const char* text) {
-  _lcd->print(text);
+  // Text past the last column is dropped (it would land in hidden DDRAM)
+  while (*text && _cursorCol < _columns) {
+    _frame[_cursorRow][_cursorCol++] = *text++;
+  }
 }
 
 void Display :: print(float value, int decimals) {
-  _lcd->print(value, decimals);
+  char buffer[24];
+  dtostrf(value, 0, decimals, buffer);
+  print(buffer);
 }
 
 void Display :: print(int value) {
-  _lcd->print(value);
+  char buffer[12];
+  snprintf(buffer, sizeof(buffer), "%d", value);
+  print(buffer);
 }
 
 void Display :: print(unsigned long value) {
-  _lcd->print(value);
+  char buffer[12];
+  snprintf(buffer, sizeof(buffer), "%lu", value);
+  print(buffer);
+}
+
+void Display :: invalidate() {
+  memset(_shadow, UNKNOWN_CELL, sizeof(_shadow));
+  _lcdCol = NO_POSITION;
+  _lcdRow = NO_POSITION;
+}
+
+void Display :: flush() {
+  static const uint8_t rowOffsets[MAX_ROWS] = { 0x00, 0x40, 0x14, 0x54 };
+  unsigned long startUs = SystemClock::micros();
+  
+  _lastStats = DisplayRefreshStats();
+  _batchLength = 0;
+  _sendFailed = false;
+  if (_busFault && ((long)(SystemClock::millis() - _lastRecoveryMs) < (long)RECOVERY_INTERVAL_MS || !_recover())) {
+    return; // Frame kept for after the recovery
+  }
+  
+  for (uint8_t row = 0; row < _rows; row++) {
+    for (uint8_t col = 0; col < _columns; col++) {
+      if (_frame[row][col] == _shadow[row][col]) {
+        continue;
+      }
+      
+      if (_lcdRow == row && _lcdCol <= col && col - _lcdCol <= BRIDGE_CELLS) {
+        // Close gap by rewriting the unchanged cells in between
+        while (_lcdCol < col) {
+          _queueByte(_frame[row][_lcdCol], PORT_RS);
+          _lastStats.cellsWritten++;
+          _lcdCol++;
+        }
+      } else {
+        _queueByte(0x80 | (rowOffsets[row] + col), 0); // Set DDRAM address
+        _lastStats.cursorMoves++;
+        _lcdRow = row;
+      }
+      
+      _queueByte(_frame[row][col], PORT_RS);
+      _lastStats.cellsWritten++;
+      _shadow[row][col] = _frame[row][col];
+      _lcdCol = col + 1; // DDRAM address auto-increments
+    }
+  }
+  _sendBatch();
+  
+  if (_sendFailed) {
+    // LCD content is unknown now: redraw everything after the recovery
+    _setBusFault();
+    invalidate();
+  }
+  
+  _lastStats.busyMicros = SystemClock::micros() - startUs;
+  _totalStats.cellsWritten += _lastStats.cellsWritten;
+  _totalStats.cursorMoves += _lastStats.cursorMoves;
+  _totalStats.i2cBytes += _lastStats.i2cBytes;
+  _totalStats.transactions += _lastStats.transactions;
+  _totalStats.busyMicros += _lastStats.busyMicros;
+  _refreshCount++;
+}
+
+void Display :: _queueByte(uint8_t value, uint8_t mode) {
+  // One LCD byte = two nibbles, each written with En high then En low
+  // (the controller latches on the falling edge). At 100 kHz every
+  // expander byte takes 90 us, well above the 37 us command time.
+  if (_batchLength + 4 > I2C_BATCH_BYTES) {
+    _sendBatch();
+  }
+  uint8_t high = (value & 0xF0) | mode | _backlightMask;
+  uint8_t low = ((value << 4) & 0xF0) | mode | _backlightMask;
+  _batch[_batchLength++] = high | PORT_EN;
+  _batch[_batchLength++] = high;
+  _batch[_batchLength++] = low | PORT_EN;
+  _batch[_batchLength++] = low;
+}
+
+bool Display :: _sendBatch() {
+  if (_batchLength == 0) {
+    return true;
+  }
+  if (!_sendFailed) {
+    Wire.beginTransmission(_address);
+    Wire.write(_batch, _batchLength);
+    if (Wire.endTransmission() != 0) {
+      _sendFailed = true;
+    }
+    _lastStats.transactions++;
+    _lastStats.i2cBytes += _batchLength + 1; // Plus address byte
+  }
+  _batchLength = 0;
+  return !_sendFailed;
+}
+
+bool Display :: _probe() {
+  Wire.beginTransmission(_address);
+  return Wire.endTransmission() == 0;
+}
+
+bool Display :: _clearBus() {
+  // I2C bus clear: lines driven open drain by hand, low as OUTPUT LOW
+  // and released as INPUT_PULLUP. A slave stopped mid-byte holds SDA
+  // until it has clocked out the rest of the byte
+  pinMode(SDA, INPUT_PULLUP);
+  pinMode(SCL, INPUT_PULLUP);
+  delayMicroseconds(BUS_CLEAR_HALF_PERIOD_US);
+  if (digitalRead(SCL) == LOW) {
+    return false; // Clock held by a device: only a power cycle helps
+  }
+  for (uint8_t pulse = 0; pulse < BUS_CLEAR_PULSES && digitalRead(SDA) == LOW; pulse++) {
+    digitalWrite(SCL, LOW);
+    pinMode(SCL, OUTPUT);
+    delayMicroseconds(BUS_CLEAR_HALF_PERIOD_US);
+    pinMode(SCL, INPUT_PULLUP);
+    delayMicroseconds(BUS_CLEAR_HALF_PERIOD_US);
+  }
+  if (digitalRead(SDA) == LOW) {
+    return false;
+  }
+  // STOP: SDA rising while SCL is high
+  digitalWrite(SDA, LOW);
+  pinMode(SDA, OUTPUT);
+  delayMicroseconds(BUS_CLEAR_HALF_PERIOD_US);
+  pinMode(SDA, INPUT_PULLUP);
+  delayMicroseconds(BUS_CLEAR_HALF_PERIOD_US);
+  return true;
+}
+
+bool Display :: _recover() {
+  _lastRecoveryMs = SystemClock::millis();
+  if (!_clearBus()) {
+    return false;
+  }
+  beginBus(_busClockHz > 0 ? _busClockHz : DEFAULT_BUS_CLOCK_HZ); // The pins back to the I2C driver
+  if (!_probe()) {
+    return false;
+  }
+  // The LCD may have seen half a command: start over from power-on
+  _lcd.init();
+  _applyBusSettings();
+  if (_backlightMask == 0) {
+    _lcd.noBacklight();
+  } else {
+    _lcd.backlight();
+  }
+  memset(_shadow, ' ', sizeof(_shadow));
+  _lcdCol = 0;
+  _lcdRow = 0;
+  _busFault = false;
+  _busRecoveries++;
+  return true;
+}
+
+void Display :: _applyBusSettings() {
+  if (_busClockHz == 0) {
+    return;
+  }
+  Wire.setClock(_busClockHz);
+  Wire.setClockStretchLimit(BUS_STRETCH_LIMIT_US);
+}
+
+void Display :: _setBusFault() {
+  if (!_busFault) {
+    _busErrors++;
+  }
+  _busFault = true;
+  _lastRecoveryMs = SystemClock::millis();
 }
 //////////////////////////////////////////////////////////
 
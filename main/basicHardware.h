@@ -3,6 +3,8 @@
 
 #include "Arduino.h"
 #include "LiquidCrystal_I2C.h"
+#include "OneWire.h"
+#include "systemClock.h"
 
 //////////////////////////////////////////////////////////
 // PIN
@@ -12,10 +14,15 @@ class Pin {
     uint8_t _pinAddress;
 
   public:
-    virtual void setPinMode(uint8_t mode);
-    virtual void doDigitalWrite(uint8_t val);
-    virtual int doDigitalRead();
-    virtual int doAnalogRead();
+    virtual void setPinMode(uint8_t mode) = 0;
+    virtual void doDigitalWrite(uint8_t val) = 0;
+    virtual int doDigitalRead() = 0;
+    virtual int doAnalogRead() = 0;
+    
+    // Call handler(arg) from interrupt context on every level change.
+    // Returns false when the pin cannot raise interrupts (caller polls).
+    virtual bool attachEdgeInterrupt(void (*handler)(void*), void* arg) { return false; }
+    uint8_t getPinAddress() { return _pinAddress; }
 };
 //////////////////////////////////////////////////////////
 
@@ -28,10 +35,44 @@ class PinNative : public Pin {
     PinNative(uint8_t pinAddress);
 
     void setPinMode(uint8_t mode);
-    void doDigitalWrite(uint8_t val);
+    void IRAM_ATTR doDigitalWrite(uint8_t val);
     int doDigitalRead();
     int doAnalogRead();
-    uint8_t getPinAddress() { return _pinAddress; }
+    bool attachEdgeInterrupt(void (*handler)(void*), void* arg);
+};
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FAST PIN (GPIO0..15, resolved at compile time)
+//////////////////////////////////////////////////////////
+// Same calls as Pin, but not virtual and with the pin number as a
+// template argument: a write is one store to the GPIO set or clear
+// register (GPOS/GPOC) instead of a vtable call into digitalWrite()
+// and its pin table lookup. Not a Pin, so it only works with the
+// templated Relay/LED/Switch/Buzzer below. Has no analog input.
+template <uint8_t PIN>
+class FastPin {
+  public:
+    static_assert(PIN < 16, "GPIO16 and A0 are not on the GPIO registers, use PinNative");
+
+    void setPinMode(uint8_t mode) { pinMode(PIN, mode); } // Once at start-up, through the core
+    void IRAM_ATTR doDigitalWrite(uint8_t val) {
+      if (val) {
+        GPOS = MASK;
+      } else {
+        GPOC = MASK;
+      }
+    }
+    int doDigitalRead() { return (GPI & MASK) ? HIGH : LOW; }
+    bool attachEdgeInterrupt(void (*handler)(void*), void* arg) {
+      attachInterruptArg(digitalPinToInterrupt(PIN), handler, arg, CHANGE);
+      return true;
+    }
+    uint8_t getPinAddress() { return PIN; }
+
+  private:
+    static const uint32_t MASK = 1UL << PIN;
 };
 //////////////////////////////////////////////////////////
 
@@ -39,77 +80,282 @@ class PinNative : public Pin {
 //////////////////////////////////////////////////////////
 // SWITCH
 //////////////////////////////////////////////////////////
-class Switch {
+// Active-low push button. Edges are captured by a GPIO interrupt when
+// the pin supports it (otherwise update() polls the level) and fed into a
+// non-blocking debounce state machine. update() must be called
+// periodically; it turns presses into gesture events.
+//
+// The state machine does not depend on the pin type and lives in
+// SwitchDebouncer; SwitchT only reads the pin.
+class SwitchDebouncer {
   public:
-    Switch(Pin* pin);
+    enum Event {
+      EVENT_NONE,
+      EVENT_SHORT_PRESS, // Released before the long-press time
+      EVENT_LONG_PRESS   // Held for the long-press time (reported while still held)
+    };
+    
+    bool isPressed(); // Debounced state
+    Event takeEvent(); // Oldest unread event, EVENT_NONE if there is none
+    bool isInterruptDriven() { return _interruptDriven; }
 
-    bool isPressed(); 
+  protected:
+    SwitchDebouncer(unsigned long debounceMs, unsigned long longPressMs);
+    void _begin(bool pressed); // Level at start-up, before the interrupt is attached
+    void _update(bool pressed); // Level read just now
+    static void IRAM_ATTR _onEdge(void* arg);
+    
+    bool _interruptDriven;
 
   private:
-    Pin* _pin;
+    unsigned long _debounceMs;
+    unsigned long _longPressMs;
+    
+    static const uint8_t MAX_TRANSITIONS = 4; // Per update(); two whole presses
+    
+    // Written by the edge interrupt
+    volatile unsigned long _lastEdgeMs;
+    volatile uint16_t _burstCount; // Edge bursts: edges closer than the debounce time count once
+    
+    uint16_t _seenBurstCount;
+    bool _lastRawPressed; // Polling mode only
+    bool _isLevelMismatch; // Level differs from the state without an edge (missed interrupt)
+    unsigned long _levelMismatchMs;
+    bool _stablePressed;
+    unsigned long _pressStartMs;
+    bool _longPressReported;
+    Event _events[4];
+    uint8_t _eventCount;
+    
+    void IRAM_ATTR _recordEdge(unsigned long nowMs);
+    void _onStableChange(bool pressed, unsigned long nowMs);
+    void _pushEvent(Event event);
+};
+
+template <typename PinType>
+class SwitchT : public SwitchDebouncer {
+  public:
+    SwitchT(PinType* pin, unsigned long debounceMs = 30, unsigned long longPressMs = 1500)
+      : SwitchDebouncer(debounceMs, longPressMs) {
+      _pin = pin;
+      _pin->setPinMode(INPUT_PULLUP);
+      _begin(_pin->doDigitalRead() == LOW);
+      _interruptDriven = _pin->attachEdgeInterrupt(&SwitchDebouncer::_onEdge, static_cast<SwitchDebouncer*>(this));
+    }
+
+    void update() { _update(_pin->doDigitalRead() == LOW); } // Run debounce and gesture detection
+
+  private:
+    PinType* _pin;
 };
+typedef SwitchT<Pin> Switch;
 //////////////////////////////////////////////////////////
 
 
 //////////////////////////////////////////////////////////
 // RELAY
 //////////////////////////////////////////////////////////
-class Relay {
+template <typename PinType>
+class RelayT {
   public:
-    Relay(Pin* controlPin);
-    void turnOn();
-    void turnOff();
+    RelayT(PinType* controlPin) {
+      _controlPin = controlPin;
+      _controlPin->setPinMode(OUTPUT);
+      _controlPin->doDigitalWrite(HIGH); // Start with relay disconnected (inverted logic)
+    }
+    // In IRAM: the loop watchdog drives the relay from its interrupt
+    void IRAM_ATTR turnOn() { _controlPin->doDigitalWrite(LOW); } // LOW connects the load (inverted logic)
+    void IRAM_ATTR turnOff() { _controlPin->doDigitalWrite(HIGH); } // HIGH disconnects the load (inverted logic)
 
   private:
-    Pin* _controlPin;
+    PinType* _controlPin;
 };
+typedef RelayT<Pin> Relay;
 //////////////////////////////////////////////////////////
 
 
 //////////////////////////////////////////////////////////
 // LED
 //////////////////////////////////////////////////////////
-class LED {
+template <typename PinType>
+class LEDT {
   public:
-    LED(Pin* pin);
-    void on();
-    void off();
-    void toggle();
-    void blink(unsigned long intervalMs);
-    void update(); // Call in loop for blinking
+    LEDT(PinType* pin) {
+      _pin = pin;
+      _pin->setPinMode(OUTPUT);
+      _blinking = false;
+      _blinkIntervalMs = 500;
+      _lastBlinkTimeMs = 0;
+      _currentState = false;
+      off();
+    }
+
+    void on() {
+      _blinking = false;
+      _currentState = true;
+      _pin->doDigitalWrite(HIGH);
+    }
+
+    void off() {
+      _blinking = false;
+      _currentState = false;
+      _pin->doDigitalWrite(LOW);
+    }
+
+    void toggle() {
+      _blinking = false;
+      _currentState = !_currentState;
+      _pin->doDigitalWrite(_currentState ? HIGH : LOW);
+    }
+
+    void blink(unsigned long intervalMs) {
+      _blinking = true;
+      _blinkIntervalMs = intervalMs;
+      _lastBlinkTimeMs = SystemClock::millis();
+    }
+
+    // Call in loop for blinking
+    void update() {
+      if (_blinking) {
+        unsigned long currentTime = SystemClock::millis();
+        if (currentTime - _lastBlinkTimeMs >= _blinkIntervalMs) {
+          _currentState = !_currentState;
+          _pin->doDigitalWrite(_currentState ? HIGH : LOW);
+          _lastBlinkTimeMs = currentTime;
+        }
+      }
+    }
 
   private:
-    Pin* _pin;
+    PinType* _pin;
     bool _blinking;
     unsigned long _blinkIntervalMs;
     unsigned long _lastBlinkTimeMs;
     bool _currentState;
 };
+typedef LEDT<Pin> LED;
 //////////////////////////////////////////////////////////
 
 
 //////////////////////////////////////////////////////////
 // BUZZER (Piezo Buzzer)
 //////////////////////////////////////////////////////////
-class Buzzer {
+// tone() needs the pin number, so any pin type works here; only
+// setPinMode() and getPinAddress() are used.
+template <typename PinType>
+class BuzzerT {
   public:
-    Buzzer(PinNative* pin);
-    void startAlarm(unsigned int frequencyHz = 1000, unsigned long durationMs = 5000); // Start alarm with frequency and duration
-    void stop(); // Stop the alarm immediately
-    void update(); // Call in loop to handle auto-stop after duration
+    BuzzerT(PinType* pin) {
+      _pin = pin;
+      _pin->setPinMode(OUTPUT);
+      _isAlarming = false;
+      _alarmStartTimeMs = 0;
+      _alarmDurationMs = 0;
+      stop(); // Ensure buzzer is off initially
+    }
+
+    // Start alarm with frequency and duration
+    void startAlarm(unsigned int frequencyHz = 1000, unsigned long durationMs = 5000) {
+      _isAlarming = true;
+      _alarmStartTimeMs = SystemClock::millis();
+      _alarmDurationMs = durationMs;
+      // Use tone() function - ESP8266 tone() signature: tone(uint8_t pin, unsigned int frequency)
+      // Note: ESP8266 tone() doesn't support duration parameter, so we handle it manually in update()
+      tone(_pin->getPinAddress(), frequencyHz);
+    }
+
+    // Stop the alarm immediately
+    void stop() {
+      _isAlarming = false;
+      _alarmStartTimeMs = 0;
+      _alarmDurationMs = 0;
+      // Use noTone() function to stop the buzzer
+      noTone(_pin->getPinAddress());
+    }
+
+    // Call in loop to handle auto-stop after duration
+    void update() {
+      if (_isAlarming) {
+        unsigned long currentTime = SystemClock::millis();
+        unsigned long elapsedMs = currentTime - _alarmStartTimeMs;
+
+        // Check if duration has elapsed (with overflow protection)
+        if (elapsedMs >= _alarmDurationMs || (currentTime < _alarmStartTimeMs)) {
+          stop();
+        }
+      }
+    }
+
+    bool isAlarming() { return _isAlarming; }
 
   private:
-    PinNative* _pin;
+    PinType* _pin;
     bool _isAlarming;
     unsigned long _alarmStartTimeMs;
     unsigned long _alarmDurationMs;
 };
+typedef BuzzerT<Pin> Buzzer;
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// ADC CALIBRATION (piecewise-linear between measured points)
+//////////////////////////////////////////////////////////
+// The ESP8266 ADC is not a straight line: gain, offset and a bend near
+// both ends of its range differ from unit to unit. Calibration points
+// pair a raw count with the battery voltage a meter showed at that count
+// (divider included). build() keeps a copy of the points; millivolts()
+// finds the segment a count falls in and interpolates along it, with the
+// first and last segments extended to counts 0 and 1023. The points take
+// 34 bytes where one entry per count took 2 KB, for a search over at
+// most POINTS_MAX points and one division per conversion.
+struct AdcCalibrationPoint {
+  uint16_t raw;        // ADC count, 0..1023
+  uint16_t millivolts; // Battery voltage measured at that count
+};
+
+class AdcCalibrationTable {
+  public:
+    static const uint16_t SIZE = 1024; // ADC counts covered
+    static const uint8_t POINTS_MAX = 8;
+
+    AdcCalibrationTable();
+    bool build(const AdcCalibrationPoint* points, uint8_t count); // false (table unchanged) unless isValid()
+    uint16_t millivolts(uint16_t raw) const; // raw 0..SIZE-1, rounded to the nearest millivolt and clamped to 0..65535
+
+    // 2..POINTS_MAX points, raw and millivolts both strictly rising
+    static bool isValid(const AdcCalibrationPoint* points, uint8_t count);
+
+  private:
+    AdcCalibrationPoint _points[POINTS_MAX];
+    uint8_t _count; // 0 until build()
+};
 //////////////////////////////////////////////////////////
 
 
 //////////////////////////////////////////////////////////
 // VOLTAGE SENSOR (ADC with Voltage Divider)
 //////////////////////////////////////////////////////////
+// Filter pipeline applied to raw ADC samples, in order:
+//   1. oversampling: oversampleCount raw samples are averaged into one
+//      decimated sample (kept with 4 fractional bits)
+//   2. sliding median over the last medianWindow decimated samples,
+//      rejecting isolated spikes (relay coil, tone() PWM)
+//   3. fixed-point EMA with weight 1/2^emaShift
+// A stage is bypassed with oversampleCount = 1, medianWindow = 1 or
+// emaShift = 0.
+struct VoltageFilterConfig {
+  uint8_t oversampleCount; // 1..64
+  uint8_t medianWindow;    // Odd, 1..MEDIAN_WINDOW_MAX
+  uint8_t emaShift;        // 0..8
+};
+
+struct VoltageReading {
+  uint16_t raw;             // Filtered ADC count with VoltageSensor::RAW_FRACTION_BITS fractional bits
+  uint16_t millivolts;      // Filtered battery voltage
+  uint16_t noiseMillivolts; // Mean absolute deviation of decimated samples from the filtered value
+};
+
 class VoltageSensor {
   public:
     // Constructor with divider ratio (0.0 to 1.0)
@@ -128,25 +374,191 @@ class VoltageSensor {
     VoltageSensor(Pin* pin, float rTopOhms, float rBottomOhms, float calibrationFactor);
     
     bool init(); // Initialize the sensor (sets pin mode)
+    void setDivider(float rTopOhms, float rBottomOhms, float calibrationFactor); // As the constructor; the filter keeps its state
     float readVoltageInVolts(); // Returns battery voltage in Volts
+    int readRaw(); // Raw ADC count (0-1023), no conversion
+    float convertRawToVolts(int raw); // Battery voltage for a raw ADC count
+    int minimumRawForVoltage(float volts); // Smallest raw count that converts to at least volts
+    void setCalibration(const AdcCalibrationTable* table); // Convert through table; nullptr: divider and calibration factor
+    bool isCalibrated() { return _table != nullptr; }
+    
+    // Integer pipeline: thresholds are converted once into fixed-point ADC
+    // counts (RAW_FRACTION_BITS fractional bits) so decisions are a single
+    // integer compare against VoltageReading::raw
+    static const uint8_t RAW_FRACTION_BITS = 4;
+    uint16_t thresholdForVoltage(float volts); // reading.raw < result  <=>  reading below volts
+    uint16_t millivoltsFromRaw(uint16_t raw); // raw with RAW_FRACTION_BITS fractional bits
+    
+    // Compile-time form of thresholdForVoltage(): counts are rounded up so
+    // that "counts < threshold" matches "voltage < volts"
+    static constexpr uint16_t thresholdCounts(float volts, float dividerRatio, float calibrationFactor, uint8_t fractionBits) {
+      return _ceilToCounts(volts / calibrationFactor * dividerRatio / ADC_REFERENCE_VOLTAGE * ADC_RESOLUTION * (float)(1UL << fractionBits));
+    }
+    
+    // Filter pipeline
+    static const uint8_t MEDIAN_WINDOW_MAX = 7;
+    void setFilter(const VoltageFilterConfig& config); // Also resets filter state
+    VoltageFilterConfig getFilter() { return _filter; }
+    bool filterRaw(uint16_t raw); // Feed one raw sample; true when a decimated sample completed
+    VoltageReading getFilteredReading(); // Current pipeline output
+    VoltageReading readFiltered(); // Take oversampleCount fresh readings through the pipeline
+    bool hasFilteredReading() { return _filterPrimed; }
+    void restartFilter(); // Drop the history; the next decimated sample primes the filter again
     
   private:
     Pin* _pin;
     float _dividerRatio; // Ratio = R1 / (R1 + R2) when measuring across R1
     float _calibrationFactor; // Multiplier to compensate for internal voltage divider
     bool _initialized;
-    static const float ADC_REFERENCE_VOLTAGE; // ESP8266 WeMos D1 Mini A0 max input: 3.3V
-    static const int ADC_RESOLUTION; // 10-bit ADC: 0-1023
+    uint32_t _millivoltsPerCountQ16; // Battery millivolts per ADC count, 16 fractional bits
+    const AdcCalibrationTable* _table; // Replaces the divider conversion when set
+    static constexpr float ADC_REFERENCE_VOLTAGE = 3.3f; // ESP8266 WeMos D1 Mini A0 max input: 3.3V
+    static constexpr int ADC_RESOLUTION = 1023; // 10-bit ADC: 0-1023
+    
+    static constexpr uint16_t _ceilToCounts(float counts) {
+      return counts <= 0.0f ? 0 : (counts >= 65535.0f ? 65535 : (uint16_t)(counts == (float)(uint16_t)counts ? counts : counts + 1.0f));
+    }
+    void _initScale();
+    void _initConversion();
+    uint16_t _deviationMillivolts(uint16_t deviation, uint16_t raw); // A spread of counts around raw (both RAW_FRACTION_BITS) in millivolts
+    uint16_t _tableThreshold(uint32_t millivolts, uint8_t fractionBits); // Smallest raw (0 or RAW_FRACTION_BITS fractional bits) converting to at least millivolts
+    
+    // Filter state (values in raw ADC counts with fixed-point fractions;
+    // decimated and median samples use RAW_FRACTION_BITS)
+    static const uint8_t EMA_FRACTION_BITS = 12;      // EMA accumulator and noise estimate
+    static const uint8_t NOISE_SHIFT = 4;             // Noise estimate averages over ~16 samples
+    VoltageFilterConfig _filter;
+    uint32_t _oversampleSum;
+    uint8_t _oversampleFill;
+    uint16_t _medianHistory[MEDIAN_WINDOW_MAX];
+    uint8_t _medianFill;
+    uint8_t _medianNext;
+    int32_t _ema;
+    int32_t _noise;
+    bool _filterPrimed;
+    
+    void _resetFilter();
+    uint16_t _median(uint16_t decimated);
+};
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// CURRENT SENSOR (INA219 / INA226 on I2C)
+//////////////////////////////////////////////////////////
+// Battery current through an external shunt, read from the shunt voltage
+// register only and scaled here, so the chip's calibration register is
+// not used. The chip converts continuously (averaged over a few
+// milliseconds); each read returns the latest result. Positive current
+// discharges the battery, negative current charges it.
+class CurrentSensor {
+  public:
+    enum Chip {
+      CHIP_INA219, // 10 uV per count, +-80 mV range set here
+      CHIP_INA226  // 2.5 uV per count, +-81.92 mV
+    };
+    
+    // shuntMilliohms: 1.5 for a 75 mV / 50 A shunt
+    CurrentSensor(Chip chip, uint8_t address = 0x40, float shuntMilliohms = 1.5f);
+    
+    bool init(); // Continuous shunt conversions; false when the chip did not answer
+    bool readMilliamps(int32_t& milliamps); // false when the chip did not answer
+    unsigned long getConversionUs() { return _chip == CHIP_INA219 ? 4260 : 4400; } // Time between fresh results
+    uint8_t getAddress() { return _address; }
+    
+  private:
+    static const uint8_t REGISTER_CONFIG = 0x00;
+    static const uint8_t REGISTER_SHUNT = 0x01;
+    static const uint16_t INA219_CONFIG = 0x29DD; // 32 V bus, +-80 mV shunt, 8 x 12-bit averages, shunt only, continuous
+    static const uint16_t INA226_CONFIG = 0x4325; // 4 averages of 1.1 ms, shunt only, continuous
+    
+    Chip _chip;
+    uint8_t _address;
+    int32_t _milliampsPerCountQ16; // 16 fractional bits
 };
 //////////////////////////////////////////////////////////
 
 
+//////////////////////////////////////////////////////////
+// TEMPERATURE SENSOR (DS18B20 on 1-Wire)
+//////////////////////////////////////////////////////////
+// Battery temperature from a DS18B20 alone on its pin (Skip ROM, VDD
+// wired, 4.7k pull-up). A 12-bit conversion takes 750 ms, so it is split
+// in two: startConversion() sends Convert T and returns, and once
+// isConversionDone() the result is read with readSixteenths(). Each
+// half is one short bus transaction (~2 ms and ~7 ms of bit-banged
+// slots); nothing waits for the conversion.
+class TemperatureSensor {
+  public:
+    static const unsigned long CONVERSION_MS = 750;       // 12-bit resolution, the power-on default
+    static const int16_t POWER_ON_SIXTEENTHS = 85 * 16;   // Scratchpad before any conversion ran
+
+    TemperatureSensor(uint8_t pin);
+    
+    bool startConversion(); // false when no sensor answered the reset
+    bool isConverting() { return _isConverting; }
+    bool isConversionDone(); // CONVERSION_MS after startConversion()
+    bool readSixteenths(int16_t& sixteenths); // Last result in 1/16 C; false on no answer, a bad CRC or the power-on value
+    uint8_t getPin() { return _pin; }
+    
+  private:
+    static const uint8_t COMMAND_CONVERT = 0x44;
+    static const uint8_t COMMAND_READ_SCRATCHPAD = 0xBE;
+    static const uint8_t SCRATCHPAD_SIZE = 9; // 8 bytes and their CRC
+    
+    OneWire _bus;
+    uint8_t _pin;
+    bool _isConverting;
+    unsigned long _startedMs;
+};
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FORMATTING
+//////////////////////////////////////////////////////////
+// Writes millivolts as Volts with two decimals ("12.34"), rounded, using
+// integer math only. buffer must hold at least 7 characters.
+void formatMillivolts(uint16_t millivolts, char* buffer);
+
+// Writes a duration short enough for the LCD: "<1m", "40m", "2h05m",
+// and whole hours from 10 h on ("12h", at most "999h"). buffer must
+// hold at least 7 characters.
+void formatDuration(uint32_t seconds, char* buffer);
+//////////////////////////////////////////////////////////
+
+
 //////////////////////////////////////////////////////////
 // DISPLAY (I2C LCD)
 //////////////////////////////////////////////////////////
+// setCursor/print/clear only draw into a RAM frame. flush() compares
+// the frame with a shadow copy of what the LCD shows and sends just the
+// changed cells (plus the cursor moves they need) straight to the
+// PCF8574 backpack, packed into as few I2C transactions as possible.
+//
+// A failed transfer marks a bus fault. flush() then sends nothing but
+// tries a recovery once per RECOVERY_INTERVAL_MS: the I2C bus clear
+// (clock pulses until a slave holding SDA lets go, then a STOP), the
+// bus restarted, and the LCD initialised again and redrawn. A clock
+// held low cannot be cleared from here; the short clock stretch limit
+// of beginBus() keeps each attempt at a few milliseconds. The library's
+// init() calls Wire.begin(), which puts the clock and the stretch limit
+// back to the core's defaults, so both are set again after it.
+struct DisplayRefreshStats {
+  uint32_t cellsWritten;  // Characters sent, including bridged unchanged cells
+  uint32_t cursorMoves;   // Set DDRAM address commands
+  uint32_t i2cBytes;      // Bytes on the wire, including address bytes
+  uint32_t transactions;  // I2C transactions
+  uint32_t busyMicros;    // Time spent inside flush()
+};
+
 class Display {
   public:
+    static const uint8_t MAX_COLUMNS = 20;
+    static const uint8_t MAX_ROWS = 4;
+
     Display(uint8_t i2cAddress = 0x27, uint8_t columns = 16, uint8_t rows = 2);
+    void beginBus(uint32_t clockHz); // Wire.begin() and setClock(), with a clock stretch limit that bounds a stuck bus
     void init();
     void backlight();
     void noBacklight();
@@ -156,11 +568,68 @@ class Display {
     void print(float value, int decimals = 2);
     void print(int value);
     void print(unsigned long value);
+    void flush(); // Send frame changes to the LCD
+    void invalidate(); // Force the next flush() to redraw every cell
+    
+    const DisplayRefreshStats& getLastRefreshStats() const { return _lastStats; }
+    const DisplayRefreshStats& getTotalRefreshStats() const { return _totalStats; }
+    uint32_t getRefreshCount() const { return _refreshCount; }
+    bool isBusFault() const { return _busFault; } // Last transfer failed; flush() tries a recovery every RECOVERY_INTERVAL_MS
+    uint32_t getBusErrorCount() const { return _busErrors; }
+    uint32_t getBusRecoveryCount() const { return _busRecoveries; }
     
   private:
-    LiquidCrystal_I2C* _lcd;
+    static const uint8_t I2C_BATCH_BYTES = 32; // Fits the Wire transmit buffer of every core
+    static const uint8_t BRIDGE_CELLS = 1;     // Rewriting this many unchanged cells is cheaper than a cursor move
+    static const char UNKNOWN_CELL = '\0';    // Shadow marker: LCD content not known
+    static const uint8_t NO_POSITION = 0xFF;
+    
+    // PCF8574 backpack wiring
+    static const uint8_t PORT_RS = 0x01;
+    static const uint8_t PORT_EN = 0x04;
+    static const uint8_t PORT_BACKLIGHT = 0x08;
+    
+    // Bus fault handling
+    static const uint32_t BUS_STRETCH_LIMIT_US = 1000;    // Per clock; the core's default is 150 ms
+    static const uint32_t DEFAULT_BUS_CLOCK_HZ = 100000;  // Recovery without beginBus()
+    static const unsigned long RECOVERY_INTERVAL_MS = 1000;
+    static const uint8_t BUS_CLEAR_PULSES = 9;            // Enough for any slave to finish its byte
+    static const unsigned int BUS_CLEAR_HALF_PERIOD_US = 5; // 100 kHz
+    
+    void _queueByte(uint8_t value, uint8_t mode);
+    bool _sendBatch();
+    bool _probe(); // Empty write: the LCD acknowledges its address
+    bool _clearBus();
+    bool _recover();
+    void _applyBusSettings(); // After every LiquidCrystal_I2C::init(), which calls Wire.begin()
+    void _setBusFault();
+    
+    LiquidCrystal_I2C _lcd; // Only for init() and the backlight; frames bypass the library
+    uint8_t _address;
     uint8_t _columns;
     uint8_t _rows;
+    uint8_t _backlightMask;
+    
+    char _frame[MAX_ROWS][MAX_COLUMNS];
+    char _shadow[MAX_ROWS][MAX_COLUMNS];
+    uint8_t _cursorCol; // Frame cursor used by print()
+    uint8_t _cursorRow;
+    uint8_t _lcdCol;    // Hardware DDRAM cursor, NO_POSITION when unknown
+    uint8_t _lcdRow;
+    
+    uint8_t _batch[I2C_BATCH_BYTES];
+    uint8_t _batchLength;
+    bool _sendFailed;
+    
+    uint32_t _busClockHz; // 0 until beginBus(): Wire as the sketch set it up
+    bool _busFault;
+    unsigned long _lastRecoveryMs;
+    uint32_t _busErrors;
+    uint32_t _busRecoveries;
+    
+    DisplayRefreshStats _lastStats;
+    DisplayRefreshStats _totalStats;
+    uint32_t _refreshCount;
 };
 //////////////////////////////////////////////////////////
 
@@ -1,5 +1,7 @@
 #include "Arduino.h"
 #include "batteryProtector.h"
+#include "systemClock.h"
+#include <flash_hal.h>
 
 //////////////////////////////////////////////////////////
 // BATTERY PROTECTOR
@@ -9,125 +11,906 @@ BatteryProtector :: BatteryProtector(
   float voltageRearmThreshold,
   unsigned long rearmDelayMs,
   Display* display
-) {
-  Serial.println("Initializing Battery Protector...");
+) :
+  _voltagePin(PIN_VOLTAGE_SENSOR),
+  // Divider defaults; a stored configuration may replace them
+  _voltageSensor(&_voltagePin, (float)DIVIDER_TOP_OHMS, (float)DIVIDER_BOTTOM_OHMS, CALIBRATION_PPM / 1000000.0f),
+  _sampler(&_voltageSensor),
+  _loadRelay(&_relayPin), // Opens the relay until the state is known
+  _greenLED(&_greenLEDPin),
+  _redLED(&_redLEDPin),
+  _testButton(&_testButtonPin, BUTTON_DEBOUNCE_MS, BUTTON_LONG_PRESS_MS),
+  _buzzer(&_buzzerPin),
+  // Raw sectors of the filesystem area (nothing mounts LittleFS here);
+  // the configuration and then the MQTT spool keep the last sectors of it
+  _history(FS_PHYS_ADDR / HistoryLog::SECTOR_SIZE, _flashAreaSectors() > 0 ? _flashAreaSectors() - MQTT_SPOOL_SECTORS - CONFIG_SECTORS : 0),
+  _configStore(_flashSectorFromEnd(MQTT_SPOOL_SECTORS + CONFIG_SECTORS))
+{
+  // Nothing is printed before the relay is decided: Serial may not be
+  // up yet, and a full UART FIFO would stall the decision
+  _bootStartUs = SystemClock::micros();
+  _console = &Serial;
+  _telemetryEnabled = false;
+  _telemetryTaskId = -1;
   
-  _voltageCutoffThreshold = voltageCutoffThreshold;
-  _voltageRearmThreshold = voltageRearmThreshold;
-  _rearmDelayMs = rearmDelayMs;
+  // Compiled defaults, replaced by the block saved on flash (when there
+  // is a valid one) before anything is decided
+  _defaultConfig.cutoffMillivolts = (uint16_t)(voltageCutoffThreshold * 1000.0f + 0.5f);
+  _defaultConfig.rearmMillivolts = (uint16_t)(voltageRearmThreshold * 1000.0f + 0.5f);
+  _defaultConfig.rearmDelayMs = rearmDelayMs;
+  _defaultConfig.dividerTopOhms = DIVIDER_TOP_OHMS;
+  _defaultConfig.dividerBottomOhms = DIVIDER_BOTTOM_OHMS;
+  _defaultConfig.calibrationPpm = CALIBRATION_PPM;
+  _defaultConfig.samplePeriodMs = SAMPLE_PERIOD_MS;
+  _defaultConfig.reserved = 0;
+  _defaultConfig.adcPointCount = 0; // Divider and calibration factor until points are captured ('a')
+  memset(_defaultConfig.adcReserved, 0, sizeof(_defaultConfig.adcReserved));
+  memset(_defaultConfig.adcPoints, 0, sizeof(_defaultConfig.adcPoints));
+  _config = _defaultConfig;
+  _isConfigLoaded = _configStore.load(_config);
+  _isConfigChanged = false;
+  _isConfigSavePending = false;
+  _commandLength = 0;
+  _hasAdcFirstPoint = false;
+  _temperatureSensor = nullptr;
+  _temperatureTaskId = -1;
+  _temperatureMillivoltsPerC = 0;
+  _temperatureSixteenths = TEMPERATURE_REFERENCE_SIXTEENTHS;
+  _hasTemperature = false;
+  _failedTemperatureReadings = 0;
+  _temperatureOffsetMillivolts = 0; // Configured thresholds until the first reading
+  _lastTemperatureStartMs = 0;
   _display = display;
+  _mqtt = nullptr;
+  _mqttTaskId = -1;
+  _lowPowerMode = false;
+  _isNearCutoff = false;
+  _deepSleepInCutoff = false;
+  _historyEnabled = false;
+  _historyOut = nullptr;
+  _historyTaskId = -1;
+  _bootMs = SystemClock::millis();
+  _lastHistoryMs = _bootMs;
+  _state = STATE_CUTOFF; // Relay open until decided below
+  _cutoffInput = CUTOFF_INPUT_TERMINAL;
+  _nominalLoadMilliamps = 0;
+  _compensationRaw = 0;
+  _isMeasuringStep = false;
+  _isStepSettled = false;
+  _isStepClosing = false;
+  _stepMillivolts = 0;
+  _stepMilliamps = 0;
+  _stepAtMs = 0;
+  _appliedSagMillivolts = 0;
+  _currentSensor = nullptr;
+  _currentTaskId = -1;
+  _socCutoffPercent = 20;
+  _averageMilliamps = 0;
+  _failedCurrentReadings = 0;
+  _lastCurrentMs = 0;
+  _lastTrendMs = 0;
+  _isTrendOnCharge = false;
+  _transientsEnabled = false;
+  _reportedTransients = 0;
+  _lastSampleMs = 0;
   
-  // Initialize hardware components
-  // VoltageSensor with resistor values: R1=100kΩ, R2=430kΩ (100k+330k in series)
-  // Calibration factor 1.20 compensates for WeMos D1 Mini internal voltage divider (220k/100k)
-  _voltageSensor = new VoltageSensor(new PinNative(PIN_VOLTAGE_SENSOR), 100000.0f, 430000.0f, 1.20f);
-  _loadRelay = new Relay(new PinNative(PIN_RELAY_CONTROL));
-  _greenLED = new LED(new PinNative(PIN_GREEN_LED));
-  _redLED = new LED(new PinNative(PIN_RED_LED));
-  _testButton = new Switch(new PinNative(PIN_TEST_BUTTON));
-  _buzzer = new Buzzer(new PinNative(PIN_BUZZER));
-  
-  // Initialize voltage sensor
-  if (!_voltageSensor->init()) {
-    Serial.println("ERROR: Failed to initialize voltage sensor!");
-  } else {
-    Serial.println("Voltage sensor initialized successfully.");
+  // After a deep sleep the chip restarted: pick up the saved state before
+  // anything closes the relay
+  RtcState saved;
+  bool resumed = _power.wokeFromDeepSleep() && _power.loadRtc(RTC_STATE_OFFSET, &saved, sizeof(saved));
+  if (resumed) {
+    _power.getEnergy().restore(saved.energyMs);
+    _lastHistoryMs = _bootMs - saved.historyElapsedMs;
   }
+  _wokeFromDeepSleep = resumed;
+  _isChargeRestored = resumed && saved.isChargeKnown;
+  _restoredChargeMas = resumed ? saved.chargeMas : 0;
   
-  // Initialize display if provided
-  if (_display) {
-    _display->init();
-    delay(100);
-    _display->backlight();
-    delay(50);
-    _display->clear();
-    delay(50);
-  }
+  // After a watchdog reset the record says where the loop hung; with the
+  // relay safe state open, the load stays off until it is rearmed
+  _hasWatchdogRecord = _power.wasWatchdogReset() && LoopWatchdog::loadRecord(RTC_WATCHDOG_OFFSET, _watchdogRecord);
+  _isHeldOpenByWatchdog = false;
+  _isDisplayBusFault = false;
+  
+  VoltageFilterConfig filter;
+  filter.oversampleCount = FILTER_OVERSAMPLE;
+  filter.medianWindow = FILTER_MEDIAN_WINDOW;
+  filter.emaShift = FILTER_EMA_SHIFT;
+  _voltageSensor.setFilter(filter);
   
-  _lastVoltage = 0.0;
+  _applyConfig();
+  
+  _isSensorReady = _voltageSensor.init();
+  _lastRaw = 0;
+  _lastMillivolts = 0;
+  _lastNoiseMillivolts = 0;
   _lastRearmAttemptMs = 0;
-  _lastUpdateTimeMs = millis();
-  _lastLEDUpdateMs = millis();
-  _lastDisplayUpdateMs = millis();
+  _lastUpdateTimeMs = SystemClock::millis();
+  _lastLEDUpdateMs = SystemClock::millis();
   _rearmCountdownStartMs = 0;
   _isWaitingForRearm = false;
+  _isVerifyingRearm = false;
+  _isRearmSettled = false;
+  _rearmVerifyAtMs = 0;
   
-  // Read initial voltage
-  _lastVoltage = _voltageSensor->readVoltageInVolts();
+  // Read initial voltage (one oversampled reading primes the filter) and
+  // decide the relay: everything else waits until this is done
+  _storeReading(_voltageSensor.readFiltered());
+  _bootMillivolts = _lastMillivolts;
   
-  // Check if voltage is already below threshold on startup
-  if (_lastVoltage < _voltageCutoffThreshold) {
-    Serial.print("Battery voltage (");
-    Serial.print(_lastVoltage, 2);
-    Serial.print("V) is below cutoff threshold (");
-    Serial.print(_voltageCutoffThreshold, 2);
-    Serial.println("V). Cutting off immediately.");
+  if (resumed && saved.state == STATE_CUTOFF) {
+    // Woke up from deep sleep in cutoff: relay stays open, no second
+    // alarm, and the rearm countdown keeps its progress
+    _state = STATE_CUTOFF;
+    _isWaitingForRearm = saved.isWaitingForRearm != 0;
+    if (_isWaitingForRearm) {
+      _rearmCountdownStartMs = SystemClock::millis() - saved.rearmElapsedMs;
+    }
+    _loadRelay.turnOff();
+    _greenLED.off();
+    _redLED.on();
+  } else if (_hasWatchdogRecord && _watchdogRecord.safeState == LoopWatchdog::SAFE_RELAY_OPEN) {
+    // The last boot hung with the relay opened: keep it open, as after a
+    // cutoff, and sound the alarm
     _state = STATE_CUTOFF;
-    _loadRelay->turnOff();
-    _greenLED->off();
-    _redLED->on();
+    _isHeldOpenByWatchdog = true;
+    _loadRelay.turnOff();
+    _greenLED.off();
+    _redLED.on();
+    _buzzer.startAlarm(1000, 5000);
+  } else if (_shouldCutoff()) {
+    // Check if voltage is already below threshold on startup
+    _state = STATE_CUTOFF;
+    _loadRelay.turnOff();
+    _greenLED.off();
+    _redLED.on();
     // Sound alarm buzzer for 5 seconds at 1kHz
-    _buzzer->startAlarm(1000, 5000);
+    _buzzer.startAlarm(1000, 5000);
   } else {
-    Serial.print("Battery voltage: ");
-    Serial.print(_lastVoltage, 2);
-    Serial.println("V - Above threshold, circuit armed.");
     _state = STATE_ARMED;
-    _loadRelay->turnOn();
-    _greenLED->on();
-    _redLED->off();
+    _loadRelay.turnOn();
+    _greenLED.on();
+    _redLED.off();
+    _startResistanceStep(true); // First internal resistance estimate from the boot closing
   }
+  _bootState = _state;
+  _bootDecisionUs = SystemClock::micros();
+  _isBootReported = false; // Printed from the first state task run, once Serial is up
   
-  // Update display with initial state
-  updateDisplay();
+  // Then the slow parts: the modem off (waits for the SDK), and the LCD
+  // brought up from the display task (the library's power-on sequence
+  // needs the I2C bus, which the sketch starts after this)
+  _power.begin();
+  _displayReady = false;
+  _displayInitStep = _display ? 1 : 0;
+  _displayStepAtMs = SystemClock::millis();
   
-  Serial.println("Battery Protector ready!");
+  // Start timer-driven sampling; the sampler opens the relay on its own
+  // after TRIP_SAMPLES consecutive raw readings well below the cutoff
+  // threshold; readings near the threshold go through the filter
+  _sampler.setTripHandler(&BatteryProtector::_onSamplerTrip, this);
+  _sampler.setTripLevel(_tripRaw, TRIP_SAMPLES);
+  _sampler.begin(_samplePeriodMs);
+  
+  // Cooperative tasks; the cutoff-relevant ones have the highest priority
+  _sampleTaskId = _addTask("sample", &BatteryProtector::_taskSample, _samplePeriodMs, 0);
+  _stateTaskId = _addTask("state", &BatteryProtector::_taskState, STATE_PERIOD_MS, 1);
+  _buzzerTaskId = _addTask("buzzer", &BatteryProtector::_taskBuzzer, BUZZER_PERIOD_MS, 2);
+  _ledTaskId = _addTask("leds", &BatteryProtector::_taskLEDs, LED_PERIOD_MS, 3);
+  _displayTaskId = _addTask("display", &BatteryProtector::_taskDisplay, DISPLAY_PERIOD_MS, 4);
 }
 
 void BatteryProtector :: update() {
-  unsigned long currentTime = millis();
+  // Run whatever tasks are due; never blocks
+  PROFILE_STAGE(_profiler, STAGE_LOOP);
+  if (_watchdog.isTripped()) {
+    _recoverFromWatchdog(); // Feeds the watchdog once the stall is known
+  } else {
+    _watchdog.feed();
+  }
+  _scheduler.run();
+}
+
+unsigned long BatteryProtector :: getIdleMs() {
+  return _scheduler.msUntilNextDeadline();
+}
+
+void BatteryProtector :: idle() {
+  unsigned long sleepMs;
+  if (_canDeepSleep(sleepMs)) {
+    _enterDeepSleep(sleepMs);
+    return;
+  }
+  // tone() needs the CPU clock: no light sleep while the alarm sounds
+  _power.idle(getIdleMs(), !_buzzer.isAlarming());
+}
+
+void BatteryProtector :: setLowPowerMode(bool enabled) {
+  _lowPowerMode = enabled;
+  _applyPowerMode();
+}
+
+void BatteryProtector :: setDeepSleepInCutoff(bool enabled) {
+  _deepSleepInCutoff = enabled;
+}
+
+void BatteryProtector :: setHistoryLog(bool enabled) {
+  if (!enabled || _historyEnabled) {
+    return;
+  }
+  if (!_history.begin()) {
+    _console->println("ERROR: No flash area for the history log!");
+    return;
+  }
+  _historyTaskId = _addTask("history", &BatteryProtector::_taskHistory, HISTORY_PERIOD_MS, 5);
+  if (_historyTaskId < 0) {
+    return;
+  }
+  _historyEnabled = true;
+  _history.addEvent(_wokeFromDeepSleep ? HISTORY_EVENT_WAKE : HISTORY_EVENT_BOOT);
+  if (_hasWatchdogRecord) {
+    _history.addEvent(HISTORY_EVENT_WATCHDOG);
+  }
+  if (_state == STATE_CUTOFF && !_wokeFromDeepSleep && !_isHeldOpenByWatchdog) {
+    _history.addEvent(HISTORY_EVENT_CUTOFF); // Cut off at power-on
+  }
   
-  // Update voltage reading periodically
-  if (currentTime - _lastUpdateTimeMs >= _updateIntervalMs) {
-    _lastVoltage = _voltageSensor->readVoltageInVolts();
-    _lastUpdateTimeMs = currentTime;
-    updateDisplay(); // Update display when voltage updates
+  _console->print("History log: ");
+  _console->print(_history.getUsedBytes() / 1024UL);
+  _console->print(" of ");
+  _console->print(_history.getCapacityBytes() / 1024UL);
+  _console->println(" KB used. Send 'h' to export.");
+}
+
+void BatteryProtector :: setTelemetry(bool enabled) {
+  if (!enabled || _telemetryEnabled) {
+    return;
+  }
+  _telemetryTaskId = _addTask("telemetry", &BatteryProtector::_taskTelemetry, TELEMETRY_PERIOD_MS, 6);
+  if (_telemetryTaskId < 0) {
+    return;
+  }
+  // From here on text goes through the telemetry queue as well, so
+  // neither records nor messages wait for the UART
+  _telemetryEnabled = true;
+  _console = &_telemetry;
+  _telemetry.sendConfig(_cutoffMillivolts, _rearmMillivolts, _rearmDelayMs);
+  uint32_t nowMs = SystemClock::millis();
+  _telemetry.sendEvent(nowMs, _wokeFromDeepSleep ? HISTORY_EVENT_WAKE : HISTORY_EVENT_BOOT, _lastMillivolts);
+  if (_hasWatchdogRecord) {
+    _telemetry.sendEvent(nowMs, HISTORY_EVENT_WATCHDOG, _lastMillivolts);
+  }
+  if (_state == STATE_CUTOFF && !_wokeFromDeepSleep && !_isHeldOpenByWatchdog) {
+    _telemetry.sendEvent(nowMs, HISTORY_EVENT_CUTOFF, _lastMillivolts);
+  }
+  _lastTelemetrySampleMs = nowMs;
+}
+
+void BatteryProtector :: setMqttPublisher(MqttPublisher* publisher, const MqttConfig& config) {
+  if (_mqtt) {
+    return;
+  }
+  _mqttTaskId = _addTask("mqtt", &BatteryProtector::_taskMqtt, MQTT_PERIOD_MS, 7);
+  if (_mqttTaskId < 0) {
+    return;
+  }
+  _mqtt = publisher;
+  _power.begin(true); // The modem stays on from here; light sleep is off with it
+  _mqtt->begin(config, _flashSectorFromEnd(MQTT_SPOOL_SECTORS), _flashAreaSectors() > 0 ? MQTT_SPOOL_SECTORS : 0);
+  _mqtt->addEvent(_wokeFromDeepSleep ? HISTORY_EVENT_WAKE : HISTORY_EVENT_BOOT);
+  if (_hasWatchdogRecord) {
+    _mqtt->addEvent(HISTORY_EVENT_WATCHDOG);
+  }
+  if (_state == STATE_CUTOFF && !_wokeFromDeepSleep && !_isHeldOpenByWatchdog) {
+    _mqtt->addEvent(HISTORY_EVENT_CUTOFF);
+  }
+  _lastMqttSampleMs = SystemClock::millis();
+  
+  _console->print("MQTT: publishing to ");
+  for (uint8_t i = 0; i < 4; i++) {
+    _console->print((unsigned int)config.brokerAddress[i]);
+    _console->print(i < 3 ? "." : ":");
+  }
+  _console->print((unsigned int)config.brokerPort);
+  _console->print(" as ");
+  _console->print(config.clientId);
+  _console->print(", ");
+  _console->print(_mqtt->getSpooledBatches());
+  _console->println(" batches spooled.");
+}
+
+void BatteryProtector :: setNominalLoadCurrent(float amps) {
+  float milliamps = amps * 1000.0f + 0.5f;
+  _nominalLoadMilliamps = milliamps <= 0.0f ? 0 : (milliamps >= 65535.0f ? 65535 : (uint16_t)milliamps);
+  _applyCompensation();
+}
+
+void BatteryProtector :: setCutoffInput(CutoffInput input) {
+  _cutoffInput = input;
+  _applyCompensation();
+}
+
+void BatteryProtector :: setCurrentSensor(CurrentSensor* sensor, float capacityAmpHours) {
+  if (_currentTaskId < 0) {
+    _currentTaskId = _addTask("current", &BatteryProtector::_taskCurrent, _taskPeriod(CURRENT_PERIOD_MS), 1);
+    if (_currentTaskId < 0) {
+      return;
+    }
   }
+  _currentSensor = sensor;
+  if (!_currentSensor->init()) {
+    _console->println("ERROR: Current sensor not answering!");
+  }
+  _charge.begin((uint32_t)(capacityAmpHours * 1000.0f + 0.5f));
+  if (_isChargeRestored) {
+    _charge.restore(_restoredChargeMas); // Counted on before the deep sleep
+  } else {
+    _charge.anchor(_bootMillivolts); // Best guess until the battery rests
+  }
+  // Seeded from a first reading, not ramped up from zero: the boot
+  // resistance step is measured 100 ms after the relay closed
+  int32_t milliamps;
+  _averageMilliamps = _currentSensor->readMilliamps(milliamps) ? milliamps : 0;
+  _failedCurrentReadings = 0;
+  _lastCurrentMs = SystemClock::millis();
+  _applyCompensation();
+  
+  _console->print("Current sensor: state of charge ");
+  _console->print((unsigned int)_charge.getPercent());
+  _console->print("% of ");
+  _console->print(_charge.getCapacityMilliampHours() / 1000UL);
+  _console->println(" Ah.");
+}
+
+void BatteryProtector :: setStateOfChargeCutoff(uint8_t percent) {
+  _socCutoffPercent = percent > 100 ? 100 : percent;
+}
+
+void BatteryProtector :: setTransientRideThrough(const TransientConfig& config) {
+  _transients.begin(config, _cutoffMillivolts);
+  _transientsEnabled = true;
+  _reportedTransients = 0;
+  _applyCompensation(); // Threshold and the sampler's trip level
   
-  // Update display every second during countdown for smooth countdown display
-  if (_isWaitingForRearm && (currentTime - _lastDisplayUpdateMs >= 1000)) {
-    updateDisplay();
-    _lastDisplayUpdateMs = currentTime;
+  _console->print("Transient ride-through: up to ");
+  _console->print(config.dwellMs);
+  _console->print("ms below the cutoff, collapse below ");
+  _printVolts(config.collapseMillivolts);
+  _console->println("V.");
+}
+
+void BatteryProtector :: setLoopWatchdog(const WatchdogConfig& config) {
+  if (!_watchdog.begin(config, &BatteryProtector::_onWatchdogTrip, this, RTC_WATCHDOG_OFFSET)) {
+    _console->println("ERROR: Loop watchdog timeout out of range!");
+    return;
   }
+  _watchdog.setExpectedPeriod(_taskPeriod(_samplePeriodMs) * 1000UL);
   
-  // Handle test button
-  _handleTestButton();
+  _console->print("Loop watchdog: relay ");
+  _console->print(LoopWatchdog::safeStateName(config.safeState));
+  _console->print(" after ");
+  _console->print((unsigned int)config.timeoutMs);
+  _console->println("ms without a loop pass. Send 'w' for loop stats.");
+}
+
+void BatteryProtector :: setTemperatureSensor(TemperatureSensor* sensor, uint8_t millivoltsPerCelsius) {
+  _temperatureSensor = sensor;
+  _temperatureMillivoltsPerC = millivoltsPerCelsius;
+  _failedTemperatureReadings = 0;
+  _lastTemperatureStartMs = SystemClock::millis();
+  bool isAnswering = _temperatureSensor->startConversion(); // First reading in CONVERSION_MS
+  if (_temperatureTaskId < 0) {
+    _temperatureTaskId = _addTask("temperature", &BatteryProtector::_taskTemperature, TEMPERATURE_PERIOD_MS, 8);
+    if (_temperatureTaskId < 0) {
+      _temperatureSensor = nullptr; // Never read: the configured thresholds stay
+      return;
+    }
+  }
+  if (!isAnswering) {
+    _console->print("ERROR: Temperature sensor not answering on GPIO");
+    _console->print((unsigned int)_temperatureSensor->getPin());
+    _console->println("!");
+    return;
+  }
+  _console->print("Temperature compensation: thresholds ");
+  _console->print((unsigned int)millivoltsPerCelsius);
+  _console->print("mV lower per C below 25C, higher above (DS18B20 on GPIO");
+  _console->print((unsigned int)_temperatureSensor->getPin());
+  _console->println(").");
+}
+
+bool BatteryProtector :: setConfig(const ProtectorConfig& config) {
+  if (!ConfigStore::isValid(config)) {
+    return false;
+  }
+  _config = config;
+  _isConfigChanged = true;
+  _applyConfig();
+  _applyCompensation(); // Trip level and ride-through threshold follow the cutoff
+  if (_sampler.isRunning()) {
+    _sampler.begin(_samplePeriodMs);
+  }
+  _applyTaskPeriods();
+  if (_telemetryEnabled) {
+    _telemetry.sendConfig(_cutoffMillivolts, _rearmMillivolts, _rearmDelayMs);
+  }
+  return true;
+}
+
+void BatteryProtector :: saveConfig() {
+  _isConfigSavePending = true;
+}
+
+bool BatteryProtector :: startHistoryExport(Print& out) {
+  if (!_historyEnabled || !_history.startExport()) {
+    return false;
+  }
+  _historyOut = &out;
+  _applyTaskPeriods();
+  return true;
+}
+
+bool BatteryProtector :: isHistoryExporting() {
+  return _historyEnabled && _history.isExporting();
+}
+
+void BatteryProtector :: printSchedulerStats(Print& out) {
+  _scheduler.printStats(out);
+}
+
+void BatteryProtector :: printProfile(Print& out) {
+#if PROFILER_ENABLED
+  _profiler.print(out, ESP.getCpuFreqMHz());
+#else
+  out.println("Profiler compiled out (PROFILER_ENABLED in profiler.h).");
+#endif
+}
+
+void BatteryProtector :: resetProfile() {
+#if PROFILER_ENABLED
+  _profiler.reset();
+#endif
+}
+
+void BatteryProtector :: printPowerStats(Print& out) {
+  _power.printStats(out);
+}
+
+void BatteryProtector :: printLoopStats(Print& out) {
+  _watchdog.printStats(out);
+}
+
+void BatteryProtector :: printMemoryReport(Print& out) {
+  // All compile-time sizes: nothing here is allocated at run time. A
+  // component that outgrows its budget fails the build instead of first
+  // showing up here. The budgets fit the 64-bit sim build, where
+  // pointers and longs are twice their ESP8266 size
+  static_assert(sizeof(_power) <= 64, "Power manager over its RAM budget");
+  static_assert(sizeof(_voltageSensor) <= 96, "Voltage sensor over its RAM budget");
+  static_assert(sizeof(_adcTable) <= 48, "ADC calibration over its RAM budget");
+  static_assert(sizeof(_sampler) <= 448, "Sampler over its RAM budget");
+  static_assert(sizeof(_scheduler) <= 1280, "Scheduler over its RAM budget");
+  static_assert(sizeof(_loadRelay) + sizeof(_greenLED) + sizeof(_redLED) + sizeof(_testButton) + sizeof(_buzzer) <= 320, "Outputs over their RAM budget");
+  static_assert(sizeof(_history) <= 64, "History log over its RAM budget");
+  static_assert(sizeof(_telemetry) <= 1280, "Telemetry queue over its RAM budget");
+  static_assert(sizeof(_resistance) + sizeof(_charge) + sizeof(_trend) <= 288, "Estimators over their RAM budget");
+  static_assert(sizeof(_transients) <= 192, "Transient classifier over its RAM budget");
+  static_assert(sizeof(_watchdog) + sizeof(_watchdogRecord) <= 192, "Loop watchdog over its RAM budget");
+#if PROFILER_ENABLED
+  static_assert(sizeof(_profiler) <= 768, "Profiler over its RAM budget");
+#endif
+  static_assert(sizeof(BatteryProtector) <= 5120, "Protector over its RAM budget");
+  // Owned by the sketch, listed when attached
+  static_assert(sizeof(Display) <= 640, "Display over its RAM budget");
+  static_assert(sizeof(MqttPublisher) <= 2560, "MQTT publisher over its RAM budget");
+  static_assert(sizeof(CurrentSensor) <= 32, "Current sensor over its RAM budget");
+  static_assert(sizeof(TemperatureSensor) <= 32, "Temperature sensor over its RAM budget");
+  struct Entry {
+    const char* name;
+    size_t bytes;
+  };
+  const Entry entries[] = {
+    { "pins", sizeof(_voltagePin) + sizeof(_relayPin) + sizeof(_greenLEDPin) + sizeof(_redLEDPin) + sizeof(_testButtonPin) + sizeof(_buzzerPin) },
+    { "power", sizeof(_power) },
+    { "voltage sensor", sizeof(_voltageSensor) },
+    { "adc table", sizeof(_adcTable) },
+    { "sampler", sizeof(_sampler) },
+    { "scheduler", sizeof(_scheduler) },
+    { "relay", sizeof(_loadRelay) },
+    { "leds", sizeof(_greenLED) + sizeof(_redLED) },
+    { "button", sizeof(_testButton) },
+    { "buzzer", sizeof(_buzzer) },
+    { "history log", sizeof(_history) },
+    { "telemetry", sizeof(_telemetry) },
+    { "resistance", sizeof(_resistance) },
+    { "charge counter", sizeof(_charge) },
+    { "trend", sizeof(_trend) },
+    { "transients", sizeof(_transients) },
+    { "watchdog", sizeof(_watchdog) + sizeof(_watchdogRecord) },
+    { "temperature", sizeof(_temperatureSensor) + sizeof(_temperatureSixteenths) + sizeof(_temperatureOffsetMillivolts) + sizeof(_lastTemperatureStartMs) },
+    { "config", sizeof(_configStore) + sizeof(_defaultConfig) + sizeof(_config) + sizeof(_commandLine) },
+#if PROFILER_ENABLED
+    { "profiler", sizeof(_profiler) },
+#endif
+  };
+  out.println("Component        bytes");
+  size_t componentBytes = 0;
+  for (size_t i = 0; i < sizeof(entries) / sizeof(entries[0]); i++) {
+    out.print(entries[i].name);
+    for (size_t pad = strlen(entries[i].name); pad < 17; pad++) {
+      out.print(' ');
+    }
+    out.println((unsigned long)entries[i].bytes);
+    componentBytes += entries[i].bytes;
+  }
+  out.print("protector state  ");
+  out.println((unsigned long)(sizeof(BatteryProtector) - componentBytes));
+  out.print("total            ");
+  out.println((unsigned long)sizeof(BatteryProtector));
+  if (_display) {
+    out.print("display          ");
+    out.println((unsigned long)sizeof(Display));
+  }
+  if (_mqtt) {
+    out.print("mqtt publisher   ");
+    out.println((unsigned long)sizeof(MqttPublisher)); // Its TCP connection is a pcb in lwIP's own pool
+  }
+  if (_currentSensor) {
+    out.print("current sensor   ");
+    out.println((unsigned long)sizeof(CurrentSensor));
+  }
+  if (_temperatureSensor) {
+    out.print("temp sensor      ");
+    out.println((unsigned long)sizeof(TemperatureSensor));
+  }
+}
+
+unsigned long BatteryProtector :: _taskPeriod(unsigned long periodMs) {
+  if (_power.isLowPower() && periodMs < LOW_POWER_PERIOD_MS) {
+    return LOW_POWER_PERIOD_MS;
+  }
+  return periodMs;
+}
+
+int8_t BatteryProtector :: _addTask(const char* name, Scheduler::TaskFunction function, unsigned long periodMs, uint8_t priority) {
+  int8_t taskId = _scheduler.addTask(name, function, this, periodMs, priority);
+  if (taskId < 0) {
+    _console->print("ERROR: No scheduler slot for the ");
+    _console->print(name);
+    _console->println(" task!");
+  }
+  return taskId;
+}
+
+void BatteryProtector :: _updatePowerMode(bool burstNearCutoff) {
+  // 100 ms bursts through the median and EMA take ~1.8 s to follow a
+  // drop to just below the cutoff; near it, sample at full rate instead
+  bool nearCutoff;
+  if (_isVerifyingRearm) {
+    nearCutoff = true;
+  } else if (_state != STATE_ARMED) {
+    nearCutoff = false;
+  } else if (_isNearCutoff) {
+    nearCutoff = _lastRaw < _guardExitRaw;
+  } else {
+    nearCutoff = burstNearCutoff || _lastRaw < _guardRaw;
+  }
+  if (nearCutoff != _isNearCutoff) {
+    _isNearCutoff = nearCutoff;
+    _applyPowerMode();
+  }
+}
+
+void BatteryProtector :: _applyPowerMode() {
+  bool lowPower = _lowPowerMode && !_isNearCutoff;
+  _power.setLowPower(lowPower);
+  if (lowPower) {
+    // os_timer stops in light sleep; the sample task reads the ADC itself
+    _sampler.stop();
+  } else if (!_sampler.isRunning()) {
+    _sampler.begin(_samplePeriodMs);
+  }
+  _applyTaskPeriods();
+}
+
+void BatteryProtector :: _applyTaskPeriods() {
+  _scheduler.setPeriod(_sampleTaskId, _taskPeriod(_samplePeriodMs));
+  _watchdog.setExpectedPeriod(_taskPeriod(_samplePeriodMs) * 1000UL); // The loop wakes at least this often
+  _scheduler.setPeriod(_stateTaskId, _taskPeriod(STATE_PERIOD_MS));
+  _scheduler.setPeriod(_buzzerTaskId, _taskPeriod(BUZZER_PERIOD_MS));
+  _scheduler.setPeriod(_ledTaskId, _taskPeriod(LED_PERIOD_MS));
+  _scheduler.setPeriod(_displayTaskId, _taskPeriod(DISPLAY_PERIOD_MS));
+  if (_telemetryTaskId >= 0) {
+    _scheduler.setPeriod(_telemetryTaskId, _taskPeriod(TELEMETRY_PERIOD_MS));
+  }
+  if (_currentTaskId >= 0) {
+    _scheduler.setPeriod(_currentTaskId, _taskPeriod(CURRENT_PERIOD_MS));
+  }
+  if (_historyTaskId >= 0) {
+    _scheduler.setPeriod(_historyTaskId, _taskPeriod(isHistoryExporting() ? HISTORY_EXPORT_PERIOD_MS : HISTORY_PERIOD_MS));
+  }
+}
+
+bool BatteryProtector :: _canDeepSleep(unsigned long& sleepMs) {
+  if (!_deepSleepInCutoff || _state != STATE_CUTOFF || _isVerifyingRearm || _buzzer.isAlarming() || isHistoryExporting()) {
+    return false;
+  }
+  if (_display && !_displayReady) {
+    return false; // Let the LCD show the cutoff first
+  }
+  if (SystemClock::millis() - _bootMs < DEEP_SLEEP_MIN_AWAKE_MS) {
+    return false;
+  }
   
-  // Update state based on voltage
-  _updateState();
+  // Wake up in time to finish a running rearm countdown
+  sleepMs = DEEP_SLEEP_INTERVAL_MS;
+  if (_isWaitingForRearm) {
+    unsigned long elapsedMs = SystemClock::millis() - _rearmCountdownStartMs;
+    unsigned long remainingMs = elapsedMs < _rearmDelayMs ? _rearmDelayMs - elapsedMs : 0;
+    if (remainingMs < sleepMs) {
+      sleepMs = remainingMs;
+    }
+  }
+  return sleepMs >= DEEP_SLEEP_MIN_MS;
+}
+
+void BatteryProtector :: _enterDeepSleep(unsigned long sleepMs) {
+  _console->print("Cutoff: deep sleep for ");
+  _console->print(sleepMs / 1000UL);
+  _console->println("s");
   
-  // Update LEDs (called every loop iteration for blinking)
-  _updateLEDs();
+  if (_mqtt) {
+    _mqtt->sync(); // RAM queue to flash: published after a later wake-up
+  }
+  _power.accountDeepSleep(sleepMs);
+  RtcState saved;
+  memset(&saved, 0, sizeof(saved));
+  saved.state = (uint8_t)_state;
+  saved.isWaitingForRearm = _isWaitingForRearm ? 1 : 0;
+  saved.isChargeKnown = _currentSensor && _charge.isAnchored() ? 1 : 0;
+  saved.chargeMas = _charge.getChargeMilliampSeconds();
+  saved.rearmElapsedMs = _isWaitingForRearm ? SystemClock::millis() - _rearmCountdownStartMs + sleepMs : 0;
+  saved.historyElapsedMs = SystemClock::millis() - _lastHistoryMs + sleepMs;
+  for (uint8_t i = 0; i < EnergyModel::POWER_STATE_COUNT; i++) {
+    saved.energyMs[i] = _power.getEnergy().getMs((EnergyModel::PowerState)i);
+  }
+  _power.saveRtc(RTC_STATE_OFFSET, &saved, sizeof(saved));
+  if (_historyEnabled) {
+    _history.sync(); // The word in RAM would be lost with the reset
+  }
+  if (_telemetryEnabled) {
+    _telemetry.drain(Serial); // So would the queued output
+  }
+  _power.deepSleep(sleepMs);
+}
+
+void BatteryProtector :: _taskSample(void* arg) {
+  BatteryProtector* self = static_cast<BatteryProtector*>(arg);
+  PROFILE_STAGE(self->_profiler, STAGE_ADC);
+  bool burstNearCutoff = false;
+  if (!self->_sampler.isRunning()) {
+    // Low power mode: no sampler timer, take one oversampled burst per period;
+    // a low burst switches to full rate before the filter catches up
+    uint16_t burstRaw = self->_sampler.sampleBurst(FILTER_OVERSAMPLE);
+    burstNearCutoff = (uint16_t)(burstRaw << VoltageSensor::RAW_FRACTION_BITS) < self->_guardRaw;
+  }
+  // Consume samples queued by the timer and act on a fast trip
+  self->_consumeSamples();
+  self->_updatePowerMode(burstNearCutoff);
+}
+
+void BatteryProtector :: _taskState(void* arg) {
+  BatteryProtector* self = static_cast<BatteryProtector*>(arg);
+  if (!self->_isBootReported) {
+    self->_printBootReport();
+  }
+  {
+    PROFILE_STAGE(self->_profiler, STAGE_BUTTON);
+    self->_handleTestButton();
+  }
+  self->_handleSerialCommand();
+  if (self->_isConfigSavePending && self->_canStall()) {
+    self->_saveConfig();
+  }
+  PROFILE_STAGE(self->_profiler, STAGE_STATE);
+  self->_updateResistanceStep();
+  self->_updateState();
+  self->_updateTrend();
+  self->_updatePowerMode(false); // A rearm trial starts here
+}
+
+void BatteryProtector :: _taskLEDs(void* arg) {
+  // Update LEDs (blinking during countdown)
+  BatteryProtector* self = static_cast<BatteryProtector*>(arg);
+  PROFILE_STAGE(self->_profiler, STAGE_LEDS);
+  self->_updateLEDs();
+}
 
+void BatteryProtector :: _taskBuzzer(void* arg) {
   // Update buzzer (handles auto-stop after duration)
-  _updateBuzzer();
+  BatteryProtector* self = static_cast<BatteryProtector*>(arg);
+  PROFILE_STAGE(self->_profiler, STAGE_BUZZER);
+  self->_updateBuzzer();
+}
+
+void BatteryProtector :: _taskDisplay(void* arg) {
+  BatteryProtector* self = static_cast<BatteryProtector*>(arg);
+  PROFILE_STAGE(self->_profiler, STAGE_DISPLAY); // Bring-up steps included
+  unsigned long currentTime = SystemClock::millis();
+  
+  // Bus faults and recoveries of the last run, once each
+  if (self->_display && self->_display->isBusFault() != self->_isDisplayBusFault) {
+    self->_isDisplayBusFault = !self->_isDisplayBusFault;
+    self->_console->println(self->_isDisplayBusFault ? "ERROR: Display not answering on I2C, retrying every second." : "Display: I2C bus recovered.");
+  }
+  
+  // Finish display bring-up one step at a time instead of delay()
+  if (!self->_displayReady) {
+    if (self->_displayInitStep == 0 || (long)(currentTime - self->_displayStepAtMs) < 0) {
+      return;
+    }
+    if (self->_displayInitStep == 1) {
+      self->_display->init(); // Power-on sequence; the relay was decided long before
+      self->_displayInitStep = 2;
+      self->_displayStepAtMs = currentTime + 100;
+    } else if (self->_displayInitStep == 2) {
+      self->_display->backlight();
+      self->_displayInitStep = 3;
+      self->_displayStepAtMs = currentTime + 50;
+    } else if (self->_displayInitStep == 3) {
+      self->_display->clear();
+      self->_displayInitStep = 4;
+      self->_displayStepAtMs = currentTime + 50;
+    } else {
+      self->_displayReady = true;
+      self->updateDisplay();
+      self->_lastUpdateTimeMs = currentTime;
+    }
+    return;
+  }
+  
+  // Refresh display once per interval (also drives the rearm countdown)
+  if (currentTime - self->_lastUpdateTimeMs >= self->_updateIntervalMs) {
+    self->_lastUpdateTimeMs = currentTime;
+    self->updateDisplay();
+  }
+}
+
+void BatteryProtector :: _taskHistory(void* arg) {
+  BatteryProtector* self = static_cast<BatteryProtector*>(arg);
+  
+  // Whole seconds since the last sample; the remainder carries over
+  unsigned long elapsedSeconds = (SystemClock::millis() - self->_lastHistoryMs) / 1000UL;
+  if (elapsedSeconds > 0) {
+    self->_lastHistoryMs += elapsedSeconds * 1000UL;
+    self->_history.addSample(self->_lastMillivolts, elapsedSeconds);
+  }
+  
+  self->_history.maintain(self->_canStall());
+  
+  if (self->_history.isExporting() && !self->_history.exportStep(*self->_historyOut)) {
+    self->_historyOut = nullptr;
+    self->_applyTaskPeriods(); // Export done: back to one run per second
+  }
+}
+
+void BatteryProtector :: _taskTelemetry(void* arg) {
+  BatteryProtector* self = static_cast<BatteryProtector*>(arg);
+  unsigned long nowMs = SystemClock::millis();
+  if (nowMs - self->_lastTelemetrySampleMs >= TELEMETRY_SAMPLE_PERIOD_MS) {
+    self->_lastTelemetrySampleMs = nowMs;
+    uint8_t flags = 0;
+    if (self->_isWaitingForRearm) {
+      flags |= TELEMETRY_FLAG_WAITING_FOR_REARM;
+    }
+    if (self->_isVerifyingRearm) {
+      flags |= TELEMETRY_FLAG_VERIFYING_REARM;
+    }
+    if (self->_power.isLowPower()) {
+      flags |= TELEMETRY_FLAG_LOW_POWER;
+    }
+    self->_telemetry.sendSample(nowMs, self->_lastMillivolts, self->_lastNoiseMillivolts, (uint8_t)self->_state, flags);
+  }
+  // Only what the UART FIFO takes right now
+  self->_telemetry.pump(Serial);
+}
+
+void BatteryProtector :: _taskMqtt(void* arg) {
+  BatteryProtector* self = static_cast<BatteryProtector*>(arg);
+  unsigned long elapsedSeconds = (SystemClock::millis() - self->_lastMqttSampleMs) / 1000UL;
+  if (elapsedSeconds > 0) {
+    self->_lastMqttSampleMs += elapsedSeconds * 1000UL;
+    self->_mqtt->addSample(self->_lastMillivolts, elapsedSeconds);
+  }
+  self->_mqtt->update(self->_canStall());
+}
+
+void BatteryProtector :: _taskTemperature(void* arg) {
+  // One bus transaction per run at most: read a finished conversion, or
+  // start the next one once the interval is up
+  BatteryProtector* self = static_cast<BatteryProtector*>(arg);
+  TemperatureSensor* sensor = self->_temperatureSensor;
+  if (sensor->isConverting()) {
+    if (sensor->isConversionDone()) {
+      int16_t sixteenths = 0;
+      bool isValid = sensor->readSixteenths(sixteenths);
+      self->_updateTemperature(isValid, sixteenths);
+    }
+    return;
+  }
+  unsigned long nowMs = SystemClock::millis();
+  if (nowMs - self->_lastTemperatureStartMs >= TEMPERATURE_INTERVAL_MS) {
+    self->_lastTemperatureStartMs = nowMs;
+    if (!sensor->startConversion()) {
+      self->_updateTemperature(false, 0);
+    }
+  }
+}
+
+void BatteryProtector :: _taskCurrent(void* arg) {
+  BatteryProtector* self = static_cast<BatteryProtector*>(arg);
+  unsigned long nowMs = SystemClock::millis();
+  unsigned long elapsedMs = nowMs - self->_lastCurrentMs;
+  self->_lastCurrentMs = nowMs;
+  int32_t milliamps;
+  if (!self->_currentSensor->readMilliamps(milliamps)) {
+    // The charge misses this interval; the next rest anchor corrects it
+    if (self->_failedCurrentReadings < MAX_FAILED_CURRENT_READINGS) {
+      self->_failedCurrentReadings++;
+      if (self->_failedCurrentReadings == MAX_FAILED_CURRENT_READINGS) {
+        self->_console->println("ERROR: Current sensor not answering, cutoff on voltage.");
+      }
+    }
+    return;
+  }
+  if (self->_failedCurrentReadings >= MAX_FAILED_CURRENT_READINGS) {
+    self->_console->println("Current sensor answering again.");
+  }
+  self->_failedCurrentReadings = 0;
+  self->_averageMilliamps += (milliamps - self->_averageMilliamps) >> CURRENT_AVERAGE_SHIFT;
+  
+  if (self->_charge.addSample(milliamps, elapsedMs)) {
+    // No current for a long while: the terminal voltage is the resting voltage
+    self->_charge.anchor(self->_lastMillivolts);
+    if (self->_isTrendOnCharge) {
+      self->_trend.reset(); // The charge jumped
+    }
+    self->_console->print("State of charge re-anchored at rest: ");
+    self->_console->print((unsigned int)self->_charge.getPercent());
+    self->_console->print("% (");
+    self->_printVolts(self->_lastMillivolts);
+    self->_console->println("V)");
+  }
+  
+  // The compensation follows the measured current
+  if (self->_cutoffInput == CUTOFF_INPUT_COMPENSATED && self->_resistance.hasEstimate()) {
+    int32_t sagMillivolts = self->_resistance.getSagMillivolts(self->_loadMilliamps());
+    int32_t change = sagMillivolts - (int32_t)self->_appliedSagMillivolts;
+    if (change >= SAG_UPDATE_MILLIVOLTS || change <= -SAG_UPDATE_MILLIVOLTS) {
+      self->_applyCompensation();
+    }
+  }
 }
 
 void BatteryProtector :: rearm() {
   // Manually rearm the circuit
-  Serial.println("Manually rearming circuit...");
+  _console->println("Manually rearming circuit...");
+  _logEvent(HISTORY_EVENT_MANUAL_REARM);
   _state = STATE_ARMED;
   _isWaitingForRearm = false;
+  _isVerifyingRearm = false;
   _rearmCountdownStartMs = 0;
-  _loadRelay->turnOn();
-  _lastRearmAttemptMs = millis();
-  _greenLED->on();
-  _redLED->off();
+  _loadRelay.turnOn();
+  _sampler.clearTrip();
+  _startResistanceStep(true);
+  _lastRearmAttemptMs = SystemClock::millis();
+  _greenLED.on();
+  _redLED.off();
   
   // Update display immediately
   updateDisplay();
   
-  Serial.println("Circuit rearmed.");
+  _console->println("Circuit rearmed.");
 }
 
 BatteryProtector::State BatteryProtector :: getState() {
@@ -135,63 +918,615 @@ BatteryProtector::State BatteryProtector :: getState() {
 }
 
 float BatteryProtector :: getBatteryVoltage() {
-  return _lastVoltage;
+  return _lastMillivolts / 1000.0f;
+}
+
+uint16_t BatteryProtector :: getBatteryMillivolts() {
+  return _lastMillivolts;
+}
+
+uint16_t BatteryProtector :: getVoltageNoiseMillivolts() {
+  return _lastNoiseMillivolts;
+}
+
+uint16_t BatteryProtector :: getInternalResistanceMilliohms() {
+  return _resistance.getMilliohms();
+}
+
+uint16_t BatteryProtector :: getCompensatedMillivolts() {
+  int32_t milliamps = _loadMilliamps();
+  if (!_isLoadConnected() || milliamps == 0) {
+    return _lastMillivolts;
+  }
+  return _resistance.compensate(_lastMillivolts, milliamps > 0xFFFF ? 0xFFFF : (uint16_t)milliamps);
+}
+
+int32_t BatteryProtector :: getCurrentMilliamps() {
+  return _currentSensor ? _averageMilliamps : 0;
+}
+
+uint8_t BatteryProtector :: getStateOfChargePercent() {
+  return _currentSensor ? _charge.getPercent() : 0;
+}
+
+uint16_t BatteryProtector :: getTransientCount() {
+  return _transients.getTransientCount();
+}
+
+uint32_t BatteryProtector :: getSecondsToCutoff() {
+  if (_state != STATE_ARMED || _isVerifyingRearm) {
+    return TrendEstimator::NO_ESTIMATE;
+  }
+  // Where the cutoff input crosses: the charge threshold, or the
+  // terminal voltage the compensated compare lets through
+  uint16_t threshold;
+  if (_isTrendOnCharge) {
+    threshold = _socCutoffPercent > 0 ? (uint16_t)_socCutoffPercent * 10 - 5 : 0; // getPercent() rounds
+  } else {
+    threshold = _cutoffMillivolts > _appliedSagMillivolts ? _cutoffMillivolts - _appliedSagMillivolts : 0;
+  }
+  uint32_t intervals = _trend.getIntervalsTo(threshold);
+  if (intervals == TrendEstimator::NO_ESTIMATE) {
+    return intervals;
+  }
+  return intervals * (TREND_PERIOD_MS / 1000);
 }
 
 float BatteryProtector :: getVoltageCutoffThreshold() {
   return _voltageCutoffThreshold;
 }
 
+void BatteryProtector :: _consumeSamples() {
+  AdcSample sample;
+  unsigned long nowMs = SystemClock::millis();
+  // Samples carry no time: the newest is taken as now and each older one
+  // a sample period before it, so a late loop() does not squeeze a dip.
+  // Timer jitter can put the oldest before the last batch's newest; the
+  // classifier needs times that never go back
+  uint16_t remaining = _sampler.available();
+  unsigned long periodMs = _sampler.getSamplePeriodMs();
+  while (remaining > 0 && _sampler.read(sample)) {
+    remaining--;
+    _voltageSensor.filterRaw(sample.raw);
+    if (_transientsEnabled) {
+      unsigned long sampleMs = nowMs - remaining * periodMs;
+      if ((long)(sampleMs - _lastSampleMs) < 0) {
+        sampleMs = _lastSampleMs;
+      }
+      _lastSampleMs = sampleMs;
+      // Unfiltered: the shape of a dip is what the filter smooths away
+      _transients.addSample(_voltageSensor.millivoltsFromRaw((uint16_t)(sample.raw << VoltageSensor::RAW_FRACTION_BITS)), sampleMs);
+    }
+  }
+  if (_transientsEnabled && _transients.getTransientCount() != _reportedTransients) {
+    _reportTransient();
+  }
+  if (_voltageSensor.hasFilteredReading()) {
+    _storeReading(_voltageSensor.getFilteredReading());
+  }
+  
+  // The sampler already opened the relay; bring the state machine in line
+  if (_sampler.isTripped() && _state == STATE_ARMED) {
+    _lastRaw = (uint16_t)(_sampler.getTripRaw() << VoltageSensor::RAW_FRACTION_BITS);
+    _lastMillivolts = _voltageSensor.millivoltsFromRaw(_lastRaw);
+    _logEvent(HISTORY_EVENT_FAST_TRIP);
+    _performCutoff();
+  }
+}
+
+void BatteryProtector :: _reportTransient() {
+  _reportedTransients = _transients.getTransientCount();
+  const TransientClassifier::DipStats& dip = _transients.getLastDip();
+  _logEvent(HISTORY_EVENT_TRANSIENT);
+  _console->print("Transient dip ridden through: ");
+  _printVolts(dip.minMillivolts);
+  _console->print("V minimum, ");
+  _console->print(dip.durationMs);
+  _console->print("ms, recovery ");
+  _console->print((unsigned int)dip.recoveryMillivoltsPerSecond);
+  _console->println("mV/s.");
+}
+
+void BatteryProtector :: _storeReading(const VoltageReading& reading) {
+  _lastRaw = reading.raw;
+  _lastMillivolts = reading.millivolts;
+  _lastNoiseMillivolts = reading.noiseMillivolts;
+}
+
+void BatteryProtector :: _printVolts(uint16_t millivolts) {
+  char text[8];
+  formatMillivolts(millivolts, text);
+  _console->print(text);
+}
+
+void BatteryProtector :: _onSamplerTrip(void* arg) {
+  // Timer context: only drive the relay, bookkeeping happens in update()
+  static_cast<BatteryProtector*>(arg)->_loadRelay.turnOff();
+}
+
+int8_t IRAM_ATTR BatteryProtector :: _onWatchdogTrip(void* arg, uint8_t safeState) {
+  // Interrupt context: only drive the relay, bookkeeping happens in update()
+  BatteryProtector* self = static_cast<BatteryProtector*>(arg);
+  if (safeState == LoopWatchdog::SAFE_RELAY_CLOSED) {
+    self->_loadRelay.turnOn();
+  } else {
+    self->_loadRelay.turnOff();
+  }
+  return self->_scheduler.getRunningTask();
+}
+
+void BatteryProtector :: _recoverFromWatchdog() {
+  unsigned long stalledMs = SystemClock::millis() - _watchdog.getLastFeedMs();
+  WatchdogRecord record;
+  _watchdog.takeTrip(record);
+  _watchdog.feed();
+  _logEvent(HISTORY_EVENT_WATCHDOG);
+  _console->print("WATCHDOG: loop stalled ");
+  _console->print(stalledMs);
+  _console->print("ms in task '");
+  _console->print(_scheduler.getTaskName(record.taskId));
+  _console->print("', relay ");
+  _console->print(LoopWatchdog::safeStateName(record.safeState));
+  _console->println(".");
+  
+  if (record.safeState == LoopWatchdog::SAFE_RELAY_OPEN) {
+    // Open it stays: rearmed like after any cutoff
+    if (_state == STATE_ARMED || _isVerifyingRearm) {
+      _performCutoff();
+    }
+  } else if (_state == STATE_CUTOFF && !_isVerifyingRearm) {
+    _loadRelay.turnOff(); // Closed for the hang only
+  }
+}
+
 void BatteryProtector :: _handleTestButton() {
-  if (_testButton->isPressed()) {
-    delay(50); // Debounce
-    if (_testButton->isPressed()) {
+  _testButton.update();
+  
+  switch (_testButton.takeEvent()) {
+    case Switch::EVENT_SHORT_PRESS:
+      // Show status on Serial and refresh the display right away
+      _console->println("Test button: Status");
+      printStatus();
+      updateDisplay();
+      break;
+      
+    case Switch::EVENT_LONG_PRESS:
       if (_state == STATE_ARMED) {
         // Simulate voltage drop below 11V threshold - trigger cutoff
-        Serial.println("Test button: Simulating voltage drop below 11V threshold");
+        _console->println("Test button: Simulating voltage drop below 11V threshold");
+        _logEvent(HISTORY_EVENT_TEST_CUTOFF);
         _performCutoff();
       } else if (_state == STATE_CUTOFF) {
-        // Immediately rearm (bypass voltage threshold check and delay)
-        Serial.println("Test button: Immediately rearming circuit");
+        // Force rearm (bypass voltage threshold check and delay)
+        _console->println("Test button: Immediately rearming circuit");
         rearm();
       }
-      // Wait for button release
-      while (_testButton->isPressed()) {
-        delay(10);
+      break;
+      
+    case Switch::EVENT_NONE:
+      break;
+  }
+}
+
+void BatteryProtector :: _handleSerialCommand() {
+  while (Serial.available() > 0) {
+    int command = Serial.read();
+    if (_commandLength > 0) {
+      // Rest of a configuration line
+      if (command == '\n' || command == '\r') {
+        _commandLine[_commandLength] = '\0';
+        _commandLength = 0;
+        if (_commandLine[0] == 'a') {
+          _handleAdcCommand(_commandLine + 1);
+        } else {
+          _handleConfigCommand(_commandLine + 1);
+        }
+      } else if (_commandLength < sizeof(_commandLine) - 1) {
+        _commandLine[_commandLength++] = (char)command;
       }
+      continue;
+    }
+    if (command == 'c' || command == 'a') {
+      _commandLine[0] = (char)command;
+      _commandLength = 1;
+    } else if (command == 'p') {
+      printProfile(*_console);
+    } else if (command == 'm') {
+      printMemoryReport(*_console);
+    } else if (command == 'w') {
+      printLoopStats(*_console);
+    } else if (command == 'h') {
+      if (isHistoryExporting()) {
+        continue;
+      }
+      if (!startHistoryExport(*_console)) { // Through the telemetry queue when enabled, so frames do not interleave
+        _console->println("History log is disabled.");
+      }
+    }
+  }
+}
+
+void BatteryProtector :: _handleConfigCommand(char* arguments) {
+  // "c" shows the configuration, "c <field> <value>" changes and applies
+  // it, "c save" writes it to flash, "c defaults" goes back to the
+  // compiled values
+  char* name = arguments;
+  while (*name == ' ') {
+    name++;
+  }
+  char* value = name;
+  while (*value != '\0' && *value != ' ') {
+    value++;
+  }
+  if (*value != '\0') {
+    *value++ = '\0';
+    while (*value == ' ') {
+      value++;
+    }
+  }
+  
+  ProtectorConfig config = _config;
+  uint32_t number;
+  if (*name == '\0') {
+    _printConfig();
+    return;
+  } else if (strcmp(name, "save") == 0) {
+    saveConfig();
+    return;
+  } else if (strcmp(name, "defaults") == 0) {
+    config = _defaultConfig;
+  } else if (strcmp(name, "cutoff") == 0 && _parseFixed(value, 3, number) && number <= 0xFFFF) {
+    config.cutoffMillivolts = (uint16_t)number;
+  } else if (strcmp(name, "rearm") == 0 && _parseFixed(value, 3, number) && number <= 0xFFFF) {
+    config.rearmMillivolts = (uint16_t)number;
+  } else if (strcmp(name, "delay") == 0 && _parseFixed(value, 0, number)) {
+    config.rearmDelayMs = number;
+  } else if (strcmp(name, "rtop") == 0 && _parseFixed(value, 0, number)) {
+    config.dividerTopOhms = number;
+  } else if (strcmp(name, "rbottom") == 0 && _parseFixed(value, 0, number)) {
+    config.dividerBottomOhms = number;
+  } else if (strcmp(name, "cal") == 0 && _parseFixed(value, 6, number)) {
+    config.calibrationPpm = number;
+  } else if (strcmp(name, "period") == 0 && _parseFixed(value, 0, number) && number <= 0xFFFF) {
+    config.samplePeriodMs = (uint16_t)number;
+  } else {
+    _console->println("Config: c [cutoff V | rearm V | delay ms | rtop ohm | rbottom ohm | cal factor | period ms | defaults | save]");
+    return;
+  }
+  if (!setConfig(config)) {
+    _console->println("Config: out of range, not changed.");
+    return;
+  }
+  _printConfig();
+}
+
+void BatteryProtector :: _handleAdcCommand(char* arguments) {
+  // "a" shows the points and the count being read now, "a <V>" pairs
+  // that count with the voltage a meter shows across the battery, "a
+  // clear" goes back to the divider conversion. A calibration applies
+  // from its second point on; "c save" keeps it
+  while (*arguments == ' ') {
+    arguments++;
+  }
+  if (*arguments == '\0') {
+    _printAdcCalibration();
+    return;
+  }
+  
+  ProtectorConfig config = _config;
+  if (strcmp(arguments, "clear") == 0) {
+    _hasAdcFirstPoint = false;
+    config.adcPointCount = 0;
+    memset(config.adcPoints, 0, sizeof(config.adcPoints));
+    setConfig(config);
+    _printAdcCalibration();
+    return;
+  }
+  uint32_t millivolts;
+  if (!_parseFixed(arguments, 3, millivolts) || millivolts == 0 || millivolts > 0xFFFF) {
+    _console->println("ADC calibration: a [V on the meter now | clear]");
+    return;
+  }
+  AdcCalibrationPoint point;
+  point.raw = (uint16_t)((_lastRaw + (1U << (VoltageSensor::RAW_FRACTION_BITS - 1))) >> VoltageSensor::RAW_FRACTION_BITS);
+  point.millivolts = (uint16_t)millivolts;
+  
+  // Into the points so far, by count; a point at the same count is replaced
+  AdcCalibrationPoint points[AdcCalibrationTable::POINTS_MAX + 1];
+  uint8_t count = config.adcPointCount;
+  memcpy(points, config.adcPoints, sizeof(config.adcPoints));
+  if (count == 0 && _hasAdcFirstPoint) {
+    points[0] = _adcFirstPoint;
+    count = 1;
+  }
+  uint8_t at = 0;
+  while (at < count && points[at].raw < point.raw) {
+    at++;
+  }
+  if (at == count || points[at].raw != point.raw) {
+    memmove(&points[at + 1], &points[at], (count - at) * sizeof(point));
+    count++;
+  }
+  points[at] = point;
+  
+  if (count == 1) {
+    _adcFirstPoint = point;
+    _hasAdcFirstPoint = true;
+    _printAdcCalibration();
+    return;
+  }
+  if (!AdcCalibrationTable::isValid(points, count)) {
+    _console->println("ADC calibration: point does not rise with the others (or 8 already), not taken.");
+    return;
+  }
+  config.adcPointCount = count;
+  memset(config.adcPoints, 0, sizeof(config.adcPoints));
+  memcpy(config.adcPoints, points, count * sizeof(point));
+  if (!setConfig(config)) {
+    _console->println("Config: out of range, not changed.");
+    return;
+  }
+  _hasAdcFirstPoint = false;
+  _printAdcCalibration();
+}
+
+void BatteryProtector :: _printAdcCalibration() {
+  // "ADC: count 614.5 = 12.60V, points 536=11.000V 614=12.600V (not saved)"
+  _console->print("ADC: count ");
+  _console->print((unsigned int)(_lastRaw >> VoltageSensor::RAW_FRACTION_BITS));
+  _console->print('.');
+  _console->print((unsigned int)(((_lastRaw & ((1U << VoltageSensor::RAW_FRACTION_BITS) - 1)) * 10) >> VoltageSensor::RAW_FRACTION_BITS));
+  _console->print(" = ");
+  _printVolts(_voltageSensor.millivoltsFromRaw(_lastRaw));
+  uint8_t count = _config.adcPointCount;
+  const AdcCalibrationPoint* points = _config.adcPoints;
+  if (count == 0 && _hasAdcFirstPoint) {
+    _console->print("V, divider until a second point, taken ");
+    count = 1;
+    points = &_adcFirstPoint;
+  } else if (count == 0) {
+    _console->println("V, divider (no points)");
+    return;
+  } else {
+    _console->print("V, points ");
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    if (i > 0) {
+      _console->print(' ');
     }
+    _console->print((unsigned int)points[i].raw);
+    _console->print('=');
+    _console->print((unsigned int)(points[i].millivolts / 1000));
+    _console->print('.');
+    for (uint16_t digit = 100; digit > 0; digit /= 10) {
+      _console->print((char)('0' + points[i].millivolts / digit % 10));
+    }
+    _console->print('V');
+  }
+  _console->println(_isConfigChanged && _config.adcPointCount > 0 ? " (not saved)" : "");
+}
+
+void BatteryProtector :: _printConfig() {
+  _console->print("Config: cutoff ");
+  _printVolts(_config.cutoffMillivolts);
+  _console->print("V, rearm ");
+  _printVolts(_config.rearmMillivolts);
+  _console->print("V, delay ");
+  _console->print(_config.rearmDelayMs);
+  _console->print("ms, divider ");
+  _console->print(_config.dividerTopOhms);
+  _console->print('/');
+  _console->print(_config.dividerBottomOhms);
+  _console->print(" ohm, cal ");
+  _console->print(_config.calibrationPpm / 1000000UL);
+  _console->print('.');
+  uint32_t fraction = _config.calibrationPpm % 1000000UL;
+  for (uint32_t digit = 100000UL; digit > 0; digit /= 10) {
+    _console->print((char)('0' + fraction / digit % 10));
+  }
+  _console->print(", period ");
+  _console->print(_config.samplePeriodMs);
+  _console->print("ms");
+  if (_config.adcPointCount > 0) {
+    _console->print(", adc ");
+    _console->print((unsigned int)_config.adcPointCount);
+    _console->print(" points");
+  }
+  if (_isConfigChanged) {
+    _console->println(" (not saved)");
+  } else if (_configStore.getSequence() > 0) {
+    _console->print(" (saved #");
+    _console->print(_configStore.getSequence());
+    _console->println(")");
+  } else {
+    _console->println(" (defaults)");
+  }
+}
+
+void BatteryProtector :: _saveConfig() {
+  _isConfigSavePending = false;
+  if (!_configStore.hasArea()) {
+    _console->println("ERROR: No flash area for the configuration!");
+    return;
+  }
+  if (!_configStore.save(_config)) {
+    _console->println("ERROR: Config save failed, flash did not read back.");
+    return;
+  }
+  _isConfigChanged = false;
+  _printConfig();
+}
+
+uint32_t BatteryProtector :: _flashAreaSectors() {
+  // FS_PHYS_SIZE is 0 in a layout without a filesystem area (Tools >
+  // Flash Size): the history log, the configuration and the MQTT spool
+  // are then left off instead of getting wrapped-around sector counts
+  uint32_t sectors = FS_PHYS_SIZE / HistoryLog::SECTOR_SIZE;
+  return sectors >= FLASH_AREA_MIN_SECTORS ? sectors : 0;
+}
+
+uint32_t BatteryProtector :: _flashSectorFromEnd(uint16_t sectors) {
+  if (_flashAreaSectors() == 0) {
+    return 0;
+  }
+  return FS_PHYS_ADDR / HistoryLog::SECTOR_SIZE + _flashAreaSectors() - sectors;
+}
+
+bool BatteryProtector :: _parseFixed(const char* text, uint8_t decimals, uint32_t& value) {
+  // Digits, then optionally '.' and up to decimals more: integer math,
+  // no strtof
+  uint32_t result = 0;
+  uint8_t digits = 0;
+  int8_t fractionDigits = -1; // -1 until the '.'
+  for (; *text != '\0'; text++) {
+    if (*text == '.' && fractionDigits < 0) {
+      fractionDigits = 0;
+      continue;
+    }
+    if (*text < '0' || *text > '9' || fractionDigits >= decimals || result > 400000000UL) {
+      return false;
+    }
+    result = result * 10 + (uint32_t)(*text - '0');
+    digits++;
+    if (fractionDigits >= 0) {
+      fractionDigits++;
+    }
+  }
+  if (digits == 0) {
+    return false;
+  }
+  for (int8_t i = fractionDigits < 0 ? 0 : fractionDigits; i < decimals; i++) {
+    if (result > 400000000UL) {
+      return false;
+    }
+    result *= 10;
+  }
+  value = result;
+  return true;
+}
+
+void BatteryProtector :: _printBootReport() {
+  _isBootReported = true;
+  if (!_isSensorReady) {
+    _console->println("ERROR: Failed to initialize voltage sensor!");
   }
+  if (_bootState == STATE_ARMED) {
+    _console->print("Battery voltage: ");
+    _printVolts(_bootMillivolts);
+    _console->println("V - Above threshold, circuit armed.");
+  } else if (_wokeFromDeepSleep) {
+    _console->print("Woke from deep sleep in cutoff. Battery voltage: ");
+    _printVolts(_bootMillivolts);
+    _console->println("V");
+  } else if (_isHeldOpenByWatchdog) {
+    _console->print("Battery voltage: ");
+    _printVolts(_bootMillivolts);
+    _console->println("V - Relay kept open after the watchdog reset.");
+  } else {
+    _console->print("Battery voltage (");
+    _printVolts(_bootMillivolts);
+    _console->print("V) is below cutoff threshold (");
+    _printVolts(_cutoffMillivolts);
+    _console->println("V). Cutting off immediately.");
+  }
+  _console->print("Boot: relay decided ");
+  _console->print(_bootDecisionUs);
+  _console->print("us after start (");
+  _console->print(_bootDecisionUs - _bootStartUs);
+  _console->println("us in the protector)");
+  if (_hasWatchdogRecord) {
+    _console->print("Watchdog: reset after the loop hung in task '");
+    _console->print(_scheduler.getTaskName(_watchdogRecord.taskId));
+    _console->print("' at ");
+    _console->print((unsigned long)_watchdogRecord.tripMs);
+    _console->print("ms uptime, relay ");
+    _console->print(LoopWatchdog::safeStateName(_watchdogRecord.safeState));
+    _console->println(".");
+  } else if (_power.wasWatchdogReset()) {
+    _console->println("Watchdog: chip reset by its watchdog or an exception (no loop record).");
+  }
+  if (_isConfigLoaded) {
+    _printConfig();
+  }
+  _console->println("Battery Protector ready!");
+}
+
+void BatteryProtector :: _logEvent(HistoryEvent event) {
+  if (_historyEnabled) {
+    _history.addEvent(event);
+  }
+  if (_telemetryEnabled) {
+    _telemetry.sendEvent(SystemClock::millis(), event, _lastMillivolts);
+  }
+  if (_mqtt) {
+    _mqtt->addEvent(event); // Queued; the mqtt task sends it
+  }
+}
+
+bool BatteryProtector :: _canStall() {
+  // A sector erase stalls the loop for ~45 ms: not near the cutoff
+  // threshold and not while a rearm is being judged under load
+  return !(_state == STATE_ARMED && _isNearCutoff) && !_isVerifyingRearm;
+}
+
+void BatteryProtector :: _updateTrend() {
+  unsigned long nowMs = SystemClock::millis();
+  bool onCharge = _isChargeCutoff();
+  if (_state != STATE_ARMED || _isVerifyingRearm || onCharge != _isTrendOnCharge) {
+    // Load off, on trial, or the cutoff input changed: the old samples
+    // belong to another series
+    _trend.reset();
+    _isTrendOnCharge = onCharge;
+    _lastTrendMs = nowMs;
+    return;
+  }
+  if (nowMs - _lastTrendMs < TREND_PERIOD_MS) {
+    return;
+  }
+  // Fixed steps keep the samples evenly spaced; a long stall restarts them
+  _lastTrendMs += TREND_PERIOD_MS;
+  if (nowMs - _lastTrendMs >= TREND_PERIOD_MS) {
+    _lastTrendMs = nowMs;
+  }
+  _trend.addSample(onCharge ? _charge.getPermille() : _lastMillivolts);
 }
 
 void BatteryProtector :: _updateState() {
+  if (_isVerifyingRearm) {
+    // Relay was closed for a rearm attempt; judge it once the load settled
+    _verifyRearm();
+    return;
+  }
+  
   switch (_state) {
     case STATE_ARMED:
       // Check if voltage dropped below threshold
       if (_shouldCutoff()) {
+        _logEvent(HISTORY_EVENT_CUTOFF);
         _performCutoff();
       }
       break;
       
     case STATE_CUTOFF:
       // Check if voltage is above rearm threshold (12.8V) but we're waiting for rearm delay
-      if (_lastVoltage >= _voltageRearmThreshold && !_isWaitingForRearm) {
+      if (_canRearm() && !_isWaitingForRearm) {
         // Voltage is above rearm threshold, start countdown
         _isWaitingForRearm = true;
-        _rearmCountdownStartMs = millis();
-        Serial.print("Voltage (");
-        Serial.print(_lastVoltage, 2);
-        Serial.print("V) is above rearm threshold (");
-        Serial.print(_voltageRearmThreshold, 2);
-        Serial.println("V). Starting rearm countdown...");
-      } else if (_lastVoltage < _voltageRearmThreshold && _isWaitingForRearm) {
+        _rearmCountdownStartMs = SystemClock::millis();
+        _console->print("Voltage (");
+        _printVolts(_lastMillivolts);
+        _console->print("V) is above rearm threshold (");
+        _printVolts(_rearmMillivolts);
+        _console->println("V). Starting rearm countdown...");
+      } else if (!_canRearm() && _isWaitingForRearm) {
         // Voltage dropped below rearm threshold during countdown, stop waiting
         _isWaitingForRearm = false;
         _rearmCountdownStartMs = 0;
-        Serial.print("Voltage (");
-        Serial.print(_lastVoltage, 2);
-        Serial.print("V) dropped below rearm threshold (");
-        Serial.print(_voltageRearmThreshold, 2);
-        Serial.println("V) during countdown. Cancelling rearm.");
+        _console->print("Voltage (");
+        _printVolts(_lastMillivolts);
+        _console->print("V) dropped below rearm threshold (");
+        _printVolts(_rearmMillivolts);
+        _console->println("V) during countdown. Cancelling rearm.");
         updateDisplay();
       } else if (_isWaitingForRearm) {
         // Check if countdown is complete
@@ -203,13 +1538,13 @@ void BatteryProtector :: _updateState() {
 }
 
 void BatteryProtector :: _updateLEDs() {
-  unsigned long currentTime = millis();
+  unsigned long currentTime = SystemClock::millis();
   
   switch (_state) {
     case STATE_ARMED:
       // Green LED solid ON (voltage above threshold, relay closed)
-      _greenLED->on();
-      _redLED->off();
+      _greenLED.on();
+      _redLED.off();
       break;
       
     case STATE_CUTOFF:
@@ -217,100 +1552,285 @@ void BatteryProtector :: _updateLEDs() {
         // Flash green LED while keeping red LED on during countdown
         // Blink every 500ms
         if (currentTime - _lastLEDUpdateMs >= 500) {
-          _greenLED->toggle();
+          _greenLED.toggle();
           _lastLEDUpdateMs = currentTime;
         }
-        _redLED->on(); // Keep red LED on
+        _redLED.on(); // Keep red LED on
       } else {
         // Red LED solid ON (voltage below threshold, relay opened)
-        _greenLED->off();
-        _redLED->on();
+        _greenLED.off();
+        _redLED.on();
       }
       break;
   }
 }
 
 bool BatteryProtector :: _shouldCutoff() {
-  // Cut off if voltage drops below threshold
-  return _lastVoltage < _voltageCutoffThreshold;
+  if (_isChargeCutoff()) {
+    return _charge.getPercent() < _socCutoffPercent;
+  }
+  // A crank or inrush dip is ridden through; a rearm trial is judged as is
+  if (_transientsEnabled && _transients.isRidingThrough() && !_isVerifyingRearm) {
+    return false;
+  }
+  // Cut off if voltage drops below threshold (filtered ADC counts)
+  return _cutoffInputRaw() < _cutoffRaw;
+}
+
+bool BatteryProtector :: _isChargeCutoff() {
+  return _cutoffInput == CUTOFF_INPUT_STATE_OF_CHARGE && _currentSensor && _charge.isAnchored() &&
+    _failedCurrentReadings < MAX_FAILED_CURRENT_READINGS;
+}
+
+bool BatteryProtector :: _canRearm() {
+  if (_lastRaw < _rearmRaw) {
+    return false;
+  }
+  // A charger lifts the voltage long before the charge is back
+  return !_isChargeCutoff() || _charge.getPercent() >= _socCutoffPercent + SOC_REARM_MARGIN_PERCENT;
+}
+
+int32_t BatteryProtector :: _loadMilliamps() {
+  if (_currentSensor && _failedCurrentReadings < MAX_FAILED_CURRENT_READINGS) {
+    return _averageMilliamps > 0 ? _averageMilliamps : 0;
+  }
+  return _nominalLoadMilliamps;
+}
+
+bool BatteryProtector :: _isLoadConnected() {
+  return _state == STATE_ARMED || _isVerifyingRearm;
+}
+
+uint16_t BatteryProtector :: _cutoffInputRaw() {
+  return _isLoadConnected() ? _lastRaw + _compensationRaw : _lastRaw;
+}
+
+void BatteryProtector :: _startResistanceStep(bool closing) {
+  // Judged on a fresh reading once the relay contacts and the load settled
+  _isMeasuringStep = true;
+  _isStepSettled = false;
+  _isStepClosing = closing;
+  _stepMillivolts = _lastMillivolts;
+  _stepMilliamps = _loadMilliamps(); // Used by an opening step: the current it cut
+  _stepAtMs = SystemClock::millis() + REARM_SETTLE_MS;
+}
+
+void BatteryProtector :: _updateResistanceStep() {
+  if (!_isMeasuringStep || _isVerifyingRearm || (long)(SystemClock::millis() - _stepAtMs) < 0) {
+    return; // A rearm trial takes its step in _verifyRearm()
+  }
+  if (!_isStepSettled) {
+    _consumeSamples();
+    _voltageSensor.restartFilter();
+    _isStepSettled = true;
+    return;
+  }
+  if (!_voltageSensor.hasFilteredReading()) {
+    return;
+  }
+  _isMeasuringStep = false;
+  if (_sampler.isTripped()) {
+    return; // The reading is a collapse, not a load step
+  }
+  if (_isStepClosing) {
+    _addResistanceStep(_stepMillivolts, _lastMillivolts, _loadMilliamps());
+  } else {
+    _addResistanceStep(_lastMillivolts, _stepMillivolts, _stepMilliamps);
+  }
+}
+
+void BatteryProtector :: _addResistanceStep(uint16_t restMillivolts, uint16_t loadedMillivolts, int32_t loadMilliamps) {
+  if (!_currentSensor && _nominalLoadMilliamps == 0) {
+    return; // No current to divide by
+  }
+  uint16_t milliamps = loadMilliamps <= 0 ? 0 : (loadMilliamps > 0xFFFF ? 0xFFFF : (uint16_t)loadMilliamps);
+  if (!_resistance.addStep(restMillivolts, loadedMillivolts, milliamps)) {
+    _console->println("Internal resistance: relay step rejected.");
+    return;
+  }
+  _applyCompensation();
+  _console->print("Internal resistance: ");
+  _console->print((unsigned int)_resistance.getMilliohms());
+  _console->print("mOhm (");
+  _printVolts(_resistance.getSagMillivolts(milliamps));
+  _console->print("V sag at ");
+  _console->print((unsigned long)milliamps);
+  _console->println("mA).");
+}
+
+void BatteryProtector :: _applyConfig() {
+  _rearmDelayMs = _config.rearmDelayMs;
+  _samplePeriodMs = _config.samplePeriodMs;
+  _voltageSensor.setDivider((float)_config.dividerTopOhms, (float)_config.dividerBottomOhms, _config.calibrationPpm / 1000000.0f);
+  if (_config.adcPointCount > 0 && _adcTable.build(_config.adcPoints, _config.adcPointCount)) {
+    _voltageSensor.setCalibration(&_adcTable); // Measured points replace the divider arithmetic
+  } else {
+    _voltageSensor.setCalibration(nullptr);
+  }
+#if PROFILER_ENABLED
+  _profiler.setLoopBudget(_samplePeriodMs * 1000UL * ESP.getCpuFreqMHz()); // A longer loop delays the next sample batch
+#endif
+  
+  _applyThresholds();
+}
+
+void BatteryProtector :: _applyThresholds() {
+  // The temperature offset moves both thresholds together; the guard
+  // band and the sampler's trip level follow the cutoff
+  int32_t cutoffMillivolts = (int32_t)_config.cutoffMillivolts + _temperatureOffsetMillivolts;
+  int32_t rearmMillivolts = (int32_t)_config.rearmMillivolts + _temperatureOffsetMillivolts;
+  _cutoffMillivolts = cutoffMillivolts < 0 ? 0 : (uint16_t)cutoffMillivolts;
+  _rearmMillivolts = rearmMillivolts < 0 ? 0 : (uint16_t)rearmMillivolts;
+  _voltageCutoffThreshold = _cutoffMillivolts / 1000.0f;
+  _voltageRearmThreshold = _rearmMillivolts / 1000.0f;
+  
+  // Convert thresholds once into filtered ADC counts; every decision
+  // after this is an integer compare
+  _cutoffRaw = _voltageSensor.thresholdForVoltage(_voltageCutoffThreshold);
+  _rearmRaw = _voltageSensor.thresholdForVoltage(_voltageRearmThreshold);
+  _guardRaw = _voltageSensor.thresholdForVoltage(_voltageCutoffThreshold + LOW_POWER_GUARD_VOLTS);
+  _guardExitRaw = _voltageSensor.thresholdForVoltage(_voltageCutoffThreshold + LOW_POWER_GUARD_VOLTS + LOW_POWER_GUARD_HYSTERESIS_VOLTS);
+  _tripRaw = _voltageSensor.minimumRawForVoltage(_voltageCutoffThreshold - TRIP_MARGIN_VOLTS);
+}
+
+void BatteryProtector :: _updateTemperature(bool isValid, int16_t sixteenths) {
+  if (!isValid) {
+    if (_failedTemperatureReadings < MAX_FAILED_TEMPERATURE_READINGS) {
+      _failedTemperatureReadings++;
+      if (_failedTemperatureReadings == MAX_FAILED_TEMPERATURE_READINGS) {
+        _console->println("ERROR: Temperature sensor not answering, thresholds as configured.");
+        _hasTemperature = false;
+        if (_temperatureOffsetMillivolts != 0) {
+          _temperatureOffsetMillivolts = 0;
+          _applyThresholds();
+          _applyCompensation();
+        }
+      }
+    }
+    return;
+  }
+  if (_failedTemperatureReadings >= MAX_FAILED_TEMPERATURE_READINGS) {
+    _console->println("Temperature sensor answering again.");
+  }
+  _failedTemperatureReadings = 0;
+  _hasTemperature = true;
+  _temperatureSixteenths = sixteenths;
+  
+  // Thresholds only move when the offset has moved by a step: a reading
+  // jittering by 1/16 C converts nothing
+  int16_t clamped = sixteenths < TEMPERATURE_MIN_SIXTEENTHS ? TEMPERATURE_MIN_SIXTEENTHS : (sixteenths > TEMPERATURE_MAX_SIXTEENTHS ? TEMPERATURE_MAX_SIXTEENTHS : sixteenths);
+  int16_t offsetMillivolts = (int16_t)((int32_t)(clamped - TEMPERATURE_REFERENCE_SIXTEENTHS) * _temperatureMillivoltsPerC / 16);
+  int16_t change = offsetMillivolts - _temperatureOffsetMillivolts;
+  if (change < TEMPERATURE_STEP_MILLIVOLTS && change > -TEMPERATURE_STEP_MILLIVOLTS) {
+    return;
+  }
+  _temperatureOffsetMillivolts = offsetMillivolts;
+  _applyThresholds();
+  _applyCompensation(); // Sag compensation and the sampler's trip level are relative to the cutoff
+}
+
+void BatteryProtector :: _printCelsius(int16_t sixteenths) {
+  // Tenths of a degree, rounded half away from zero
+  int32_t tenths = (int32_t)sixteenths * 10;
+  tenths = tenths < 0 ? -((-tenths + 8) / 16) : (tenths + 8) / 16;
+  if (tenths < 0) {
+    _console->print('-');
+    tenths = -tenths;
+  }
+  _console->print((long)(tenths / 10));
+  _console->print('.');
+  _console->print((long)(tenths % 10));
+}
+
+void BatteryProtector :: _applyCompensation() {
+  // The filtered threshold compare and the sampler's trip level both
+  // move by the expected sag; the terminal thresholds stay as they are
+  uint16_t sagMillivolts = 0;
+  if (_cutoffInput == CUTOFF_INPUT_COMPENSATED && _resistance.hasEstimate()) {
+    int32_t milliamps = _loadMilliamps();
+    sagMillivolts = _resistance.getSagMillivolts(milliamps > 0xFFFF ? 0xFFFF : (uint16_t)milliamps);
+  }
+  _appliedSagMillivolts = sagMillivolts;
+  _compensationRaw = 0;
+  if (sagMillivolts > 0) {
+    // Counts the sag spans at the cutoff: with an ADC table the counts
+    // per volt depend on where on the curve the reading is
+    uint16_t sagRaw = _voltageSensor.thresholdForVoltage(_voltageCutoffThreshold - sagMillivolts / 1000.0f);
+    _compensationRaw = sagRaw < _cutoffRaw ? _cutoffRaw - sagRaw : 0;
+  }
+  if (_transientsEnabled) {
+    // Crank dips go well below the usual trip level: the sampler only
+    // catches a collapse, held for the configured time
+    const TransientConfig& config = _transients.getConfig();
+    unsigned long tripSamples = config.collapseMs / _samplePeriodMs;
+    _transients.setThreshold(_cutoffMillivolts > sagMillivolts ? _cutoffMillivolts - sagMillivolts : 0);
+    _tripRaw = _voltageSensor.minimumRawForVoltage(config.collapseMillivolts / 1000.0f);
+    _sampler.setTripLevel(_tripRaw, tripSamples < TRIP_SAMPLES ? TRIP_SAMPLES : (tripSamples > 255 ? 255 : (uint8_t)tripSamples));
+    return;
+  }
+  _tripRaw = _voltageSensor.minimumRawForVoltage(_voltageCutoffThreshold - TRIP_MARGIN_VOLTS - sagMillivolts / 1000.0f);
+  _sampler.setTripLevel(_tripRaw, TRIP_SAMPLES);
 }
 
 void BatteryProtector :: _performCutoff() {
+  PROFILE_STAGE(_profiler, STAGE_CUTOFF);
+  // A fast trip reading is a collapse, not the voltage under a steady load
+  bool isSteadyLoad = !_sampler.isTripped() && !_isMeasuringStep;
   _state = STATE_CUTOFF;
   _isWaitingForRearm = false; // Reset countdown state
+  _isVerifyingRearm = false;
   _rearmCountdownStartMs = 0;
-  _loadRelay->turnOff();
-  _greenLED->off();
-  _redLED->on();
+  _loadRelay.turnOff();
+  _greenLED.off();
+  _redLED.on();
   
   // Sound alarm buzzer for 5 seconds at 1kHz
-  _buzzer->startAlarm(1000, 5000);
+  _buzzer.startAlarm(1000, 5000);
+  
+  _isMeasuringStep = false;
+  if (isSteadyLoad) {
+    _startResistanceStep(false);
+  }
 
   // Update display immediately
   updateDisplay();
   
-  Serial.print("CUTOFF: Battery voltage (");
-  Serial.print(_lastVoltage, 2);
-  Serial.print("V) dropped below threshold (");
-  Serial.print(_voltageCutoffThreshold, 2);
-  Serial.println("V). Relay opened.");
+  _console->print("CUTOFF: Battery voltage (");
+  _printVolts(_lastMillivolts);
+  _console->print("V) dropped below threshold (");
+  _printVolts(_cutoffMillivolts);
+  _console->println("V). Relay opened.");
 }
 
 void BatteryProtector :: _attemptRearm() {
-  unsigned long currentTime = millis();
+  unsigned long currentTime = SystemClock::millis();
   
   if (_isWaitingForRearm) {
     // Check if countdown is complete
     unsigned long elapsedMs = currentTime - _rearmCountdownStartMs;
     if (elapsedMs >= _rearmDelayMs) {
-      Serial.println("Attempting to rearm circuit...");
+      _console->println("Attempting to rearm circuit...");
       
       // Verify voltage is still above rearm threshold before rearming
-      float voltage = _voltageSensor->readVoltageInVolts();
-      _lastVoltage = voltage;
-      
-      if (voltage >= _voltageRearmThreshold) {
-        // Voltage is still above rearm threshold, close relay and check cutoff threshold
-        _loadRelay->turnOn();
-        delay(100); // Brief delay to allow voltage reading
-        
-        // Read voltage again after closing relay
-        voltage = _voltageSensor->readVoltageInVolts();
-        _lastVoltage = voltage;
-        
-        if (voltage >= _voltageCutoffThreshold) {
-          // Voltage is above cutoff threshold, rearm successful
-          _state = STATE_ARMED;
-          _isWaitingForRearm = false;
-          _rearmCountdownStartMs = 0;
-          _greenLED->on();
-          _redLED->off();
-          updateDisplay(); // Update display immediately
-          Serial.print("Rearm successful: Voltage (");
-          Serial.print(voltage, 2);
-          Serial.println("V) is above cutoff threshold.");
-        } else {
-          // Voltage dropped below cutoff threshold, reopen relay and reset countdown
-          _loadRelay->turnOff();
-          _isWaitingForRearm = false;
-          _rearmCountdownStartMs = 0;
-          updateDisplay(); // Update display immediately
-          Serial.print("Rearm failed: Voltage (");
-          Serial.print(voltage, 2);
-          Serial.print("V) dropped below cutoff threshold (");
-          Serial.print(_voltageCutoffThreshold, 2);
-          Serial.println("V). Relay reopened.");
-        }
+      if (_canRearm()) {
+        // Voltage is still above rearm threshold: close relay, then check the
+        // cutoff threshold under load after a settle time (see _verifyRearm)
+        _loadRelay.turnOn();
+        _sampler.clearTrip();
+        _startResistanceStep(true); // Taken by _verifyRearm() on its under-load reading
+        _isVerifyingRearm = true;
+        _isRearmSettled = false;
+        _rearmVerifyAtMs = currentTime + REARM_SETTLE_MS;
       } else {
         // Voltage dropped below rearm threshold during countdown, cancel rearm
         _isWaitingForRearm = false;
         _rearmCountdownStartMs = 0;
         updateDisplay(); // Update display immediately
-        Serial.print("Rearm cancelled: Voltage (");
-        Serial.print(voltage, 2);
-        Serial.print("V) dropped below rearm threshold (");
-        Serial.print(_voltageRearmThreshold, 2);
-        Serial.println("V).");
+        _console->print("Rearm cancelled: Voltage (");
+        _printVolts(_lastMillivolts);
+        _console->print("V) dropped below rearm threshold (");
+        _printVolts(_rearmMillivolts);
+        _console->println("V).");
       }
       
       _lastRearmAttemptMs = currentTime;
@@ -318,38 +1838,139 @@ void BatteryProtector :: _attemptRearm() {
   }
 }
 
+void BatteryProtector :: _verifyRearm() {
+  if ((long)(SystemClock::millis() - _rearmVerifyAtMs) < 0) {
+    return;
+  }
+  if (!_isRearmSettled) {
+    // The filter lags the load step by ~160 ms and would still show the
+    // resting voltage: judge the rearm on samples taken from now on only
+    _consumeSamples();
+    _voltageSensor.restartFilter();
+    _isRearmSettled = true;
+    return;
+  }
+  if (!_voltageSensor.hasFilteredReading() && !_sampler.isTripped()) {
+    return; // First under-load reading not complete yet
+  }
+  if (_isMeasuringStep) {
+    _isMeasuringStep = false;
+    if (!_sampler.isTripped()) {
+      _addResistanceStep(_stepMillivolts, _lastMillivolts, _loadMilliamps()); // Before judging: the new estimate applies already
+    }
+  }
+  bool isBelowCutoff = _shouldCutoff() || _sampler.isTripped(); // Still under load here
+  _isVerifyingRearm = false;
+  
+  if (!isBelowCutoff) {
+    // Voltage is above cutoff threshold, rearm successful
+    _state = STATE_ARMED;
+    _isWaitingForRearm = false;
+    _rearmCountdownStartMs = 0;
+    _greenLED.on();
+    _redLED.off();
+    _logEvent(HISTORY_EVENT_REARM);
+    updateDisplay(); // Update display immediately
+    _console->print("Rearm successful: Voltage (");
+    _printVolts(_lastMillivolts);
+    _console->println("V) is above cutoff threshold.");
+  } else {
+    // Voltage dropped below cutoff threshold, reopen relay and reset countdown
+    _loadRelay.turnOff();
+    _isWaitingForRearm = false;
+    _rearmCountdownStartMs = 0;
+    _logEvent(HISTORY_EVENT_REARM_FAILED);
+    updateDisplay(); // Update display immediately
+    _console->print("Rearm failed: Voltage (");
+    _printVolts(_lastMillivolts);
+    _console->print("V) dropped below cutoff threshold (");
+    _printVolts(_cutoffMillivolts);
+    _console->println("V). Relay reopened.");
+  }
+}
+
 void BatteryProtector :: printStatus() {
   State state = getState();
-  float voltage = getBatteryVoltage();
   
-  Serial.print("State: ");
+  _console->print("State: ");
   switch (state) {
     case STATE_ARMED:
-      Serial.print("ARMED");
+      _console->print("ARMED");
       break;
     case STATE_CUTOFF:
-      Serial.print("CUTOFF");
+      _console->print("CUTOFF");
       break;
   }
-  Serial.print(" | Voltage: ");
-  Serial.print(voltage, 2);
-  Serial.print("V | Threshold: ");
-  Serial.print(_voltageCutoffThreshold, 2);
-  Serial.println("V");
+  _console->print(" | Voltage: ");
+  _printVolts(_lastMillivolts);
+  _console->print("V | Noise: ");
+  _console->print((unsigned int)_lastNoiseMillivolts);
+  _console->print("mV");
+  if (_resistance.hasEstimate()) {
+    _console->print(" | IR: ");
+    _console->print((unsigned int)_resistance.getMilliohms());
+    _console->print("mOhm");
+  }
+  if (_transientsEnabled) {
+    _console->print(" | Dips ridden: ");
+    _console->print((unsigned int)_transients.getTransientCount());
+  }
+  if (_currentSensor) {
+    _console->print(" | Current: ");
+    _console->print((long)_averageMilliamps);
+    _console->print("mA | SoC: ");
+    _console->print((unsigned int)_charge.getPercent());
+    _console->print("%");
+  }
+  if (_cutoffInput == CUTOFF_INPUT_COMPENSATED) {
+    _console->print(" | Compensated: ");
+    _printVolts(getCompensatedMillivolts());
+    _console->print("V");
+  }
+  if (_temperatureSensor) {
+    _console->print(" | Temp: ");
+    if (_hasTemperature) {
+      _printCelsius(_temperatureSixteenths);
+      _console->print("C");
+    } else {
+      _console->print("--");
+    }
+  }
+  _console->print(" | Threshold: ");
+  _printVolts(_cutoffMillivolts);
+  _console->print("V");
+  uint32_t secondsToCutoff = getSecondsToCutoff();
+  if (secondsToCutoff != TrendEstimator::NO_ESTIMATE) {
+    char duration[7];
+    formatDuration(secondsToCutoff, duration);
+    _console->print(" | Cutoff in: ~");
+    _console->print(duration);
+  }
+  if (_display && _display->isBusFault()) {
+    _console->print(" | LCD: bus fault");
+  }
+  if (_mqtt) {
+    _console->print(" | MQTT: ");
+    _console->print(_mqtt->isConnected() ? "up, " : "down, ");
+    _console->print((unsigned long)(_mqtt->getQueuedBatches() + _mqtt->getSpooledBatches()));
+    _console->print(" queued");
+  }
+  _console->println();
 }
 
 void BatteryProtector :: updateDisplay() {
-  if (!_display) {
+  if (!_display || !_displayReady) {
     return;
   }
   
-  float voltage = getBatteryVoltage();
   State state = getState();
+  char volts[8];
+  formatMillivolts(_lastMillivolts, volts);
   
   // Top row: Battery voltage
   _display->setCursor(0, 0);
   _display->print("Baterija: ");
-  _display->print(voltage, 2);
+  _display->print(volts);
   _display->print("V");
   // Clear rest of line
   _display->print("      ");
@@ -358,7 +1979,7 @@ void BatteryProtector :: updateDisplay() {
   _display->setCursor(0, 1);
   if (_isWaitingForRearm && state == STATE_CUTOFF) {
     // Show countdown
-    unsigned long currentTime = millis();
+    unsigned long currentTime = SystemClock::millis();
     unsigned long elapsedMs = currentTime - _rearmCountdownStartMs;
     unsigned long remainingMs = _rearmDelayMs - elapsedMs;
     
@@ -380,6 +2001,14 @@ void BatteryProtector :: updateDisplay() {
     _display->print("s");
     // Clear rest of line
     _display->print("   ");
+  } else if (getSecondsToCutoff() != TrendEstimator::NO_ESTIMATE) {
+    // Show the predicted time to cutoff while the battery runs down
+    char duration[7];
+    formatDuration(getSecondsToCutoff(), duration);
+    _display->print("Gasim za: ~");
+    _display->print(duration);
+    // Clear rest of line
+    _display->print("     ");
   } else {
     // Show relay state
     _display->print("Potrosac: ");
@@ -391,10 +2020,13 @@ void BatteryProtector :: updateDisplay() {
     // Clear rest of line
     _display->print("   ");
   }
+  
+  // Send only the cells that changed since the last refresh
+  _display->flush();
 }
 
 void BatteryProtector :: _updateBuzzer() {
   // Update buzzer state (handles auto-stop after duration)
-  _buzzer->update();
+  _buzzer.update();
 }
 //////////////////////////////////////////////////////////
@@ -3,6 +3,19 @@
 
 #include "Arduino.h"
 #include "basicHardware.h"
+#include "adcSampler.h"
+#include "configStore.h"
+#include "historyLog.h"
+#include "loopWatchdog.h"
+#include "mqttPublisher.h"
+#include "powerManager.h"
+#include "profiler.h"
+#include "resistanceEstimator.h"
+#include "scheduler.h"
+#include "stateOfCharge.h"
+#include "telemetry.h"
+#include "transientClassifier.h"
+#include "trendEstimator.h"
 
 //////////////////////////////////////////////////////////
 // BATTERY PROTECTOR
@@ -16,9 +29,50 @@ class BatteryProtector {
       Display* display = nullptr  // Optional LCD display for status output
     );
     
-    void update(); // Call in loop()
+    void update(); // Call in loop(); runs due tasks without blocking
+    unsigned long getIdleMs(); // Time until the next task is due (safe to sleep this long)
+    void idle(); // Call after update(); sleeps until the next task (delay, light sleep or deep sleep)
+    void setLowPowerMode(bool enabled); // Light sleep between 100 ms sample bursts, full rate near the cutoff threshold
+    void setDeepSleepInCutoff(bool enabled); // Deep sleep while cut off (needs D0-RST and a relay pull-up)
+    void setHistoryLog(bool enabled); // Log voltage once per second and state changes to flash
+    bool startHistoryExport(Print& out); // Stream the history log to out from the history task
+    bool isHistoryExporting();
+    void setTelemetry(bool enabled); // Binary sample and event records on Serial; text is queued too, never blocking
+    void setMqttPublisher(MqttPublisher* publisher, const MqttConfig& config); // Batched readings and events over WiFi (keeps the modem on)
+    
+    // Voltage the cutoff decision compares against the threshold
+    enum CutoffInput {
+      CUTOFF_INPUT_TERMINAL,    // Measured battery voltage
+      CUTOFF_INPUT_COMPENSATED, // Plus the I x R sag under load: stays put through short heavy draws
+      CUTOFF_INPUT_STATE_OF_CHARGE // Coulomb-counted charge below setStateOfChargeCutoff(); needs a current sensor
+    };
+    void setNominalLoadCurrent(float amps); // Typical load current; enables the internal resistance estimate
+    void setCutoffInput(CutoffInput input); // Compensation starts once a relay step gave an estimate
+    void setCurrentSensor(CurrentSensor* sensor, float capacityAmpHours); // Measured current replaces the nominal one
+    void setStateOfChargeCutoff(uint8_t percent); // CUTOFF_INPUT_STATE_OF_CHARGE threshold
+    void setTransientRideThrough(const TransientConfig& config); // Crank and inrush dips do not cut off (see TransientClassifier)
+    void setLoopWatchdog(const WatchdogConfig& config); // A loop pass hung this long drives the relay to the safe state (see LoopWatchdog)
+    void setTemperatureSensor(TemperatureSensor* sensor, uint8_t millivoltsPerCelsius); // Thresholds this much lower per C below 25 C, higher above
+    bool hasTemperature() { return _hasTemperature; } // A recent reading is in use
+    int16_t getTemperatureSixteenths() { return _temperatureSixteenths; } // Last good reading, 1/16 C
+    int16_t getTemperatureOffsetMillivolts() { return _temperatureOffsetMillivolts; } // Applied to the configured thresholds
+    // Runtime configuration: the constructor arguments, the divider and
+    // the sample period are the compiled defaults; a valid block saved on
+    // flash replaces them at boot, before the relay is decided
+    ProtectorConfig getConfig() { return _config; }
+    ProtectorConfig getDefaultConfig() { return _defaultConfig; }
+    bool isConfigLoaded() { return _isConfigLoaded; } // Booted on the block from flash
+    bool setConfig(const ProtectorConfig& config); // Applied at once; false (nothing changed) when not ConfigStore::isValid()
+    void saveConfig(); // Written from the state task once a ~45 ms flash stall is harmless
+    bool isConfigSavePending() { return _isConfigSavePending; }
+    void printSchedulerStats(Print& out); // Per-task run counts, jitter and run time
+    void printPowerStats(Print& out); // Time per power state and modelled current draw
+    void printLoopStats(Print& out); // Loop period, jitter, deadline misses and watchdog trips
+    void printProfile(Print& out); // Cycle-counted run time per update() stage (PROFILER_ENABLED builds)
+    void resetProfile();
+    void printMemoryReport(Print& out); // Static RAM per component and free heap
     void rearm();  // Manually rearm the circuit (close relay and resume monitoring)
-    void printStatus(); // Print current status to Serial
+    void printStatus(); // Print current status to Serial (through the telemetry queue when enabled)
     void updateDisplay(); // Update LCD display with current status
     
     enum State {
@@ -28,46 +82,307 @@ class BatteryProtector {
     
     State getState();
     float getBatteryVoltage();
+    uint16_t getBatteryMillivolts();
+    uint16_t getVoltageNoiseMillivolts();
+    uint16_t getInternalResistanceMilliohms(); // 0 until a relay step was measured
+    uint16_t getCompensatedMillivolts(); // Open-circuit estimate; the measured voltage while the load is off
+    int32_t getCurrentMilliamps(); // Averaged; 0 without a current sensor
+    uint8_t getStateOfChargePercent(); // 0 without a current sensor
+    uint16_t getTransientCount(); // Dips ridden through since boot
+    uint32_t getSecondsToCutoff(); // From the trend of the cutoff input; TrendEstimator::NO_ESTIMATE when not falling or cut off
+    unsigned long getBootDecisionUs() { return _bootDecisionUs; } // micros() when the boot relay decision was driven
     float getVoltageCutoffThreshold();
     
   private:
-    VoltageSensor* _voltageSensor;
-    Relay* _loadRelay;
-    LED* _greenLED;
-    LED* _redLED;
-    Switch* _testButton;
-    Buzzer* _buzzer;
-    Display* _display;
-    
     // Pin definitions
     static const uint8_t PIN_VOLTAGE_SENSOR = A0;  // A0 analog pin for voltage divider
     static const uint8_t PIN_RELAY_CONTROL = 12;    // D6/GPIO12
     static const uint8_t PIN_GREEN_LED = 2;         // D4/GPIO2
-    static const uint8_t PIN_RED_LED = 14;         // D5/GPIO14
+    static const uint8_t PIN_RED_LED = 15;         // D8/GPIO15 (boot strap pulled low: the LED to GND keeps it so)
     static const uint8_t PIN_TEST_BUTTON = 0;      // D3/GPIO0
     static const uint8_t PIN_BUZZER = 13;          // D7/GPIO13
     
+    // Every component is a member: the protector needs no heap, and its
+    // size is known at build time (see printMemoryReport()). Pins come
+    // first, they are handed to the components by address. Digital pins
+    // are FastPins: relay and LED writes are single register stores.
+    typedef FastPin<PIN_RELAY_CONTROL> RelayPin;
+    typedef FastPin<PIN_GREEN_LED> GreenLEDPin;
+    typedef FastPin<PIN_RED_LED> RedLEDPin;
+    typedef FastPin<PIN_TEST_BUTTON> TestButtonPin;
+    typedef FastPin<PIN_BUZZER> BuzzerPin;
+    PinNative _voltagePin;
+    RelayPin _relayPin;
+    GreenLEDPin _greenLEDPin;
+    RedLEDPin _redLEDPin;
+    TestButtonPin _testButtonPin;
+    BuzzerPin _buzzerPin;
+    PowerManager _power;
+    VoltageSensor _voltageSensor;
+    AdcCalibrationTable _adcTable; // Built from _config.adcPoints; the sensor uses it while there are points
+    AdcSampler _sampler;
+    Scheduler _scheduler;
+    RelayT<RelayPin> _loadRelay;
+    LEDT<GreenLEDPin> _greenLED;
+    LEDT<RedLEDPin> _redLED;
+    SwitchT<TestButtonPin> _testButton;
+    BuzzerT<BuzzerPin> _buzzer;
+    HistoryLog _history;
+    ConfigStore _configStore;
+    Telemetry _telemetry;
+    ResistanceEstimator _resistance;
+    CoulombCounter _charge;
+    TrendEstimator _trend;
+    TransientClassifier _transients;
+    LoopWatchdog _watchdog;
+    CurrentSensor* _currentSensor; // Owned by the sketch; nullptr without one
+    TemperatureSensor* _temperatureSensor; // Owned by the sketch; nullptr without one
+    Display* _display; // Owned by the sketch
+    MqttPublisher* _mqtt; // Owned by the sketch; nullptr without MQTT
+    bool _historyEnabled;
+    bool _telemetryEnabled;
+    Print* _historyOut; // Export target while exporting
+    Print* _console; // Text output: Serial, or the telemetry queue
+#if PROFILER_ENABLED
+    StageProfiler _profiler; // Loop budget: one sample period
+#endif
+    
+    // Sampling configuration
+    static const unsigned long SAMPLE_PERIOD_MS = 5; // Default ADC sample period of the timer-driven sampler
+    static const uint8_t TRIP_SAMPLES = 3;           // Consecutive low samples that open the relay from the sampler
+    static constexpr float TRIP_MARGIN_VOLTS = 0.3f; // Sampler trips this far below the cutoff threshold (noise guard band)
+    
+    // Task periods (cooperative scheduler)
+    static const unsigned long STATE_PERIOD_MS = 10;    // Button and state machine
+    static const unsigned long BUZZER_PERIOD_MS = 20;
+    static const unsigned long LED_PERIOD_MS = 50;
+    static const unsigned long DISPLAY_PERIOD_MS = 50;  // Bring-up steps; content refreshes every _updateIntervalMs
+    static const unsigned long BUTTON_DEBOUNCE_MS = 50;
+    static const unsigned long BUTTON_LONG_PRESS_MS = 1500; // Long press: test cutoff / force rearm
+    static const unsigned long REARM_SETTLE_MS = 100;   // Load settle time before checking a rearm
+    static const unsigned long HISTORY_PERIOD_MS = 1000;      // One history sample per second
+    static const unsigned long HISTORY_EXPORT_PERIOD_MS = 10; // One export chunk per run while exporting
+    static const unsigned long TELEMETRY_PERIOD_MS = 10;        // UART pump: ~115 bytes at 115200 baud fit the 128-byte FIFO
+    static const unsigned long TELEMETRY_SAMPLE_PERIOD_MS = 100; // One sample record per 100 ms
+    static const unsigned long CURRENT_PERIOD_MS = 10;          // Current sensor read and charge integration
+    static const unsigned long TREND_PERIOD_MS = 10000;         // One trend sample per 10 s: the window spans ~10 min
+    static const unsigned long MQTT_PERIOD_MS = 100;            // Client state machine and one publish per run
+    static const unsigned long TEMPERATURE_PERIOD_MS = 250;     // Looks for a finished conversion; bus traffic only then
+    static const unsigned long TEMPERATURE_INTERVAL_MS = 10000; // One conversion per 10 s: a battery warms and cools over hours
+    static const uint8_t TASKS_MAX = 10;                        // Five always, plus history, telemetry, mqtt, current and temperature
+    static_assert(TASKS_MAX <= Scheduler::MAX_TASKS, "Every protector task needs a scheduler slot");
+    static const uint16_t MQTT_SPOOL_SECTORS = 16;              // Last 64 KB of the filesystem area; the history log gets the rest
+    static const uint16_t CONFIG_SECTORS = ConfigStore::SECTOR_COUNT; // Right before the MQTT spool
+    static const uint16_t FLASH_AREA_MIN_SECTORS = MQTT_SPOOL_SECTORS + CONFIG_SECTORS + HistoryLog::MIN_SECTORS;
+    
+    // Voltage divider defaults: R1=100kΩ, R2=430kΩ (100k+330k in series);
+    // calibration factor 1.20 compensates for the WeMos D1 Mini internal divider (220k/100k)
+    static const uint32_t DIVIDER_TOP_OHMS = 100000;
+    static const uint32_t DIVIDER_BOTTOM_OHMS = 430000;
+    static const uint32_t CALIBRATION_PPM = 1200000;
+    
+    // Power saving
+    static const unsigned long LOW_POWER_PERIOD_MS = 100;        // Shortest task period in low power mode
+    static constexpr float LOW_POWER_GUARD_VOLTS = 0.5f;         // Full-rate sampling this close to the cutoff threshold
+    static constexpr float LOW_POWER_GUARD_HYSTERESIS_VOLTS = 0.2f; // Back to low power this far above the guard band
+    static const unsigned long DEEP_SLEEP_INTERVAL_MS = 30000;   // Voltage check interval while cut off
+    static const unsigned long DEEP_SLEEP_MIN_MS = 2000;         // Shorter waits stay awake
+    static const unsigned long DEEP_SLEEP_MIN_AWAKE_MS = 1000;   // Let the filter settle after waking up
+    static const uint8_t RTC_STATE_OFFSET = PowerManager::RTC_FIRST_FREE_WORD; // RTC user memory word offset of RtcState
+    static const uint8_t RTC_WATCHDOG_OFFSET = RTC_STATE_OFFSET + 32; // WatchdogRecord, past the largest saveRtc() block
+    
+    // State kept in RTC memory across deep sleep
+    struct RtcState {
+      uint8_t state;
+      uint8_t isWaitingForRearm;
+      uint8_t isChargeKnown;
+      uint8_t reserved;
+      int32_t chargeMas; // Coulomb counter, when isChargeKnown
+      uint32_t rearmElapsedMs; // Countdown progress at wake-up
+      uint32_t historyElapsedMs; // Time since the last history sample at wake-up
+      uint32_t energyMs[EnergyModel::POWER_STATE_COUNT];
+    };
+    
+    // Voltage filter configuration (see VoltageFilterConfig)
+    static const uint8_t FILTER_OVERSAMPLE = 4;      // 4 x 5 ms samples per decimated sample (50 Hz)
+    static const uint8_t FILTER_MEDIAN_WINDOW = 5;   // Rejects spikes up to 2 decimated samples long
+    static const uint8_t FILTER_EMA_SHIFT = 3;       // EMA weight 1/8 (~160 ms time constant)
+    
     float _voltageCutoffThreshold;
     float _voltageRearmThreshold; // Voltage threshold in Volts (rearm when battery voltage rises above this)
+    uint16_t _cutoffRaw; // Cutoff threshold in filtered ADC counts (VoltageSensor::RAW_FRACTION_BITS)
+    uint16_t _rearmRaw;  // Rearm threshold in filtered ADC counts
+    uint16_t _guardRaw;     // Low power is suspended below this (filtered counts or burst mean)
+    uint16_t _guardExitRaw; // and resumes above this
+    uint16_t _tripRaw;      // Sampler trip level: TRIP_MARGIN_VOLTS below the cutoff, lowered by the compensation
+    uint16_t _cutoffMillivolts; // Thresholds in millivolts for logging
+    uint16_t _rearmMillivolts;
     unsigned long _rearmDelayMs; // Rearm delay in milliseconds
+    unsigned long _samplePeriodMs;
+    
+    // Runtime configuration (see ConfigStore)
+    ProtectorConfig _defaultConfig; // From the constructor arguments and the constants above
+    ProtectorConfig _config;        // In use
+    bool _isConfigLoaded;
+    bool _isConfigChanged;          // Since boot or the last save
+    bool _isConfigSavePending;
+    char _commandLine[24];          // Serial 'c' or 'a' command being received; empty when _commandLength is 0
+    uint8_t _commandLength;
+    AdcCalibrationPoint _adcFirstPoint; // Captured with no calibration in use, waiting for a second one
+    bool _hasAdcFirstPoint;
     
     State _state;
-    float _lastVoltage;
+    uint16_t _lastRaw; // Filtered ADC counts, compared against _cutoffRaw / _rearmRaw
+    uint16_t _lastMillivolts;
+    uint16_t _lastNoiseMillivolts; // Noise estimate of the filtered voltage
     unsigned long _lastRearmAttemptMs;
     unsigned long _rearmCountdownStartMs; // When the rearm countdown started
     bool _isWaitingForRearm; // True when voltage is above rearm threshold but waiting for rearm delay
-    const unsigned long _updateIntervalMs = 1000; // Update interval: 1 second (1000 ms)
+    bool _isVerifyingRearm; // True while the relay is closed on trial after the countdown
+    bool _isRearmSettled; // Settle time over, filter restarted on under-load samples
+    unsigned long _rearmVerifyAtMs;
+    bool _displayReady;
+    uint8_t _displayInitStep; // Non-blocking display bring-up sequence
+    unsigned long _displayStepAtMs;
+    const unsigned long _updateIntervalMs = 1000; // Display refresh interval: 1 second (1000 ms)
     unsigned long _lastUpdateTimeMs;
     unsigned long _lastLEDUpdateMs; // For LED blinking during countdown
-    unsigned long _lastDisplayUpdateMs; // For display updates during countdown
+    bool _lowPowerMode; // Requested by setLowPowerMode()
+    bool _isNearCutoff; // Low power suspended: full-rate sampling near the cutoff threshold
+    bool _deepSleepInCutoff;
+    bool _wokeFromDeepSleep;
+    bool _isSensorReady;
+    unsigned long _bootStartUs;    // micros() when the constructor started
+    unsigned long _bootDecisionUs; // and when the relay was driven
+    State _bootState;
+    bool _isBootReported;
+    unsigned long _bootMs;
+    unsigned long _lastHistoryMs; // Log time of the last history sample (whole seconds are logged)
+    unsigned long _lastTelemetrySampleMs;
+    unsigned long _lastMqttSampleMs; // Whole seconds are published, like the history log
+    
+    // Load compensation (see ResistanceEstimator)
+    CutoffInput _cutoffInput;
+    uint16_t _nominalLoadMilliamps; // 0: no estimate
+    uint16_t _compensationRaw;      // I x R in filtered ADC counts, added while the load is connected
+    uint16_t _appliedSagMillivolts; // Sag behind _compensationRaw; follows the measured current
+    bool _isMeasuringStep;          // Relay switched, waiting for the settled reading on the other side
+    bool _isStepSettled;
+    bool _isStepClosing;            // Load connected by the step (else disconnected)
+    uint16_t _stepMillivolts;       // Reading before the step
+    int32_t _stepMilliamps;         // Load current before an opening step
+    unsigned long _stepAtMs;
+    
+    // Current sensor and state of charge
+    static const int32_t SAG_UPDATE_MILLIVOLTS = 50;     // Compensation follows the current in steps of this
+    static const uint8_t MAX_FAILED_CURRENT_READINGS = 3; // Then the cutoff falls back to the voltage
+    static const uint8_t SOC_REARM_MARGIN_PERCENT = 5;    // Rearm needs this much more than the cutoff
+    static const uint8_t CURRENT_AVERAGE_SHIFT = 3;       // EMA weight 1/8 (~80 ms)
+    uint8_t _socCutoffPercent;
+    int32_t _averageMilliamps;
+    uint8_t _failedCurrentReadings;
+    unsigned long _lastCurrentMs;
+    uint16_t _bootMillivolts; // Relay still open: the first state-of-charge anchor
+    bool _isChargeRestored;   // Charge came back from RTC memory after a deep sleep
+    int32_t _restoredChargeMas;
+    
+    // Temperature compensation: a straight line through the configured
+    // thresholds at 25 C, flat outside -20..50 C
+    static const int16_t TEMPERATURE_REFERENCE_SIXTEENTHS = 25 * 16;
+    static const int16_t TEMPERATURE_MIN_SIXTEENTHS = -20 * 16;
+    static const int16_t TEMPERATURE_MAX_SIXTEENTHS = 50 * 16;
+    static const int16_t TEMPERATURE_STEP_MILLIVOLTS = 9; // Thresholds are redone once the offset moved this far (0.5 C)
+    static const uint8_t MAX_FAILED_TEMPERATURE_READINGS = 3; // Then the thresholds go back to the configured ones
+    uint8_t _temperatureMillivoltsPerC;
+    int16_t _temperatureSixteenths;
+    bool _hasTemperature;
+    uint8_t _failedTemperatureReadings;
+    int16_t _temperatureOffsetMillivolts;
+    unsigned long _lastTemperatureStartMs;
+    
+    // Time to cutoff (see TrendEstimator)
+    unsigned long _lastTrendMs;
+    bool _isTrendOnCharge; // Samples are state of charge permille, else millivolts
+    
+    // Loop watchdog (see LoopWatchdog)
+    WatchdogRecord _watchdogRecord; // Left by the hang that reset the chip, when _hasWatchdogRecord
+    bool _hasWatchdogRecord;
+    bool _isHeldOpenByWatchdog; // Booted with the relay open because of the record
+    bool _isDisplayBusFault; // Reported on the console
+    
+    // Crank and inrush ride-through (see TransientClassifier)
+    bool _transientsEnabled;
+    uint16_t _reportedTransients; // Dips already logged
+    unsigned long _lastSampleMs; // Time given to the newest sample the classifier saw
+    int8_t _sampleTaskId;
+    int8_t _stateTaskId;
+    int8_t _buzzerTaskId;
+    int8_t _ledTaskId;
+    int8_t _displayTaskId;
+    int8_t _historyTaskId; // -1 until the history log is enabled
+    int8_t _telemetryTaskId; // -1 until telemetry is enabled
+    int8_t _currentTaskId; // -1 without a current sensor
+    int8_t _mqttTaskId; // -1 without MQTT
+    int8_t _temperatureTaskId; // -1 without a temperature sensor
     
+    void _consumeSamples(); // Drain the sampler queue, classify dips and pick up fast trips
+    void _reportTransient();
+    static void _onSamplerTrip(void* arg); // Called from the sampler timer callback
+    static int8_t _onWatchdogTrip(void* arg, uint8_t safeState); // Called from the watchdog interrupt
+    void _recoverFromWatchdog(); // The hung pass returned: bring the state machine in line
+    static uint32_t _flashAreaSectors(); // Filesystem area in sectors; 0 when there is none big enough
+    static uint32_t _flashSectorFromEnd(uint16_t sectors); // First of the last sectors of the area; 0 without one
+    static void _taskSample(void* arg);
+    static void _taskState(void* arg);
+    static void _taskLEDs(void* arg);
+    static void _taskBuzzer(void* arg);
+    static void _taskDisplay(void* arg);
+    static void _taskHistory(void* arg);
+    static void _taskTelemetry(void* arg);
+    static void _taskCurrent(void* arg);
+    static void _taskMqtt(void* arg);
+    static void _taskTemperature(void* arg);
+    void _storeReading(const VoltageReading& reading);
+    void _printVolts(uint16_t millivolts); // "12.34" on the console, integer math
     void _handleTestButton();
+    void _handleSerialCommand(); // 'h': export the history log, 'm': memory report, 'p': profile, 'w': loop stats, 'c ...' line: configuration, 'a ...' line: ADC calibration
+    void _handleConfigCommand(char* arguments);
+    void _handleAdcCommand(char* arguments);
+    void _printConfig();
+    void _printAdcCalibration();
+    void _saveConfig();
+    void _applyConfig(); // Thresholds, divider, ADC table, rearm delay and sample period from _config
+    void _applyThresholds(); // Configured thresholds plus the temperature offset, into ADC counts
+    void _updateTemperature(bool isValid, int16_t sixteenths); // A reading, or a failed one
+    void _printCelsius(int16_t sixteenths); // "-5.3" on the console, integer math
+    static bool _parseFixed(const char* text, uint8_t decimals, uint32_t& value); // "11.2" with 3 decimals: 11200
+    void _printBootReport(); // Boot decision and its timing, once the console is up
+    void _logEvent(HistoryEvent event); // History log, telemetry and MQTT
+    bool _canStall(); // A ~45 ms flash erase is harmless right now
     void _updateState();
     void _updateLEDs();
+    void _updateTrend(); // One trend sample per TREND_PERIOD_MS while armed
     bool _shouldCutoff();
+    bool _isLoadConnected();
+    uint16_t _cutoffInputRaw(); // _lastRaw, compensated when selected and the load is connected
+    void _startResistanceStep(bool closing);
+    void _updateResistanceStep();
+    void _addResistanceStep(uint16_t restMillivolts, uint16_t loadedMillivolts, int32_t loadMilliamps);
+    void _applyCompensation();
+    int32_t _loadMilliamps(); // Measured, or the nominal current without a sensor
+    bool _isChargeCutoff(); // State of charge decides (sensor answering, charge known)
+    bool _canRearm(); // Voltage above the rearm threshold (and charge above the cutoff margin)
     void _performCutoff();
     void _attemptRearm();
+    void _verifyRearm();
     void _updateBuzzer(); // Update buzzer state (handles auto-stop)
+    void _updatePowerMode(bool burstNearCutoff); // Suspend low power near the cutoff threshold and during a rearm trial
+    void _applyPowerMode();
+    void _applyTaskPeriods();
+    unsigned long _taskPeriod(unsigned long periodMs); // Stretched to LOW_POWER_PERIOD_MS in low power mode
+    int8_t _addTask(const char* name, Scheduler::TaskFunction function, unsigned long periodMs, uint8_t priority); // -1 (reported) when no slot is left
+    bool _canDeepSleep(unsigned long& sleepMs);
+    void _enterDeepSleep(unsigned long sleepMs);
 };
 //////////////////////////////////////////////////////////
 
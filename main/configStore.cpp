@@ -0,0 +1,107 @@
+#include "Arduino.h"
+#include "configStore.h"
+#include "historyLog.h"
+
+//////////////////////////////////////////////////////////
+// CONFIG STORE
+//////////////////////////////////////////////////////////
+ConfigStore :: ConfigStore(uint32_t firstSector) {
+  _firstSector = firstSector;
+  _sequence = 0;
+  _current = SECTOR_COUNT - 1; // The first save goes to sector 0
+}
+
+bool ConfigStore :: load(ProtectorConfig& config) {
+  if (!hasArea()) {
+    return false;
+  }
+  bool found = false;
+  ProtectorConfig best;
+  for (uint8_t i = 0; i < SECTOR_COUNT; i++) {
+    ConfigBlockHeader header;
+    ProtectorConfig stored = config; // Defaults for fields an older block does not have
+    if (_readBlock(i, header, stored) && (!found || header.sequence > _sequence)) {
+      found = true;
+      best = stored;
+      _sequence = header.sequence;
+      _current = i;
+    }
+  }
+  if (!found || !isValid(best)) {
+    return false;
+  }
+  config = best;
+  return true;
+}
+
+bool ConfigStore :: save(const ProtectorConfig& config) {
+  static_assert(sizeof(ConfigBlockHeader) == 16, "Block header is four flash words");
+  if (!hasArea()) {
+    return false;
+  }
+  uint8_t next = (_current + 1) % SECTOR_COUNT;
+  ConfigBlockHeader header;
+  header.magic = MAGIC;
+  header.version = VERSION;
+  header.length = sizeof(ProtectorConfig);
+  header.sequence = _sequence + 1;
+  header.reserved = 0;
+  header.crc = _crc(header, config);
+
+  // One program operation: header and config
+  uint32_t words[(sizeof(ConfigBlockHeader) + sizeof(ProtectorConfig)) / 4];
+  memcpy(words, &header, sizeof(header));
+  memcpy(reinterpret_cast<uint8_t*>(words) + sizeof(header), &config, sizeof(config));
+  ESP.flashEraseSector(_firstSector + next);
+  ESP.flashWrite(_address(next), words, sizeof(words));
+
+  ConfigBlockHeader written;
+  ProtectorConfig readBack = config;
+  if (!_readBlock(next, written, readBack) || written.sequence != header.sequence) {
+    return false;
+  }
+  _sequence = header.sequence;
+  _current = next;
+  return true;
+}
+
+bool ConfigStore :: isValid(const ProtectorConfig& config) {
+  // Rearm above the cutoff, a divider that puts a 12 V battery in the
+  // ADC range, a calibration near 1, a sample period the filter and the
+  // sampler's trip timing were sized for, and ADC points that rise
+  return config.cutoffMillivolts >= 1000 && config.rearmMillivolts > config.cutoffMillivolts
+    && config.rearmDelayMs <= 86400000UL
+    && config.dividerTopOhms > 0 && config.dividerBottomOhms > 0
+    && config.calibrationPpm >= 500000UL && config.calibrationPpm <= 2000000UL
+    && config.samplePeriodMs >= 1 && config.samplePeriodMs <= 50
+    && (config.adcPointCount == 0 || AdcCalibrationTable::isValid(config.adcPoints, config.adcPointCount));
+}
+
+bool ConfigStore :: _readBlock(uint8_t index, ConfigBlockHeader& header, ProtectorConfig& config) {
+  uint32_t words[sizeof(ConfigBlockHeader) / 4];
+  if (!ESP.flashRead(_address(index), words, sizeof(words))) {
+    return false;
+  }
+  memcpy(&header, words, sizeof(header));
+  if (header.magic != MAGIC || header.version != VERSION || header.length == 0
+    || header.length > sizeof(ProtectorConfig) || header.length % 4 != 0) {
+    return false;
+  }
+  // Straight into the struct: no parsing, the layout is the format
+  ProtectorConfig stored = config;
+  if (!ESP.flashRead(_address(index) + sizeof(header), reinterpret_cast<uint32_t*>(&stored), header.length)) {
+    return false;
+  }
+  if (_crc(header, stored) != header.crc) {
+    return false;
+  }
+  config = stored;
+  return true;
+}
+
+uint16_t ConfigStore :: _crc(const ConfigBlockHeader& header, const ProtectorConfig& config) {
+  // Header up to the CRC field, then the block's length of config bytes
+  uint16_t crc = HistoryLog::crc16(reinterpret_cast<const uint8_t*>(&header), offsetof(ConfigBlockHeader, crc));
+  return HistoryLog::crc16(reinterpret_cast<const uint8_t*>(&config), header.length, crc);
+}
+//////////////////////////////////////////////////////////
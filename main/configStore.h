@@ -0,0 +1,82 @@
+#ifndef configStore_h
+#define configStore_h
+
+#include "Arduino.h"
+#include "basicHardware.h"
+
+//////////////////////////////////////////////////////////
+// PROTECTOR CONFIGURATION (binary layout, stored as is)
+//////////////////////////////////////////////////////////
+// Integers only, no padding: the block on flash is this struct byte for
+// byte, read straight into place at boot. New fields go at the end (an
+// older, shorter block keeps the defaults for them); anything else that
+// changes the layout bumps ConfigStore::VERSION.
+struct ProtectorConfig {
+  uint16_t cutoffMillivolts;
+  uint16_t rearmMillivolts;
+  uint32_t rearmDelayMs;
+  uint32_t dividerTopOhms;    // VoltageSensor rTopOhms
+  uint32_t dividerBottomOhms; // VoltageSensor rBottomOhms
+  uint32_t calibrationPpm;    // VoltageSensor calibration factor x 1000000
+  uint16_t samplePeriodMs;    // ADC sampler period
+  uint16_t reserved;          // 0
+  uint8_t adcPointCount;      // 0: divider and calibration factor; else AdcCalibrationTable points
+  uint8_t adcReserved[3];     // 0
+  AdcCalibrationPoint adcPoints[AdcCalibrationTable::POINTS_MAX]; // Rising; unused ones 0
+};
+static_assert(sizeof(ProtectorConfig) == 60, "ProtectorConfig is fifteen flash words, no padding");
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// CONFIG STORE (two raw flash sectors)
+//////////////////////////////////////////////////////////
+// Keeps the latest ProtectorConfig in one of two sectors, each holding
+// a single block:
+//   ConfigBlockHeader (magic, version, length, sequence, CRC-16)
+//   the config bytes
+// The CRC covers the header fields before it and the config. save()
+// writes the sector the current block is not in, so a reset during a
+// save leaves the previous block valid; load() takes the valid block
+// with the highest sequence number. A missing, torn or foreign block,
+// another VERSION, or values that fail isValid() load nothing, and the
+// caller keeps its compiled defaults.
+//
+// save() erases a sector first: a ~45 ms stall, like the history log's
+// erase, so the caller picks the moment.
+struct ConfigBlockHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t length;   // sizeof(ProtectorConfig) of the firmware that saved it
+  uint32_t sequence; // Increments with every save
+  uint16_t crc;
+  uint16_t reserved;
+};
+
+class ConfigStore {
+  public:
+    static const uint16_t SECTOR_SIZE = 4096;
+    static const uint16_t SECTOR_COUNT = 2;
+    static const uint32_t MAGIC = 0x31474643; // "CFG1"
+    static const uint16_t VERSION = 1;
+
+    ConfigStore(uint32_t firstSector); // 0 (the boot loader's sector): no flash area, nothing loads or saves
+    bool hasArea() { return _firstSector > 0; }
+    bool load(ProtectorConfig& config); // Fields from flash over config's defaults; false (config untouched) when there is no usable block
+    bool save(const ProtectorConfig& config); // False when the block did not read back
+    uint32_t getSequence() { return _sequence; } // Saves so far; 0 with nothing on flash
+
+    static bool isValid(const ProtectorConfig& config); // Values the protector can run on
+
+  private:
+    uint32_t _firstSector;
+    uint32_t _sequence;
+    uint8_t _current; // Sector of the loaded or last saved block
+
+    uint32_t _address(uint8_t index) { return (_firstSector + index) * (uint32_t)SECTOR_SIZE; }
+    bool _readBlock(uint8_t index, ConfigBlockHeader& header, ProtectorConfig& config);
+    static uint16_t _crc(const ConfigBlockHeader& header, const ProtectorConfig& config);
+};
+//////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,271 @@
+#include "Arduino.h"
+#include "flashSpool.h"
+#include "historyLog.h"
+
+//////////////////////////////////////////////////////////
+// FLASH SPOOL
+//////////////////////////////////////////////////////////
+FlashSpool :: FlashSpool() {
+  _firstSector = 0;
+  _sectorCount = 0;
+  _ready = false;
+  _current = 0;
+  _sequence = 0;
+  _writeOffset = SECTOR_SIZE;
+  _isNextErased = false;
+  _readSector = 0;
+  _readOffset = 0;
+  _peekedBytes = 0;
+  _pending = 0;
+  _dropped = 0;
+}
+
+bool FlashSpool :: begin(uint32_t firstSector, uint16_t sectorCount) {
+  _firstSector = firstSector;
+  _sectorCount = sectorCount;
+  _ready = false;
+  if (_sectorCount < 2) {
+    return false; // Needs one sector to write and one to erase ahead
+  }
+
+  // The newest sector has the highest sequence number
+  bool found = false;
+  for (uint16_t i = 0; i < _sectorCount; i++) {
+    SpoolSectorHeader header;
+    if (_readHeader(i, header) && (!found || header.sequence > _sequence)) {
+      found = true;
+      _sequence = header.sequence;
+      _current = i;
+    }
+  }
+
+  _pending = 0;
+  _peekedBytes = 0;
+  if (found) {
+    // Oldest pending record: sectors are written in turn, so the ring
+    // order after the newest one is oldest first
+    bool hasRead = false;
+    for (uint16_t step = 1; step <= _sectorCount; step++) {
+      uint16_t index = (_current + step) % _sectorCount;
+      SpoolSectorHeader header;
+      if (!_readHeader(index, header)) {
+        continue;
+      }
+      uint32_t pending = 0;
+      uint16_t end = _scanSector(index, pending);
+      if (index == _current) {
+        _writeOffset = end;
+      }
+      if (pending > 0 && !hasRead) {
+        hasRead = true;
+        _readSector = index;
+        _readOffset = sizeof(SpoolSectorHeader);
+      }
+      _pending += pending;
+    }
+    if (!hasRead) {
+      _readSector = _current;
+      _readOffset = _writeOffset;
+    }
+  } else {
+    // Blank or foreign flash: start in the first sector
+    _sequence = 0;
+    _current = _sectorCount - 1;
+    _isNextErased = false;
+    _prepareNext();
+    _startSector(0);
+    _readSector = 0;
+    _readOffset = sizeof(SpoolSectorHeader);
+  }
+  _isNextErased = _isErased((_current + 1) % _sectorCount);
+  _ready = true;
+  return true;
+}
+
+bool FlashSpool :: append(const uint8_t* data, uint16_t length, bool mayErase) {
+  if (!_ready || length == 0 || length > MAX_RECORD_BYTES) {
+    return false;
+  }
+  uint16_t recordBytes = _recordBytes(length);
+  if (_writeOffset + recordBytes > SECTOR_SIZE) {
+    if (!_isNextErased) {
+      if (!mayErase) {
+        return false;
+      }
+      _prepareNext();
+    }
+    _startSector((_current + 1) % _sectorCount);
+  }
+
+  // One program operation: length and CRC, the state word left erased, data
+  uint32_t words[(RECORD_HEADER_BYTES + MAX_RECORD_BYTES) / 4];
+  memset(words, 0xFF, recordBytes);
+  words[0] = (uint32_t)length | ((uint32_t)HistoryLog::crc16(data, length) << 16);
+  memcpy(&words[RECORD_HEADER_BYTES / 4], data, length);
+  ESP.flashWrite(_address(_current, _writeOffset), words, recordBytes);
+  _writeOffset += recordBytes;
+  _pending++;
+  return true;
+}
+
+uint16_t FlashSpool :: peek(uint8_t* data, uint16_t maxLength) {
+  _peekedBytes = 0;
+  if (!_ready) {
+    return 0;
+  }
+  while (_pending > 0) {
+    if (_readSector == _current && _readOffset >= _writeOffset) {
+      return 0;
+    }
+    SpoolSectorHeader header;
+    uint16_t length;
+    uint16_t crc;
+    uint32_t state;
+    if (!_readHeader(_readSector, header) || !_readRecord(_readSector, _readOffset, length, crc, state)) {
+      if (_readSector == _current) {
+        return 0;
+      }
+      _readSector = (_readSector + 1) % _sectorCount;
+      _readOffset = sizeof(SpoolSectorHeader);
+      continue;
+    }
+    uint16_t recordBytes = _recordBytes(length);
+    if (state == STATE_SENT) {
+      _readOffset += recordBytes;
+      continue;
+    }
+    uint32_t words[MAX_RECORD_BYTES / 4];
+    bool isValid = length <= maxLength && length <= MAX_RECORD_BYTES;
+    if (isValid) {
+      ESP.flashRead(_address(_readSector, _readOffset + RECORD_HEADER_BYTES), words, (length + 3) & ~3);
+      isValid = HistoryLog::crc16(reinterpret_cast<const uint8_t*>(words), length) == crc;
+    }
+    if (!isValid) {
+      // Torn by a reset (or too long for the caller): lost
+      _readOffset += recordBytes;
+      _pending--;
+      _dropped++;
+      continue;
+    }
+    memcpy(data, words, length);
+    _peekedBytes = recordBytes;
+    return length;
+  }
+  return 0;
+}
+
+void FlashSpool :: remove() {
+  if (_peekedBytes == 0) {
+    return;
+  }
+  uint32_t sent = STATE_SENT;
+  ESP.flashWrite(_address(_readSector, _readOffset + 4), &sent, sizeof(sent));
+  _readOffset += _peekedBytes;
+  _peekedBytes = 0;
+  _pending--;
+}
+
+void FlashSpool :: maintain(bool mayErase) {
+  if (!_ready || _isNextErased || !mayErase || _writeOffset < PREPARE_FILL_BYTES) {
+    return;
+  }
+  _prepareNext();
+}
+
+bool FlashSpool :: _readHeader(uint16_t index, SpoolSectorHeader& header) {
+  static_assert(sizeof(SpoolSectorHeader) == 12, "Sector header is three flash words");
+  uint32_t words[3];
+  if (!ESP.flashRead(_address(index, 0), words, sizeof(words))) {
+    return false;
+  }
+  memcpy(&header, words, sizeof(header));
+  return header.magic == MAGIC && header.check == _headerCheck(header.sequence);
+}
+
+bool FlashSpool :: _readRecord(uint16_t index, uint16_t offset, uint16_t& length, uint16_t& crc, uint32_t& state) {
+  if (offset + RECORD_HEADER_BYTES > SECTOR_SIZE) {
+    return false;
+  }
+  uint32_t words[2];
+  ESP.flashRead(_address(index, offset), words, sizeof(words));
+  length = (uint16_t)(words[0] & 0xFFFF);
+  crc = (uint16_t)(words[0] >> 16);
+  state = words[1];
+  // Erased, or not a record this spool wrote
+  return words[0] != 0xFFFFFFFFUL && length > 0 && offset + _recordBytes(length) <= SECTOR_SIZE;
+}
+
+uint16_t FlashSpool :: _scanSector(uint16_t index, uint32_t& pending) {
+  uint16_t offset = sizeof(SpoolSectorHeader);
+  uint16_t length;
+  uint16_t crc;
+  uint32_t state;
+  while (_readRecord(index, offset, length, crc, state)) {
+    if (state != STATE_SENT) {
+      pending++;
+    }
+    offset += _recordBytes(length);
+  }
+  if (offset + RECORD_HEADER_BYTES <= SECTOR_SIZE) {
+    uint32_t word;
+    ESP.flashRead(_address(index, offset), &word, sizeof(word));
+    if (word != 0xFFFFFFFFUL) {
+      return SECTOR_SIZE; // Garbage after the last record: write no more here
+    }
+  }
+  return offset;
+}
+
+bool FlashSpool :: _isErased(uint16_t index) {
+  uint32_t words[32];
+  for (uint16_t offset = 0; offset < SECTOR_SIZE; offset += sizeof(words)) {
+    ESP.flashRead(_address(index, offset), words, sizeof(words));
+    for (uint8_t i = 0; i < sizeof(words) / 4; i++) {
+      if (words[i] != 0xFFFFFFFFUL) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void FlashSpool :: _prepareNext() {
+  if (_isErased((_current + 1) % _sectorCount)) {
+    _isNextErased = true; // First pass over the ring: nothing to erase
+  } else {
+    _eraseNext();
+  }
+}
+
+void FlashSpool :: _eraseNext() {
+  uint16_t next = (_current + 1) % _sectorCount;
+  SpoolSectorHeader header;
+  if (_readHeader(next, header)) {
+    uint32_t pending = 0;
+    _scanSector(next, pending);
+    _pending -= pending;
+    _dropped += pending;
+  }
+  if (_readSector == next) {
+    // The oldest records go; reading goes on after them
+    _readSector = (next + 1) % _sectorCount;
+    _readOffset = sizeof(SpoolSectorHeader);
+    _peekedBytes = 0;
+  }
+  ESP.flashEraseSector(_firstSector + next);
+  _isNextErased = true;
+}
+
+void FlashSpool :: _startSector(uint16_t index) {
+  SpoolSectorHeader header;
+  header.magic = MAGIC;
+  header.sequence = ++_sequence;
+  header.check = _headerCheck(header.sequence);
+  uint32_t words[3];
+  memcpy(words, &header, sizeof(header));
+  ESP.flashWrite(_address(index, 0), words, sizeof(words));
+  _current = index;
+  _writeOffset = sizeof(SpoolSectorHeader);
+  _isNextErased = false;
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,79 @@
+#ifndef flashSpool_h
+#define flashSpool_h
+
+#include "Arduino.h"
+
+//////////////////////////////////////////////////////////
+// FLASH SPOOL (records waiting to be sent)
+//////////////////////////////////////////////////////////
+// A first-in first-out queue of short records in a ring of raw flash
+// sectors, for data that outlives the RAM it was queued in (a long
+// network outage, a deep sleep, a reset). Each sector starts with a
+// SpoolSectorHeader; records follow, word aligned:
+//   uint16 length, uint16 CRC-16 of the data   written with the data
+//   uint32 state word                          0xFFFFFFFF pending, 0 sent
+//   data, padded to a flash word
+// Marking a record sent only clears bits of its state word, so nothing
+// is erased until the ring comes round. A record torn by a reset fails
+// its CRC and is skipped; begin() finds the oldest pending record and
+// the write position again after a reboot.
+//
+// When the ring is full the oldest sector is erased, pending records
+// and all (counted as dropped). A sector erase stalls ~45 ms, so it
+// only happens when the caller allows it, like HistoryLog::maintain().
+struct SpoolSectorHeader {
+  uint32_t magic;
+  uint32_t sequence; // Increments with every new sector; the highest is the newest
+  uint32_t check;
+};
+
+class FlashSpool {
+  public:
+    static const uint16_t SECTOR_SIZE = 4096;
+    static const uint32_t MAGIC = 0x31505342; // "BSP1"
+    static const uint16_t MAX_RECORD_BYTES = 256;
+
+    FlashSpool();
+    bool begin(uint32_t firstSector, uint16_t sectorCount); // Pick up pending records; false when the region is unusable
+    bool isReady() { return _ready; }
+
+    bool append(const uint8_t* data, uint16_t length, bool mayErase); // False when there is no room without an erase
+    uint16_t peek(uint8_t* data, uint16_t maxLength); // Oldest pending record; 0 when none
+    void remove(); // Mark the record peek() returned as sent
+    void maintain(bool mayErase); // Erase the next sector early while a stall is harmless
+
+    uint32_t getPendingCount() { return _pending; }
+    unsigned long getDroppedCount() { return _dropped; } // Pending records lost to a full ring
+
+  private:
+    static const uint16_t RECORD_HEADER_BYTES = 8;
+    static const uint16_t PREPARE_FILL_BYTES = SECTOR_SIZE * 3 / 4; // Erase the next sector from here on
+    static const uint32_t STATE_SENT = 0;
+
+    uint32_t _firstSector;
+    uint16_t _sectorCount;
+    bool _ready;
+    uint16_t _current;      // Sector being written
+    uint32_t _sequence;     // Its sequence number
+    uint16_t _writeOffset;
+    bool _isNextErased;
+    uint16_t _readSector;   // Next record to look at
+    uint16_t _readOffset;
+    uint16_t _peekedBytes;  // Size on flash of the record peek() returned; 0 when none
+    uint32_t _pending;
+    unsigned long _dropped;
+
+    uint32_t _address(uint16_t index, uint16_t offset) { return (_firstSector + index) * (uint32_t)SECTOR_SIZE + offset; }
+    static uint32_t _headerCheck(uint32_t sequence) { return MAGIC ^ sequence ^ 0x5A5A5A5AUL; }
+    static uint16_t _recordBytes(uint16_t length) { return RECORD_HEADER_BYTES + ((length + 3) & ~3); }
+    bool _readHeader(uint16_t index, SpoolSectorHeader& header);
+    bool _readRecord(uint16_t index, uint16_t offset, uint16_t& length, uint16_t& crc, uint32_t& state); // False at the end of the records
+    uint16_t _scanSector(uint16_t index, uint32_t& pending); // Where the next record goes; counts the pending ones
+    bool _isErased(uint16_t index);
+    void _prepareNext(); // Erased next sector, unless it already is
+    void _eraseNext();
+    void _startSector(uint16_t index);
+};
+//////////////////////////////////////////////////////////
+
+#endif
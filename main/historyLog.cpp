@@ -0,0 +1,422 @@
+#include "Arduino.h"
+#include "historyLog.h"
+
+//////////////////////////////////////////////////////////
+// HISTORY ENTRIES
+//////////////////////////////////////////////////////////
+uint16_t HistoryDecoder :: headerCheck(const HistorySectorHeader& header) {
+  uint32_t folded = header.magic ^ header.sequence ^ header.startSeconds ^ ((uint32_t)header.startMillivolts << 16);
+  return (uint16_t)(folded ^ (folded >> 16) ^ 0x5A5A);
+}
+
+bool HistoryDecoder :: isValidHeader(const HistorySectorHeader& header) {
+  return header.magic == MAGIC && header.check == headerCheck(header);
+}
+
+const char* HistoryDecoder :: eventName(uint8_t event) {
+  static const char* const names[HISTORY_EVENT_COUNT] = {
+    "boot", "wake", "cutoff", "fast-trip", "test-cutoff", "rearm", "rearm-failed", "manual-rearm", "transient", "watchdog"
+  };
+  return event < HISTORY_EVENT_COUNT ? names[event] : "unknown";
+}
+
+void HistoryDecoder :: begin(const HistorySectorHeader& header) {
+  _value = 0;
+  _shift = 0;
+  _seconds = header.startSeconds;
+  _millivolts = header.startMillivolts;
+}
+
+bool HistoryDecoder :: feed(uint8_t byte, HistoryEntry& entry) {
+  _value |= (uint32_t)(byte & 0x7F) << _shift;
+  if (byte & 0x80) {
+    _shift += 7;
+    if (_shift >= 7 * MAX_ENTRY_BYTES) {
+      _value = 0; // Malformed: longer than any entry we write
+      _shift = 0;
+    }
+    return false;
+  }
+  uint32_t value = _value;
+  _value = 0;
+  _shift = 0;
+
+  if ((value & 1) == 0) {
+    uint32_t zigzag = value >> 1;
+    int32_t delta = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+    _seconds++;
+    _millivolts = (uint16_t)(_millivolts + delta);
+    entry.kind = HistoryEntry::KIND_SAMPLE;
+    entry.seconds = _seconds;
+    entry.millivolts = _millivolts;
+    entry.event = 0;
+    return true;
+  }
+
+  uint8_t tag = (value >> 1) & 0x07;
+  uint32_t payload = value >> 4;
+  if (tag == TAG_SKIP) {
+    _seconds += payload;
+  } else if (tag == TAG_EVENT) {
+    entry.kind = HistoryEntry::KIND_EVENT;
+    entry.seconds = _seconds;
+    entry.millivolts = _millivolts;
+    entry.event = (uint8_t)payload;
+    return true;
+  }
+  return false; // Padding
+}
+
+uint32_t HistoryEncoder :: sampleEntry(int32_t deltaMillivolts) {
+  uint32_t zigzag = ((uint32_t)deltaMillivolts << 1) ^ (uint32_t)(deltaMillivolts >> 31);
+  return zigzag << 1;
+}
+
+uint32_t HistoryEncoder :: skipEntry(uint32_t seconds) {
+  return (seconds << 4) | (HistoryDecoder::TAG_SKIP << 1) | 1;
+}
+
+uint32_t HistoryEncoder :: eventEntry(HistoryEvent event) {
+  return ((uint32_t)event << 4) | (HistoryDecoder::TAG_EVENT << 1) | 1;
+}
+
+uint8_t HistoryEncoder :: put(uint32_t entry, uint8_t* out) {
+  uint8_t length = 0;
+  do {
+    uint8_t byte = entry & 0x7F;
+    entry >>= 7;
+    out[length++] = entry ? (byte | 0x80) : byte;
+  } while (entry && length < HistoryDecoder::MAX_ENTRY_BYTES);
+  return length;
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// HISTORY LOG (raw flash sectors)
+//////////////////////////////////////////////////////////
+HistoryLog :: HistoryLog(uint32_t firstSector, uint16_t sectorCount) {
+  _firstSector = firstSector;
+  _sectorCount = sectorCount;
+  _ready = false;
+  _current = 0;
+  _sequence = 0;
+  _writeOffset = SECTOR_SIZE;
+  _pendingLength = 0;
+  _isNextErased = false;
+  _seconds = 0;
+  _millivolts = 0;
+  _usedSectors = 0;
+  _exporting = false;
+  _exportSector = 0;
+  _exportLeft = 0;
+  _exportOffset = 0;
+  _exportLength = 0;
+  _exportCrc = 0;
+  _exportHeaderSent = false;
+}
+
+bool HistoryLog :: begin() {
+  if (_sectorCount < MIN_SECTORS) {
+    return false;
+  }
+
+  // The newest sector has the highest sequence number
+  bool found = false;
+  HistorySectorHeader newest;
+  _usedSectors = 0;
+  for (uint16_t i = 0; i < _sectorCount; i++) {
+    HistorySectorHeader header;
+    if (!_readHeader(i, header)) {
+      continue;
+    }
+    _usedSectors++;
+    if (!found || header.sequence > newest.sequence) {
+      found = true;
+      newest = header;
+      _current = i;
+    }
+  }
+
+  _pendingLength = 0;
+  if (found) {
+    // Continue after the last entry, with its time and voltage
+    HistoryDecoder decoder;
+    decoder.begin(newest);
+    _sequence = newest.sequence;
+    _writeOffset = _findEnd(_current, &decoder);
+    _seconds = decoder.getSeconds();
+    _millivolts = decoder.getMillivolts();
+  } else {
+    // Blank or foreign flash: start a new log in the first sector
+    _sequence = 0;
+    _seconds = 0;
+    _millivolts = 0;
+    _current = _sectorCount - 1;
+    _isNextErased = _isErased(0);
+    if (!_isNextErased) {
+      _eraseNext();
+    }
+    _startSector(0);
+  }
+  _isNextErased = _isErased((_current + 1) % _sectorCount);
+  _ready = true;
+  return true;
+}
+
+void HistoryLog :: addSample(uint16_t millivolts, uint32_t elapsedSeconds) {
+  if (!_ready) {
+    return;
+  }
+  if (elapsedSeconds == 0) {
+    elapsedSeconds = 1;
+  }
+  // A gap is one skip entry per 2^24 s (payload limit of a 4-byte entry)
+  uint32_t skipSeconds = elapsedSeconds - 1;
+  while (skipSeconds > 0) {
+    uint32_t chunk = skipSeconds < 0xFFFFFFUL ? skipSeconds : 0xFFFFFFUL;
+    _append(HistoryEncoder::skipEntry(chunk));
+    _seconds += chunk;
+    skipSeconds -= chunk;
+  }
+  _append(HistoryEncoder::sampleEntry((int32_t)millivolts - (int32_t)_millivolts));
+  _seconds++;
+  _millivolts = millivolts;
+}
+
+void HistoryLog :: addEvent(HistoryEvent event) {
+  if (!_ready) {
+    return;
+  }
+  _append(HistoryEncoder::eventEntry(event));
+  _padWord(); // Events reach flash right away
+}
+
+void HistoryLog :: maintain(bool mayErase) {
+  if (!_ready || _isNextErased || !mayErase || _writeOffset < PREPARE_FILL_BYTES) {
+    return;
+  }
+  if (_exporting && _exportLeft > 0 && _exportSector == (_current + 1) % _sectorCount) {
+    return; // Oldest sector still waiting for the export; erase when the sector is full
+  }
+  _eraseNext();
+}
+
+void HistoryLog :: sync() {
+  if (_ready) {
+    _padWord();
+  }
+}
+
+bool HistoryLog :: startExport() {
+  if (!_ready) {
+    return false;
+  }
+  _padWord(); // Export includes the latest samples
+  _exporting = true;
+  _exportSector = (_current + 1) % _sectorCount; // Oldest first
+  _exportLeft = _sectorCount;
+  _exportHeaderSent = false;
+  return true;
+}
+
+bool HistoryLog :: exportStep(Print& out) {
+  if (!_exporting) {
+    return false;
+  }
+  int room = out.availableForWrite();
+  uint16_t budget = room > 0 ? (room < EXPORT_CHUNK_BYTES ? (uint16_t)room : EXPORT_CHUNK_BYTES) : 16;
+  if (budget < 6) {
+    return true; // Frame start or end would not fit; try next time
+  }
+
+  if (!_exportHeaderSent) {
+    // Skip blank and erased sectors
+    while (_exportLeft > 0 && (_exportLength = _exportableLength(_exportSector)) == 0) {
+      _exportSector = (_exportSector + 1) % _sectorCount;
+      _exportLeft--;
+    }
+    uint8_t start[4] = { '#', 'H', 0, 0 };
+    if (_exportLeft == 0) {
+      out.write(start, sizeof(start)); // Zero length: end of export
+      _exporting = false;
+      return false;
+    }
+    start[2] = (uint8_t)(_exportLength & 0xFF);
+    start[3] = (uint8_t)(_exportLength >> 8);
+    out.write(start, sizeof(start));
+    _exportOffset = 0;
+    _exportCrc = 0xFFFF;
+    _exportHeaderSent = true;
+    return true;
+  }
+
+  if (_exportOffset < _exportLength) {
+    uint32_t words[EXPORT_CHUNK_BYTES / 4];
+    uint16_t length = _exportLength - _exportOffset;
+    uint16_t limit = budget & ~3;
+    if (length > limit) {
+      length = limit;
+    }
+    ESP.flashRead(_address(_exportSector, _exportOffset), words, length);
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(words);
+    out.write(bytes, length);
+    _exportCrc = crc16(bytes, length, _exportCrc);
+    _exportOffset += length;
+    return true;
+  }
+
+  uint8_t end[2] = { (uint8_t)(_exportCrc & 0xFF), (uint8_t)(_exportCrc >> 8) };
+  out.write(end, sizeof(end));
+  _exportSector = (_exportSector + 1) % _sectorCount;
+  _exportLeft--;
+  _exportHeaderSent = false;
+  return true;
+}
+
+uint32_t HistoryLog :: getUsedBytes() {
+  if (!_ready || _usedSectors == 0) {
+    return 0;
+  }
+  uint16_t entryBytes = SECTOR_SIZE - sizeof(HistorySectorHeader);
+  return (uint32_t)(_usedSectors - 1) * entryBytes + (_writeOffset - sizeof(HistorySectorHeader)) + _pendingLength;
+}
+
+uint32_t HistoryLog :: getCapacityBytes() {
+  // The sector erased ahead of the writer holds nothing
+  return (uint32_t)(_sectorCount - 1) * (SECTOR_SIZE - sizeof(HistorySectorHeader));
+}
+
+uint16_t HistoryLog :: crc16(const uint8_t* data, uint16_t length, uint16_t crc) {
+  // CRC-16/CCITT, bitwise: at most one export chunk per call
+  for (uint16_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+bool HistoryLog :: _readHeader(uint16_t index, HistorySectorHeader& header) {
+  static_assert(sizeof(HistorySectorHeader) == 16, "Sector header is four flash words");
+  uint32_t words[4];
+  if (!ESP.flashRead(_address(index, 0), words, sizeof(words))) {
+    return false;
+  }
+  memcpy(&header, words, sizeof(header));
+  return HistoryDecoder::isValidHeader(header);
+}
+
+uint16_t HistoryLog :: _findEnd(uint16_t index, HistoryDecoder* decoder) {
+  // Every written word starts with an entry, never with 0xFF
+  uint32_t words[EXPORT_CHUNK_BYTES / 4];
+  uint16_t offset = sizeof(HistorySectorHeader);
+  while (offset < SECTOR_SIZE) {
+    uint16_t length = SECTOR_SIZE - offset < (int)sizeof(words) ? SECTOR_SIZE - offset : sizeof(words);
+    ESP.flashRead(_address(index, offset), words, length);
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(words);
+    for (uint16_t i = 0; i < length; i += 4) {
+      if (bytes[i] == 0xFF) {
+        return offset + i;
+      }
+      if (decoder) {
+        HistoryEntry entry;
+        for (uint8_t j = 0; j < 4; j++) {
+          decoder->feed(bytes[i + j], entry);
+        }
+      }
+    }
+    offset += length;
+  }
+  return SECTOR_SIZE;
+}
+
+bool HistoryLog :: _isErased(uint16_t index) {
+  uint32_t words[EXPORT_CHUNK_BYTES / 4];
+  for (uint16_t offset = 0; offset < SECTOR_SIZE; offset += sizeof(words)) {
+    ESP.flashRead(_address(index, offset), words, sizeof(words));
+    for (uint8_t i = 0; i < sizeof(words) / 4; i++) {
+      if (words[i] != 0xFFFFFFFFUL) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void HistoryLog :: _eraseNext() {
+  uint16_t next = (_current + 1) % _sectorCount;
+  HistorySectorHeader header;
+  if (_readHeader(next, header) && _usedSectors > 0) {
+    _usedSectors--; // Oldest sector goes
+  }
+  ESP.flashEraseSector(_firstSector + next);
+  _isNextErased = true;
+}
+
+void HistoryLog :: _startSector(uint16_t index) {
+  HistorySectorHeader header;
+  header.magic = HistoryDecoder::MAGIC;
+  header.sequence = ++_sequence;
+  header.startSeconds = _seconds;
+  header.startMillivolts = _millivolts;
+  header.check = HistoryDecoder::headerCheck(header);
+  uint32_t words[4];
+  memcpy(words, &header, sizeof(header));
+  ESP.flashWrite(_address(index, 0), words, sizeof(words));
+  _current = index;
+  _writeOffset = sizeof(HistorySectorHeader);
+  _pendingLength = 0;
+  _isNextErased = false;
+  _usedSectors++;
+}
+
+void HistoryLog :: _append(uint32_t value) {
+  uint8_t bytes[HistoryDecoder::MAX_ENTRY_BYTES];
+  uint8_t length = HistoryEncoder::put(value, bytes);
+
+  // Entries never straddle a flash word: a reset loses whole entries only
+  if (_pendingLength + length > 4) {
+    _padWord();
+  }
+  if (_writeOffset >= SECTOR_SIZE) {
+    if (!_isNextErased) {
+      _eraseNext(); // Not prepared in time: this stalls once
+    }
+    _startSector((_current + 1) % _sectorCount);
+  }
+  for (uint8_t i = 0; i < length; i++) {
+    _pending[_pendingLength++] = bytes[i];
+  }
+  if (_pendingLength == 4) {
+    _flushWord();
+  }
+}
+
+void HistoryLog :: _flushWord() {
+  uint32_t word;
+  memcpy(&word, _pending, sizeof(word));
+  ESP.flashWrite(_address(_current, _writeOffset), &word, sizeof(word));
+  _writeOffset += 4;
+  _pendingLength = 0;
+}
+
+void HistoryLog :: _padWord() {
+  if (_pendingLength == 0) {
+    return;
+  }
+  while (_pendingLength < 4) {
+    _pending[_pendingLength++] = (HistoryDecoder::TAG_PAD << 1) | 1;
+  }
+  _flushWord();
+}
+
+uint16_t HistoryLog :: _exportableLength(uint16_t index) {
+  HistorySectorHeader header;
+  if (!_readHeader(index, header)) {
+    return 0;
+  }
+  return index == _current ? _writeOffset : _findEnd(index, nullptr);
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,176 @@
+#ifndef historyLog_h
+#define historyLog_h
+
+#include "Arduino.h"
+
+//////////////////////////////////////////////////////////
+// HISTORY ENTRIES (encoding shared by the logger and decoders)
+//////////////////////////////////////////////////////////
+// The log is a sequence of 4 KB flash sectors. Each sector starts with a
+// HistorySectorHeader and holds entries packed as unsigned LEB128
+// varints. Bit 0 of the value selects the kind:
+//   ...0  sample one second after the previous one; value >> 1 is the
+//         zigzag-encoded millivolt delta to the previous sample
+//   ...1  tagged entry; bits 1..3 are the tag, value >> 4 the payload:
+//         TAG_SKIP   payload = seconds without a sample before the next one
+//         TAG_EVENT  payload = HistoryEvent, at the time of the last sample
+//         TAG_PAD    filler up to the next flash word
+// No entry is longer than 4 bytes or crosses a flash word, so every
+// word starts with an entry. Tag 7 is never written: a word starting
+// with 0xFF is erased flash and ends the sector.
+enum HistoryEvent {
+  HISTORY_EVENT_BOOT = 0,      // Power-on or reset
+  HISTORY_EVENT_WAKE,          // Woke from deep sleep
+  HISTORY_EVENT_CUTOFF,        // Filtered voltage below the cutoff threshold
+  HISTORY_EVENT_FAST_TRIP,     // Sampler opened the relay on a hard drop
+  HISTORY_EVENT_TEST_CUTOFF,   // Long press while armed
+  HISTORY_EVENT_REARM,         // Rearm held under load
+  HISTORY_EVENT_REARM_FAILED,  // Relay reopened after the trial closing
+  HISTORY_EVENT_MANUAL_REARM,  // Long press while cut off
+  HISTORY_EVENT_TRANSIENT,     // Crank or inrush dip ridden through
+  HISTORY_EVENT_WATCHDOG,      // Loop hung: relay driven to the safe state
+  HISTORY_EVENT_COUNT
+};
+
+struct HistorySectorHeader {
+  uint32_t magic;
+  uint32_t sequence;       // Increments with every new sector; the highest is the newest
+  uint32_t startSeconds;   // Log time of the sample the first delta refers to
+  uint16_t startMillivolts;
+  uint16_t check;          // Guards the fields above against torn writes
+};
+
+struct HistoryEntry {
+  enum Kind {
+    KIND_SAMPLE,
+    KIND_EVENT
+  };
+  Kind kind;
+  uint32_t seconds;     // Log time: seconds the logger ran, across reboots
+  uint16_t millivolts;  // Sample value, or the last sample for an event
+  uint8_t event;        // HistoryEvent for KIND_EVENT
+};
+
+// Turns the bytes of one sector (header included) back into entries
+class HistoryDecoder {
+  public:
+    static const uint32_t MAGIC = 0x31484C42; // "BLH1"
+    static const uint8_t TAG_SKIP = 0;
+    static const uint8_t TAG_EVENT = 1;
+    static const uint8_t TAG_PAD = 6;
+    static const uint8_t MAX_ENTRY_BYTES = 4;
+
+    static uint16_t headerCheck(const HistorySectorHeader& header);
+    static bool isValidHeader(const HistorySectorHeader& header);
+    static const char* eventName(uint8_t event);
+
+    void begin(const HistorySectorHeader& header);
+    bool feed(uint8_t byte, HistoryEntry& entry); // True when byte completed an entry
+    bool isBetweenEntries() { return _shift == 0; }
+    uint32_t getSeconds() { return _seconds; }
+    uint16_t getMillivolts() { return _millivolts; }
+
+  private:
+    uint32_t _value;
+    uint8_t _shift;
+    uint32_t _seconds;
+    uint16_t _millivolts;
+};
+
+// Builds entries (the MQTT batches use the same encoding in RAM)
+class HistoryEncoder {
+  public:
+    static uint32_t sampleEntry(int32_t deltaMillivolts);
+    static uint32_t skipEntry(uint32_t seconds); // Up to 2^24 - 1
+    static uint32_t eventEntry(HistoryEvent event);
+    static uint8_t put(uint32_t entry, uint8_t* out); // LEB128 bytes written, at most MAX_ENTRY_BYTES
+};
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// HISTORY LOG (raw flash sectors)
+//////////////////////////////////////////////////////////
+// Voltage samples and state changes in a ring of flash sectors. A 1 Hz
+// sample usually takes one byte (deltas up to +-31 mV), so the 2 MB
+// filesystem area of a 4 MB board holds about three weeks and a 16 MB
+// board about five months. The region must not be used by LittleFS at
+// the same time.
+//
+// Wear leveling: sectors are written strictly in turn and each one is
+// erased once per pass over the ring. Entries are written a flash word
+// at a time; the word being filled stays in RAM, and events flush it
+// right away. After a reset begin() finds the newest sector and its end
+// and continues there; at most the samples of the unwritten word are lost.
+//
+// Nothing here blocks for long except the sector erase (~45 ms, once per
+// ~4000 samples). maintain() erases the next sector ahead of time, when
+// the caller says a stall is harmless; only a full sector forces it.
+// Export streams the log in small chunks from a periodic task.
+class HistoryLog {
+  public:
+    static const uint16_t SECTOR_SIZE = 4096;
+    static const uint16_t EXPORT_CHUNK_BYTES = 128; // Upper bound per exportStep()
+    static const uint16_t MIN_SECTORS = 2; // One sector to write and one to erase ahead
+
+    HistoryLog(uint32_t firstSector, uint16_t sectorCount);
+    bool begin(); // Pick up the existing log (or start one); false when the region is unusable
+    bool isReady() { return _ready; }
+
+    void addSample(uint16_t millivolts, uint32_t elapsedSeconds); // elapsedSeconds since the previous sample, at least 1
+    void addEvent(HistoryEvent event);
+    void maintain(bool mayErase); // Erase the next sector early while a stall is harmless
+    void sync(); // Write out the word being filled (before a deep sleep)
+
+    // Export: per sector from oldest to newest "#H", uint16 length, the
+    // sector bytes and their CRC-16 (CCITT), then "#H" with length 0.
+    // Integers are little-endian.
+    bool startExport();
+    bool exportStep(Print& out); // Writes what fits in out's buffer; false when done
+    bool isExporting() { return _exporting; }
+
+    uint32_t getSeconds() { return _seconds; }
+    uint16_t getSectorCount() { return _sectorCount; }
+    uint32_t getUsedBytes(); // Entry bytes in flash, headers excluded
+    uint32_t getCapacityBytes(); // Kept once the ring wrapped, give or take the sector erased ahead
+    static uint16_t crc16(const uint8_t* data, uint16_t length, uint16_t crc = 0xFFFF);
+
+  private:
+    static const uint16_t PREPARE_FILL_BYTES = SECTOR_SIZE * 3 / 4; // Erase the next sector from here on
+
+    uint32_t _firstSector;
+    uint16_t _sectorCount;
+    bool _ready;
+
+    uint16_t _current;       // Index in the ring
+    uint32_t _sequence;      // Sequence number of the current sector
+    uint16_t _writeOffset;   // Next flash word to program in the current sector
+    uint8_t _pending[4];     // Flash word being filled
+    uint8_t _pendingLength;
+    bool _isNextErased;
+    uint32_t _seconds;       // Log time of the last sample
+    uint16_t _millivolts;    // Last sample
+    uint16_t _usedSectors;   // Sectors holding a valid header
+
+    bool _exporting;
+    uint16_t _exportSector;  // Ring index being exported
+    uint16_t _exportLeft;    // Sectors left, including the current one
+    uint16_t _exportOffset;  // Next byte of the sector to send
+    uint16_t _exportLength;  // Bytes of the sector to send (snapshot)
+    uint16_t _exportCrc;
+    bool _exportHeaderSent;
+
+    uint32_t _address(uint16_t index, uint16_t offset) { return (_firstSector + index) * (uint32_t)SECTOR_SIZE + offset; }
+    bool _readHeader(uint16_t index, HistorySectorHeader& header);
+    uint16_t _findEnd(uint16_t index, HistoryDecoder* decoder); // Offset of the first erased word
+    bool _isErased(uint16_t index);
+    void _eraseNext();
+    void _startSector(uint16_t index);
+    void _append(uint32_t value);
+    void _flushWord();
+    void _padWord();
+    uint16_t _exportableLength(uint16_t index);
+};
+//////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,173 @@
+#include "Arduino.h"
+#include "loopWatchdog.h"
+#include "systemClock.h"
+
+#ifndef RTC_USER_MEM
+#define RTC_USER_MEM ((volatile uint32_t*)0x60001200) // Word 0 of ESP.rtcUserMemoryRead/Write
+#endif
+
+LoopWatchdog* LoopWatchdog::_instance = nullptr;
+
+//////////////////////////////////////////////////////////
+// LOOP WATCHDOG (timer0 deadline)
+//////////////////////////////////////////////////////////
+LoopWatchdog :: LoopWatchdog() {
+  _config.timeoutMs = 0;
+  _config.safeState = SAFE_RELAY_OPEN;
+  _enabled = false;
+  _handler = nullptr;
+  _arg = nullptr;
+  _rtcOffsetWords = 0;
+  _timeoutCycles = 0;
+  _expectedPeriodUs = 0;
+  _lastFeedUs = 0;
+  _lastFeedMs = 0;
+  _lastPeriodUs = 0;
+  _tripped = false;
+  memset(&_record, 0, sizeof(_record));
+  resetStats();
+}
+
+bool LoopWatchdog :: begin(const WatchdogConfig& config, TripHandler handler, void* arg, uint8_t rtcOffsetWords) {
+  if (config.timeoutMs == 0 || config.timeoutMs > MAX_TIMEOUT_MS || config.safeState > SAFE_RELAY_CLOSED) {
+    return false;
+  }
+  if (rtcOffsetWords + sizeof(WatchdogRecord) / 4 > RTC_USER_WORDS) {
+    return false;
+  }
+  _config = config;
+  _handler = handler;
+  _arg = arg;
+  _rtcOffsetWords = rtcOffsetWords;
+  _timeoutCycles = (uint32_t)config.timeoutMs * 1000UL * ESP.getCpuFreqMHz();
+  _instance = this;
+  _enabled = true;
+  feed(); // Compare value set before the interrupt is on
+  timer0_isr_init();
+  timer0_attachInterrupt(&LoopWatchdog::_onTimer);
+  _lastPeriodUs = 0; // Setup time is not a loop period
+  return true;
+}
+
+void LoopWatchdog :: setExpectedPeriod(uint32_t us) {
+  _expectedPeriodUs = us;
+}
+
+void LoopWatchdog :: feed() {
+  if (!_enabled) {
+    return;
+  }
+  timer0_write(ESP.getCycleCount() + _timeoutCycles);
+  unsigned long nowUs = SystemClock::micros();
+  uint32_t periodUs = nowUs - _lastFeedUs;
+  _lastFeedUs = nowUs;
+  _lastFeedMs = SystemClock::millis();
+  if (_lastPeriodUs > 0) {
+    // Pass to pass: the first feed only marks the start
+    uint32_t jitterUs = periodUs > _lastPeriodUs ? periodUs - _lastPeriodUs : _lastPeriodUs - periodUs;
+    _stats.passes++;
+    _stats.totalPeriodUs += periodUs;
+    _stats.totalJitterUs += jitterUs;
+    if (periodUs > _stats.maxPeriodUs) {
+      _stats.maxPeriodUs = periodUs;
+    }
+    if (jitterUs > _stats.maxJitterUs) {
+      _stats.maxJitterUs = jitterUs;
+    }
+    if (_expectedPeriodUs > 0 && periodUs > _expectedPeriodUs * DEADLINE_PERIODS) {
+      _stats.deadlineMisses++;
+    }
+  }
+  _lastPeriodUs = periodUs > 0 ? periodUs : 1;
+}
+
+bool LoopWatchdog :: takeTrip(WatchdogRecord& record) {
+  if (!_tripped) {
+    return false;
+  }
+  record = _record;
+  _tripped = false;
+  WatchdogRecord cleared;
+  memset(&cleared, 0, sizeof(cleared));
+  ESP.rtcUserMemoryWrite(_rtcOffsetWords, (uint32_t*)&cleared, sizeof(cleared)); // The loop is back: no reset to explain
+  return true;
+}
+
+void LoopWatchdog :: resetStats() {
+  memset(&_stats, 0, sizeof(_stats));
+  _lastPeriodUs = 0;
+}
+
+void LoopWatchdog :: printStats(Print& out) {
+  out.print("Loop: ");
+  out.print(_stats.passes);
+  out.print(" passes, period mean/max ");
+  out.print(_stats.passes > 0 ? (unsigned long)(_stats.totalPeriodUs / _stats.passes) : 0UL);
+  out.print('/');
+  out.print(_stats.maxPeriodUs);
+  out.print("us, jitter mean/max ");
+  out.print(_stats.passes > 0 ? (unsigned long)(_stats.totalJitterUs / _stats.passes) : 0UL);
+  out.print('/');
+  out.print(_stats.maxJitterUs);
+  out.println("us");
+  out.print("Deadline misses: ");
+  out.print(_stats.deadlineMisses);
+  out.print(" over ");
+  out.print(_expectedPeriodUs * DEADLINE_PERIODS);
+  out.print("us, watchdog trips: ");
+  out.print(_stats.trips);
+  if (_enabled) {
+    out.print(" (");
+    out.print((unsigned int)_config.timeoutMs);
+    out.print("ms, relay ");
+    out.print(safeStateName(_config.safeState));
+    out.println(")");
+  } else {
+    out.println(" (off)");
+  }
+}
+
+bool LoopWatchdog :: loadRecord(uint8_t rtcOffsetWords, WatchdogRecord& record) {
+  if (!ESP.rtcUserMemoryRead(rtcOffsetWords, (uint32_t*)&record, sizeof(record))) {
+    return false;
+  }
+  bool valid = record.magic == RECORD_MAGIC && record.check == _check(record);
+  WatchdogRecord cleared;
+  memset(&cleared, 0, sizeof(cleared));
+  ESP.rtcUserMemoryWrite(rtcOffsetWords, (uint32_t*)&cleared, sizeof(cleared)); // One report per hang
+  return valid;
+}
+
+const char* LoopWatchdog :: safeStateName(uint8_t safeState) {
+  return safeState == SAFE_RELAY_CLOSED ? "closed" : "open";
+}
+
+void IRAM_ATTR LoopWatchdog :: _onTimer() {
+  // Interrupt context: relay first, then the record; one trip per hang
+  LoopWatchdog* self = _instance;
+  if (!self || self->_tripped) {
+    return;
+  }
+  WatchdogRecord& record = self->_record;
+  record.magic = RECORD_MAGIC;
+  record.safeState = self->_config.safeState;
+  record.taskId = self->_handler ? self->_handler(self->_arg, self->_config.safeState) : -1;
+  record.reserved = 0;
+  record.tripMs = self->_lastFeedMs + self->_config.timeoutMs;
+  record.check = _check(record);
+  // Plain stores: the SDK's RTC calls are in flash, which may not be
+  // mapped while the interrupt runs
+  const uint32_t* words = (const uint32_t*)&record;
+  volatile uint32_t* rtc = RTC_USER_MEM + self->_rtcOffsetWords;
+  for (uint8_t i = 0; i < sizeof(record) / 4; i++) {
+    rtc[i] = words[i];
+  }
+  self->_stats.trips++;
+  self->_tripped = true;
+}
+
+uint32_t IRAM_ATTR LoopWatchdog :: _check(const WatchdogRecord& record) {
+  const uint32_t* words = (const uint32_t*)&record;
+  return ~(words[1] ^ record.tripMs) ^ RECORD_MAGIC;
+}
+//////////////////////////////////////////////////////////
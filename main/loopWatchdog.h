@@ -0,0 +1,104 @@
+#ifndef loopWatchdog_h
+#define loopWatchdog_h
+
+#include "Arduino.h"
+
+//////////////////////////////////////////////////////////
+// LOOP WATCHDOG (timer0 deadline)
+//////////////////////////////////////////////////////////
+// A software watchdog in front of the chip's own: feed() at the top of
+// every update() re-arms timer0 (the CCOMPARE0 interrupt) timeoutMs
+// ahead. When a pass hangs that long, e.g. in an I2C transfer waiting
+// out a stretched clock, the interrupt calls the trip handler, which
+// drives the relay to the configured safe state right away, and leaves
+// a record in RTC user memory saying where the loop was. Everything the
+// interrupt reaches is in IRAM: the handler, the relay write and plain
+// stores into RTC memory instead of the SDK's flash-resident calls.
+//
+// The loop then either comes back (update() sees isTripped() and
+// recovers) or it does not, and the SDK's soft watchdog (~3.2 s) or the
+// hardware watchdog (~8 s) resets the chip; the next boot finds the
+// record with loadRecord(). timer0 keeps counting in a hung loop, unlike
+// os_timer, and is free unlike timer1 (tone(), analogWrite()). It stops
+// in light sleep along with the CPU clock, as does the loop.
+//
+// feed() also measures the pass period: mean and worst case, jitter
+// (change from one period to the next) and deadline misses (periods over
+// DEADLINE_PERIODS expected periods).
+struct WatchdogConfig {
+  uint16_t timeoutMs; // 0: off; at most LoopWatchdog::MAX_TIMEOUT_MS
+  uint8_t safeState;  // LoopWatchdog::SafeState
+};
+
+// Written from the interrupt; magic and check tell it from garbage
+struct WatchdogRecord {
+  uint32_t magic;
+  uint8_t safeState;
+  int8_t taskId;      // Scheduler task running at the trip; -1 between tasks
+  uint16_t reserved;
+  uint32_t tripMs;    // SystemClock::millis() at the trip
+  uint32_t check;
+};
+static_assert(sizeof(WatchdogRecord) % 4 == 0, "RTC user memory is written in whole words");
+
+class LoopWatchdog {
+  public:
+    enum SafeState {
+      SAFE_RELAY_OPEN,  // Load disconnected: the battery is protected
+      SAFE_RELAY_CLOSED // Load kept on: for loads that must not lose power
+    };
+    typedef int8_t (*TripHandler)(void* arg, uint8_t safeState); // Interrupt context: drive the relay, return the running task
+    static const uint16_t MAX_TIMEOUT_MS = 3000; // Above this the SDK's soft watchdog resets the chip first
+    static const uint8_t DEADLINE_PERIODS = 2;
+
+    struct LoopStats {
+      uint32_t passes;         // Periods measured
+      uint32_t maxPeriodUs;
+      uint64_t totalPeriodUs;
+      uint32_t maxJitterUs;
+      uint64_t totalJitterUs;
+      uint32_t deadlineMisses;
+      uint32_t trips;
+    };
+
+    LoopWatchdog();
+    bool begin(const WatchdogConfig& config, TripHandler handler, void* arg, uint8_t rtcOffsetWords); // false when the timeout or the offset is out of range
+    bool isEnabled() { return _enabled; }
+    void setExpectedPeriod(uint32_t us); // Periods over DEADLINE_PERIODS times this are deadline misses
+    void feed(); // Top of every loop pass
+    bool isTripped() { return _tripped; }
+    bool takeTrip(WatchdogRecord& record); // Record of the last trip; clears it here and in RTC memory
+    uint32_t getLastFeedMs() { return _lastFeedMs; }
+    const WatchdogConfig& getConfig() { return _config; }
+    const LoopStats& getStats() { return _stats; }
+    void resetStats();
+    void printStats(Print& out);
+
+    static bool loadRecord(uint8_t rtcOffsetWords, WatchdogRecord& record); // Left by the last boot; cleared on read
+    static const char* safeStateName(uint8_t safeState);
+
+  private:
+    static const uint32_t RECORD_MAGIC = 0x47445757; // "WWDG"
+    static const uint8_t RTC_USER_WORDS = 128;
+
+    WatchdogConfig _config;
+    bool _enabled;
+    TripHandler _handler;
+    void* _arg;
+    uint8_t _rtcOffsetWords;
+    uint32_t _timeoutCycles;
+    uint32_t _expectedPeriodUs;
+    unsigned long _lastFeedUs;
+    volatile uint32_t _lastFeedMs;
+    uint32_t _lastPeriodUs; // 0 before the second feed
+    volatile bool _tripped;
+    WatchdogRecord _record;
+    LoopStats _stats;
+
+    static LoopWatchdog* _instance; // timer0 has one callback without an argument
+    static void _onTimer();
+    static uint32_t _check(const WatchdogRecord& record);
+};
+//////////////////////////////////////////////////////////
+
+#endif
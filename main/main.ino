@@ -1,40 +1,186 @@
 #include "batteryProtector.h"
 #include "basicHardware.h"
+#include "multiBankProtector.h"
 #include <Wire.h>
 
+// Both objects live in static storage (no heap): they are constructed
+// in setup(), and their size shows in the build's "Global variables
+// use ..." figure. The single-bank protector comes first, before Serial
+// and Wire: it samples the battery and drives the relay in its
+// constructor, and prints the boot report once Serial is up
 BatteryProtector* batteryProtector;
+MultiBankProtector* multiBankProtector;
 Display* display;
 
-// Voltage configuration
+// Voltage configuration (compiled defaults: 'c' on Serial changes the
+// thresholds, rearm delay, divider and sample period at run time, and
+// 'c save' keeps them in flash for the next boot)
 #define VOLTAGE_CUTOFF_THRESHOLD 11.0f  // Cutoff threshold in Volts (battery voltage below this will trigger cutoff)
 #define VOLTAGE_REARM_THRESHOLD 12.8f  // Rearm threshold in Volts (battery voltage must rise above this to trigger rearm)
 
 // Timing configuration
 #define REARM_DELAY_SECONDS 60  // Delay in seconds before rearming after voltage exceeds rearm threshold
 
+// Power configuration (the WiFi modem is off unless MQTT_TELEMETRY uses it; light sleep needs it off)
+#define LOW_POWER_MODE false  // Light sleep between samples (voltage checked every 100 ms instead of 5 ms, full rate within 0.5 V of the cutoff)
+#define DEEP_SLEEP_IN_CUTOFF false  // Deep sleep while cut off; needs D0 wired to RST and a pull-up on the relay line
+
+// Serial configuration
+#define SERIAL_TELEMETRY false  // Binary sample/event records (COBS frames, decode with sim/telemetryDecode) between the text lines; nothing waits for the UART
+
+// History configuration
+#define HISTORY_LOG true  // Voltage once per second and cutoff/rearm events in the flash filesystem area (no LittleFS); send 'h' on Serial to export
+
+// MQTT configuration: one history-encoded batch per minute (and one per
+// event) to the broker at QoS 1; buffered in RAM, then in the last 64 KB
+// of the flash filesystem area while the broker is unreachable
+#define MQTT_TELEMETRY false
+#define MQTT_WIFI_SSID "battery"
+#define MQTT_WIFI_PASSWORD ""
+#define MQTT_BROKER_ADDRESS 192, 168, 1, 10  // IPv4 only, no DNS
+#define MQTT_BROKER_PORT 1883
+#define MQTT_CLIENT_ID "battery-protector"
+#define MQTT_TOPIC "battery/telemetry"
+
+// Load compensation configuration
+#define NOMINAL_LOAD_AMPS 0.0f  // Typical load current; the voltage step at each relay switching then gives the battery's internal resistance
+#define CUTOFF_ON_COMPENSATED_VOLTAGE false  // Cut off on the open-circuit estimate (measured + I x R) instead of the terminal voltage; needs NOMINAL_LOAD_AMPS
+
+// Crank ride-through configuration: an engine start or a load's inrush
+// pulls the battery below the cutoff for a moment; with this on, such
+// dips are judged by their shape instead of tripping the relay
+#define CRANK_RIDE_THROUGH false
+#define CRANK_DWELL_MS 3000  // Longest dip ridden through; a real discharge that starts with a step is cut off after this
+#define CRANK_COLLAPSE_VOLTS 6.0f  // Below this for CRANK_COLLAPSE_MS is a fault, not a crank
+#define CRANK_COLLAPSE_MS 100
+
+// State of charge configuration: INA219/INA226 on the LCD's I2C bus
+// (0x40) measuring the load current across a shunt in the negative lead
+#define CURRENT_SENSOR false
+#define CURRENT_SENSOR_INA226 true  // false for an INA219
+#define CURRENT_SHUNT_MILLIOHMS 1.5f  // 50 A / 75 mV shunt
+#define BATTERY_CAPACITY_AH 100.0f
+#define SOC_CUTOFF_PERCENT 0  // Cut off below this state of charge instead of VOLTAGE_CUTOFF_THRESHOLD (0 keeps the voltage cutoff)
+
+// Loop watchdog: a loop pass that hangs this long (an I2C transfer
+// stuck on the bus, a library waiting forever) drives the relay to the
+// safe state from a timer interrupt; 'w' on Serial shows loop stats
+#define LOOP_WATCHDOG true
+#define LOOP_WATCHDOG_MS 1000  // At most 3000: the SDK's own watchdog resets the chip after ~3.2 s
+#define LOOP_WATCHDOG_SAFE_RELAY_OPEN true  // false keeps the load connected through a hang
+
+// Temperature compensation: DS18B20 on the battery case (1-Wire, 4.7k
+// pull-up to 3.3V). Cutoff and rearm move by this much per degree away
+// from 25C (lower in the cold), -20..50C. The OneWire library drives
+// GPIO0..15 only, and GPIO15 must be low at boot, so the sensor has
+// GPIO14 (D5) and the red LED sits on GPIO15 (D8)
+#define TEMPERATURE_SENSOR false
+#define TEMPERATURE_SENSOR_PIN 14
+#define TEMPERATURE_MV_PER_C 18  // 12V lead-acid: 6 cells x 3mV/C
+
+// Multi-bank configuration: house and starter battery through an ADS1115
+// (0x48, AIN0/AIN1 behind 100k/25k dividers) with their relays on a
+// PCF8574 (0x20, P0/P1), replacing the single-bank protector on A0/GPIO12.
+// For more banks without an ADS1115, an AnalogMux on A0 also works; its
+// select lines fit on GPIO12, GPIO14 and GPIO16 (D6, D5, D0 - D5 is then
+// taken from the temperature sensor and D0 lost for the deep sleep wake-up)
+#define MULTI_BANK false
+#define HOUSE_CUTOFF_THRESHOLD 11.0f
+#define HOUSE_REARM_THRESHOLD 12.8f
+#define STARTER_CUTOFF_THRESHOLD 11.8f  // Keep enough charge to crank
+#define STARTER_REARM_THRESHOLD 12.8f
+
 void setup() {
+  // LCD display (I²C address 0x27); the constructor does not touch the bus
+  static Display lcd(0x27, 16, 2);
+  display = &lcd;
+
+#if MULTI_BANK
+  // The banks are read over I²C: the bus comes first here
   Serial.begin(115200);
-  delay(100); // Wait for Serial to initialize
-  
-  Wire.begin(); // Initialize I²C bus for LCD
-  delay(100); // Wait for I²C bus to stabilize
-  Wire.setClock(100000); // Set I²C clock speed to 100kHz (slower for reliability)
-  
-  // Initialize LCD display (I²C address 0x27)
-  display = new Display(0x27, 16, 2);
-  
-  // Initialize Battery Protector with voltage thresholds, rearm delay, and display
-  batteryProtector = new BatteryProtector(
+  display->beginBus(100000); // I²C at 100kHz (slower for reliability), with a short clock stretch limit
+  static Ads1x15 adc(0x48);
+  static Pcf8574 relays(0x20);
+  static const BankConfig banks[] = {
+    // name, ADC, input, relay bit, divider, cutoff, rearm, rearm delay
+    { "house", &adc, 0, 0, 0.2f, HOUSE_CUTOFF_THRESHOLD, HOUSE_REARM_THRESHOLD, REARM_DELAY_SECONDS * 1000UL },
+    { "start", &adc, 1, 1, 0.2f, STARTER_CUTOFF_THRESHOLD, STARTER_REARM_THRESHOLD, REARM_DELAY_SECONDS * 1000UL }
+  };
+  static MultiBankProtector protector(banks, sizeof(banks) / sizeof(banks[0]), &relays, display);
+  multiBankProtector = &protector;
+  multiBankProtector->printMemoryReport(Serial); // No serial commands here: once at boot
+#else
+  // Initialize Battery Protector with voltage thresholds, rearm delay, and display;
+  // the relay is decided when this returns (boot report: "Boot: relay decided ...")
+  static BatteryProtector protector(
     VOLTAGE_CUTOFF_THRESHOLD,
     VOLTAGE_REARM_THRESHOLD,
     REARM_DELAY_SECONDS * 1000UL,  // Convert seconds to milliseconds
     display
   );
+  batteryProtector = &protector;
+  
+  // Peripherals after the decision; neither needs a settling delay. The
+  // display task brings the LCD up in the background
+  Serial.begin(115200);
+  display->beginBus(100000); // I²C at 100kHz (slower for reliability), with a short clock stretch limit
+  
+  batteryProtector->setLowPowerMode(LOW_POWER_MODE);
+  batteryProtector->setDeepSleepInCutoff(DEEP_SLEEP_IN_CUTOFF);
+  batteryProtector->setTelemetry(SERIAL_TELEMETRY);
+  batteryProtector->setHistoryLog(HISTORY_LOG);
+#if MQTT_TELEMETRY
+  static MqttPublisher mqtt;
+  MqttConfig mqttConfig = MqttPublisher::defaultConfig();
+  const uint8_t brokerAddress[] = { MQTT_BROKER_ADDRESS };
+  memcpy(mqttConfig.brokerAddress, brokerAddress, sizeof(brokerAddress));
+  mqttConfig.ssid = MQTT_WIFI_SSID;
+  mqttConfig.password = MQTT_WIFI_PASSWORD;
+  mqttConfig.brokerPort = MQTT_BROKER_PORT;
+  mqttConfig.clientId = MQTT_CLIENT_ID;
+  mqttConfig.topic = MQTT_TOPIC;
+  batteryProtector->setMqttPublisher(&mqtt, mqttConfig);
+#endif
+  batteryProtector->setNominalLoadCurrent(NOMINAL_LOAD_AMPS);
+  batteryProtector->setCutoffInput(CUTOFF_ON_COMPENSATED_VOLTAGE ? BatteryProtector::CUTOFF_INPUT_COMPENSATED : BatteryProtector::CUTOFF_INPUT_TERMINAL);
+#if CRANK_RIDE_THROUGH
+  TransientConfig crank = TransientClassifier::defaultConfig();
+  crank.dwellMs = CRANK_DWELL_MS;
+  crank.collapseMillivolts = (uint16_t)(CRANK_COLLAPSE_VOLTS * 1000.0f);
+  crank.collapseMs = CRANK_COLLAPSE_MS;
+  batteryProtector->setTransientRideThrough(crank);
+#endif
+#if CURRENT_SENSOR
+  static CurrentSensor currentSensor(CURRENT_SENSOR_INA226 ? CurrentSensor::CHIP_INA226 : CurrentSensor::CHIP_INA219, 0x40, CURRENT_SHUNT_MILLIOHMS);
+  batteryProtector->setCurrentSensor(&currentSensor, BATTERY_CAPACITY_AH);
+  if (SOC_CUTOFF_PERCENT > 0) {
+    batteryProtector->setStateOfChargeCutoff(SOC_CUTOFF_PERCENT);
+    batteryProtector->setCutoffInput(BatteryProtector::CUTOFF_INPUT_STATE_OF_CHARGE);
+  }
+#endif
+#if LOOP_WATCHDOG
+  WatchdogConfig watchdog;
+  watchdog.timeoutMs = LOOP_WATCHDOG_MS;
+  watchdog.safeState = LOOP_WATCHDOG_SAFE_RELAY_OPEN ? LoopWatchdog::SAFE_RELAY_OPEN : LoopWatchdog::SAFE_RELAY_CLOSED;
+  batteryProtector->setLoopWatchdog(watchdog);
+#endif
+#if TEMPERATURE_SENSOR
+  static TemperatureSensor temperatureSensor(TEMPERATURE_SENSOR_PIN);
+  batteryProtector->setTemperatureSensor(&temperatureSensor, TEMPERATURE_MV_PER_C);
+#endif
+#endif
 }
 
 void loop() {
-  // Update battery protector (handles voltage monitoring, state management, and display updates)
+#if MULTI_BANK
+  multiBankProtector->update();
+  multiBankProtector->idle();
+#else
+  // Update battery protector (runs due tasks: sampling, state, LEDs, buzzer, display)
   batteryProtector->update();
   
-  delay(500); // 500ms delay to prevent tight loop
+  // Sleep until the next task is due (delay() or light sleep; deep sleep
+  // in cutoff restarts the sketch from setup() on wake-up)
+  batteryProtector->idle();
+#endif
 }
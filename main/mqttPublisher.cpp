@@ -0,0 +1,529 @@
+#include "Arduino.h"
+#include <ESP8266WiFi.h>
+#include "mqttPublisher.h"
+#include "systemClock.h"
+
+//////////////////////////////////////////////////////////
+// MQTT CLIENT
+//////////////////////////////////////////////////////////
+MqttClient :: MqttClient() {
+  _config = nullptr;
+  _pcb = nullptr;
+  _state = STATE_OFFLINE;
+  _stateAtMs = 0;
+  _retryAtMs = 0;
+  _retryMs = RETRY_MIN_MS;
+  _lastSendMs = 0;
+  _isPublishing = false;
+  _publishAtMs = 0;
+  _packetId = 0;
+  _isAcked = false;
+  _isPinging = false;
+  _pingAtMs = 0;
+  _connects = 0;
+  _drops = 0;
+  _isTcpUp = false;
+  _isLost = false;
+  _isRefused = false;
+  _rxType = 0;
+  _rxRemaining = 0;
+  _rxShift = 0;
+  _rxPhase = 0;
+  _rxBodyLength = 0;
+}
+
+void MqttClient :: begin(const MqttConfig* config) {
+  _config = config;
+  // Credentials stay out of the SDK's flash config: no sector write per boot
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  WiFi.begin(_config->ssid, _config->password); // Returns at once; the SDK associates and reconnects
+  _state = STATE_OFFLINE;
+  _retryAtMs = SystemClock::millis();
+}
+
+void MqttClient :: poll(unsigned long nowMs) {
+  if (!_config) {
+    return;
+  }
+  if (_state != STATE_OFFLINE && (_isLost || _isRefused || WiFi.status() != WL_CONNECTED)) {
+    _drop(nowMs);
+  }
+
+  switch (_state) {
+    case STATE_OFFLINE:
+      if (WiFi.status() == WL_CONNECTED && (long)(nowMs - _retryAtMs) >= 0) {
+        _connect(nowMs);
+      }
+      break;
+    case STATE_CONNECTING:
+      if (_isTcpUp) {
+        _sendConnect(nowMs);
+      } else if (nowMs - _stateAtMs >= CONNECT_TIMEOUT_MS) {
+        _drop(nowMs);
+      }
+      break;
+    case STATE_HANDSHAKE:
+      if (nowMs - _stateAtMs >= CONNECT_TIMEOUT_MS) {
+        _drop(nowMs);
+      }
+      break;
+    case STATE_CONNECTED:
+      if ((_isPublishing && nowMs - _publishAtMs >= RESPONSE_TIMEOUT_MS) || (_isPinging && nowMs - _pingAtMs >= RESPONSE_TIMEOUT_MS)) {
+        _drop(nowMs); // Half-open: the broker or the path to it went quiet
+      } else if (!_isPinging && nowMs - _lastSendMs >= _config->keepAliveSeconds * 750UL && _canWrite(2)) {
+        // Quiet for 3/4 of the keep-alive: ping before the broker gives up on us
+        const uint8_t ping[] = { PACKET_PINGREQ << 4, 0 };
+        _write(ping, sizeof(ping), false);
+        _endPacket(nowMs);
+        _isPinging = true;
+        _pingAtMs = nowMs;
+      }
+      break;
+  }
+}
+
+bool MqttClient :: publish(const uint8_t* payload, uint16_t length, unsigned long nowMs) {
+  if (!canPublish()) {
+    return false;
+  }
+  uint16_t topicLength = (uint16_t)strlen(_config->topic);
+  uint8_t header[7];
+  uint8_t headerLength = 0;
+  header[headerLength++] = (PACKET_PUBLISH << 4) | 0x02; // QoS 1
+  headerLength += _putRemainingLength(2 + topicLength + 2 + (uint32_t)length, &header[headerLength]);
+  header[headerLength++] = (uint8_t)(topicLength >> 8);
+  header[headerLength++] = (uint8_t)(topicLength & 0xFF);
+  if (!_canWrite(headerLength + topicLength + 2 + length)) {
+    return false; // lwIP still holds earlier data; try next time
+  }
+  _packetId = _packetId == 0xFFFF ? 1 : _packetId + 1;
+  uint8_t packetId[2] = { (uint8_t)(_packetId >> 8), (uint8_t)(_packetId & 0xFF) };
+  _write(header, headerLength, true);
+  _write(_config->topic, topicLength, true);
+  _write(packetId, sizeof(packetId), true);
+  _write(payload, length, false);
+  _endPacket(nowMs);
+  _isPublishing = true;
+  _isAcked = false;
+  _publishAtMs = nowMs;
+  return true;
+}
+
+bool MqttClient :: takeAck() {
+  bool acked = _isAcked;
+  _isAcked = false;
+  return acked;
+}
+
+void MqttClient :: _connect(unsigned long nowMs) {
+  _isTcpUp = false;
+  _isLost = false;
+  _isRefused = false;
+  _rxPhase = 0;
+  _state = STATE_CONNECTING;
+  _stateAtMs = nowMs;
+  _pcb = tcp_new();
+  if (!_pcb) {
+    _drop(nowMs); // Out of pcbs: try again later
+    return;
+  }
+  tcp_arg(_pcb, this);
+  tcp_err(_pcb, &MqttClient::_onError);
+  tcp_recv(_pcb, &MqttClient::_onReceive);
+  ip_addr_t address;
+  IP_ADDR4(&address, _config->brokerAddress[0], _config->brokerAddress[1], _config->brokerAddress[2], _config->brokerAddress[3]);
+  if (tcp_connect(_pcb, &address, _config->brokerPort, &MqttClient::_onConnected) != ERR_OK) {
+    _drop(nowMs);
+  }
+}
+
+void MqttClient :: _drop(unsigned long nowMs) {
+  if (_pcb) {
+    // Detach first: tcp_abort() reports ERR_ABRT to the error callback
+    tcp_arg(_pcb, nullptr);
+    tcp_err(_pcb, nullptr);
+    tcp_recv(_pcb, nullptr);
+    tcp_abort(_pcb);
+    _pcb = nullptr;
+  }
+  _drops++;
+  _state = STATE_OFFLINE;
+  _retryAtMs = nowMs + _retryMs;
+  _retryMs = _retryMs * 2 < RETRY_MAX_MS ? _retryMs * 2 : RETRY_MAX_MS;
+  _isPublishing = false;
+  _isAcked = false;
+  _isPinging = false;
+  _isTcpUp = false;
+  _isLost = false;
+  _isRefused = false;
+}
+
+void MqttClient :: _sendConnect(unsigned long nowMs) {
+  uint16_t idLength = (uint16_t)strlen(_config->clientId);
+  uint8_t header[5 + 10 + 2];
+  uint8_t headerLength = 0;
+  header[headerLength++] = PACKET_CONNECT << 4;
+  headerLength += _putRemainingLength(10 + 2 + (uint32_t)idLength, &header[headerLength]);
+  const uint8_t variable[] = {
+    0, 4, 'M', 'Q', 'T', 'T', 4, // Protocol name and level (3.1.1)
+    0x02,                        // Clean session; no will, user name or password
+    (uint8_t)(_config->keepAliveSeconds >> 8), (uint8_t)(_config->keepAliveSeconds & 0xFF),
+    (uint8_t)(idLength >> 8), (uint8_t)(idLength & 0xFF)
+  };
+  memcpy(&header[headerLength], variable, sizeof(variable));
+  headerLength += sizeof(variable);
+  if (!_canWrite(headerLength + idLength)) {
+    _isLost = true; // An empty send buffer always takes a CONNECT
+    return;
+  }
+  _write(header, headerLength, true);
+  _write(_config->clientId, idLength, false);
+  _endPacket(nowMs);
+  _state = STATE_HANDSHAKE;
+}
+
+bool MqttClient :: _canWrite(uint16_t length) {
+  return _pcb && tcp_sndbuf(_pcb) >= length;
+}
+
+void MqttClient :: _write(const void* data, uint16_t length, bool more) {
+  // Copied into lwIP's buffers: the caller's data may change right after
+  if (tcp_write(_pcb, data, length, TCP_WRITE_FLAG_COPY | (more ? TCP_WRITE_FLAG_MORE : 0)) != ERR_OK) {
+    _isLost = true; // Part of a packet is missing: the stream is useless
+  }
+}
+
+void MqttClient :: _endPacket(unsigned long nowMs) {
+  tcp_output(_pcb);
+  _lastSendMs = nowMs;
+}
+
+uint8_t MqttClient :: _putRemainingLength(uint32_t length, uint8_t* out) {
+  uint8_t count = 0;
+  do {
+    uint8_t byte = length & 0x7F;
+    length >>= 7;
+    out[count++] = length ? (byte | 0x80) : byte;
+  } while (length && count < 4);
+  return count;
+}
+
+void MqttClient :: _receive(uint8_t byte) {
+  switch (_rxPhase) {
+    case 0: // Packet type
+      _rxType = byte >> 4;
+      _rxRemaining = 0;
+      _rxShift = 0;
+      _rxBodyLength = 0;
+      _rxPhase = 1;
+      break;
+    case 1: // Remaining length
+      _rxRemaining |= (uint32_t)(byte & 0x7F) << _rxShift;
+      _rxShift += 7;
+      if (!(byte & 0x80)) {
+        if (_rxRemaining == 0) {
+          _handlePacket();
+          _rxPhase = 0;
+        } else {
+          _rxPhase = 2;
+        }
+      } else if (_rxShift >= 28) {
+        _isRefused = true; // Longer than MQTT allows
+        _rxPhase = 0;
+      }
+      break;
+    default: // Body: only the first two bytes matter for what a broker sends us
+      if (_rxBodyLength < sizeof(_rxBody)) {
+        _rxBody[_rxBodyLength++] = byte;
+      }
+      if (--_rxRemaining == 0) {
+        _handlePacket();
+        _rxPhase = 0;
+      }
+      break;
+  }
+}
+
+void MqttClient :: _handlePacket() {
+  switch (_rxType) {
+    case PACKET_CONNACK:
+      if (_state == STATE_HANDSHAKE && _rxBodyLength == 2 && _rxBody[1] == 0) {
+        _state = STATE_CONNECTED;
+        _stateAtMs = SystemClock::millis();
+        _retryMs = RETRY_MIN_MS;
+        _connects++;
+      } else {
+        _isRefused = true; // Bad client id, not authorised, server unavailable...
+      }
+      break;
+    case PACKET_PUBACK:
+      if (_isPublishing && _rxBodyLength == 2 && (uint16_t)((_rxBody[0] << 8) | _rxBody[1]) == _packetId) {
+        _isPublishing = false;
+        _isAcked = true;
+      }
+      break;
+    case PACKET_PINGRESP:
+      _isPinging = false;
+      break;
+    default:
+      break; // Nothing subscribed: anything else is ignored
+  }
+}
+
+err_t MqttClient :: _onConnected(void* arg, struct tcp_pcb* pcb, err_t err) {
+  MqttClient* self = static_cast<MqttClient*>(arg);
+  if (self) {
+    self->_isTcpUp = true;
+  }
+  return ERR_OK;
+}
+
+err_t MqttClient :: _onReceive(void* arg, struct tcp_pcb* pcb, struct pbuf* p, err_t err) {
+  MqttClient* self = static_cast<MqttClient*>(arg);
+  if (!p) {
+    if (self) {
+      self->_isLost = true; // Closed by the broker
+    }
+    return ERR_OK;
+  }
+  if (self) {
+    uint8_t chunk[32];
+    for (uint16_t offset = 0; offset < p->tot_len; offset += sizeof(chunk)) {
+      uint16_t length = pbuf_copy_partial(p, chunk, sizeof(chunk), offset);
+      for (uint16_t i = 0; i < length; i++) {
+        self->_receive(chunk[i]);
+      }
+    }
+  }
+  tcp_recved(pcb, p->tot_len);
+  pbuf_free(p);
+  return ERR_OK;
+}
+
+void MqttClient :: _onError(void* arg, err_t err) {
+  MqttClient* self = static_cast<MqttClient*>(arg);
+  if (self) {
+    self->_pcb = nullptr; // lwIP freed it
+    self->_isLost = true;
+  }
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// MQTT PUBLISHER
+//////////////////////////////////////////////////////////
+MqttPublisher :: MqttPublisher() {
+  _config = defaultConfig();
+  _ready = false;
+  _batchLength = 0;
+  _batchSamples = 0;
+  _batchSequence = 0;
+  _seconds = 0;
+  _millivolts = 0;
+  _head = 0;
+  _count = 0;
+  _queuedBatches = 0;
+  _inFlight = SOURCE_NONE;
+  _mayErase = false;
+  _published = 0;
+  _dropped = 0;
+}
+
+MqttConfig MqttPublisher :: defaultConfig() {
+  MqttConfig config;
+  config.ssid = "";
+  config.password = "";
+  config.brokerAddress[0] = 192;
+  config.brokerAddress[1] = 168;
+  config.brokerAddress[2] = 1;
+  config.brokerAddress[3] = 10;
+  config.brokerPort = 1883;
+  config.clientId = "battery-protector";
+  config.topic = "battery/telemetry";
+  config.batchSeconds = 60;
+  config.keepAliveSeconds = 120;
+  return config;
+}
+
+void MqttPublisher :: begin(const MqttConfig& config, uint32_t spoolFirstSector, uint16_t spoolSectorCount) {
+  _config = config;
+  if (_config.batchSeconds == 0) {
+    _config.batchSeconds = 1;
+  }
+  _spool.begin(spoolFirstSector, spoolSectorCount); // Without it, overflow is dropped
+  _client.begin(&_config);
+  _ready = true;
+}
+
+void MqttPublisher :: addSample(uint16_t millivolts, uint32_t elapsedSeconds) {
+  if (!_ready) {
+    return;
+  }
+  if (elapsedSeconds == 0) {
+    elapsedSeconds = 1;
+  }
+  if (_batchLength == 0) {
+    _openBatch();
+  }
+  uint32_t skipSeconds = elapsedSeconds - 1;
+  while (skipSeconds > 0) {
+    uint32_t chunk = skipSeconds < 0xFFFFFFUL ? skipSeconds : 0xFFFFFFUL;
+    _appendEntry(HistoryEncoder::skipEntry(chunk));
+    _seconds += chunk;
+    skipSeconds -= chunk;
+  }
+  _appendEntry(HistoryEncoder::sampleEntry((int32_t)millivolts - (int32_t)_millivolts));
+  _seconds++;
+  _millivolts = millivolts;
+  _batchSamples++;
+  if (_batchSamples >= _config.batchSeconds) {
+    _closeBatch();
+  }
+}
+
+void MqttPublisher :: addEvent(HistoryEvent event) {
+  if (!_ready) {
+    return;
+  }
+  if (_batchLength == 0) {
+    _openBatch();
+  }
+  _appendEntry(HistoryEncoder::eventEntry(event));
+  _closeBatch(); // Events go out now, not at the end of the minute
+}
+
+void MqttPublisher :: update(bool mayErase) {
+  if (!_ready) {
+    return;
+  }
+  _mayErase = mayErase;
+  unsigned long nowMs = SystemClock::millis();
+  _client.poll(nowMs);
+  _spool.maintain(mayErase);
+
+  if (_client.takeAck()) {
+    if (_inFlight == SOURCE_SPOOL) {
+      _spool.remove();
+      _published++;
+    } else if (_inFlight == SOURCE_QUEUE) {
+      _popQueue();
+      _published++;
+    }
+    _inFlight = SOURCE_NONE;
+  }
+  if (!_client.isConnected()) {
+    _inFlight = SOURCE_NONE; // Sent again on the next connection
+  }
+
+  // Oldest first: the spool only ever holds batches older than the queue
+  if (_inFlight == SOURCE_NONE && _client.canPublish()) {
+    Source source = SOURCE_SPOOL;
+    uint16_t length = _spool.peek(_message, sizeof(_message));
+    if (length == 0) {
+      source = SOURCE_QUEUE;
+      length = _peekQueue(_message);
+    }
+    if (length > 0 && _client.publish(_message, length, nowMs)) {
+      _inFlight = source;
+    }
+  }
+}
+
+void MqttPublisher :: sync() {
+  if (!_ready) {
+    return;
+  }
+  _closeBatch();
+  while (_evictOldest(true)) {
+  }
+}
+
+void MqttPublisher :: _openBatch() {
+  // The header holds the sample the first delta refers to
+  HistorySectorHeader header;
+  header.magic = HistoryDecoder::MAGIC;
+  header.sequence = _batchSequence++;
+  header.startSeconds = _seconds;
+  header.startMillivolts = _millivolts;
+  header.check = HistoryDecoder::headerCheck(header);
+  memcpy(_batch, &header, sizeof(header));
+  _batchLength = sizeof(header);
+  _batchSamples = 0;
+}
+
+void MqttPublisher :: _appendEntry(uint32_t entry) {
+  uint8_t bytes[HistoryDecoder::MAX_ENTRY_BYTES];
+  uint8_t length = HistoryEncoder::put(entry, bytes);
+  if (_batchLength + length > MAX_BATCH_BYTES) {
+    _closeBatch();
+    _openBatch();
+  }
+  memcpy(&_batch[_batchLength], bytes, length);
+  _batchLength += length;
+}
+
+void MqttPublisher :: _closeBatch() {
+  if (_batchLength == 0) {
+    return;
+  }
+  _enqueue(_batch, _batchLength);
+  _batchLength = 0;
+}
+
+void MqttPublisher :: _enqueue(const uint8_t* data, uint16_t length) {
+  uint16_t needed = 2 + length;
+  while (QUEUE_SIZE - _count < needed && _evictOldest(_mayErase)) {
+  }
+  uint16_t tail = (_head + _count) % QUEUE_SIZE;
+  _queue[tail] = (uint8_t)(length & 0xFF);
+  _queue[(tail + 1) % QUEUE_SIZE] = (uint8_t)(length >> 8);
+  for (uint16_t i = 0; i < length; i++) {
+    _queue[(tail + 2 + i) % QUEUE_SIZE] = data[i];
+  }
+  _count += needed;
+  _queuedBatches++;
+}
+
+bool MqttPublisher :: _evictOldest(bool mayErase) {
+  uint8_t batch[MAX_BATCH_BYTES];
+  uint16_t length = _peekQueue(batch);
+  if (length == 0) {
+    return false;
+  }
+  if (!_spool.append(batch, length, mayErase)) {
+    _dropped++; // No spool, or no sector erase allowed right now
+  }
+  if (_inFlight == SOURCE_QUEUE) {
+    _inFlight = SOURCE_NONE; // Its PUBACK no longer removes anything; the spool sends it again
+  }
+  _popQueue();
+  return true;
+}
+
+uint16_t MqttPublisher :: _peekQueue(uint8_t* data) {
+  if (_count == 0) {
+    return 0;
+  }
+  uint16_t length = (uint16_t)(_queue[_head] | (_queue[(_head + 1) % QUEUE_SIZE] << 8));
+  _queueRead((_head + 2) % QUEUE_SIZE, data, length);
+  return length;
+}
+
+void MqttPublisher :: _popQueue() {
+  if (_count == 0) {
+    return;
+  }
+  uint16_t length = (uint16_t)(_queue[_head] | (_queue[(_head + 1) % QUEUE_SIZE] << 8));
+  _head = (_head + 2 + length) % QUEUE_SIZE;
+  _count -= 2 + length;
+  _queuedBatches--;
+}
+
+void MqttPublisher :: _queueRead(uint16_t offset, uint8_t* data, uint16_t length) {
+  for (uint16_t i = 0; i < length; i++) {
+    data[i] = _queue[(offset + i) % QUEUE_SIZE];
+  }
+}
+//////////////////////////////////////////////////////////
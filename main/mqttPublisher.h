@@ -0,0 +1,206 @@
+#ifndef mqttPublisher_h
+#define mqttPublisher_h
+
+#include "Arduino.h"
+#include <lwip/tcp.h>
+#include "flashSpool.h"
+#include "historyLog.h"
+
+//////////////////////////////////////////////////////////
+// MQTT CONFIGURATION
+//////////////////////////////////////////////////////////
+struct MqttConfig {
+  const char* ssid;
+  const char* password;
+  uint8_t brokerAddress[4]; // IPv4; no DNS lookup
+  uint16_t brokerPort;
+  const char* clientId;
+  const char* topic;        // Batches are published here at QoS 1
+  uint16_t batchSeconds;    // One payload per this many 1 Hz samples
+  uint16_t keepAliveSeconds;
+};
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// MQTT CLIENT (3.1.1 over the lwIP raw TCP API)
+//////////////////////////////////////////////////////////
+// Just what a publisher needs: CONNECT with a clean session, PUBLISH at
+// QoS 1 with one message in flight, PINGREQ for the keep-alive. The
+// core's WiFiClient blocks in connect() for up to its timeout; the raw
+// API does not block anywhere: tcp_connect() and tcp_write() return at
+// once, and lwIP calls back (between sketch code, never concurrently)
+// when the connection is up, data arrives or the connection is lost.
+// The callbacks only parse and record what happened; poll() does the
+// rest, and is the only place a connection is aborted.
+//
+// Anything that goes quiet is dropped and retried: no CONNACK within
+// CONNECT_TIMEOUT_MS, no PUBACK or PINGRESP within RESPONSE_TIMEOUT_MS.
+// Retries back off from RETRY_MIN_MS to RETRY_MAX_MS.
+class MqttClient {
+  public:
+    static const unsigned long CONNECT_TIMEOUT_MS = 10000;
+    static const unsigned long RESPONSE_TIMEOUT_MS = 10000;
+    static const unsigned long RETRY_MIN_MS = 1000;
+    static const unsigned long RETRY_MAX_MS = 60000;
+
+    enum State {
+      STATE_OFFLINE,    // Waiting for WiFi or for the retry time
+      STATE_CONNECTING, // TCP handshake
+      STATE_HANDSHAKE,  // CONNECT sent, waiting for CONNACK
+      STATE_CONNECTED
+    };
+
+    MqttClient();
+    void begin(const MqttConfig* config); // Joins the access point; connects from poll()
+    void poll(unsigned long nowMs);
+
+    State getState() { return _state; }
+    bool isConnected() { return _state == STATE_CONNECTED; }
+    bool canPublish() { return _state == STATE_CONNECTED && !_isPublishing; }
+    bool publish(const uint8_t* payload, uint16_t length, unsigned long nowMs); // False when not possible right now
+    bool takeAck(); // True once after the PUBACK of the last publish()
+    unsigned long getConnectCount() { return _connects; } // Sessions that reached CONNACK
+    unsigned long getDropCount() { return _drops; }       // Sessions or attempts given up
+
+  private:
+    static const uint8_t PACKET_CONNECT = 1;
+    static const uint8_t PACKET_CONNACK = 2;
+    static const uint8_t PACKET_PUBLISH = 3;
+    static const uint8_t PACKET_PUBACK = 4;
+    static const uint8_t PACKET_PINGREQ = 12;
+    static const uint8_t PACKET_PINGRESP = 13;
+
+    const MqttConfig* _config;
+    struct tcp_pcb* _pcb;
+    State _state;
+    unsigned long _stateAtMs;
+    unsigned long _retryAtMs;
+    unsigned long _retryMs;     // Next back-off
+    unsigned long _lastSendMs;
+    bool _isPublishing;         // PUBLISH sent, PUBACK not yet
+    unsigned long _publishAtMs;
+    uint16_t _packetId;
+    bool _isAcked;
+    bool _isPinging;
+    unsigned long _pingAtMs;
+    unsigned long _connects;
+    unsigned long _drops;
+
+    // Set from the lwIP callbacks; poll() acts on them
+    bool _isTcpUp;
+    bool _isLost;               // pcb gone (error callback), closed by the broker, or a write failed
+    bool _isRefused;            // CONNACK with an error code, or a malformed packet
+
+    // Incoming packet being parsed: fixed header, remaining length, up to 2 body bytes
+    uint8_t _rxType;
+    uint32_t _rxRemaining;
+    uint8_t _rxShift;
+    uint8_t _rxPhase;
+    uint8_t _rxBody[2];
+    uint8_t _rxBodyLength;
+
+    void _connect(unsigned long nowMs);
+    void _drop(unsigned long nowMs);
+    void _sendConnect(unsigned long nowMs);
+    bool _canWrite(uint16_t length); // Room for a whole packet in lwIP's send buffer
+    void _write(const void* data, uint16_t length, bool more);
+    void _endPacket(unsigned long nowMs);
+    void _receive(uint8_t byte);
+    void _handlePacket();
+    static uint8_t _putRemainingLength(uint32_t length, uint8_t* out);
+    static err_t _onConnected(void* arg, struct tcp_pcb* pcb, err_t err);
+    static err_t _onReceive(void* arg, struct tcp_pcb* pcb, struct pbuf* p, err_t err);
+    static void _onError(void* arg, err_t err);
+};
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// MQTT PUBLISHER (batched telemetry with offline buffering)
+//////////////////////////////////////////////////////////
+// Collects one voltage sample per second and the protector's events
+// into batches, and publishes each batch as one QoS 1 message. A batch
+// is a history sector in miniature: a HistorySectorHeader (sequence =
+// batch number since boot, startSeconds = seconds since boot) followed
+// by history entries, so ~80 bytes carry a minute of readings and the
+// history tools decode it. A batch closes after batchSeconds samples,
+// when it is full, or right after an event, so a cutoff goes out
+// without waiting for the minute to end.
+//
+// Closed batches wait in a RAM queue until the broker acknowledges
+// them. When the queue is full (the broker unreachable for longer than
+// it holds), the oldest batch moves to a FlashSpool; without a spool,
+// or with the spool unable to take it, it is dropped and counted.
+// Spooled batches are older than any in RAM and are sent first, and
+// they survive a reset. sync() moves everything to flash before a
+// deep sleep.
+//
+// update() never waits for the network: it runs the client state
+// machine, writes at most one message into lwIP's send buffer, and
+// erases a spool sector only when the caller allows it.
+class MqttPublisher {
+  public:
+    static const uint16_t QUEUE_SIZE = 1536;       // ~16 one-minute batches
+    static const uint16_t MAX_BATCH_BYTES = 192;   // One TCP segment with the MQTT header
+
+    MqttPublisher();
+    static MqttConfig defaultConfig(); // Broker port 1883, one batch per minute, 120 s keep-alive
+
+    void begin(const MqttConfig& config, uint32_t spoolFirstSector, uint16_t spoolSectorCount);
+    void addSample(uint16_t millivolts, uint32_t elapsedSeconds); // elapsedSeconds since the previous sample, at least 1
+    void addEvent(HistoryEvent event);
+    void update(bool mayErase); // Non-blocking; call every 100 ms or so
+    void sync(); // Open batch and RAM queue to flash (before a deep sleep)
+
+    bool isConnected() { return _client.isConnected(); }
+    uint16_t getQueuedBatches() { return _queuedBatches; }           // In RAM
+    uint32_t getSpooledBatches() { return _spool.getPendingCount(); } // In flash
+    unsigned long getPublishedBatches() { return _published; }       // Acknowledged by the broker
+    unsigned long getDroppedBatches() { return _dropped + _spool.getDroppedCount(); }
+    MqttClient& getClient() { return _client; }
+
+  private:
+    enum Source {
+      SOURCE_NONE,
+      SOURCE_SPOOL,
+      SOURCE_QUEUE
+    };
+
+    MqttConfig _config;
+    MqttClient _client;
+    FlashSpool _spool;
+    bool _ready;
+
+    // Batch being filled
+    uint8_t _batch[MAX_BATCH_BYTES];
+    uint16_t _batchLength;      // 0: none open
+    uint16_t _batchSamples;
+    uint32_t _batchSequence;
+    uint32_t _seconds;          // Time of the last sample
+    uint16_t _millivolts;       // Last sample
+
+    // Closed batches: uint16 length, then the bytes, in a ring
+    uint8_t _queue[QUEUE_SIZE];
+    uint16_t _head;
+    uint16_t _count;
+    uint16_t _queuedBatches;
+
+    uint8_t _message[MAX_BATCH_BYTES]; // Batch in flight
+    Source _inFlight;
+    bool _mayErase;                    // From the last update()
+    unsigned long _published;
+    unsigned long _dropped;
+
+    void _openBatch();
+    void _appendEntry(uint32_t entry);
+    void _closeBatch();
+    void _enqueue(const uint8_t* data, uint16_t length);
+    bool _evictOldest(bool mayErase); // Oldest RAM batch to the spool (or dropped); false when the queue is empty
+    uint16_t _peekQueue(uint8_t* data); // Oldest RAM batch; 0 when none
+    void _popQueue();
+    void _queueRead(uint16_t offset, uint8_t* data, uint16_t length);
+};
+//////////////////////////////////////////////////////////
+
+#endif
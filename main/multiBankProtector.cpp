@@ -0,0 +1,490 @@
+#include "Arduino.h"
+#include "multiBankProtector.h"
+#include "systemClock.h"
+
+//////////////////////////////////////////////////////////
+// MULTI-BANK PROTECTOR
+//////////////////////////////////////////////////////////
+MultiBankProtector :: MultiBankProtector(const BankConfig* banks, uint8_t bankCount, Pcf8574* relays, Display* display) :
+  _greenLED(&_greenLEDPin),
+  _redLED(&_redLEDPin),
+  _testButton(&_testButtonPin, BUTTON_DEBOUNCE_MS, BUTTON_LONG_PRESS_MS),
+  _buzzer(&_buzzerPin)
+{
+  Serial.println("Initializing Multi-Bank Protector...");
+  _relays = relays;
+  _display = display;
+  _bankCount = bankCount > MAX_BANKS ? MAX_BANKS : bankCount;
+  _convertingBank = -1;
+  _nextBank = 0;
+  _conversionStartUs = 0;
+  _lastLEDToggleMs = SystemClock::millis();
+  _lastDisplayMs = 0;
+  _isDisplayDirty = true;
+  _displayPage = 0;
+  _displayPageAtMs = SystemClock::millis();
+  _power.begin();
+
+  // All relays open until each bank has a reading
+  _relays->writePort(0xFF);
+
+  for (uint8_t i = 0; i < _bankCount; i++) {
+    Bank& bank = _banks[i];
+    bank.config = banks[i];
+    bank.relayPin = ExpanderPin(_relays, bank.config.relayBit);
+    bank.scaleQ16 = (uint32_t)(65536.0f / bank.config.dividerRatio + 0.5f);
+    bank.cutoffMillivolts = (uint16_t)(bank.config.cutoffVolts * 1000.0f + 0.5f);
+    bank.rearmMillivolts = (uint16_t)(bank.config.rearmVolts * 1000.0f + 0.5f);
+    bank.tripMillivolts = bank.cutoffMillivolts - TRIP_MARGIN_MILLIVOLTS;
+    bank.millivolts = 0;
+    bank.tripCount = 0;
+    bank.failedReadings = 0;
+    bank.isWaitingForRearm = false;
+    bank.rearmCountdownStartMs = 0;
+    bank.isVerifyingRearm = false;
+    bank.isRearmSettled = false;
+    bank.rearmVerifyAtMs = 0;
+    _restartFilter(bank);
+
+    // First reading in line, so the relay decision does not wait for a
+    // whole round of the sample task
+    uint16_t adcMillivolts = 0;
+    bool ok = bank.config.adc->startConversion(bank.config.adcInput);
+    if (ok) {
+      delayMicroseconds(bank.config.adc->getConversionUs());
+      ok = bank.config.adc->readMillivolts(adcMillivolts);
+    }
+    if (ok) {
+      _filter(bank, (uint16_t)(((uint32_t)adcMillivolts * bank.scaleQ16) >> 16));
+    }
+    if (ok && bank.millivolts >= bank.cutoffMillivolts) {
+      bank.state = STATE_ARMED;
+      bank.relayPin.doDigitalWrite(LOW); // LOW connects the load (inverted logic)
+      _printBank("Armed", bank);
+    } else {
+      bank.state = STATE_CUTOFF;
+      bank.failedReadings = ok ? 0 : 1;
+      _printBank(ok ? "Below cutoff, relay open" : "No reading, relay open", bank);
+      _buzzer.startAlarm(1000, 5000);
+    }
+  }
+
+  if (_display) {
+    _display->init();
+    _displayInitStep = 1;
+    _displayStepAtMs = SystemClock::millis() + 100;
+  } else {
+    _displayInitStep = 0;
+    _displayStepAtMs = 0;
+  }
+
+  _scheduler.addTask("sample", &MultiBankProtector::_taskSample, this, SAMPLE_PERIOD_MS, 0);
+  _scheduler.addTask("state", &MultiBankProtector::_taskState, this, STATE_PERIOD_MS, 1);
+  _scheduler.addTask("buzzer", &MultiBankProtector::_taskBuzzer, this, BUZZER_PERIOD_MS, 2);
+  _scheduler.addTask("leds", &MultiBankProtector::_taskLEDs, this, LED_PERIOD_MS, 3);
+  _scheduler.addTask("display", &MultiBankProtector::_taskDisplay, this, DISPLAY_PERIOD_MS, 4);
+
+  Serial.print("Multi-Bank Protector ready: ");
+  Serial.print((unsigned int)_bankCount);
+  Serial.print(" banks, each read every ");
+  Serial.print(getSampleIntervalMs());
+  Serial.print(" ms, hard drops cut off within ");
+  Serial.print(getWorstCaseTripMs());
+  Serial.println(" ms.");
+}
+
+void MultiBankProtector :: update() {
+  _scheduler.run();
+}
+
+unsigned long MultiBankProtector :: getIdleMs() {
+  return _scheduler.msUntilNextDeadline();
+}
+
+void MultiBankProtector :: idle() {
+  // Light sleep would stop the round robin; the conversions need the CPU awake
+  _power.idle(getIdleMs(), false);
+}
+
+unsigned long MultiBankProtector :: getWorstCaseTripMs() {
+  // The drop lands just after the bank's conversion started: the next
+  // TRIP_READINGS conversions of that bank are one round apart each, and
+  // the last one is read one sample period after it started
+  return (TRIP_READINGS * (unsigned long)_bankCount + 1) * SAMPLE_PERIOD_MS;
+}
+
+void MultiBankProtector :: rearm(uint8_t index) {
+  Bank& bank = _banks[index];
+  bank.state = STATE_ARMED;
+  bank.isWaitingForRearm = false;
+  bank.isVerifyingRearm = false;
+  bank.tripCount = 0;
+  bank.failedReadings = 0;
+  bank.relayPin.doDigitalWrite(LOW);
+  _printBank("Manually rearmed", bank);
+}
+
+void MultiBankProtector :: printStatus() {
+  for (uint8_t i = 0; i < _bankCount; i++) {
+    Bank& bank = _banks[i];
+    _printBank(bank.state == STATE_ARMED ? "ARMED" : "CUTOFF", bank);
+  }
+}
+
+void MultiBankProtector :: printSchedulerStats(Print& out) {
+  _scheduler.printStats(out);
+}
+
+void MultiBankProtector :: printMemoryReport(Print& out) {
+  // Compile-time sizes, budgets for the 64-bit sim build as in
+  // BatteryProtector::printMemoryReport()
+  static_assert(sizeof(_banks) <= 1024, "Banks over their RAM budget");
+  static_assert(sizeof(_scheduler) <= 1280, "Scheduler over its RAM budget");
+  static_assert(sizeof(MultiBankProtector) <= 2816, "Multi-bank protector over its RAM budget");
+  static_assert(sizeof(Ads1x15) <= 48 && sizeof(AnalogMux) <= 48, "Bank ADC over its RAM budget");
+  static_assert(sizeof(Pcf8574) <= 8, "Relay expander over its RAM budget");
+  struct Entry {
+    const char* name;
+    size_t bytes;
+  };
+  const Entry entries[] = {
+    { "pins", sizeof(_greenLEDPin) + sizeof(_redLEDPin) + sizeof(_testButtonPin) + sizeof(_buzzerPin) },
+    { "power", sizeof(_power) },
+    { "scheduler", sizeof(_scheduler) },
+    { "outputs", sizeof(_greenLED) + sizeof(_redLED) + sizeof(_testButton) + sizeof(_buzzer) },
+    { "banks", sizeof(_banks) },
+  };
+  out.println("Component        bytes");
+  size_t componentBytes = 0;
+  for (size_t i = 0; i < sizeof(entries) / sizeof(entries[0]); i++) {
+    out.print(entries[i].name);
+    for (size_t pad = strlen(entries[i].name); pad < 17; pad++) {
+      out.print(' ');
+    }
+    out.println((unsigned long)entries[i].bytes);
+    componentBytes += entries[i].bytes;
+  }
+  out.print("protector state  ");
+  out.println((unsigned long)(sizeof(MultiBankProtector) - componentBytes));
+  out.print("total            ");
+  out.println((unsigned long)sizeof(MultiBankProtector));
+  if (_display) {
+    out.print("display          ");
+    out.println((unsigned long)sizeof(Display));
+  }
+  out.print("relay expander   ");
+  out.println((unsigned long)sizeof(Pcf8574));
+  // One ADC object per distinct chip or mux the banks are read through;
+  // the sketch picks the type, so only the larger size is known here
+  uint8_t adcCount = 0;
+  for (uint8_t i = 0; i < _bankCount; i++) {
+    bool isShared = false;
+    for (uint8_t j = 0; j < i; j++) {
+      isShared = isShared || _banks[j].config.adc == _banks[i].config.adc;
+    }
+    adcCount += isShared ? 0 : 1;
+  }
+  out.print("bank adcs        ");
+  out.print((unsigned int)adcCount);
+  out.print(" x <= ");
+  out.println((unsigned long)(sizeof(Ads1x15) > sizeof(AnalogMux) ? sizeof(Ads1x15) : sizeof(AnalogMux)));
+}
+
+void MultiBankProtector :: _taskSample(void* arg) {
+  MultiBankProtector* self = static_cast<MultiBankProtector*>(arg);
+  unsigned long nowUs = SystemClock::micros();
+  if (self->_convertingBank >= 0) {
+    Bank& bank = self->_banks[self->_convertingBank];
+    if (nowUs - self->_conversionStartUs < bank.config.adc->getConversionUs()) {
+      return; // Not done yet (only when the period is shorter than a conversion)
+    }
+    uint16_t adcMillivolts = 0;
+    bool ok = bank.config.adc->readMillivolts(adcMillivolts);
+    self->_onReading(self->_convertingBank, ok, adcMillivolts);
+    self->_convertingBank = -1;
+  }
+
+  // Next bank in line
+  uint8_t index = self->_nextBank;
+  self->_nextBank = (index + 1) % self->_bankCount;
+  Bank& bank = self->_banks[index];
+  if (bank.config.adc->startConversion(bank.config.adcInput)) {
+    self->_convertingBank = index;
+    self->_conversionStartUs = SystemClock::micros();
+  } else {
+    self->_onReading(index, false, 0);
+  }
+}
+
+void MultiBankProtector :: _onReading(uint8_t index, bool ok, uint16_t adcMillivolts) {
+  Bank& bank = _banks[index];
+  if (!ok) {
+    bank.tripCount = 0;
+    if (bank.failedReadings < MAX_FAILED_READINGS) {
+      bank.failedReadings++;
+    }
+    if (bank.failedReadings >= MAX_FAILED_READINGS && (bank.state == STATE_ARMED || bank.isVerifyingRearm)) {
+      _performCutoff(index, "no reading from the ADC");
+    }
+    return;
+  }
+  bank.failedReadings = 0;
+  uint16_t millivolts = (uint16_t)(((uint32_t)adcMillivolts * bank.scaleQ16) >> 16);
+
+  // Hard drop: open the relay now, the filter would take ~10 readings
+  if (millivolts < bank.tripMillivolts) {
+    if (bank.tripCount < TRIP_READINGS) {
+      bank.tripCount++;
+    }
+    if (bank.tripCount >= TRIP_READINGS && (bank.state == STATE_ARMED || bank.isVerifyingRearm)) {
+      bank.millivolts = millivolts;
+      _performCutoff(index, "fast trip");
+    }
+  } else {
+    bank.tripCount = 0;
+  }
+  _filter(bank, millivolts);
+}
+
+void MultiBankProtector :: _filter(Bank& bank, uint16_t millivolts) {
+  // Median of the last 3 readings, then an EMA in fixed point
+  bank.median[bank.medianNext] = millivolts;
+  bank.medianNext = (bank.medianNext + 1) % MEDIAN_WINDOW;
+  if (bank.medianFill < MEDIAN_WINDOW) {
+    bank.medianFill++;
+  }
+  uint16_t median = millivolts;
+  if (bank.medianFill == MEDIAN_WINDOW) {
+    uint16_t a = bank.median[0];
+    uint16_t b = bank.median[1];
+    uint16_t c = bank.median[2];
+    median = a > b ? (b > c ? b : (a > c ? c : a)) : (a > c ? a : (b > c ? c : b));
+  }
+  int32_t sample = (int32_t)median << EMA_FRACTION_BITS;
+  if (!bank.filterPrimed) {
+    bank.ema = sample;
+    bank.filterPrimed = true;
+  } else {
+    bank.ema += (sample - bank.ema) >> EMA_SHIFT;
+  }
+  bank.millivolts = (uint16_t)((bank.ema + (1 << (EMA_FRACTION_BITS - 1))) >> EMA_FRACTION_BITS);
+}
+
+void MultiBankProtector :: _restartFilter(Bank& bank) {
+  bank.medianFill = 0;
+  bank.medianNext = 0;
+  bank.ema = 0;
+  bank.filterPrimed = false;
+}
+
+void MultiBankProtector :: _taskState(void* arg) {
+  MultiBankProtector* self = static_cast<MultiBankProtector*>(arg);
+  self->_handleTestButton();
+  if (self->_relays->isStale()) {
+    self->_relays->resend(); // An unacknowledged relay write must not stick
+  }
+  for (uint8_t i = 0; i < self->_bankCount; i++) {
+    self->_updateBank(i);
+  }
+}
+
+void MultiBankProtector :: _updateBank(uint8_t index) {
+  Bank& bank = _banks[index];
+  if (bank.isVerifyingRearm) {
+    _verifyRearm(index);
+    return;
+  }
+  unsigned long nowMs = SystemClock::millis();
+  switch (bank.state) {
+    case STATE_ARMED:
+      if (bank.filterPrimed && bank.millivolts < bank.cutoffMillivolts) {
+        _performCutoff(index, "below threshold");
+      }
+      break;
+
+    case STATE_CUTOFF:
+      if (bank.failedReadings > 0 || !bank.filterPrimed) {
+        bank.isWaitingForRearm = false; // No rearm without readings
+      } else if (bank.millivolts >= bank.rearmMillivolts && !bank.isWaitingForRearm) {
+        bank.isWaitingForRearm = true;
+        bank.rearmCountdownStartMs = nowMs;
+        _printBank("Above rearm threshold, countdown started", bank);
+      } else if (bank.millivolts < bank.rearmMillivolts && bank.isWaitingForRearm) {
+        bank.isWaitingForRearm = false;
+        _printBank("Below rearm threshold, countdown cancelled", bank);
+      } else if (bank.isWaitingForRearm && nowMs - bank.rearmCountdownStartMs >= bank.config.rearmDelayMs) {
+        // Close the relay, judge the bank under load after the settle time
+        bank.relayPin.doDigitalWrite(LOW);
+        bank.tripCount = 0;
+        bank.isVerifyingRearm = true;
+        bank.isRearmSettled = false;
+        bank.rearmVerifyAtMs = nowMs + REARM_SETTLE_MS;
+        _printBank("Attempting rearm", bank);
+      }
+      break;
+  }
+}
+
+void MultiBankProtector :: _verifyRearm(uint8_t index) {
+  Bank& bank = _banks[index];
+  if ((long)(SystemClock::millis() - bank.rearmVerifyAtMs) < 0) {
+    return;
+  }
+  if (!bank.isRearmSettled) {
+    _restartFilter(bank); // Only readings under load count
+    bank.isRearmSettled = true;
+    return;
+  }
+  if (!bank.filterPrimed) {
+    return;
+  }
+  bank.isVerifyingRearm = false;
+  bank.isWaitingForRearm = false;
+  if (bank.millivolts >= bank.cutoffMillivolts) {
+    bank.state = STATE_ARMED;
+    _printBank("Rearm successful", bank);
+  } else {
+    bank.relayPin.doDigitalWrite(HIGH);
+    _printBank("Rearm failed, relay reopened", bank);
+  }
+}
+
+void MultiBankProtector :: _performCutoff(uint8_t index, const char* reason) {
+  Bank& bank = _banks[index];
+  bank.relayPin.doDigitalWrite(HIGH); // HIGH disconnects the load (inverted logic)
+  bank.state = STATE_CUTOFF;
+  bank.isWaitingForRearm = false;
+  bank.isVerifyingRearm = false;
+  _buzzer.startAlarm(1000, 5000);
+  Serial.print("CUTOFF (");
+  Serial.print(reason);
+  Serial.print(") ");
+  _printBank("relay opened", bank);
+}
+
+void MultiBankProtector :: _handleTestButton() {
+  _testButton.update();
+  switch (_testButton.takeEvent()) {
+    case Switch::EVENT_SHORT_PRESS:
+      printStatus();
+      _isDisplayDirty = true;
+      break;
+
+    case Switch::EVENT_LONG_PRESS:
+      for (uint8_t i = 0; i < _bankCount; i++) {
+        if (_banks[i].state == STATE_CUTOFF) {
+          rearm(i);
+        }
+      }
+      break;
+
+    case Switch::EVENT_NONE:
+      break;
+  }
+}
+
+void MultiBankProtector :: _taskLEDs(void* arg) {
+  // Green: every bank on (blinking while one counts down); red: any bank off
+  MultiBankProtector* self = static_cast<MultiBankProtector*>(arg);
+  bool anyCutoff = false;
+  bool anyWaiting = false;
+  for (uint8_t i = 0; i < self->_bankCount; i++) {
+    anyCutoff = anyCutoff || self->_banks[i].state == STATE_CUTOFF;
+    anyWaiting = anyWaiting || self->_banks[i].isWaitingForRearm;
+  }
+  unsigned long nowMs = SystemClock::millis();
+  if (anyWaiting) {
+    if (nowMs - self->_lastLEDToggleMs >= 500) {
+      self->_greenLED.toggle();
+      self->_lastLEDToggleMs = nowMs;
+    }
+  } else if (anyCutoff) {
+    self->_greenLED.off();
+  } else {
+    self->_greenLED.on();
+  }
+  if (anyCutoff) {
+    self->_redLED.on();
+  } else {
+    self->_redLED.off();
+  }
+}
+
+void MultiBankProtector :: _taskBuzzer(void* arg) {
+  static_cast<MultiBankProtector*>(arg)->_buzzer.update();
+}
+
+void MultiBankProtector :: _taskDisplay(void* arg) {
+  MultiBankProtector* self = static_cast<MultiBankProtector*>(arg);
+  unsigned long nowMs = SystemClock::millis();
+  if (self->_displayInitStep == 0 || (long)(nowMs - self->_displayStepAtMs) < 0) {
+    return;
+  }
+  if (self->_displayInitStep == 1) {
+    self->_display->backlight();
+    self->_displayInitStep = 2;
+    self->_displayStepAtMs = nowMs + 50;
+    return;
+  }
+  if (self->_displayInitStep == 2) {
+    self->_display->clear();
+    self->_displayInitStep = 3;
+    self->_isDisplayDirty = true;
+    return;
+  }
+  if (self->_bankCount > 2 && nowMs - self->_displayPageAtMs >= DISPLAY_PAGE_MS) {
+    self->_displayPage = (self->_displayPage + 1) % ((self->_bankCount + 1) / 2);
+    self->_displayPageAtMs = nowMs;
+    self->_isDisplayDirty = true;
+  }
+  if (self->_isDisplayDirty || nowMs - self->_lastDisplayMs >= DISPLAY_REFRESH_MS) {
+    self->_isDisplayDirty = false;
+    self->_lastDisplayMs = nowMs;
+    self->_updateDisplay();
+  }
+}
+
+void MultiBankProtector :: _updateDisplay() {
+  // One bank per row: "house 12.60V ON "
+  for (uint8_t row = 0; row < 2; row++) {
+    uint8_t index = _displayPage * 2 + row;
+    char line[17];
+    memset(line, ' ', 16);
+    line[16] = '\0';
+    if (index < _bankCount) {
+      Bank& bank = _banks[index];
+      const char* name = bank.config.name;
+      for (uint8_t i = 0; i < 5 && name[i]; i++) {
+        line[i] = name[i];
+      }
+      char volts[8];
+      formatMillivolts(bank.millivolts, volts);
+      size_t length = strlen(volts);
+      memcpy(line + 11 - length, volts, length);
+      line[11] = 'V';
+      const char* relay = bank.state == STATE_ARMED ? "ON" : (bank.isWaitingForRearm ? "..." : "OFF");
+      memcpy(line + 13, relay, strlen(relay));
+    }
+    _display->setCursor(0, row);
+    _display->print(line);
+  }
+  _display->flush();
+}
+
+void MultiBankProtector :: _printBank(const char* prefix, Bank& bank) {
+  Serial.print(bank.config.name);
+  Serial.print(": ");
+  Serial.print(prefix);
+  Serial.print(" (");
+  _printVolts(bank.millivolts);
+  Serial.print("V, cutoff ");
+  _printVolts(bank.cutoffMillivolts);
+  Serial.println("V)");
+}
+
+void MultiBankProtector :: _printVolts(uint16_t millivolts) {
+  char text[8];
+  formatMillivolts(millivolts, text);
+  Serial.print(text);
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,164 @@
+#ifndef multiBankProtector_h
+#define multiBankProtector_h
+
+#include "Arduino.h"
+#include "bankHardware.h"
+#include "basicHardware.h"
+#include "powerManager.h"
+#include "scheduler.h"
+
+//////////////////////////////////////////////////////////
+// MULTI-BANK PROTECTOR
+//////////////////////////////////////////////////////////
+// Several batteries (house, starter, ...) on one board: each bank is
+// read through a BankAdc input (ADS1115/ADS1015 on I2C, or an analog
+// mux on A0) and switches its own active-low relay on a PCF8574
+// expander. Every bank runs the single-bank state machine on its own:
+// cutoff below its threshold, rearm countdown above the rearm
+// threshold, rearm judged under load.
+//
+// Sampling is round robin, one conversion per sample task run: the run
+// reads the bank converted last and starts the next one, so each bank
+// is read every getSampleIntervalMs() = banks x 5 ms. A hard drop (more
+// than 0.3 V below the cutoff on two readings in a row) opens the relay
+// from the sample task itself, within getWorstCaseTripMs(); smaller
+// drops go through a 3-sample median and an EMA and take about ten
+// readings of that bank. Both bounds grow linearly with the bank count
+// (sim/build/bankBench measures them).
+//
+// A bank whose ADC stops answering is cut off after a few missed
+// readings; a relay write the expander did not acknowledge is repeated
+// every state task run.
+struct BankConfig {
+  const char* name;         // Short, shown on the LCD (up to 5 characters fit)
+  BankAdc* adc;
+  uint8_t adcInput;         // AIN0..3 on an ADS1x15, 0..7 on the mux
+  uint8_t relayBit;         // Expander output driving this bank's relay module
+  float dividerRatio;       // ADC input volts per battery volt
+  float cutoffVolts;
+  float rearmVolts;
+  unsigned long rearmDelayMs;
+};
+
+class MultiBankProtector {
+  public:
+    static const uint8_t MAX_BANKS = 8;
+    static const unsigned long SAMPLE_PERIOD_MS = 5; // One bank conversion per run
+
+    enum State {
+      STATE_ARMED,    // Relay closed, voltage above threshold
+      STATE_CUTOFF    // Relay opened, voltage below threshold (or no reading)
+    };
+
+    // banks is copied; relays must outlive the protector
+    MultiBankProtector(const BankConfig* banks, uint8_t bankCount, Pcf8574* relays, Display* display = nullptr);
+
+    void update(); // Call in loop(); runs due tasks without blocking
+    unsigned long getIdleMs();
+    void idle(); // Call after update(); sleeps until the next task
+
+    uint8_t getBankCount() { return _bankCount; }
+    State getState(uint8_t bank) { return _banks[bank].state; }
+    uint16_t getBankMillivolts(uint8_t bank) { return _banks[bank].millivolts; }
+    unsigned long getSampleIntervalMs() { return _bankCount * SAMPLE_PERIOD_MS; } // Between two readings of one bank
+    unsigned long getWorstCaseTripMs(); // Hard drop to relay open, per bank
+    void rearm(uint8_t bank); // Force a bank back on (bypasses the thresholds)
+    void printStatus(); // One line per bank on Serial
+    void printSchedulerStats(Print& out);
+    void printMemoryReport(Print& out); // Static RAM per component, the sketch's bank hardware included
+
+  private:
+    // Board pins (the relays sit on the expander, so GPIO12 is free)
+    static const uint8_t PIN_GREEN_LED = 2;         // D4/GPIO2
+    static const uint8_t PIN_RED_LED = 15;         // D8/GPIO15 (boot strap pulled low: the LED to GND keeps it so)
+    static const uint8_t PIN_TEST_BUTTON = 0;      // D3/GPIO0
+    static const uint8_t PIN_BUZZER = 13;          // D7/GPIO13
+
+    static const unsigned long STATE_PERIOD_MS = 10;
+    static const unsigned long BUZZER_PERIOD_MS = 20;
+    static const unsigned long LED_PERIOD_MS = 50;
+    static const unsigned long DISPLAY_PERIOD_MS = 50;
+    static const unsigned long DISPLAY_REFRESH_MS = 1000;
+    static const unsigned long DISPLAY_PAGE_MS = 3000; // Two banks per page
+    static const unsigned long BUTTON_DEBOUNCE_MS = 50;
+    static const unsigned long BUTTON_LONG_PRESS_MS = 1500; // Long press: rearm every cut-off bank
+    static const unsigned long REARM_SETTLE_MS = 100;
+    static const uint8_t TRIP_READINGS = 2;        // Consecutive hard-drop readings that open the relay
+    static const uint16_t TRIP_MARGIN_MILLIVOLTS = 300;
+    static const uint8_t MAX_FAILED_READINGS = 3;  // Missed readings before a bank is cut off
+    static const uint8_t MEDIAN_WINDOW = 3;
+    static const uint8_t EMA_SHIFT = 2;            // Weight 1/4: fewer readings per bank than the single-bank filter
+    static const uint8_t EMA_FRACTION_BITS = 4;
+
+    struct Bank {
+      BankConfig config;
+      ExpanderPin relayPin;
+      uint32_t scaleQ16;         // Battery millivolts per ADC input millivolt, 16 fractional bits
+      uint16_t cutoffMillivolts;
+      uint16_t rearmMillivolts;
+      uint16_t tripMillivolts;
+      State state;
+      uint16_t millivolts;       // Filtered battery voltage
+      uint16_t median[MEDIAN_WINDOW];
+      uint8_t medianFill;
+      uint8_t medianNext;
+      int32_t ema;               // Millivolts with EMA_FRACTION_BITS
+      bool filterPrimed;
+      uint8_t tripCount;
+      uint8_t failedReadings;
+      bool isWaitingForRearm;
+      unsigned long rearmCountdownStartMs;
+      bool isVerifyingRearm;
+      bool isRearmSettled;
+      unsigned long rearmVerifyAtMs;
+    };
+
+    typedef FastPin<PIN_GREEN_LED> GreenLEDPin;
+    typedef FastPin<PIN_RED_LED> RedLEDPin;
+    typedef FastPin<PIN_TEST_BUTTON> TestButtonPin;
+    typedef FastPin<PIN_BUZZER> BuzzerPin;
+    GreenLEDPin _greenLEDPin;
+    RedLEDPin _redLEDPin;
+    TestButtonPin _testButtonPin;
+    BuzzerPin _buzzerPin;
+    PowerManager _power;
+    Scheduler _scheduler;
+    LEDT<GreenLEDPin> _greenLED;
+    LEDT<RedLEDPin> _redLED;
+    SwitchT<TestButtonPin> _testButton;
+    BuzzerT<BuzzerPin> _buzzer;
+    Pcf8574* _relays;
+    Display* _display;
+
+    Bank _banks[MAX_BANKS];
+    uint8_t _bankCount;
+    int8_t _convertingBank;      // -1 when no conversion is running
+    uint8_t _nextBank;           // Round-robin position
+    unsigned long _conversionStartUs;
+    unsigned long _lastLEDToggleMs;
+    uint8_t _displayInitStep;    // Non-blocking LCD bring-up
+    unsigned long _displayStepAtMs;
+    unsigned long _lastDisplayMs;
+    bool _isDisplayDirty;        // Refresh on the next display run
+    uint8_t _displayPage;
+    unsigned long _displayPageAtMs;
+
+    static void _taskSample(void* arg);
+    static void _taskState(void* arg);
+    static void _taskLEDs(void* arg);
+    static void _taskBuzzer(void* arg);
+    static void _taskDisplay(void* arg);
+    void _onReading(uint8_t index, bool ok, uint16_t adcMillivolts);
+    void _filter(Bank& bank, uint16_t millivolts);
+    void _restartFilter(Bank& bank);
+    void _updateBank(uint8_t index);
+    void _verifyRearm(uint8_t index);
+    void _performCutoff(uint8_t index, const char* reason);
+    void _handleTestButton();
+    void _updateDisplay();
+    void _printBank(const char* prefix, Bank& bank);
+    void _printVolts(uint16_t millivolts);
+};
+//////////////////////////////////////////////////////////
+
+#endif
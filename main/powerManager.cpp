@@ -0,0 +1,262 @@
+#include "Arduino.h"
+#include <ESP8266WiFi.h>
+#include "powerManager.h"
+#include "systemClock.h"
+
+extern "C" {
+#include "user_interface.h"
+}
+
+
+//////////////////////////////////////////////////////////
+// ENERGY MODEL
+//////////////////////////////////////////////////////////
+EnergyModel :: EnergyModel() {
+  reset();
+}
+
+void EnergyModel :: reset() {
+  for (uint8_t i = 0; i < POWER_STATE_COUNT; i++) {
+    _ms[i] = 0;
+    _remainderUs[i] = 0;
+  }
+}
+
+void EnergyModel :: addTime(PowerState state, uint32_t us) {
+  _remainderUs[state] += us % 1000UL;
+  _ms[state] += us / 1000UL + _remainderUs[state] / 1000UL;
+  _remainderUs[state] %= 1000UL;
+}
+
+void EnergyModel :: addMs(PowerState state, uint32_t ms) {
+  _ms[state] += ms;
+}
+
+void EnergyModel :: restore(const uint32_t* msPerState) {
+  for (uint8_t i = 0; i < POWER_STATE_COUNT; i++) {
+    _ms[i] = msPerState[i];
+    _remainderUs[i] = 0;
+  }
+}
+
+unsigned long long EnergyModel :: getTotalMs() const {
+  unsigned long long total = 0;
+  for (uint8_t i = 0; i < POWER_STATE_COUNT; i++) {
+    total += _ms[i];
+  }
+  return total;
+}
+
+unsigned long long EnergyModel :: getMicroAmpHours() const {
+  // uA * ms summed in 64 bits, then ms -> h
+  unsigned long long microAmpMs = 0;
+  for (uint8_t i = 0; i < POWER_STATE_COUNT; i++) {
+    microAmpMs += (unsigned long long)_ms[i] * currentMicroAmps((PowerState)i);
+  }
+  return microAmpMs / 3600000ULL;
+}
+
+uint32_t EnergyModel :: getAverageMicroAmps() const {
+  unsigned long long totalMs = getTotalMs();
+  if (totalMs == 0) {
+    return 0;
+  }
+  unsigned long long microAmpMs = 0;
+  for (uint8_t i = 0; i < POWER_STATE_COUNT; i++) {
+    microAmpMs += (unsigned long long)_ms[i] * currentMicroAmps((PowerState)i);
+  }
+  return (uint32_t)(microAmpMs / totalMs);
+}
+
+uint32_t EnergyModel :: currentMicroAmps(PowerState state) {
+  // ESP8266EX datasheet, typical values at 3.3 V
+  switch (state) {
+    case POWER_AWAKE_RADIO:
+      return 56000; // RX listening, 802.11n
+    case POWER_AWAKE:
+      return 15000; // Modem sleep
+    case POWER_LIGHT_SLEEP:
+      return 900;
+    case POWER_DEEP_SLEEP:
+      return 20;
+    default:
+      return 0;
+  }
+}
+
+const char* EnergyModel :: stateName(PowerState state) {
+  switch (state) {
+    case POWER_AWAKE_RADIO:
+      return "awake+radio";
+    case POWER_AWAKE:
+      return "awake";
+    case POWER_LIGHT_SLEEP:
+      return "light sleep";
+    case POWER_DEEP_SLEEP:
+      return "deep sleep";
+    default:
+      return "?";
+  }
+}
+
+void EnergyModel :: print(Print& out) const {
+  out.println("Power state  time_s current_uA");
+  for (uint8_t i = 0; i < POWER_STATE_COUNT; i++) {
+    const char* name = stateName((PowerState)i);
+    out.print(name);
+    for (size_t pad = strlen(name); pad < 13; pad++) {
+      out.print(' ');
+    }
+    out.print(_ms[i] / 1000UL);
+    out.print(" ");
+    out.println(currentMicroAmps((PowerState)i));
+  }
+  out.print("Average current: ");
+  out.print(getAverageMicroAmps());
+  out.print("uA | Charge: ");
+  out.print((unsigned long)getMicroAmpHours());
+  out.println("uAh");
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// POWER MANAGER
+//////////////////////////////////////////////////////////
+PowerManager :: PowerManager() {
+  _lowPower = false;
+  _radioOn = true; // The SDK starts the modem at boot
+  _markUs = 0;     // Book everything since reset as awake time
+}
+
+void PowerManager :: begin(bool radioNeeded) {
+  update(); // Boot time so far ran with the modem on
+  if (radioNeeded) {
+    WiFi.forceSleepWake();
+    _radioOn = true;
+    return;
+  }
+  WiFi.mode(WIFI_OFF);
+  WiFi.forceSleepBegin();
+  delay(1); // The modem powers down once the SDK gets control
+  _radioOn = false;
+}
+
+void PowerManager :: setLowPower(bool enabled) {
+  _lowPower = enabled;
+}
+
+void PowerManager :: update() {
+  unsigned long nowUs = SystemClock::micros();
+  _energy.addTime(_radioOn ? EnergyModel::POWER_AWAKE_RADIO : EnergyModel::POWER_AWAKE, nowUs - _markUs);
+  _markUs = nowUs;
+}
+
+void PowerManager :: idle(unsigned long ms, bool allowLightSleep) {
+  update();
+  if (_lowPower && allowLightSleep && !_radioOn && ms >= LIGHT_SLEEP_MIN_MS) {
+    _lightSleep(ms - LIGHT_SLEEP_WAKE_MS);
+  } else {
+    delay(ms);
+  }
+  update();
+}
+
+void PowerManager :: _lightSleep(unsigned long ms) {
+  Serial.flush(); // The UART stops with the CPU
+
+  uint32_t calibration = system_rtc_clock_cali_proc(); // us per RTC tick, 12 fractional bits
+  uint32_t rtcStart = system_get_rtc_time();
+  unsigned long awakeStartUs = micros();
+
+  wifi_fpm_set_sleep_type(LIGHT_SLEEP_T);
+  wifi_fpm_open();
+  wifi_fpm_set_wakeup_cb(&PowerManager::_onWake);
+  wifi_fpm_do_sleep(ms * 1000UL);
+  delay(ms + 1); // The SDK enters sleep once it gets control; waking up ends the wait
+  wifi_fpm_close();
+
+  // micros() only counted the awake part; the RTC timer kept running
+  uint32_t elapsedUs = (uint32_t)(((unsigned long long)(system_get_rtc_time() - rtcStart) * calibration) >> 12);
+  uint32_t awakeUs = micros() - awakeStartUs;
+  uint32_t sleptUs = elapsedUs > awakeUs ? elapsedUs - awakeUs : 0;
+  SystemClock::creditSleep(sleptUs);
+  _energy.addTime(EnergyModel::POWER_LIGHT_SLEEP, sleptUs);
+  _markUs += sleptUs; // Only the awake part is left for update()
+}
+
+void PowerManager :: _onWake() {
+  // Timed wake-up needs a callback; nothing to do here
+}
+
+void PowerManager :: accountDeepSleep(unsigned long ms) {
+  update();
+  _energy.addMs(EnergyModel::POWER_DEEP_SLEEP, ms);
+}
+
+void PowerManager :: deepSleep(unsigned long ms) {
+  Serial.flush();
+  // Wake with the modem off unless a network feature uses it: begin()
+  // would switch it off again anyway, and an RF-disabled wake-up cannot
+  // bring it back without another reset
+  ESP.deepSleep((uint64_t)ms * 1000ULL, _radioOn ? WAKE_RF_DEFAULT : WAKE_RF_DISABLED);
+}
+
+bool PowerManager :: wokeFromDeepSleep() {
+  return ESP.getResetInfoPtr()->reason == REASON_DEEP_SLEEP_AWAKE;
+}
+
+bool PowerManager :: wasWatchdogReset() {
+  uint32_t reason = ESP.getResetInfoPtr()->reason;
+  return reason == REASON_WDT_RST || reason == REASON_SOFT_WDT_RST || reason == REASON_EXCEPTION_RST;
+}
+
+bool PowerManager :: saveRtc(uint8_t offsetWords, const void* data, uint16_t size) {
+  uint16_t dataWords = (size + 3) / 4;
+  if (offsetWords < RTC_FIRST_FREE_WORD || dataWords + RTC_HEADER_WORDS > RTC_MAX_WORDS) {
+    return false;
+  }
+  uint32_t block[RTC_MAX_WORDS];
+  memset(block, 0, (dataWords + RTC_HEADER_WORDS) * 4);
+  memcpy(&block[RTC_HEADER_WORDS], data, size);
+  block[0] = RTC_MAGIC;
+  block[1] = size;
+  block[2] = _crc32(&block[RTC_HEADER_WORDS], dataWords);
+  return ESP.rtcUserMemoryWrite(offsetWords, block, (dataWords + RTC_HEADER_WORDS) * 4);
+}
+
+bool PowerManager :: loadRtc(uint8_t offsetWords, void* data, uint16_t size) {
+  uint16_t dataWords = (size + 3) / 4;
+  if (offsetWords < RTC_FIRST_FREE_WORD || dataWords + RTC_HEADER_WORDS > RTC_MAX_WORDS) {
+    return false;
+  }
+  uint32_t block[RTC_MAX_WORDS];
+  if (!ESP.rtcUserMemoryRead(offsetWords, block, (dataWords + RTC_HEADER_WORDS) * 4)) {
+    return false;
+  }
+  // RTC memory holds garbage after power-on; only trust a matching block
+  if (block[0] != RTC_MAGIC || block[1] != size || block[2] != _crc32(&block[RTC_HEADER_WORDS], dataWords)) {
+    return false;
+  }
+  memcpy(data, &block[RTC_HEADER_WORDS], size);
+  return true;
+}
+
+uint32_t PowerManager :: _crc32(const uint32_t* words, uint16_t count) {
+  // CRC-32 (IEEE), bitwise: a few dozen bytes per deep sleep
+  uint32_t crc = 0xFFFFFFFFUL;
+  const uint8_t* bytes = (const uint8_t*)words;
+  for (uint16_t i = 0; i < count * 4; i++) {
+    crc ^= bytes[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320UL & (0UL - (crc & 1UL)));
+    }
+  }
+  return ~crc;
+}
+
+void PowerManager :: printStats(Print& out) {
+  update();
+  _energy.print(out);
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,99 @@
+#ifndef powerManager_h
+#define powerManager_h
+
+#include "Arduino.h"
+
+//////////////////////////////////////////////////////////
+// ENERGY MODEL
+//////////////////////////////////////////////////////////
+// Charge drawn by the ESP8266 module, integrated from the time spent in
+// each power state and the typical currents of the ESP8266EX datasheet.
+// Board extras (LCD backlight, LEDs, relay coil, USB-UART bridge) are
+// not included.
+class EnergyModel {
+  public:
+    enum PowerState {
+      POWER_AWAKE_RADIO,  // CPU running, WiFi modem on
+      POWER_AWAKE,        // CPU running, modem off (modem sleep)
+      POWER_LIGHT_SLEEP,  // CPU halted, RAM retained
+      POWER_DEEP_SLEEP,   // Only the RTC runs
+      POWER_STATE_COUNT
+    };
+
+    EnergyModel();
+    void reset();
+    void addTime(PowerState state, uint32_t us);
+    void addMs(PowerState state, uint32_t ms);
+    void restore(const uint32_t* msPerState); // POWER_STATE_COUNT values, e.g. from RTC memory
+    uint32_t getMs(PowerState state) const { return _ms[state]; }
+    unsigned long long getTotalMs() const;
+    unsigned long long getMicroAmpHours() const;
+    uint32_t getAverageMicroAmps() const;
+    void print(Print& out) const;
+
+    static uint32_t currentMicroAmps(PowerState state);
+    static const char* stateName(PowerState state);
+
+  private:
+    uint32_t _ms[POWER_STATE_COUNT];
+    uint32_t _remainderUs[POWER_STATE_COUNT];
+};
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// POWER MANAGER
+//////////////////////////////////////////////////////////
+// Owns the WiFi modem state and the sleep modes:
+//   - modem off whenever no network feature needs it
+//   - idle(): plain delay(), or forced light sleep (~0.9 mA) when low
+//     power mode is on and the caller allows it; time slept is credited
+//     to SystemClock because millis() stops during light sleep
+//   - deepSleep(): ~20 uA; the chip resets on wake-up, so state that
+//     must survive goes into RTC user memory (saveRtc/loadRtc). Needs D0
+//     (GPIO16) wired to RST, and a pull-up on the relay line because
+//     every GPIO floats while asleep.
+class PowerManager {
+  public:
+    PowerManager();
+    void begin(bool radioNeeded = false); // Switch the modem off unless a network feature uses it
+    void setLowPower(bool enabled);
+    bool isLowPower() { return _lowPower; }
+    bool isRadioOn() { return _radioOn; }
+
+    void idle(unsigned long ms, bool allowLightSleep); // Wait ms, light-sleeping when possible
+    void accountDeepSleep(unsigned long ms); // Book a coming deep sleep (before saving RTC state)
+    void deepSleep(unsigned long ms); // Does not return: the chip restarts after ms
+    bool wokeFromDeepSleep();
+    bool wasWatchdogReset(); // Hardware or soft watchdog, or an exception
+
+    // Checksummed blocks in RTC user memory (survive deep sleep, not power loss).
+    // The core keeps the OTA (eboot) command in the first 32 words, so
+    // offsets start at RTC_FIRST_FREE_WORD.
+    static const uint8_t RTC_FIRST_FREE_WORD = 32;
+    bool saveRtc(uint8_t offsetWords, const void* data, uint16_t size);
+    bool loadRtc(uint8_t offsetWords, void* data, uint16_t size);
+
+    void update(); // Book awake time up to now
+    EnergyModel& getEnergy() { return _energy; }
+    void printStats(Print& out);
+
+  private:
+    static const unsigned long LIGHT_SLEEP_MIN_MS = 10; // Shorter waits are not worth the wake-up cost
+    static const unsigned long LIGHT_SLEEP_WAKE_MS = 3; // Wake-up latency, taken off the sleep time
+    static const uint32_t RTC_MAGIC = 0x42505231;      // "BPR1"
+    static const uint8_t RTC_HEADER_WORDS = 3;         // Magic, size, CRC-32
+    static const uint8_t RTC_MAX_WORDS = 32;
+
+    EnergyModel _energy;
+    bool _lowPower;
+    bool _radioOn;
+    unsigned long _markUs; // Awake time is booked up to here
+
+    void _lightSleep(unsigned long ms);
+    static void _onWake();
+    static uint32_t _crc32(const uint32_t* words, uint16_t count);
+};
+//////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,86 @@
+#include "Arduino.h"
+#include "profiler.h"
+
+//////////////////////////////////////////////////////////
+// STAGE PROFILER
+//////////////////////////////////////////////////////////
+StageProfiler :: StageProfiler() {
+  _loopBudgetCycles = 0;
+  reset();
+}
+
+void StageProfiler :: setLoopBudget(uint32_t cycles) {
+  _loopBudgetCycles = cycles;
+}
+
+void StageProfiler :: add(uint8_t stage, uint32_t cycles) {
+  StageStats& stats = _stats[stage];
+  stats.runs++;
+  stats.totalCycles += cycles;
+  if (cycles > stats.maxCycles) {
+    stats.maxCycles = cycles;
+  }
+  stats.buckets[bucketFor(cycles)]++;
+  if (stage == STAGE_LOOP && _loopBudgetCycles > 0 && cycles > _loopBudgetCycles) {
+    _overruns++;
+  }
+}
+
+void StageProfiler :: reset() {
+  memset(_stats, 0, sizeof(_stats));
+  _overruns = 0;
+}
+
+uint8_t StageProfiler :: bucketFor(uint32_t cycles) {
+  if (cycles < (1UL << FIRST_BUCKET_BITS)) {
+    return 0;
+  }
+  uint8_t bits = 32 - __builtin_clz(cycles); // Bit length: FIRST_BUCKET_BITS + 1 and up
+  uint8_t bucket = bits - FIRST_BUCKET_BITS;
+  return bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT - 1;
+}
+
+const char* StageProfiler :: stageName(uint8_t stage) {
+  static const char* const names[STAGE_COUNT] = { "loop", "adc", "button", "state", "leds", "display", "buzzer", "cutoff" };
+  return stage < STAGE_COUNT ? names[stage] : "?";
+}
+
+void StageProfiler :: print(Print& out, uint8_t cpuMHz) {
+  // Buckets as "<upper bound in us>:runs"; the last one is open ended
+  out.println("Stage    runs mean_us max_us histogram(<us:runs)");
+  for (uint8_t stage = 0; stage < STAGE_COUNT; stage++) {
+    const StageStats& stats = _stats[stage];
+    const char* name = stageName(stage);
+    out.print(name);
+    for (size_t pad = strlen(name); pad < 9; pad++) {
+      out.print(' ');
+    }
+    out.print(stats.runs);
+    out.print(' ');
+    out.print(stats.runs > 0 ? (unsigned long)(stats.totalCycles / stats.runs / cpuMHz) : 0UL);
+    out.print(' ');
+    out.print(stats.maxCycles / cpuMHz);
+    for (uint8_t bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+      if (stats.buckets[bucket] == 0) {
+        continue;
+      }
+      out.print(' ');
+      if (bucket == BUCKET_COUNT - 1) {
+        out.print('>');
+        out.print((1UL << (FIRST_BUCKET_BITS + bucket - 1)) / cpuMHz);
+      } else {
+        out.print('<');
+        out.print(((1UL << (FIRST_BUCKET_BITS + bucket)) + cpuMHz - 1) / cpuMHz);
+      }
+      out.print(':');
+      out.print(stats.buckets[bucket]);
+    }
+    out.println();
+  }
+  out.print("Loop overruns: ");
+  out.print(_overruns);
+  out.print(" over ");
+  out.print(_loopBudgetCycles / cpuMHz);
+  out.println("us");
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,84 @@
+#ifndef profiler_h
+#define profiler_h
+
+#include "Arduino.h"
+
+// Compile-time switch: with 0 (the default) the PROFILE_STAGE() scopes
+// compile to nothing and the protector carries no profiler. Set it to 1
+// here or with -DPROFILER_ENABLED=1 in the build flags.
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 0
+#endif
+
+//////////////////////////////////////////////////////////
+// STAGE PROFILER (CPU cycle counter)
+//////////////////////////////////////////////////////////
+// Per-stage run times from ESP.getCycleCount(), in a log2 histogram:
+// bucket 0 holds runs under 2^FIRST_BUCKET_BITS cycles, bucket i the
+// runs from 2^(FIRST_BUCKET_BITS + i - 1) up to twice that, and the last
+// bucket everything longer. Per stage also the run count, total and
+// worst case. Runs of the loop stage over the loop budget count as
+// overruns.
+//
+// Recording is a subtraction, a count-leading-zeros and three adds:
+// cheap enough for every run of every stage. The cycle counter wraps
+// every ~53 s at 80 MHz, far above any single run.
+class StageProfiler {
+  public:
+    enum Stage {
+      STAGE_LOOP,    // Whole update(): all due tasks
+      STAGE_ADC,     // Sample task: queued samples, filter, fast trip
+      STAGE_BUTTON,
+      STAGE_STATE,   // State machine, resistance step, trend
+      STAGE_LEDS,
+      STAGE_DISPLAY, // LCD refresh and its I2C traffic
+      STAGE_BUZZER,
+      STAGE_CUTOFF,  // Relay opened and the event logged
+      STAGE_COUNT
+    };
+    static const uint8_t BUCKET_COUNT = 16;
+    static const uint8_t FIRST_BUCKET_BITS = 7; // Bucket 0: under 128 cycles (1.6 us at 80 MHz)
+
+    struct StageStats {
+      uint32_t runs;
+      uint32_t maxCycles;
+      uint64_t totalCycles;
+      uint32_t buckets[BUCKET_COUNT];
+    };
+
+    StageProfiler();
+    void setLoopBudget(uint32_t cycles); // Loop runs longer than this are overruns; 0: none counted
+    void add(uint8_t stage, uint32_t cycles);
+    void reset();
+    const StageStats& getStats(uint8_t stage) { return _stats[stage]; }
+    uint32_t getOverruns() { return _overruns; }
+    void print(Print& out, uint8_t cpuMHz); // Table per stage: runs, mean and max in us, non-empty buckets
+    static uint8_t bucketFor(uint32_t cycles);
+    static const char* stageName(uint8_t stage);
+
+  private:
+    StageStats _stats[STAGE_COUNT];
+    uint32_t _loopBudgetCycles;
+    uint32_t _overruns;
+};
+
+// Times its enclosing block into one stage
+class ProfileScope {
+  public:
+    ProfileScope(StageProfiler& profiler, uint8_t stage) : _profiler(profiler), _stage(stage), _start(ESP.getCycleCount()) {}
+    ~ProfileScope() { _profiler.add(_stage, ESP.getCycleCount() - _start); }
+
+  private:
+    StageProfiler& _profiler;
+    uint8_t _stage;
+    uint32_t _start;
+};
+
+#if PROFILER_ENABLED
+#define PROFILE_STAGE(profiler, stage) ProfileScope _profileScope((profiler), StageProfiler::stage)
+#else
+#define PROFILE_STAGE(profiler, stage) do {} while (0)
+#endif
+//////////////////////////////////////////////////////////
+
+#endif
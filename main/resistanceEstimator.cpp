@@ -0,0 +1,55 @@
+#include "Arduino.h"
+#include "resistanceEstimator.h"
+
+//////////////////////////////////////////////////////////
+// INTERNAL RESISTANCE ESTIMATOR
+//////////////////////////////////////////////////////////
+ResistanceEstimator :: ResistanceEstimator() {
+  reset();
+}
+
+void ResistanceEstimator :: reset() {
+  _milliohmsQ4 = 0;
+  _stepCount = 0;
+  _rejectedCount = 0;
+}
+
+bool ResistanceEstimator :: addStep(uint16_t restMillivolts, uint16_t loadedMillivolts, uint16_t loadMilliamps) {
+  // A load step that raises the voltage means a charger took over
+  if (loadMilliamps < MIN_STEP_MILLIAMPS || loadedMillivolts > restMillivolts) {
+    _rejectedCount++;
+    return false;
+  }
+  // mV / mA = ohm; x1000 for milliohms, x16 for the fraction bits
+  uint32_t sagMillivolts = restMillivolts - loadedMillivolts;
+  uint32_t milliohmsQ4 = (sagMillivolts * (1000UL << FRACTION_BITS) + loadMilliamps / 2) / loadMilliamps;
+  if (milliohmsQ4 > ((uint32_t)MAX_MILLIOHMS << FRACTION_BITS)) {
+    _rejectedCount++;
+    return false;
+  }
+  if (_stepCount == 0) {
+    _milliohmsQ4 = milliohmsQ4;
+  } else {
+    _milliohmsQ4 = (uint32_t)((int32_t)_milliohmsQ4 + (((int32_t)milliohmsQ4 - (int32_t)_milliohmsQ4) >> EMA_SHIFT));
+  }
+  if (_stepCount < 0xFFFF) {
+    _stepCount++;
+  }
+  return true;
+}
+
+uint16_t ResistanceEstimator :: getMilliohms() {
+  return (uint16_t)((_milliohmsQ4 + (1 << (FRACTION_BITS - 1))) >> FRACTION_BITS);
+}
+
+uint16_t ResistanceEstimator :: getSagMillivolts(uint16_t loadMilliamps) {
+  // mA x mohm = uV
+  uint32_t sagMillivolts = ((uint32_t)loadMilliamps * _milliohmsQ4 / 1000UL + (1 << (FRACTION_BITS - 1))) >> FRACTION_BITS;
+  return sagMillivolts > MAX_SAG_MILLIVOLTS ? MAX_SAG_MILLIVOLTS : (uint16_t)sagMillivolts;
+}
+
+uint16_t ResistanceEstimator :: compensate(uint16_t loadedMillivolts, uint16_t loadMilliamps) {
+  uint32_t millivolts = (uint32_t)loadedMillivolts + getSagMillivolts(loadMilliamps);
+  return millivolts > 0xFFFF ? 0xFFFF : (uint16_t)millivolts;
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,48 @@
+#ifndef resistanceEstimator_h
+#define resistanceEstimator_h
+
+#include "Arduino.h"
+
+//////////////////////////////////////////////////////////
+// INTERNAL RESISTANCE ESTIMATOR
+//////////////////////////////////////////////////////////
+// Every relay transition is a current step of known size: the load
+// current flows on one side of it and nothing on the other. The voltage
+// step across it, divided by that current, is the battery's internal
+// resistance. Steps are averaged (EMA, weight 1/4 after the first), so
+// the estimate follows ageing and temperature without one bad step
+// dominating it.
+//
+// The compensated (open-circuit) voltage is then the terminal voltage
+// plus I x R, with the sag capped at MAX_SAG_MILLIVOLTS: a wrong
+// estimate can only move the cutoff by that much.
+class ResistanceEstimator {
+  public:
+    static const uint16_t MAX_MILLIOHMS = 500;        // Steps implying more are rejected (loose wiring, charger)
+    static const uint16_t MAX_SAG_MILLIVOLTS = 1000;  // Cap on the compensation
+    static const uint16_t MIN_STEP_MILLIAMPS = 100;   // Smaller current steps are too noisy to use
+
+    ResistanceEstimator();
+
+    // One relay transition: the voltage without load, with the load and
+    // the load current. false when the step was rejected.
+    bool addStep(uint16_t restMillivolts, uint16_t loadedMillivolts, uint16_t loadMilliamps);
+    bool hasEstimate() { return _stepCount > 0; }
+    uint16_t getMilliohms(); // 0 without an estimate
+    uint16_t getSagMillivolts(uint16_t loadMilliamps); // Expected I x R drop at this current, capped
+    uint16_t compensate(uint16_t loadedMillivolts, uint16_t loadMilliamps); // Open-circuit estimate
+    uint16_t getStepCount() { return _stepCount; }
+    uint16_t getRejectedCount() { return _rejectedCount; }
+    void reset();
+
+  private:
+    static const uint8_t EMA_SHIFT = 2;
+    static const uint8_t FRACTION_BITS = 4;
+
+    uint32_t _milliohmsQ4; // FRACTION_BITS fractional bits
+    uint16_t _stepCount;
+    uint16_t _rejectedCount;
+};
+//////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,149 @@
+#include "Arduino.h"
+#include "scheduler.h"
+#include "systemClock.h"
+
+//////////////////////////////////////////////////////////
+// SCHEDULER (cooperative, deadline based)
+//////////////////////////////////////////////////////////
+Scheduler :: Scheduler() {
+  _taskCount = 0;
+  _runningTask = -1;
+}
+
+int8_t Scheduler :: addTask(const char* name, TaskFunction function, void* arg, unsigned long periodMs, uint8_t priority) {
+  if (_taskCount >= MAX_TASKS) {
+    return -1;
+  }
+  Task& task = _tasks[_taskCount];
+  task.name = name;
+  task.function = function;
+  task.arg = arg;
+  task.periodUs = periodMs * 1000UL;
+  task.nextDeadlineUs = SystemClock::micros(); // First run as soon as possible
+  task.priority = priority;
+  memset(&task.stats, 0, sizeof(task.stats));
+  return (int8_t)_taskCount++;
+}
+
+void Scheduler :: setPeriod(int8_t taskId, unsigned long periodMs) {
+  if (taskId < 0 || taskId >= _taskCount) {
+    return;
+  }
+  Task& task = _tasks[taskId];
+  task.periodUs = periodMs * 1000UL;
+  unsigned long latestUs = SystemClock::micros() + task.periodUs;
+  if ((long)(task.nextDeadlineUs - latestUs) > 0) {
+    task.nextDeadlineUs = latestUs;
+  }
+}
+
+int8_t Scheduler :: _nextDueTask(unsigned long nowUs) {
+  int8_t best = -1;
+  for (uint8_t i = 0; i < _taskCount; i++) {
+    Task& task = _tasks[i];
+    if ((long)(nowUs - task.nextDeadlineUs) < 0) {
+      continue;
+    }
+    if (best < 0 ||
+        task.priority < _tasks[best].priority ||
+        (task.priority == _tasks[best].priority &&
+         (long)(task.nextDeadlineUs - _tasks[best].nextDeadlineUs) < 0)) {
+      best = (int8_t)i;
+    }
+  }
+  return best;
+}
+
+void Scheduler :: run() {
+  // Re-select after every task so a newly due high-priority task goes next
+  int8_t index;
+  while ((index = _nextDueTask(SystemClock::micros())) >= 0) {
+    Task& task = _tasks[index];
+    unsigned long startUs = SystemClock::micros();
+    unsigned long latenessUs = startUs - task.nextDeadlineUs;
+
+    _runningTask = index;
+    task.function(task.arg);
+    _runningTask = -1;
+
+    unsigned long runUs = SystemClock::micros() - startUs;
+    task.stats.runs++;
+    task.stats.totalLatenessUs += latenessUs;
+    if (latenessUs > task.stats.maxLatenessUs) {
+      task.stats.maxLatenessUs = latenessUs;
+    }
+    if (runUs > task.stats.maxRunUs) {
+      task.stats.maxRunUs = runUs;
+    }
+
+    // Keep the phase; if a whole period was lost, resynchronise instead
+    // of running the task back to back to catch up
+    task.nextDeadlineUs += task.periodUs;
+    if ((long)(SystemClock::micros() - task.nextDeadlineUs) >= 0) {
+      task.stats.missedPeriods++;
+      task.nextDeadlineUs = SystemClock::micros() + task.periodUs;
+    }
+  }
+}
+
+unsigned long Scheduler :: msUntilNextDeadline() {
+  if (_taskCount == 0) {
+    return 0;
+  }
+  unsigned long nowUs = SystemClock::micros();
+  long soonestUs = (long)(_tasks[0].nextDeadlineUs - nowUs);
+  for (uint8_t i = 1; i < _taskCount; i++) {
+    long remainingUs = (long)(_tasks[i].nextDeadlineUs - nowUs);
+    if (remainingUs < soonestUs) {
+      soonestUs = remainingUs;
+    }
+  }
+  // Round up: a sub-millisecond remainder must not become delay(0) and a busy spin
+  return soonestUs <= 0 ? 0 : ((unsigned long)soonestUs + 999UL) / 1000UL;
+}
+
+const char* Scheduler :: getTaskName(int8_t taskId) {
+  if (taskId < 0 || taskId >= _taskCount) {
+    return "loop";
+  }
+  return _tasks[taskId].name;
+}
+
+const Scheduler::TaskStats* Scheduler :: getStats(int8_t taskId) {
+  if (taskId < 0 || taskId >= _taskCount) {
+    return nullptr;
+  }
+  return &_tasks[taskId].stats;
+}
+
+void Scheduler :: resetStats() {
+  for (uint8_t i = 0; i < _taskCount; i++) {
+    memset(&_tasks[i].stats, 0, sizeof(_tasks[i].stats));
+  }
+}
+
+void Scheduler :: printStats(Print& out) {
+  out.println("Task        prio period_ms runs lateness_us(mean/max) run_us(max) missed");
+  for (uint8_t i = 0; i < _taskCount; i++) {
+    Task& task = _tasks[i];
+    unsigned long meanLatenessUs = task.stats.runs > 0 ? (unsigned long)(task.stats.totalLatenessUs / task.stats.runs) : 0;
+    out.print(task.name);
+    for (size_t pad = strlen(task.name); pad < 12; pad++) {
+      out.print(' ');
+    }
+    out.print((unsigned int)task.priority);
+    out.print("    ");
+    out.print(task.periodUs / 1000UL);
+    out.print(" ");
+    out.print(task.stats.runs);
+    out.print(" ");
+    out.print(meanLatenessUs);
+    out.print("/");
+    out.print(task.stats.maxLatenessUs);
+    out.print(" ");
+    out.print(task.stats.maxRunUs);
+    out.print(" ");
+    out.println(task.stats.missedPeriods);
+  }
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,63 @@
+#ifndef scheduler_h
+#define scheduler_h
+
+#include "Arduino.h"
+
+//////////////////////////////////////////////////////////
+// SCHEDULER (cooperative, deadline based)
+//////////////////////////////////////////////////////////
+// Periodic tasks with a fixed period and priority (0 = highest). run()
+// executes every task whose deadline has passed, always picking the
+// highest-priority due task next, so a high-priority task is never
+// queued behind more than one lower-priority task. Tasks must not block.
+//
+// Jitter is tracked per task as lateness: how far after its deadline a
+// task actually started.
+class Scheduler {
+  public:
+    typedef void (*TaskFunction)(void* arg);
+    static const uint8_t MAX_TASKS = 12; // BatteryProtector takes up to 10 with every option on
+
+    struct TaskStats {
+      unsigned long runs;
+      unsigned long maxLatenessUs;
+      unsigned long long totalLatenessUs;
+      unsigned long maxRunUs;
+      unsigned long missedPeriods; // Deadlines skipped because the task fell a full period behind
+    };
+
+    Scheduler();
+
+    // Returns the task id, or -1 when the table is full
+    int8_t addTask(const char* name, TaskFunction function, void* arg, unsigned long periodMs, uint8_t priority);
+    void setPeriod(int8_t taskId, unsigned long periodMs); // A shorter period takes effect right away
+    void run(); // Run all due tasks, highest priority first
+    unsigned long msUntilNextDeadline(); // 0 when a task is already due
+
+    int8_t getRunningTask() { return _runningTask; } // -1 between tasks; safe from interrupt context
+    const char* getTaskName(int8_t taskId); // "loop" for -1
+
+    const TaskStats* getStats(int8_t taskId);
+    void resetStats();
+    void printStats(Print& out);
+
+  private:
+    struct Task {
+      const char* name;
+      TaskFunction function;
+      void* arg;
+      unsigned long periodUs;
+      unsigned long nextDeadlineUs;
+      uint8_t priority;
+      TaskStats stats;
+    };
+
+    Task _tasks[MAX_TASKS];
+    uint8_t _taskCount;
+    volatile int8_t _runningTask;
+
+    int8_t _nextDueTask(unsigned long nowUs);
+};
+//////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,105 @@
+#include "Arduino.h"
+#include "stateOfCharge.h"
+
+//////////////////////////////////////////////////////////
+// COULOMB COUNTER (state of charge)
+//////////////////////////////////////////////////////////
+namespace {
+
+  // 12 V flooded lead-acid at rest, about 25 degrees C
+  struct OpenCircuitPoint {
+    uint16_t millivolts;
+    uint16_t permille;
+  };
+  const OpenCircuitPoint OPEN_CIRCUIT_TABLE[] = {
+    { 11630, 0 },
+    { 11750, 100 },
+    { 11880, 200 },
+    { 11980, 300 },
+    { 12060, 400 },
+    { 12200, 500 },
+    { 12320, 600 },
+    { 12420, 700 },
+    { 12500, 800 },
+    { 12620, 900 },
+    { 12730, 1000 }
+  };
+  const uint8_t OPEN_CIRCUIT_POINTS = sizeof(OPEN_CIRCUIT_TABLE) / sizeof(OPEN_CIRCUIT_TABLE[0]);
+
+}
+
+CoulombCounter :: CoulombCounter() {
+  begin(100000UL);
+}
+
+void CoulombCounter :: begin(uint32_t capacityMilliampHours) {
+  if (capacityMilliampHours < 1) {
+    capacityMilliampHours = 1;
+  }
+  if (capacityMilliampHours > MAX_CAPACITY_MILLIAMP_HOURS) {
+    capacityMilliampHours = MAX_CAPACITY_MILLIAMP_HOURS;
+  }
+  _capacityMas = (int32_t)(capacityMilliampHours * 3600UL);
+  _permilleDivisor = _capacityMas / 1000 > 0 ? _capacityMas / 1000 : 1;
+  _restMilliamps = (int32_t)(capacityMilliampHours / 200) > 50 ? (int32_t)(capacityMilliampHours / 200) : 50;
+  _chargeMas = _capacityMas;
+  _remainderMaMs = 0;
+  _restMs = 0;
+  _isAnchored = false;
+}
+
+bool CoulombCounter :: addSample(int32_t milliamps, unsigned long elapsedMs) {
+  if (elapsedMs > 10000UL) {
+    elapsedMs = 10000UL; // Keeps mA x ms in 31 bits up to 200 A
+  }
+  if (milliamps < 0) {
+    milliamps = milliamps * CHARGE_EFFICIENCY_PERCENT / 100; // Only part of the charge is stored
+  }
+  _remainderMaMs -= milliamps * (int32_t)elapsedMs;
+  int32_t wholeMas = _remainderMaMs / 1000;
+  _remainderMaMs -= wholeMas * 1000;
+  _chargeMas += wholeMas;
+  if (_chargeMas < 0) {
+    _chargeMas = 0;
+  } else if (_chargeMas > _capacityMas) {
+    _chargeMas = _capacityMas;
+  }
+
+  bool isResting = milliamps < _restMilliamps && milliamps > -_restMilliamps;
+  _restMs = isResting ? _restMs + elapsedMs : 0;
+  return _restMs >= REST_ANCHOR_MS;
+}
+
+void CoulombCounter :: anchor(uint16_t restingMillivolts) {
+  _chargeMas = (int32_t)permilleFromRestingVoltage(restingMillivolts) * _permilleDivisor;
+  _remainderMaMs = 0;
+  _restMs = 0;
+  _isAnchored = true;
+}
+
+void CoulombCounter :: restore(int32_t chargeMilliampSeconds) {
+  _chargeMas = chargeMilliampSeconds < 0 ? 0 : (chargeMilliampSeconds > _capacityMas ? _capacityMas : chargeMilliampSeconds);
+  _remainderMaMs = 0;
+  _restMs = 0;
+  _isAnchored = true;
+}
+
+uint16_t CoulombCounter :: getPermille() {
+  int32_t permille = _chargeMas / _permilleDivisor;
+  return permille > 1000 ? 1000 : (uint16_t)permille;
+}
+
+uint16_t CoulombCounter :: permilleFromRestingVoltage(uint16_t millivolts) {
+  if (millivolts <= OPEN_CIRCUIT_TABLE[0].millivolts) {
+    return 0;
+  }
+  for (uint8_t i = 1; i < OPEN_CIRCUIT_POINTS; i++) {
+    const OpenCircuitPoint& high = OPEN_CIRCUIT_TABLE[i];
+    if (millivolts < high.millivolts) {
+      const OpenCircuitPoint& low = OPEN_CIRCUIT_TABLE[i - 1];
+      return low.permille + (uint16_t)((uint32_t)(millivolts - low.millivolts) * (high.permille - low.permille) / (high.millivolts - low.millivolts));
+    }
+  }
+  return 1000;
+}
+//////////////////////////////////////////////////////////
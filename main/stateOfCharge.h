@@ -0,0 +1,51 @@
+#ifndef stateOfCharge_h
+#define stateOfCharge_h
+
+#include "Arduino.h"
+
+//////////////////////////////////////////////////////////
+// COULOMB COUNTER (state of charge)
+//////////////////////////////////////////////////////////
+// Integrates the battery current into the charge left, in integer
+// milliamp-seconds (a remainder below 1 mAs carries over, so nothing is
+// lost at short sample intervals). Charging current counts at
+// CHARGE_EFFICIENCY_PERCENT: lead-acid turns part of it into gas.
+//
+// Counting drifts with the sensor offset and the efficiency guess, so
+// the charge is re-anchored to the resting voltage: once the current has
+// stayed below the rest level (C/200) for REST_ANCHOR_MS, the caller
+// passes the voltage to anchor(), which looks the charge up in a 12 V
+// lead-acid open-circuit table. The first anchor (at boot) uses
+// whatever voltage the battery shows then.
+class CoulombCounter {
+  public:
+    static const uint8_t CHARGE_EFFICIENCY_PERCENT = 95;
+    static const unsigned long REST_ANCHOR_MS = 1800000UL; // 30 min without current: surface charge gone
+    static const uint32_t MAX_CAPACITY_MILLIAMP_HOURS = 500000UL; // Keeps milliamp-seconds in 31 bits
+
+    CoulombCounter();
+
+    void begin(uint32_t capacityMilliampHours);
+    bool addSample(int32_t milliamps, unsigned long elapsedMs); // Positive discharges; true when rested long enough to anchor
+    void anchor(uint16_t restingMillivolts); // Charge from the open-circuit voltage; restarts the rest time
+    void restore(int32_t chargeMilliampSeconds); // Charge saved before a deep sleep
+    bool isAnchored() { return _isAnchored; }
+    uint16_t getPermille(); // 0..1000
+    uint8_t getPercent() { return (uint8_t)((getPermille() + 5) / 10); }
+    int32_t getChargeMilliampSeconds() { return _chargeMas; }
+    uint32_t getCapacityMilliampHours() { return _capacityMas / 3600; }
+
+    static uint16_t permilleFromRestingVoltage(uint16_t millivolts);
+
+  private:
+    int32_t _capacityMas;
+    int32_t _permilleDivisor; // _capacityMas / 1000
+    int32_t _restMilliamps;
+    int32_t _chargeMas;
+    int32_t _remainderMaMs;   // Below one milliamp-second, carried to the next sample
+    unsigned long _restMs;
+    bool _isAnchored;
+};
+//////////////////////////////////////////////////////////
+
+#endif
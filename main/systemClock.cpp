@@ -0,0 +1,28 @@
+#include "Arduino.h"
+#include "systemClock.h"
+
+//////////////////////////////////////////////////////////
+// SYSTEM CLOCK
+//////////////////////////////////////////////////////////
+volatile unsigned long SystemClock :: _offsetMs = 0;
+volatile unsigned long SystemClock :: _offsetUs = 0;
+uint32_t SystemClock :: _remainderUs = 0;
+unsigned long long SystemClock :: _totalSleptUs = 0;
+
+void SystemClock :: creditSleep(uint32_t sleptUs) {
+  // Both offsets are single machine words, so readers in interrupt
+  // context never see a torn value
+  _offsetUs += sleptUs;
+  _remainderUs += sleptUs;
+  _offsetMs += _remainderUs / 1000UL;
+  _remainderUs %= 1000UL;
+  _totalSleptUs += sleptUs;
+}
+
+void SystemClock :: reset() {
+  _offsetUs = 0;
+  _offsetMs = 0;
+  _remainderUs = 0;
+  _totalSleptUs = 0;
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,35 @@
+#ifndef systemClock_h
+#define systemClock_h
+
+#include "Arduino.h"
+
+//////////////////////////////////////////////////////////
+// SYSTEM CLOCK
+//////////////////////////////////////////////////////////
+// millis() and micros() stop while the chip is in forced light sleep
+// (the CPU clock and its timers are halted). Firmware timing goes
+// through SystemClock instead, which adds the sleep time measured on the
+// RTC timer, so deadlines, debounce and the rearm countdown keep running
+// in real time. Safe to call from interrupt and timer context.
+class SystemClock {
+  public:
+    static inline unsigned long millis() { return ::millis() + _offsetMs; }
+    static inline unsigned long micros() { return ::micros() + _offsetUs; }
+    
+    // Called after waking up with the time spent asleep
+    static void creditSleep(uint32_t sleptUs);
+    static unsigned long long getTotalSleptUs() { return _totalSleptUs; }
+    
+    // Back to the power-on state (a chip reset clears RAM; the host
+    // simulator restarts the sketch without one)
+    static void reset();
+    
+  private:
+    static volatile unsigned long _offsetMs;
+    static volatile unsigned long _offsetUs; // Same width as micros(), so both wrap together
+    static uint32_t _remainderUs;       // Sub-millisecond part not yet in _offsetMs
+    static unsigned long long _totalSleptUs;
+};
+//////////////////////////////////////////////////////////
+
+#endif
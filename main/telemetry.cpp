@@ -0,0 +1,171 @@
+#include "Arduino.h"
+#include "telemetry.h"
+#include "historyLog.h"
+
+//////////////////////////////////////////////////////////
+// TELEMETRY (binary records over Serial)
+//////////////////////////////////////////////////////////
+namespace {
+
+  uint8_t putUint16(uint8_t* out, uint16_t value) {
+    out[0] = (uint8_t)(value & 0xFF);
+    out[1] = (uint8_t)(value >> 8);
+    return 2;
+  }
+
+  uint8_t putUint32(uint8_t* out, uint32_t value) {
+    putUint16(out, (uint16_t)(value & 0xFFFF));
+    putUint16(out + 2, (uint16_t)(value >> 16));
+    return 4;
+  }
+
+}
+
+Telemetry :: Telemetry() {
+  _head = 0;
+  _count = 0;
+  _sequence = 0;
+  _droppedFrames = 0;
+  _droppedTextBytes = 0;
+}
+
+void Telemetry :: sendSample(uint32_t timeMs, uint16_t millivolts, uint16_t noiseMillivolts, uint8_t state, uint8_t flags) {
+  uint8_t record[MAX_RECORD_BYTES];
+  uint8_t length = 2;
+  record[0] = TELEMETRY_SAMPLE;
+  length += putUint32(record + length, timeMs);
+  length += putUint16(record + length, millivolts);
+  length += putUint16(record + length, noiseMillivolts);
+  record[length++] = state;
+  record[length++] = flags;
+  _sendRecord(record, length);
+}
+
+void Telemetry :: sendEvent(uint32_t timeMs, uint8_t event, uint16_t millivolts) {
+  uint8_t record[MAX_RECORD_BYTES];
+  uint8_t length = 2;
+  record[0] = TELEMETRY_EVENT;
+  length += putUint32(record + length, timeMs);
+  record[length++] = event;
+  length += putUint16(record + length, millivolts);
+  _sendRecord(record, length);
+}
+
+void Telemetry :: sendConfig(uint16_t cutoffMillivolts, uint16_t rearmMillivolts, uint32_t rearmDelayMs) {
+  uint8_t record[MAX_RECORD_BYTES];
+  uint8_t length = 2;
+  record[0] = TELEMETRY_CONFIG;
+  length += putUint16(record + length, cutoffMillivolts);
+  length += putUint16(record + length, rearmMillivolts);
+  length += putUint32(record + length, rearmDelayMs);
+  _sendRecord(record, length);
+}
+
+void Telemetry :: pump(Print& out) {
+  int room = out.availableForWrite();
+  while (_count > 0 && room > 0) {
+    // Contiguous part of the ring first, the wrapped part on the next pass
+    uint16_t length = QUEUE_SIZE - _head < _count ? QUEUE_SIZE - _head : _count;
+    if (length > room) {
+      length = room;
+    }
+    out.write(_queue + _head, length);
+    _head = (_head + length) % QUEUE_SIZE;
+    _count -= length;
+    room -= length;
+  }
+}
+
+void Telemetry :: drain(Print& out) {
+  while (_count > 0) {
+    uint16_t length = QUEUE_SIZE - _head < _count ? QUEUE_SIZE - _head : _count;
+    out.write(_queue + _head, length);
+    _head = (_head + length) % QUEUE_SIZE;
+    _count -= length;
+  }
+}
+
+size_t Telemetry :: write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t Telemetry :: write(const uint8_t* buffer, size_t size) {
+  // Text is not framed: whatever does not fit is cut off
+  size_t room = QUEUE_SIZE - _count;
+  if (size > room) {
+    _droppedTextBytes += size - room;
+    size = room;
+  }
+  _push(buffer, (uint16_t)size);
+  return size;
+}
+
+int Telemetry :: availableForWrite() {
+  return QUEUE_SIZE - _count;
+}
+
+size_t Telemetry :: cobsEncode(const uint8_t* data, size_t length, uint8_t* out) {
+  size_t codeIndex = 0;
+  size_t outLength = 1;
+  uint8_t code = 1;
+  for (size_t i = 0; i < length; i++) {
+    if (data[i] != 0) {
+      out[outLength++] = data[i];
+      code++;
+    }
+    if (data[i] == 0 || code == 0xFF) {
+      out[codeIndex] = code;
+      codeIndex = outLength++;
+      code = 1;
+    }
+  }
+  out[codeIndex] = code;
+  return outLength;
+}
+
+size_t Telemetry :: cobsDecode(const uint8_t* data, size_t length, uint8_t* out) {
+  size_t outLength = 0;
+  size_t i = 0;
+  while (i < length) {
+    uint8_t code = data[i++];
+    if (code == 0 || i + code - 1 > length) {
+      return 0;
+    }
+    for (uint8_t j = 1; j < code; j++) {
+      if (data[i] == 0) {
+        return 0;
+      }
+      out[outLength++] = data[i++];
+    }
+    if (code != 0xFF && i < length) {
+      out[outLength++] = 0;
+    }
+  }
+  return outLength;
+}
+
+void Telemetry :: _sendRecord(uint8_t* record, uint8_t length) {
+  record[1] = _sequence++;
+  uint16_t crc = HistoryLog::crc16(record, length);
+  record[length++] = (uint8_t)(crc & 0xFF);
+  record[length++] = (uint8_t)(crc >> 8);
+
+  uint8_t frame[MAX_FRAME_BYTES + 1];
+  uint8_t frameLength = 0;
+  frame[frameLength++] = 0; // Ends any text or partial frame before this one
+  frameLength += cobsEncode(record, length, frame + frameLength);
+  frame[frameLength++] = 0;
+  if (frameLength > QUEUE_SIZE - _count) {
+    _droppedFrames++; // The sequence gap shows the loss to the decoder
+    return;
+  }
+  _push(frame, frameLength);
+}
+
+void Telemetry :: _push(const uint8_t* data, uint16_t length) {
+  for (uint16_t i = 0; i < length; i++) {
+    _queue[(_head + _count) % QUEUE_SIZE] = data[i];
+    _count++;
+  }
+}
+//////////////////////////////////////////////////////////
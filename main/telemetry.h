@@ -0,0 +1,77 @@
+#ifndef telemetry_h
+#define telemetry_h
+
+#include "Arduino.h"
+
+//////////////////////////////////////////////////////////
+// TELEMETRY (binary records over Serial)
+//////////////////////////////////////////////////////////
+// Fixed-layout records, each sent as one COBS-encoded frame between two
+// 0x00 delimiters. A frame is:
+//   uint8 type, uint8 sequence, payload, uint16 CRC-16 (CCITT) of all before
+// Integers are little-endian. The sequence increments per frame, so a
+// decoder sees dropped frames. Plain text may sit between frames; COBS
+// keeps 0x00 out of frames and text never contains it.
+//
+//   TELEMETRY_SAMPLE  uint32 timeMs, uint16 millivolts, uint16 noiseMillivolts,
+//                     uint8 state, uint8 flags (TELEMETRY_FLAG_*)
+//   TELEMETRY_EVENT   uint32 timeMs, uint8 event (HistoryEvent), uint16 millivolts
+//   TELEMETRY_CONFIG  uint16 cutoffMillivolts, uint16 rearmMillivolts, uint32 rearmDelayMs
+enum TelemetryRecordType {
+  TELEMETRY_SAMPLE = 1,
+  TELEMETRY_EVENT = 2,
+  TELEMETRY_CONFIG = 3
+};
+
+enum TelemetryFlags {
+  TELEMETRY_FLAG_WAITING_FOR_REARM = 0x01,
+  TELEMETRY_FLAG_VERIFYING_REARM = 0x02,
+  TELEMETRY_FLAG_LOW_POWER = 0x04
+};
+
+// Everything written goes into a RAM queue first; pump() moves as much
+// as the UART FIFO takes right now, so neither records nor text written
+// through this Print ever block the loop. When the queue is full, whole
+// frames (or text bytes) are dropped and counted instead.
+class Telemetry : public Print {
+  public:
+    static const uint16_t QUEUE_SIZE = 1024;
+    static const uint8_t MAX_RECORD_BYTES = 16;                  // Type, sequence and payload
+    static const uint8_t MAX_FRAME_BYTES = MAX_RECORD_BYTES + 2 + 2 + 1; // CRC, COBS overhead and delimiters
+
+    Telemetry();
+
+    void sendSample(uint32_t timeMs, uint16_t millivolts, uint16_t noiseMillivolts, uint8_t state, uint8_t flags);
+    void sendEvent(uint32_t timeMs, uint8_t event, uint16_t millivolts);
+    void sendConfig(uint16_t cutoffMillivolts, uint16_t rearmMillivolts, uint32_t rearmDelayMs);
+    void pump(Print& out); // Non-blocking: writes at most out.availableForWrite() bytes
+    void drain(Print& out); // Blocking: writes everything queued (before a deep sleep)
+
+    // Text log through the same queue
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buffer, size_t size);
+    using Print::write;
+    int availableForWrite();
+
+    uint16_t getQueued() { return _count; }
+    unsigned long getDroppedFrames() { return _droppedFrames; }
+    unsigned long getDroppedTextBytes() { return _droppedTextBytes; }
+
+    // Frame coding, shared with host decoders
+    static size_t cobsEncode(const uint8_t* data, size_t length, uint8_t* out); // out needs length + length / 254 + 1
+    static size_t cobsDecode(const uint8_t* data, size_t length, uint8_t* out); // 0 on malformed input
+
+  private:
+    uint8_t _queue[QUEUE_SIZE];
+    uint16_t _head; // Next byte to send
+    uint16_t _count;
+    uint8_t _sequence;
+    unsigned long _droppedFrames;
+    unsigned long _droppedTextBytes;
+
+    void _sendRecord(uint8_t* record, uint8_t length); // record[1] is filled in with the sequence
+    void _push(const uint8_t* data, uint16_t length);
+};
+//////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,153 @@
+#include "Arduino.h"
+#include "transientClassifier.h"
+
+//////////////////////////////////////////////////////////
+// TRANSIENT CLASSIFIER
+//////////////////////////////////////////////////////////
+TransientClassifier :: TransientClassifier() {
+  _config.dwellMs = 0;
+  _config.onsetMs = 0;
+  _config.onsetMillivolts = 0;
+  _config.collapseMillivolts = 0;
+  _config.collapseMs = 0;
+  _config.recoveryMillivoltsPerSecond = 0;
+  _threshold = 0;
+  reset();
+}
+
+TransientConfig TransientClassifier :: defaultConfig() {
+  TransientConfig config;
+  config.dwellMs = 3000;
+  config.onsetMs = 200;
+  config.onsetMillivolts = 500;
+  config.collapseMillivolts = 6000;
+  config.collapseMs = 100;
+  config.recoveryMillivoltsPerSecond = 2000;
+  return config;
+}
+
+void TransientClassifier :: begin(const TransientConfig& config, uint16_t thresholdMillivolts) {
+  _config = config;
+  _threshold = thresholdMillivolts;
+  reset();
+}
+
+void TransientClassifier :: setThreshold(uint16_t thresholdMillivolts) {
+  _threshold = thresholdMillivolts;
+}
+
+void TransientClassifier :: reset() {
+  _verdict = VERDICT_CLEAR;
+  _inDip = false;
+  _isSettling = false;
+  _hasHigh = false;
+  _lastHighMs = 0;
+  _dipStartMs = 0;
+  _dipEndMs = 0;
+  _lastLowAtMs = 0;
+  _lastLowMillivolts = 0;
+  _minMillivolts = 0;
+  _collapseStartMs = 0;
+  _isCollapsing = false;
+  _dwellLeftMs = _config.dwellMs;
+  _transientCount = 0;
+  _slowRecoveryCount = 0;
+  _lastDip.minMillivolts = 0;
+  _lastDip.durationMs = 0;
+  _lastDip.recoveryMillivoltsPerSecond = 0;
+}
+
+TransientClassifier::Verdict TransientClassifier :: addSample(uint16_t millivolts, unsigned long nowMs) {
+  if (!_inDip) {
+    if ((uint32_t)millivolts >= (uint32_t)_threshold + _config.onsetMillivolts) {
+      _hasHigh = true;
+      _lastHighMs = nowMs;
+    }
+    if (millivolts >= _threshold) {
+      if (_isSettling && nowMs - _dipEndMs >= SETTLE_MS) {
+        _isSettling = false;
+      }
+      _verdict = _isSettling ? VERDICT_TRANSIENT : VERDICT_CLEAR;
+      return _verdict;
+    }
+    _startDip(nowMs);
+  }
+
+  // Lowest point, and the last point of the climb back (below the band
+  // the recovery slope is measured across)
+  if (millivolts <= _minMillivolts) {
+    _minMillivolts = millivolts;
+    _lastLowMillivolts = millivolts;
+    _lastLowAtMs = nowMs;
+  } else if ((uint32_t)millivolts + EXIT_HYSTERESIS_MILLIVOLTS <= _threshold) {
+    _lastLowMillivolts = millivolts;
+    _lastLowAtMs = nowMs;
+  }
+
+  // Depth: a collapse is not ridden through
+  if (millivolts < _config.collapseMillivolts) {
+    if (!_isCollapsing) {
+      _isCollapsing = true;
+      _collapseStartMs = nowMs;
+    }
+    if (nowMs - _collapseStartMs >= _config.collapseMs) {
+      _verdict = VERDICT_SUSTAINED;
+    }
+  } else {
+    _isCollapsing = false;
+  }
+
+  // Duration: the dwell time bounds the ride-through
+  if (_verdict == VERDICT_TRANSIENT && nowMs - _dipStartMs >= _dwellLeftMs) {
+    _verdict = VERDICT_SUSTAINED;
+  }
+
+  if ((uint32_t)millivolts >= (uint32_t)_threshold + EXIT_HYSTERESIS_MILLIVOLTS) {
+    _endDip(millivolts, nowMs);
+  }
+  return _verdict;
+}
+
+void TransientClassifier :: _startDip(unsigned long nowMs) {
+  _inDip = true;
+  _isSettling = false;
+  _dipStartMs = nowMs;
+  _minMillivolts = 0xFFFF;
+  _isCollapsing = false;
+  if (nowMs - _dipEndMs >= DWELL_REFILL_MS) {
+    _dwellLeftMs = _config.dwellMs; // Long enough above the threshold
+  }
+  // Onset: only a fast fall from well above the threshold is a transient
+  bool isFastOnset = _hasHigh && nowMs - _lastHighMs <= _config.onsetMs;
+  _verdict = isFastOnset && _dwellLeftMs > 0 ? VERDICT_TRANSIENT : VERDICT_SUSTAINED;
+}
+
+void TransientClassifier :: _endDip(uint16_t millivolts, unsigned long nowMs) {
+  _isSettling = _verdict == VERDICT_TRANSIENT;
+  if (_isSettling) {
+    // Recovery: the climb from the last low point out of the dip
+    unsigned long climbMs = nowMs - _lastLowAtMs;
+    uint32_t rate = climbMs == 0 ? 0xFFFF : (uint32_t)(millivolts - _lastLowMillivolts) * 1000UL / climbMs;
+    unsigned long durationMs = nowMs - _dipStartMs;
+    _lastDip.minMillivolts = _minMillivolts;
+    _lastDip.durationMs = durationMs;
+    _lastDip.recoveryMillivoltsPerSecond = rate > 0xFFFF ? 0xFFFF : (uint16_t)rate;
+    if (_transientCount < 0xFFFF) {
+      _transientCount++;
+    }
+    if (rate >= _config.recoveryMillivoltsPerSecond) {
+      _dwellLeftMs = _config.dwellMs;
+    } else {
+      // Slow to come back: the next dip only gets the rest of the dwell
+      _dwellLeftMs = _dwellLeftMs > durationMs ? _dwellLeftMs - durationMs : 0;
+      if (_slowRecoveryCount < 0xFFFF) {
+        _slowRecoveryCount++;
+      }
+    }
+  }
+  _inDip = false;
+  _dipEndMs = nowMs;
+  _isCollapsing = false;
+  _verdict = _isSettling ? VERDICT_TRANSIENT : VERDICT_CLEAR;
+}
+//////////////////////////////////////////////////////////
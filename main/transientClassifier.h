@@ -0,0 +1,104 @@
+#ifndef transientClassifier_h
+#define transientClassifier_h
+
+#include "Arduino.h"
+
+//////////////////////////////////////////////////////////
+// TRANSIENT CLASSIFIER (crank and inrush dips)
+//////////////////////////////////////////////////////////
+// Cranking an engine pulls a 12 V battery to 9-10 V for a second or two
+// (deeper for the first few milliseconds of starter inrush); switching
+// on a large load does the same for a fraction of a second. Neither
+// means the battery is empty, but both cross the cutoff threshold. The
+// classifier watches every raw sample and judges each excursion below
+// the threshold by its shape:
+//
+//   onset     a transient falls from onsetMillivolts above the
+//             threshold to below it within onsetMs; a discharge creeps
+//             across it and is SUSTAINED at once
+//   duration  a transient dip ends within dwellMs; longer is SUSTAINED,
+//             so a real discharge that starts with a step is cut off
+//             after at most dwellMs
+//   depth     below collapseMillivolts for collapseMs is a collapse
+//             (short circuit, failed cell), SUSTAINED at once
+//   recovery  a crank ends with the voltage climbing back at
+//             recoveryMillivoltsPerSecond or faster (alternator, starter
+//             released); a slow climb is a battery near empty, and the
+//             next dip only gets what is left of the dwell time
+//
+// The dwell time refills after a fast recovery, or after the voltage
+// has stayed above the threshold for DWELL_REFILL_MS. The verdict stays
+// TRANSIENT for SETTLE_MS after a transient dip ends, while a filtered
+// voltage behind it is still catching up.
+struct TransientConfig {
+  unsigned long dwellMs;               // Longest ride-through below the threshold
+  unsigned long onsetMs;
+  uint16_t onsetMillivolts;
+  uint16_t collapseMillivolts;         // Absolute battery voltage
+  unsigned long collapseMs;
+  uint16_t recoveryMillivoltsPerSecond;
+};
+
+class TransientClassifier {
+  public:
+    static const uint16_t EXIT_HYSTERESIS_MILLIVOLTS = 200; // A dip ends this far above the threshold
+    static const unsigned long DWELL_REFILL_MS = 60000;
+    static const unsigned long SETTLE_MS = 500;
+
+    enum Verdict {
+      VERDICT_CLEAR,     // Above the threshold
+      VERDICT_TRANSIENT, // Below it, riding through
+      VERDICT_SUSTAINED  // Below it, and not a transient: let the cutoff act
+    };
+
+    // Shape of the last finished transient dip
+    struct DipStats {
+      uint16_t minMillivolts;
+      unsigned long durationMs;
+      uint16_t recoveryMillivoltsPerSecond;
+    };
+
+    TransientClassifier();
+    
+    // 3 s dwell (a cold diesel cranks for about 2 s), fast onset from
+    // 0.5 V above the threshold within 200 ms, collapse below 6.0 V for
+    // 100 ms, fast recovery from 2 V/s
+    static TransientConfig defaultConfig();
+
+    void begin(const TransientConfig& config, uint16_t thresholdMillivolts);
+    void setThreshold(uint16_t thresholdMillivolts); // Follows the load compensation
+    Verdict addSample(uint16_t millivolts, unsigned long nowMs);
+    Verdict getVerdict() { return _verdict; }
+    bool isRidingThrough() { return _verdict == VERDICT_TRANSIENT; }
+    const TransientConfig& getConfig() { return _config; }
+    uint16_t getTransientCount() { return _transientCount; } // Dips ridden through
+    uint16_t getSlowRecoveryCount() { return _slowRecoveryCount; }
+    const DipStats& getLastDip() { return _lastDip; }
+    void reset();
+
+  private:
+    TransientConfig _config;
+    uint16_t _threshold;
+    Verdict _verdict;
+    bool _inDip;
+    bool _isSettling;               // Transient dip over, filtered readings still low
+    bool _hasHigh;
+    unsigned long _lastHighMs;      // Last sample onsetMillivolts above the threshold
+    unsigned long _dipStartMs;
+    unsigned long _dipEndMs;
+    unsigned long _lastLowAtMs;     // Start of the climb out of the dip
+    uint16_t _lastLowMillivolts;
+    uint16_t _minMillivolts;
+    unsigned long _collapseStartMs;
+    bool _isCollapsing;
+    unsigned long _dwellLeftMs;
+    uint16_t _transientCount;
+    uint16_t _slowRecoveryCount;
+    DipStats _lastDip;
+
+    void _startDip(unsigned long nowMs);
+    void _endDip(uint16_t millivolts, unsigned long nowMs);
+};
+//////////////////////////////////////////////////////////
+
+#endif
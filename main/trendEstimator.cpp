@@ -0,0 +1,77 @@
+#include "Arduino.h"
+#include "trendEstimator.h"
+
+//////////////////////////////////////////////////////////
+// TREND ESTIMATOR
+//////////////////////////////////////////////////////////
+TrendEstimator :: TrendEstimator() {
+  reset();
+}
+
+void TrendEstimator :: reset() {
+  _oldest = 0;
+  _count = 0;
+  _sumY = 0;
+  _sumXY = 0;
+}
+
+void TrendEstimator :: addSample(uint16_t value) {
+  if (_count < WINDOW) {
+    // Filling: the new sample goes to x = count
+    _values[_count] = value;
+    _sumXY += (int32_t)_count * value;
+    _sumY += value;
+    _count++;
+    return;
+  }
+  // Full: the oldest sample (x = 0) leaves, the others move to x - 1,
+  // the new one enters at x = WINDOW - 1
+  uint16_t leaving = _values[_oldest];
+  _values[_oldest] = value;
+  _oldest = (_oldest + 1) % WINDOW;
+  _sumY -= leaving;
+  _sumXY -= _sumY;
+  _sumXY += (int32_t)(WINDOW - 1) * value;
+  _sumY += value;
+}
+
+int64_t TrendEstimator :: _slopeNumerator() {
+  int64_t n = _count;
+  int64_t sumX = n * (n - 1) / 2;
+  return n * _sumXY - sumX * _sumY;
+}
+
+int64_t TrendEstimator :: _slopeDenominator() {
+  int64_t n = _count;
+  int64_t sumX = n * (n - 1) / 2;
+  int64_t sumXX = (n - 1) * n * (2 * n - 1) / 6;
+  return n * sumXX - sumX * sumX;
+}
+
+int32_t TrendEstimator :: getSlopeMilliPerInterval() {
+  if (_count < MIN_SAMPLES) {
+    return 0;
+  }
+  return (int32_t)(_slopeNumerator() * 1000 / _slopeDenominator());
+}
+
+uint32_t TrendEstimator :: getIntervalsTo(uint16_t threshold) {
+  if (_count < MIN_SAMPLES) {
+    return NO_ESTIMATE;
+  }
+  int64_t numerator = _slopeNumerator();
+  if (numerator >= 0) {
+    return NO_ESTIMATE; // Flat or rising
+  }
+  // The fitted line at the newest sample (x = n - 1) is
+  // sumY / n + slope x (n - 1) / 2; its distance to the threshold over
+  // -slope, both sides multiplied by 2 x n x -numerator
+  int64_t n = _count;
+  int64_t scaledMargin = 2 * (_sumY - n * threshold) * _slopeDenominator() + n * (n - 1) * numerator;
+  if (scaledMargin <= 0) {
+    return 0;
+  }
+  int64_t intervals = scaledMargin / (2 * n * -numerator);
+  return intervals > (int64_t)MAX_INTERVALS ? NO_ESTIMATE : (uint32_t)intervals;
+}
+//////////////////////////////////////////////////////////
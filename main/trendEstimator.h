@@ -0,0 +1,47 @@
+#ifndef trendEstimator_h
+#define trendEstimator_h
+
+#include "Arduino.h"
+
+//////////////////////////////////////////////////////////
+// TREND ESTIMATOR (time to cutoff)
+//////////////////////////////////////////////////////////
+// Least-squares line through the last WINDOW samples of a slowly
+// falling value (filtered millivolts, or state of charge in permille),
+// taken at a fixed interval, and the time until that line reaches a
+// threshold.
+//
+// Sample k of the window sits at x = k, so the sums of x and x^2 only
+// depend on the sample count. The sums of y and x*y are updated as a
+// sample enters and the oldest one leaves (every remaining sample moves
+// one step to the left, which takes the sum of y off the x*y sum), so a
+// sample costs the same whether the window holds 6 samples or 64, and
+// the sums are exact integers: nothing drifts over days of running.
+class TrendEstimator {
+  public:
+    static const uint8_t WINDOW = 64;
+    static const uint8_t MIN_SAMPLES = 6; // Fewer give no estimate
+    static const uint32_t NO_ESTIMATE = 0xFFFFFFFFUL;
+    static const uint32_t MAX_INTERVALS = 100000UL; // Flatter than this is no estimate either
+
+    TrendEstimator();
+
+    void addSample(uint16_t value);
+    void reset(); // The series jumped (relay switched, charge re-anchored)
+    uint8_t getCount() { return _count; }
+    int32_t getSlopeMilliPerInterval(); // Change per interval x 1000; 0 below MIN_SAMPLES
+    uint32_t getIntervalsTo(uint16_t threshold); // Until the fitted line reaches threshold; 0 if it already has, NO_ESTIMATE if not falling
+
+  private:
+    uint16_t _values[WINDOW];
+    uint8_t _oldest;   // Ring position of x = 0 once the window is full
+    uint8_t _count;
+    int32_t _sumY;
+    int32_t _sumXY;
+
+    int64_t _slopeNumerator();   // count x sum(xy) - sum(x) x sum(y)
+    int64_t _slopeDenominator(); // count x sum(x^2) - sum(x)^2
+};
+//////////////////////////////////////////////////////////
+
+#endif
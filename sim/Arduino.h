@@ -0,0 +1,138 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+//////////////////////////////////////////////////////////
+// HOST ARDUINO SHIM
+//
+// Minimal stand-in for the ESP8266 Arduino core so the firmware
+// sources in ../main compile and run on a Linux host. Time is
+// virtual (see simHal.h): delay() advances the clock instantly.
+//////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x00
+#define OUTPUT 0x01
+#define INPUT_PULLUP 0x02
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define NOT_AN_INTERRUPT -1
+#define digitalPinToInterrupt(p) (((p) < 16) ? (p) : NOT_AN_INTERRUPT)
+
+#define IRAM_ATTR
+
+#define DEC 10
+#define HEX 16
+
+static const uint8_t A0 = 17;
+static const uint8_t SDA = 4; // D2: the core's default I2C pins
+static const uint8_t SCL = 5; // D1
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration = 0);
+void noTone(uint8_t pin);
+void attachInterruptArg(uint8_t pin, void (*handler)(void*), void* arg, int mode);
+void detachInterrupt(uint8_t pin);
+char* dtostrf(double value, signed char width, unsigned char precision, char* buffer);
+
+// timer0 (CCOMPARE0): the callback runs once when the cycle counter
+// reaches the written value; it fires during busy time too, but not in
+// light sleep (the CPU clock is halted)
+typedef void (*timercallback)(void);
+void timer0_isr_init();
+void timer0_attachInterrupt(timercallback userFunc);
+void timer0_detachInterrupt();
+void timer0_write(uint32_t count);
+
+// GPIO registers (esp8266_peri.h). On the host a write to GPOS/GPOC
+// sets every pin in the mask through the pin table, like digitalWrite()
+struct SimGpioOutputRegister {
+  uint8_t level;
+  void operator=(uint32_t mask);
+};
+struct SimGpioInputRegister {
+  operator uint32_t() const;
+};
+extern SimGpioOutputRegister GPOS;
+extern SimGpioOutputRegister GPOC;
+extern SimGpioInputRegister GPI;
+
+
+//////////////////////////////////////////////////////////
+// PRINT
+//////////////////////////////////////////////////////////
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* text) { return text ? write((const uint8_t*)text, strlen(text)) : 0; }
+    virtual int availableForWrite() { return 0; } // 0: a write may block
+
+    size_t print(const char* text);
+    size_t print(char c);
+    size_t print(int value, int base = DEC);
+    size_t print(unsigned int value, int base = DEC);
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t print(double value, int digits = 2);
+
+    size_t println();
+    size_t println(const char* text);
+    size_t println(char c);
+    size_t println(int value, int base = DEC);
+    size_t println(unsigned int value, int base = DEC);
+    size_t println(long value, int base = DEC);
+    size_t println(unsigned long value, int base = DEC);
+    size_t println(double value, int digits = 2);
+
+  private:
+    size_t _printNumber(unsigned long value, int base);
+};
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// SERIAL
+//////////////////////////////////////////////////////////
+class HardwareSerial : public Print {
+  public:
+    void begin(unsigned long baud);
+    void flush();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buffer, size_t size);
+    using Print::write;
+    int availableForWrite();
+    int available();
+    int read();
+    operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+//////////////////////////////////////////////////////////
+
+#include "Esp.h"
+
+#endif
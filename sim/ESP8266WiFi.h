@@ -0,0 +1,46 @@
+#ifndef ESP8266WiFi_h
+#define ESP8266WiFi_h
+
+#include "Arduino.h"
+
+//////////////////////////////////////////////////////////
+// FAKE ESP8266WIFI
+//
+// The modem power state: the simulation charges awake time with or
+// without the radio (see sim::getPowerStats()). Station mode joins the
+// simulated access point of tcpNet.h; like the core, begin() returns
+// at once and status() follows the association.
+//////////////////////////////////////////////////////////
+enum WiFiMode_t {
+  WIFI_OFF = 0,
+  WIFI_STA = 1,
+  WIFI_AP = 2,
+  WIFI_AP_STA = 3
+};
+
+enum wl_status_t {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_WRONG_PASSWORD = 6,
+  WL_DISCONNECTED = 7
+};
+
+class ESP8266WiFiClass {
+  public:
+    bool mode(WiFiMode_t mode);
+    WiFiMode_t getMode();
+    bool forceSleepBegin(uint32_t sleepUs = 0);
+    bool forceSleepWake();
+    void persistent(bool persistent);
+    wl_status_t begin(const char* ssid, const char* passphrase = nullptr);
+    bool disconnect(bool wifiOff = false);
+    wl_status_t status();
+};
+
+extern ESP8266WiFiClass WiFi;
+//////////////////////////////////////////////////////////
+
+#endif
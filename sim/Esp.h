@@ -0,0 +1,52 @@
+#ifndef Esp_h
+#define Esp_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "user_interface.h"
+
+//////////////////////////////////////////////////////////
+// FAKE ESP CLASS
+//
+// deepSleep() throws sim::DeepSleepReset (see simHal.h) because the
+// chip restarts instead of returning. RTC user memory (512 bytes)
+// survives that restart. The 4 MB SPI flash behaves like NOR flash:
+// erase sets a 4 KB sector to 0xFF, writes only clear bits, and both
+// block the CPU (the clock moves on, timers do not fire). The CPU runs
+// at 80 MHz: the cycle counter is the virtual clock times 80, so only
+// simulated busy time (bus transfers, flash, UART stalls) shows up in it.
+//////////////////////////////////////////////////////////
+enum RFMode {
+  RF_DEFAULT = 0,
+  RF_CAL = 1,
+  RF_NO_CAL = 2,
+  RF_DISABLED = 4
+};
+
+#define WAKE_RF_DEFAULT RF_DEFAULT
+#define WAKE_RFCAL RF_CAL
+#define WAKE_NO_RFCAL RF_NO_CAL
+#define WAKE_RF_DISABLED RF_DISABLED
+
+class EspClass {
+  public:
+    void deepSleep(uint64_t time_us, RFMode mode = RF_DEFAULT);
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size);
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size);
+    struct rst_info* getResetInfoPtr();
+    bool flashEraseSector(uint32_t sector);
+    bool flashWrite(uint32_t address, const uint32_t* data, size_t size); // 4-byte aligned address and size
+    bool flashRead(uint32_t address, uint32_t* data, size_t size);
+    uint32_t getCycleCount(); // CCOUNT: wraps every ~53 s at 80 MHz
+    uint8_t getCpuFreqMHz() { return 80; }
+};
+
+extern EspClass ESP;
+
+// RTC user memory as plain words (0x60001200 on the chip): the same 128
+// words as rtcUserMemoryRead/Write, for stores from interrupt context
+extern uint32_t g_simRtcUserMemory[128];
+#define RTC_USER_MEM ((volatile uint32_t*)g_simRtcUserMemory)
+//////////////////////////////////////////////////////////
+
+#endif
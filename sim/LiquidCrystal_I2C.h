@@ -0,0 +1,91 @@
+#ifndef LiquidCrystal_I2C_h
+#define LiquidCrystal_I2C_h
+
+#include "Arduino.h"
+#include "i2cBus.h"
+
+//////////////////////////////////////////////////////////
+// HD44780 MODEL (behind a PCF8574 backpack)
+//
+// Decodes expander bytes the way the real module is wired
+// (P0 = Rs, P2 = En, P3 = backlight, P4..P7 = D4..D7) and latches a
+// nibble on every falling edge of En. Starts in 8-bit mode like the
+// controller does after power-on.
+//////////////////////////////////////////////////////////
+class Hd44780Model : public sim::I2cDevice {
+  public:
+    static const uint8_t DDRAM_SIZE = 0x80;
+
+    Hd44780Model();
+    void onWrite(const uint8_t* data, size_t length);
+
+    char ddram(uint8_t address) const { return _ddram[address & (DDRAM_SIZE - 1)]; }
+    bool isBacklightOn() const { return (_lastPort & 0x08) != 0; }
+    unsigned long getCommandCount() const { return _commandCount; }
+    unsigned long getDataCount() const { return _dataCount; }
+
+  private:
+    void _latch(uint8_t nibble, bool isData);
+    void _execute(uint8_t value, bool isData);
+
+    char _ddram[DDRAM_SIZE];
+    uint8_t _address;
+    uint8_t _lastPort;
+    bool _fourBitMode;
+    bool _haveHighNibble;
+    uint8_t _highNibble;
+    bool _writingCgram;
+    unsigned long _commandCount;
+    unsigned long _dataCount;
+};
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FAKE LIQUIDCRYSTAL_I2C
+//
+// Talks to the module over the fake Wire exactly like the Arduino
+// library: every nibble is three single-byte expander transactions
+// (data, data|En, data). The attached Hd44780Model holds the screen
+// contents, so simulations see what really reached the glass.
+//////////////////////////////////////////////////////////
+class LiquidCrystal_I2C : public Print {
+  public:
+    static const uint8_t MAX_COLUMNS = 40;
+    static const uint8_t MAX_ROWS = 4;
+
+    LiquidCrystal_I2C(uint8_t address, uint8_t columns, uint8_t rows);
+    ~LiquidCrystal_I2C();
+
+    void init();
+    void backlight();
+    void noBacklight();
+    void clear();
+    void home();
+    void setCursor(uint8_t col, uint8_t row);
+    size_t write(uint8_t c);
+    using Print::write;
+
+    // Simulation accessors
+    const char* rowText(uint8_t row) const; // NUL-terminated copy of one row, read from the model
+    bool isBacklightOn() const { return _model.isBacklightOn(); }
+    uint8_t getAddress() const { return _address; }
+    const Hd44780Model& getModel() const { return _model; }
+
+  private:
+    void _command(uint8_t value);
+    void _send(uint8_t value, uint8_t mode);
+    void _write4bits(uint8_t value);
+    void _expanderWrite(uint8_t value);
+    void _pulseEnable(uint8_t value);
+
+    uint8_t _address;
+    uint8_t _columns;
+    uint8_t _rows;
+    uint8_t _backlightValue;
+    Hd44780Model _model;
+    mutable char _rowBuffer[MAX_COLUMNS + 1];
+};
+//////////////////////////////////////////////////////////
+
+#endif
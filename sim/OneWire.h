@@ -0,0 +1,32 @@
+#ifndef OneWire_h
+#define OneWire_h
+
+#include "Arduino.h"
+
+//////////////////////////////////////////////////////////
+// FAKE ONEWIRE LIBRARY
+//
+// The subset of the OneWire library the firmware uses, talking to the
+// device attached to its pin with sim::attachOneWireDevice() (see
+// oneWireBus.h). Without a device the bus floats high: no presence
+// pulse, and every read slot reads 1. Like the library, which drives the
+// pin through the GPIO registers, nothing answers on GPIO16.
+//////////////////////////////////////////////////////////
+class OneWire {
+  public:
+    OneWire(uint8_t pin) : _pin(pin) {}
+
+    uint8_t reset(); // 1 when a device answered with a presence pulse
+    void skip();     // Skip ROM: address the only device on the bus
+    void write(uint8_t value, uint8_t power = 0);
+    uint8_t read();
+    void depower() {}
+
+    static uint8_t crc8(const uint8_t* data, uint8_t length); // Dallas/Maxim CRC-8, as in the scratchpad's last byte
+
+  private:
+    uint8_t _pin;
+};
+//////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef Wire_h
+#define Wire_h
+
+#include "Arduino.h"
+
+#define BUFFER_LENGTH 128 // Same transmit buffer as the ESP8266 core
+
+//////////////////////////////////////////////////////////
+// FAKE TWOWIRE (I2C)
+//
+// Transactions are delivered to devices attached with
+// sim::attachI2cDevice() (see i2cBus.h). A bus fault set there decides
+// the status instead, and the clock stretch limit how long a stuck SCL
+// holds up each transaction.
+//////////////////////////////////////////////////////////
+class TwoWire {
+  public:
+    void begin() { // Like the core: clock and stretch limit go back to their defaults
+      _clock = DEFAULT_CLOCK;
+      _clockStretchLimitUs = DEFAULT_CLOCK_STRETCH_LIMIT_US;
+    }
+    void begin(int sda, int scl) { (void)sda; (void)scl; begin(); }
+    void setClock(uint32_t frequency) { _clock = frequency; }
+    void setClockStretchLimit(uint32_t limit) { _clockStretchLimitUs = limit; }
+    uint32_t getClock() const { return _clock; }
+    uint32_t getClockStretchLimit() const { return _clockStretchLimitUs; }
+
+    void beginTransmission(uint8_t address);
+    size_t write(uint8_t data);
+    size_t write(const uint8_t* data, size_t length);
+    uint8_t endTransmission(bool sendStop = true); // 0 ok, 1 too long, 2 address NACK, 4 bus busy
+
+    uint8_t requestFrom(uint8_t address, uint8_t quantity, bool sendStop = true);
+    int available();
+    int read();
+
+  private:
+    static const uint32_t DEFAULT_CLOCK = 100000;
+    static const uint32_t DEFAULT_CLOCK_STRETCH_LIMIT_US = 150000;
+    uint32_t _clock = DEFAULT_CLOCK;
+    uint32_t _clockStretchLimitUs = DEFAULT_CLOCK_STRETCH_LIMIT_US;
+    uint8_t _txAddress = 0;
+    uint8_t _txBuffer[BUFFER_LENGTH];
+    size_t _txLength = 0;
+    bool _txOverflow = false;
+    uint8_t _rxBuffer[BUFFER_LENGTH];
+    size_t _rxLength = 0;
+    size_t _rxIndex = 0;
+};
+
+extern TwoWire Wire;
+//////////////////////////////////////////////////////////
+
+#endif
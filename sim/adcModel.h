@@ -0,0 +1,48 @@
+#ifndef adcModel_h
+#define adcModel_h
+
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////
+// ADC MODEL
+//
+// Inverse of VoltageSensor's conversion: turns a battery voltage into
+// the count the ESP8266 ADC would report through the divider, with
+// optional uniform noise. Defaults match the values BatteryProtector
+// passes to its VoltageSensor. offsetCounts and bowCounts make it a
+// unit with its own offset and a bent transfer curve, as the ESP8266
+// ADC is: the bow adds the most at mid-scale and nothing at either end.
+//////////////////////////////////////////////////////////
+struct AdcModel {
+  float rTopOhms = 100000.0f;
+  float rBottomOhms = 430000.0f;
+  float calibrationFactor = 1.20f;
+  float referenceVolts = 3.3f;
+  float offsetCounts = 0.0f;
+  float bowCounts = 0.0f; // Extra counts at mid-scale
+  int noiseCounts = 0; // Peak noise amplitude in ADC counts
+  uint32_t seed = 0x12345678u;
+
+  int rawFromVolts(float volts) {
+    float ratio = rTopOhms / (rTopOhms + rBottomOhms);
+    float raw = volts * ratio / calibrationFactor / referenceVolts * 1023.0f;
+    float scale = raw / 1023.0f;
+    raw += offsetCounts + bowCounts * 4.0f * scale * (1.0f - scale);
+    int count = (int)(raw + 0.5f);
+    if (noiseCounts > 0) {
+      count += (int)(nextRandom() % (uint32_t)(2 * noiseCounts + 1)) - noiseCounts;
+    }
+    return count < 0 ? 0 : (count > 1023 ? 1023 : count);
+  }
+
+  uint32_t nextRandom() {
+    // xorshift32: deterministic so replays are repeatable
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+  }
+};
+//////////////////////////////////////////////////////////
+
+#endif
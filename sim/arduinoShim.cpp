@@ -0,0 +1,661 @@
+#include <stdio.h>
+#include <deque>
+#include <vector>
+#include "Arduino.h"
+#include "i2cBus.h"
+#include "simHal.h"
+#include "tcpNet.h"
+#include "user_interface.h"
+
+HardwareSerial Serial;
+
+
+//////////////////////////////////////////////////////////
+// SIMULATION STATE
+//////////////////////////////////////////////////////////
+namespace {
+
+  struct PinState {
+    uint8_t mode;
+    uint8_t outputLevel;
+    uint8_t inputLevel;
+    int analogValue;
+    unsigned int toneFrequency;
+    void (*interruptHandler)(void*);
+    void* interruptArg;
+    int interruptMode;
+  };
+
+  struct Listener {
+    int id;
+    sim::TickListener callback;
+  };
+
+  enum ClockMode {
+    CLOCK_AWAKE,
+    CLOCK_LIGHT_SLEEP,
+    CLOCK_DEEP_SLEEP
+  };
+
+  uint64_t g_nowUs = 0;
+  uint64_t g_bootUs = 0;   // Wall time of the last reset
+  uint64_t g_frozenUs = 0; // Light sleep since the last reset (firmware clock stopped)
+  sim::PowerStats g_powerStats = { 0, 0, 0, 0 };
+  PinState g_pins[sim::PIN_COUNT];
+  std::vector<Listener> g_tickListeners;
+  int g_nextListenerId = 1;
+  std::vector<os_timer_t*> g_armedTimers;
+  timercallback g_timer0Callback = nullptr;
+  bool g_timer0Armed = false;
+  uint64_t g_timer0DueUs = 0; // Wall time the cycle counter reaches CCOMPARE0
+  int g_interruptDepth = 0;
+  uint32_t g_flashCallsFromInterrupt = 0;
+  sim::WriteObserver g_writeObserver;
+  bool g_serialEcho = false;
+  bool g_serialCapture = false;
+  std::string g_serialOutput;
+  std::deque<uint8_t> g_serialInput;
+
+  // UART TX: a 128-byte FIFO that drains at the baud rate (8N1); a write
+  // to a full FIFO busy-waits like the core's HardwareSerial
+  const int UART_FIFO_SIZE = 128;
+  unsigned long g_serialBaud = 115200;
+  uint64_t g_uartIdleAtNs = 0; // Wall time the FIFO runs empty
+  uint64_t g_serialStallUs = 0;
+
+  uint64_t uartByteNs() {
+    return 10000000000ULL / g_serialBaud;
+  }
+
+  int uartFifoLevel() {
+    uint64_t nowNs = g_nowUs * 1000ULL;
+    if (g_uartIdleAtNs <= nowNs) {
+      return 0;
+    }
+    return (int)((g_uartIdleAtNs - nowNs + uartByteNs() - 1) / uartByteNs());
+  }
+
+  PinState* pinState(uint8_t pin) {
+    return pin < sim::PIN_COUNT ? &g_pins[pin] : nullptr;
+  }
+
+  void resetPins() {
+    for (uint8_t i = 0; i < sim::PIN_COUNT; i++) {
+      g_pins[i].mode = INPUT;
+      g_pins[i].outputLevel = LOW;
+      g_pins[i].inputLevel = HIGH; // Floating inputs read as pulled up
+      g_pins[i].analogValue = 0;
+      g_pins[i].toneFrequency = 0;
+      g_pins[i].interruptHandler = nullptr;
+      g_pins[i].interruptArg = nullptr;
+      g_pins[i].interruptMode = 0;
+    }
+  }
+
+  uint64_t firmwareUs() {
+    return g_nowUs - g_bootUs - g_frozenUs;
+  }
+
+  void chargeTime(uint64_t us, ClockMode mode) {
+    switch (mode) {
+      case CLOCK_AWAKE:
+        if (sim::isRadioOn()) {
+          g_powerStats.awakeRadioUs += us;
+        } else {
+          g_powerStats.awakeUs += us;
+        }
+        break;
+      case CLOCK_LIGHT_SLEEP:
+        g_powerStats.lightSleepUs += us;
+        g_frozenUs += us;
+        break;
+      case CLOCK_DEEP_SLEEP:
+        g_powerStats.deepSleepUs += us;
+        break;
+    }
+  }
+
+  void fireTimers(unsigned long nowMs) {
+    // Copy: callbacks may arm or disarm timers. A fixed array, so the
+    // tick itself does not show up in the allocation checks
+    os_timer_t* due[16];
+    size_t dueCount = 0;
+    for (size_t i = 0; i < g_armedTimers.size() && dueCount < 16; i++) {
+      if ((long)(nowMs - g_armedTimers[i]->timer_expire) >= 0) {
+        due[dueCount++] = g_armedTimers[i];
+      }
+    }
+    for (size_t i = 0; i < dueCount; i++) {
+      os_timer_t* timer = due[i];
+      if (timer->timer_period > 0) {
+        timer->timer_expire += timer->timer_period;
+      } else {
+        os_timer_disarm(timer);
+      }
+      if (timer->timer_func) {
+        timer->timer_func(timer->timer_arg);
+      }
+    }
+  }
+
+  void clearTimer0() {
+    g_timer0Callback = nullptr;
+    g_timer0Armed = false;
+  }
+
+  // Runs the timer0 interrupt when it comes due by targetUs; the clock
+  // stands at the compare match while the callback runs
+  void runTimer0(uint64_t targetUs) {
+    while (g_timer0Armed && g_timer0DueUs <= targetUs) {
+      if (g_timer0DueUs > g_nowUs) {
+        chargeTime(g_timer0DueUs - g_nowUs, CLOCK_AWAKE);
+        g_nowUs = g_timer0DueUs;
+      }
+      g_timer0Armed = false; // One match per write
+      if (g_timer0Callback) {
+        g_interruptDepth++;
+        g_timer0Callback();
+        g_interruptDepth--;
+      }
+    }
+  }
+
+  void notifyI2cLine(uint8_t pin) {
+    if (pin == SDA || pin == SCL) {
+      sim::onI2cLineChange(pin);
+    }
+  }
+
+  struct PinInit {
+    PinInit() { resetPins(); }
+  } g_pinInit;
+
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// SIMULATION CONTROL
+//////////////////////////////////////////////////////////
+namespace sim {
+
+  void reset() {
+    g_nowUs = 0;
+    g_bootUs = 0;
+    g_frozenUs = 0;
+    g_powerStats = PowerStats();
+    g_interruptDepth = 0;
+    g_flashCallsFromInterrupt = 0;
+    resetPins();
+    g_tickListeners.clear();
+    g_armedTimers.clear();
+    clearTimer0();
+    g_writeObserver = WriteObserver();
+    g_serialInput.clear();
+    g_serialCapture = false;
+    g_serialOutput.clear();
+    g_serialBaud = 115200;
+    g_uartIdleAtNs = 0;
+    g_serialStallUs = 0;
+    resetChip();
+    resetNetwork(true);
+    eraseFlash();
+    setFilesystemSize(0x1FA000);
+    setI2cFault(I2C_FAULT_NONE);
+  }
+
+  void reboot() {
+    g_bootUs = g_nowUs;
+    g_frozenUs = 0;
+    g_armedTimers.clear();
+    clearTimer0();
+    resetNetwork(false);
+    // Outputs float after reset; levels stay as the pull-ups hold them
+    for (uint8_t i = 0; i < PIN_COUNT; i++) {
+      g_pins[i].mode = INPUT;
+      g_pins[i].toneFrequency = 0;
+      g_pins[i].interruptHandler = nullptr;
+      g_pins[i].interruptArg = nullptr;
+      g_pins[i].interruptMode = 0;
+    }
+  }
+
+  uint64_t nowUs() {
+    return g_nowUs;
+  }
+
+  void advanceClock(uint64_t us, ClockMode mode) {
+    // Fire tick listeners on every wall-clock millisecond boundary that is
+    // crossed; timers only run while the CPU is awake
+    uint64_t target = g_nowUs + us;
+    while (g_nowUs < target) {
+      uint64_t nextMsUs = (g_nowUs / 1000 + 1) * 1000;
+      if (mode == CLOCK_AWAKE) {
+        runTimer0(nextMsUs < target ? nextMsUs : target);
+      }
+      if (nextMsUs > target) {
+        chargeTime(target - g_nowUs, mode);
+        g_nowUs = target;
+        break;
+      }
+      chargeTime(nextMsUs - g_nowUs, mode);
+      g_nowUs = nextMsUs;
+      unsigned long nowMs = (unsigned long)(g_nowUs / 1000);
+      // Index loop: listeners may register new listeners while running
+      for (size_t i = 0; i < g_tickListeners.size(); i++) {
+        g_tickListeners[i].callback(nowMs);
+      }
+      if (mode == CLOCK_AWAKE) {
+        fireTimers((unsigned long)(firmwareUs() / 1000));
+        runNetwork(nowMs);
+      }
+    }
+  }
+
+  void advanceUs(uint64_t us) {
+    advanceClock(us, CLOCK_AWAKE);
+  }
+
+  void advanceMs(unsigned long ms) {
+    advanceUs((uint64_t)ms * 1000);
+  }
+
+  void advanceBusyUs(uint64_t us) {
+    // Timers that came due meanwhile fire on the next advanceUs(); an
+    // interrupt (timer0) fires on time
+    uint64_t target = g_nowUs + us;
+    runTimer0(target);
+    chargeTime(target - g_nowUs, CLOCK_AWAKE);
+    g_nowUs = target;
+  }
+
+  void advanceLightSleepUs(uint64_t us) {
+    advanceClock(us, CLOCK_LIGHT_SLEEP);
+  }
+
+  void advanceDeepSleepUs(uint64_t us) {
+    advanceClock(us, CLOCK_DEEP_SLEEP);
+  }
+
+  bool isInInterrupt() {
+    return g_interruptDepth > 0;
+  }
+
+  uint32_t getFlashCallsFromInterrupt() {
+    return g_flashCallsFromInterrupt;
+  }
+
+  void noteFlashCall() {
+    if (g_interruptDepth > 0) {
+      g_flashCallsFromInterrupt++;
+    }
+  }
+
+  PowerStats getPowerStats() {
+    return g_powerStats;
+  }
+
+  int addTickListener(TickListener listener) {
+    Listener entry;
+    entry.id = g_nextListenerId++;
+    entry.callback = listener;
+    g_tickListeners.push_back(entry);
+    return entry.id;
+  }
+
+  void removeTickListener(int id) {
+    for (size_t i = 0; i < g_tickListeners.size(); i++) {
+      if (g_tickListeners[i].id == id) {
+        g_tickListeners.erase(g_tickListeners.begin() + i);
+        return;
+      }
+    }
+  }
+
+  void setAnalogInput(uint8_t pin, int value) {
+    PinState* state = pinState(pin);
+    if (state) {
+      state->analogValue = value < 0 ? 0 : (value > 1023 ? 1023 : value);
+    }
+  }
+
+  void setDigitalInput(uint8_t pin, uint8_t level) {
+    PinState* state = pinState(pin);
+    if (!state) {
+      return;
+    }
+    uint8_t previous = state->inputLevel;
+    state->inputLevel = level ? HIGH : LOW;
+    if (state->interruptHandler && previous != state->inputLevel) {
+      bool rising = state->inputLevel == HIGH;
+      if (state->interruptMode == CHANGE ||
+          (state->interruptMode == RISING && rising) ||
+          (state->interruptMode == FALLING && !rising)) {
+        g_interruptDepth++;
+        state->interruptHandler(state->interruptArg);
+        g_interruptDepth--;
+      }
+    }
+  }
+
+  uint8_t getDigitalOutput(uint8_t pin) {
+    PinState* state = pinState(pin);
+    return state ? state->outputLevel : LOW;
+  }
+
+  uint8_t getPinMode(uint8_t pin) {
+    PinState* state = pinState(pin);
+    return state ? state->mode : INPUT;
+  }
+
+  unsigned int getToneFrequency(uint8_t pin) {
+    PinState* state = pinState(pin);
+    return state ? state->toneFrequency : 0;
+  }
+
+  void setWriteObserver(WriteObserver observer) {
+    g_writeObserver = observer;
+  }
+
+  void setSerialEcho(bool enabled) {
+    g_serialEcho = enabled;
+  }
+
+  void setSerialCapture(bool enabled) {
+    g_serialCapture = enabled;
+  }
+
+  std::string takeSerialOutput() {
+    std::string output;
+    output.swap(g_serialOutput);
+    return output;
+  }
+
+  uint64_t getSerialStallUs() {
+    return g_serialStallUs;
+  }
+
+  void sendSerialInput(const char* text) {
+    while (*text) {
+      g_serialInput.push_back((uint8_t)*text++);
+    }
+  }
+
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// ARDUINO CORE
+//////////////////////////////////////////////////////////
+unsigned long millis() {
+  return (unsigned long)(firmwareUs() / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long)firmwareUs();
+}
+
+void delay(unsigned long ms) {
+  // A requested forced light sleep starts here; waking up ends the delay
+  if (sim::runPendingLightSleep()) {
+    return;
+  }
+  sim::advanceMs(ms);
+}
+
+void delayMicroseconds(unsigned int us) {
+  sim::advanceUs(us);
+}
+
+void yield() {
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  PinState* state = pinState(pin);
+  if (state) {
+    state->mode = mode;
+    notifyI2cLine(pin);
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  PinState* state = pinState(pin);
+  if (!state) {
+    return;
+  }
+  state->outputLevel = val ? HIGH : LOW;
+  if (g_writeObserver) {
+    g_writeObserver(pin, state->outputLevel, (unsigned long)(g_nowUs / 1000));
+  }
+  notifyI2cLine(pin);
+}
+
+int digitalRead(uint8_t pin) {
+  PinState* state = pinState(pin);
+  if (!state) {
+    return LOW;
+  }
+  return state->mode == OUTPUT ? state->outputLevel : state->inputLevel;
+}
+
+SimGpioOutputRegister GPOS = { HIGH };
+SimGpioOutputRegister GPOC = { LOW };
+SimGpioInputRegister GPI;
+
+void SimGpioOutputRegister::operator=(uint32_t mask) {
+  for (uint8_t pin = 0; pin < 16; pin++) {
+    if (mask & (1UL << pin)) {
+      digitalWrite(pin, level);
+    }
+  }
+}
+
+SimGpioInputRegister::operator uint32_t() const {
+  uint32_t value = 0;
+  for (uint8_t pin = 0; pin < 16; pin++) {
+    if (digitalRead(pin) == HIGH) {
+      value |= 1UL << pin;
+    }
+  }
+  return value;
+}
+
+int analogRead(uint8_t pin) {
+  PinState* state = pinState(pin);
+  return state ? state->analogValue : 0;
+}
+
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration) {
+  (void)duration;
+  PinState* state = pinState(pin);
+  if (state) {
+    state->toneFrequency = frequency;
+  }
+}
+
+void noTone(uint8_t pin) {
+  PinState* state = pinState(pin);
+  if (state) {
+    state->toneFrequency = 0;
+  }
+}
+
+void attachInterruptArg(uint8_t pin, void (*handler)(void*), void* arg, int mode) {
+  PinState* state = pinState(pin);
+  if (state) {
+    state->interruptHandler = handler;
+    state->interruptArg = arg;
+    state->interruptMode = mode;
+  }
+}
+
+void detachInterrupt(uint8_t pin) {
+  PinState* state = pinState(pin);
+  if (state) {
+    state->interruptHandler = nullptr;
+    state->interruptArg = nullptr;
+  }
+}
+
+void timer0_isr_init() {
+}
+
+void timer0_attachInterrupt(timercallback userFunc) {
+  g_timer0Callback = userFunc;
+}
+
+void timer0_detachInterrupt() {
+  clearTimer0();
+}
+
+void timer0_write(uint32_t count) {
+  // Cycles ahead of the counter, as the 32-bit compare sees them
+  uint32_t cyclesAhead = count - ESP.getCycleCount();
+  uint32_t cpuMHz = ESP.getCpuFreqMHz();
+  g_timer0DueUs = g_nowUs + (cyclesAhead + cpuMHz - 1) / cpuMHz;
+  g_timer0Armed = true;
+}
+
+char* dtostrf(double value, signed char width, unsigned char precision, char* buffer) {
+  sprintf(buffer, "%*.*f", width, precision, value);
+  return buffer;
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FAKE NON-OS SDK (os_timer)
+//////////////////////////////////////////////////////////
+void os_timer_setfn(os_timer_t* ptimer, os_timer_func_t* pfunction, void* parg) {
+  ptimer->timer_func = pfunction;
+  ptimer->timer_arg = parg;
+}
+
+void os_timer_arm(os_timer_t* ptimer, uint32_t milliseconds, bool repeat_flag) {
+  os_timer_disarm(ptimer);
+  ptimer->timer_expire = millis() + milliseconds;
+  ptimer->timer_period = repeat_flag ? milliseconds : 0;
+  g_armedTimers.push_back(ptimer);
+}
+
+void os_timer_disarm(os_timer_t* ptimer) {
+  for (size_t i = 0; i < g_armedTimers.size(); i++) {
+    if (g_armedTimers[i] == ptimer) {
+      g_armedTimers.erase(g_armedTimers.begin() + i);
+      return;
+    }
+  }
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// PRINT
+//////////////////////////////////////////////////////////
+size_t Print :: write(const uint8_t* buffer, size_t size) {
+  size_t written = 0;
+  while (size--) {
+    written += write(*buffer++);
+  }
+  return written;
+}
+
+size_t Print :: _printNumber(unsigned long value, int base) {
+  char buffer[8 * sizeof(long) + 1];
+  char* cursor = &buffer[sizeof(buffer) - 1];
+  *cursor = '\0';
+  if (base < 2) {
+    base = DEC;
+  }
+  do {
+    unsigned long digit = value % base;
+    *--cursor = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    value /= base;
+  } while (value);
+  return write(cursor);
+}
+
+size_t Print :: print(const char* text) { return write(text); }
+size_t Print :: print(char c) { return write((uint8_t)c); }
+size_t Print :: print(int value, int base) { return print((long)value, base); }
+size_t Print :: print(unsigned int value, int base) { return print((unsigned long)value, base); }
+size_t Print :: print(unsigned long value, int base) { return _printNumber(value, base); }
+
+size_t Print :: print(long value, int base) {
+  if (base == DEC && value < 0) {
+    return print('-') + _printNumber((unsigned long)(-value), DEC);
+  }
+  return _printNumber((unsigned long)value, base);
+}
+
+size_t Print :: print(double value, int digits) {
+  char buffer[48];
+  snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+  return write(buffer);
+}
+
+size_t Print :: println() { return write("\r\n"); }
+size_t Print :: println(const char* text) { return print(text) + println(); }
+size_t Print :: println(char c) { return print(c) + println(); }
+size_t Print :: println(int value, int base) { return print(value, base) + println(); }
+size_t Print :: println(unsigned int value, int base) { return print(value, base) + println(); }
+size_t Print :: println(long value, int base) { return print(value, base) + println(); }
+size_t Print :: println(unsigned long value, int base) { return print(value, base) + println(); }
+size_t Print :: println(double value, int digits) { return print(value, digits) + println(); }
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// SERIAL
+//////////////////////////////////////////////////////////
+void HardwareSerial :: begin(unsigned long baud) {
+  g_serialBaud = baud > 0 ? baud : 115200;
+}
+
+size_t HardwareSerial :: write(uint8_t c) {
+  if (uartFifoLevel() >= UART_FIFO_SIZE) {
+    // Wait for one slot: the loop stalls, timers do not run meanwhile
+    uint64_t slotAtNs = g_uartIdleAtNs - (UART_FIFO_SIZE - 1) * uartByteNs();
+    uint64_t waitUs = (slotAtNs - g_nowUs * 1000ULL + 999) / 1000;
+    g_serialStallUs += waitUs;
+    sim::advanceBusyUs(waitUs);
+  }
+  uint64_t nowNs = g_nowUs * 1000ULL;
+  g_uartIdleAtNs = (g_uartIdleAtNs > nowNs ? g_uartIdleAtNs : nowNs) + uartByteNs();
+  if (g_serialEcho && c != '\r') {
+    fputc(c, stdout);
+  }
+  if (g_serialCapture) {
+    g_serialOutput += (char)c;
+  }
+  return 1;
+}
+
+void HardwareSerial :: flush() {
+}
+
+size_t HardwareSerial :: write(const uint8_t* buffer, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    write(buffer[i]);
+  }
+  return size;
+}
+
+int HardwareSerial :: availableForWrite() {
+  return UART_FIFO_SIZE - uartFifoLevel();
+}
+
+int HardwareSerial :: available() {
+  return (int)g_serialInput.size();
+}
+
+int HardwareSerial :: read() {
+  if (g_serialInput.empty()) {
+    return -1;
+  }
+  uint8_t c = g_serialInput.front();
+  g_serialInput.pop_front();
+  return c;
+}
+//////////////////////////////////////////////////////////
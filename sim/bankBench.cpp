@@ -0,0 +1,175 @@
+//////////////////////////////////////////////////////////
+// BANK BENCH
+//
+// Cutoff latency of MultiBankProtector against the number of banks, on
+// two simulated ADS1115s (0x48, 0x49) and a PCF8574 relay expander
+// (0x20). For each bank count every bank is dropped in turn, at every
+// millisecond of one round-robin cycle, on a freshly booted board:
+//
+//   hard drop   12.4 V -> 9.0 V: the fast trip path (relay open within
+//               getWorstCaseTripMs(), the bound column)
+//   step        12.4 V -> 10.8 V: just below the 11.0 V cutoff, through
+//               the median and EMA
+//
+// Latency is from the voltage change to the expander write that opens
+// the bank's relay. The I2C column is the bus busy time while all banks
+// are armed. Output is CSV on stdout, one row per bank count.
+//
+//   bankBench [--ads1015]
+//     --ads1015           ADS1015 data rate (3300 SPS) instead of ADS1115
+//////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <string.h>
+#include "Arduino.h"
+#include "bankDevices.h"
+#include "bankHardware.h"
+#include "i2cBus.h"
+#include "multiBankProtector.h"
+#include "simHal.h"
+#include "systemClock.h"
+
+namespace {
+
+  const float DIVIDER_RATIO = 0.2f;
+  const float ARMED_VOLTS = 12.4f;
+  const float HARD_DROP_VOLTS = 9.0f;
+  const float STEP_VOLTS = 10.8f;
+  const unsigned long DROP_AT_MS = 500;      // Filters settled, every bank armed
+  const unsigned long GIVE_UP_MS = 1000;     // After the drop
+  const unsigned long BUSY_WINDOW_MS = 1000;
+
+  struct Result {
+    unsigned long trials = 0;
+    unsigned long missed = 0;
+    unsigned long long worstUs = 0;
+    unsigned long long totalUs = 0;
+
+    void add(bool opened, unsigned long long latencyUs) {
+      trials++;
+      if (!opened) {
+        missed++;
+        return;
+      }
+      totalUs += latencyUs;
+      if (latencyUs > worstUs) {
+        worstUs = latencyUs;
+      }
+    }
+
+    double meanMs() const {
+      unsigned long opened = trials - missed;
+      return opened ? totalUs / 1000.0 / opened : 0.0;
+    }
+  };
+
+  // Board with up to 8 banks: inputs 0..3 on the first ADC, 4..7 on the second
+  struct Board {
+    Ads1115Model adcs[2];
+    Ads1x15 drivers[2];
+    Pcf8574Model expander;
+    Pcf8574 relays;
+    BankConfig configs[MultiBankProtector::MAX_BANKS];
+    uint8_t watchedBank = 0;
+    bool opened = false;
+    unsigned long long openedUs = 0;
+
+    Board(uint8_t bankCount, bool isAds1015) :
+      adcs { Ads1115Model(0x48, isAds1015), Ads1115Model(0x49, isAds1015) },
+      drivers { Ads1x15(0x48, isAds1015), Ads1x15(0x49, isAds1015) },
+      expander(0x20),
+      relays(0x20)
+    {
+      static const char* names[MultiBankProtector::MAX_BANKS] = { "b1", "b2", "b3", "b4", "b5", "b6", "b7", "b8" };
+      for (uint8_t i = 0; i < bankCount; i++) {
+        BankConfig config = { names[i], &drivers[i / 4], (uint8_t)(i % 4), i, DIVIDER_RATIO, 11.0f, 12.8f, 60000UL };
+        configs[i] = config;
+        setVolts(i, ARMED_VOLTS);
+      }
+      expander.setChangeObserver([this](uint8_t oldPort, uint8_t newPort) {
+        uint8_t mask = 1 << watchedBank;
+        if (!opened && !(oldPort & mask) && (newPort & mask)) {
+          opened = true;
+          openedUs = sim::nowUs();
+        }
+      });
+    }
+
+    void setVolts(uint8_t bank, float volts) {
+      adcs[bank / 4].setInputVolts(bank % 4, volts * DIVIDER_RATIO);
+    }
+  };
+
+  void runUntilUs(MultiBankProtector& protector, unsigned long long untilUs) {
+    while (sim::nowUs() < untilUs) {
+      protector.update();
+      protector.idle();
+    }
+  }
+
+  // One drop of one bank at one phase of the round robin, from power-on
+  void runTrial(uint8_t bankCount, bool isAds1015, uint8_t bank, unsigned long phaseMs, float volts, Result& result) {
+    sim::reset();
+    SystemClock::reset();
+    Board board(bankCount, isAds1015);
+    MultiBankProtector protector(board.configs, bankCount, &board.relays);
+    runUntilUs(protector, (DROP_AT_MS + phaseMs) * 1000ULL);
+
+    board.watchedBank = bank;
+    board.setVolts(bank, volts);
+    unsigned long long dropUs = sim::nowUs();
+    while (!board.opened && sim::nowUs() < dropUs + GIVE_UP_MS * 1000ULL) {
+      protector.update();
+      protector.idle();
+    }
+    result.add(board.opened, board.openedUs - dropUs);
+  }
+
+  // Bus busy percentage with every bank armed; also the protector's own trip bound
+  double measureBusyPercent(uint8_t bankCount, bool isAds1015, unsigned long& boundMs) {
+    sim::reset();
+    SystemClock::reset();
+    Board board(bankCount, isAds1015);
+    MultiBankProtector protector(board.configs, bankCount, &board.relays);
+    boundMs = protector.getWorstCaseTripMs();
+    runUntilUs(protector, DROP_AT_MS * 1000ULL);
+    sim::resetI2cStats();
+    runUntilUs(protector, (DROP_AT_MS + BUSY_WINDOW_MS) * 1000ULL);
+    return sim::getI2cStats().busUs / (BUSY_WINDOW_MS * 10.0);
+  }
+
+}
+
+
+int main(int argc, char** argv) {
+  bool isAds1015 = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--ads1015") == 0) {
+      isAds1015 = true;
+    } else {
+      fprintf(stderr, "usage: bankBench [--ads1015]\n");
+      return 2;
+    }
+  }
+  sim::setSerialEcho(false);
+
+  printf("banks,trials,hard_worst_ms,hard_mean_ms,hard_bound_ms,step_worst_ms,step_mean_ms,missed,i2c_busy_percent\n");
+  for (uint8_t bankCount = 1; bankCount <= MultiBankProtector::MAX_BANKS; bankCount++) {
+    Result hard;
+    Result step;
+    unsigned long cycleMs = bankCount * MultiBankProtector::SAMPLE_PERIOD_MS;
+    for (uint8_t bank = 0; bank < bankCount; bank++) {
+      for (unsigned long phaseMs = 0; phaseMs < cycleMs; phaseMs++) {
+        runTrial(bankCount, isAds1015, bank, phaseMs, HARD_DROP_VOLTS, hard);
+        runTrial(bankCount, isAds1015, bank, phaseMs, STEP_VOLTS, step);
+      }
+    }
+    unsigned long boundMs = 0;
+    double busyPercent = measureBusyPercent(bankCount, isAds1015, boundMs);
+    printf("%u,%lu,%.1f,%.1f,%lu,%.1f,%.1f,%lu,%.1f\n",
+      (unsigned int)bankCount, hard.trials,
+      hard.worstUs / 1000.0, hard.meanMs(), boundMs,
+      step.worstUs / 1000.0, step.meanMs(),
+      hard.missed + step.missed, busyPercent);
+  }
+  return 0;
+}
@@ -0,0 +1,110 @@
+#include "bankDevices.h"
+#include "simHal.h"
+
+//////////////////////////////////////////////////////////
+// ADS1115 MODEL
+//////////////////////////////////////////////////////////
+Ads1115Model :: Ads1115Model(uint8_t address, bool isAds1015) {
+  _address = address;
+  _isAds1015 = isAds1015;
+  for (int i = 0; i < 4; i++) {
+    _inputVolts[i] = 0.0f;
+  }
+  _pointer = 0;
+  _config = 0x8583; // Power-on default, idle
+  _result = 0;
+  _pendingResult = 0;
+  _doneUs = 0;
+  _conversions = 0;
+  sim::attachI2cDevice(_address, this);
+}
+
+Ads1115Model :: ~Ads1115Model() {
+  sim::detachI2cDevice(_address);
+}
+
+void Ads1115Model :: setInputVolts(uint8_t input, float volts) {
+  _inputVolts[input & 3] = volts;
+}
+
+void Ads1115Model :: onWrite(const uint8_t* data, size_t length) {
+  if (length == 0) {
+    return;
+  }
+  _complete();
+  _pointer = data[0] & 0x03;
+  if (_pointer != 0x01 || length < 3) {
+    return;
+  }
+  _config = (uint16_t)((data[1] << 8) | data[2]);
+  if (!(_config & 0x8000)) {
+    return;
+  }
+  // Single-ended AINx (MUX 1xx) at +-4.096 V (PGA 001)
+  uint8_t mux = (_config >> 12) & 0x07;
+  float volts = mux >= 4 ? _inputVolts[mux - 4] : 0.0f;
+  float counts = volts / 4.096f * 32768.0f;
+  counts = counts > 32767.0f ? 32767.0f : (counts < -32768.0f ? -32768.0f : counts);
+  _pendingResult = (int16_t)counts;
+  if (_isAds1015) {
+    _pendingResult = (int16_t)(_pendingResult & ~0x000F); // 12 bits, left-aligned
+  }
+  unsigned long samplesPerSecond = _isAds1015 ? 3300 : 860;
+  _doneUs = sim::nowUs() + 1000000ULL / samplesPerSecond;
+  _config &= ~0x8000; // Busy
+}
+
+size_t Ads1115Model :: onRead(uint8_t* data, size_t length) {
+  _complete();
+  uint16_t value = _pointer == 0x00 ? (uint16_t)_result : _config;
+  if (length > 0) {
+    data[0] = (uint8_t)(value >> 8);
+  }
+  if (length > 1) {
+    data[1] = (uint8_t)(value & 0xFF);
+  }
+  return length < 2 ? length : 2;
+}
+
+void Ads1115Model :: _complete() {
+  if (!(_config & 0x8000) && sim::nowUs() >= _doneUs) {
+    _result = _pendingResult;
+    _config |= 0x8000; // Idle again
+    _conversions++;
+  }
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// PCF8574 MODEL
+//////////////////////////////////////////////////////////
+Pcf8574Model :: Pcf8574Model(uint8_t address) {
+  _address = address;
+  _port = 0xFF; // Power-on: all pins high
+  _writes = 0;
+  sim::attachI2cDevice(_address, this);
+}
+
+Pcf8574Model :: ~Pcf8574Model() {
+  sim::detachI2cDevice(_address);
+}
+
+void Pcf8574Model :: onWrite(const uint8_t* data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    uint8_t oldPort = _port;
+    _port = data[i];
+    _writes++;
+    if (_observer && oldPort != _port) {
+      _observer(oldPort, _port);
+    }
+  }
+}
+
+size_t Pcf8574Model :: onRead(uint8_t* data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    data[i] = _port;
+  }
+  return length;
+}
+//////////////////////////////////////////////////////////
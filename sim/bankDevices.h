@@ -0,0 +1,67 @@
+#ifndef bankDevices_h
+#define bankDevices_h
+
+#include <functional>
+#include "i2cBus.h"
+
+//////////////////////////////////////////////////////////
+// BANK DEVICES
+//
+// I2C models of the multi-bank hardware. Each attaches itself to the
+// simulated bus at its address while it exists.
+//////////////////////////////////////////////////////////
+
+// ADS1115 (or ADS1015) in single-shot mode: a conversion samples the
+// selected input when it starts and is readable once the data-rate
+// period has passed; reading earlier returns the previous result, like
+// the chip. Only the fields the firmware uses are modelled (OS, MUX
+// single-ended, PGA, DR).
+class Ads1115Model : public sim::I2cDevice {
+  public:
+    Ads1115Model(uint8_t address = 0x48, bool isAds1015 = false);
+    ~Ads1115Model();
+
+    void setInputVolts(uint8_t input, float volts);
+    unsigned long getConversionCount() const { return _conversions; }
+
+    void onWrite(const uint8_t* data, size_t length);
+    size_t onRead(uint8_t* data, size_t length);
+
+  private:
+    uint8_t _address;
+    bool _isAds1015;
+    float _inputVolts[4];
+    uint8_t _pointer;
+    uint16_t _config;
+    int16_t _result;
+    int16_t _pendingResult;
+    unsigned long long _doneUs;
+    unsigned long _conversions;
+
+    void _complete();
+};
+
+// PCF8574 port: the last byte written is the output level of all pins
+class Pcf8574Model : public sim::I2cDevice {
+  public:
+    typedef std::function<void(uint8_t oldPort, uint8_t newPort)> ChangeObserver;
+
+    Pcf8574Model(uint8_t address = 0x20);
+    ~Pcf8574Model();
+
+    uint8_t getPort() const { return _port; }
+    unsigned long getWriteCount() const { return _writes; }
+    void setChangeObserver(ChangeObserver observer) { _observer = observer; }
+
+    void onWrite(const uint8_t* data, size_t length);
+    size_t onRead(uint8_t* data, size_t length);
+
+  private:
+    uint8_t _address;
+    uint8_t _port;
+    unsigned long _writes;
+    ChangeObserver _observer;
+};
+//////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,202 @@
+//////////////////////////////////////////////////////////
+// CHARGE CHECKS
+//
+// CoulombCounter arithmetic, CurrentSensor scaling against the INA219 /
+// INA226 model, and BatteryProtector cutting off on the counted charge
+// of a battery whose voltage alone would never trip it.
+//////////////////////////////////////////////////////////
+#include "Arduino.h"
+#include "Wire.h"
+#include "adcModel.h"
+#include "basicHardware.h"
+#include "batteryProtector.h"
+#include "check.h"
+#include "checkHelpers.h"
+#include "sensorDevices.h"
+#include "simHal.h"
+#include "stateOfCharge.h"
+
+namespace {
+
+  const uint8_t RELAY_PIN = 12; // BatteryProtector::PIN_RELAY_CONTROL
+
+  // Battery on A0 and on the shunt: the load current flows while the relay is closed
+  struct MeteredBattery {
+    AdcModel adc;
+    Ina2xxModel shunt;
+    float restVolts = 12.3f;
+    float ohms = 0.02f;
+    float loadAmps = 20.0f;
+    unsigned long cutoffMs = 0;
+
+    MeteredBattery() : shunt(true, 0x40, 1.5f) {}
+
+    bool loadConnected() {
+      return sim::getPinMode(RELAY_PIN) == OUTPUT && sim::getDigitalOutput(RELAY_PIN) == LOW;
+    }
+
+    void refresh() {
+      float amps = loadConnected() ? loadAmps : 0.0f;
+      shunt.setCurrentAmps(amps);
+      sim::setAnalogInput(A0, adc.rawFromVolts(restVolts - amps * ohms));
+    }
+
+    void attach() {
+      refresh();
+      sim::addTickListener([this](unsigned long nowMs) { refresh(); });
+      sim::setWriteObserver([this](uint8_t pin, uint8_t val, unsigned long nowMs) {
+        if (pin == RELAY_PIN && val == HIGH && cutoffMs == 0 && nowMs > 0) {
+          cutoffMs = nowMs;
+        }
+        refresh();
+      });
+    }
+  };
+
+}
+
+
+//////////////////////////////////////////////////////////
+// COULOMB COUNTER
+//////////////////////////////////////////////////////////
+CHECK_CASE(coulombCounterIntegratesExactly) {
+  CoulombCounter counter;
+  counter.begin(100000UL); // 100 Ah
+  counter.anchor(12800);   // Full
+  CHECK_EQ(counter.getPercent(), 100);
+
+  // 10 A for one hour in 10 ms steps: 10 Ah out, no rounding drift
+  for (unsigned long i = 0; i < 360000UL; i++) {
+    counter.addSample(10000, 10);
+  }
+  CHECK_EQ(counter.getChargeMilliampSeconds(), 360000000L - 36000000L);
+  CHECK_EQ(counter.getPercent(), 90);
+
+  // 333 mA in 3 ms steps leaves sub-mAs remainders that must carry
+  for (unsigned long i = 0; i < 3000UL; i++) {
+    counter.addSample(333, 3);
+  }
+  CHECK_EQ(counter.getChargeMilliampSeconds(), 360000000L - 36000000L - 2997L);
+}
+
+CHECK_CASE(coulombCounterChargesAtEfficiency) {
+  CoulombCounter counter;
+  counter.begin(100000UL);
+  counter.anchor(12200); // 50 %
+  CHECK_EQ(counter.getPermille(), 500);
+  for (unsigned long i = 0; i < 3600UL; i++) {
+    counter.addSample(-10000, 1000);
+  }
+  CHECK_EQ(counter.getPermille(), 595); // 9.5 Ah stored of 10 Ah in
+}
+
+CHECK_CASE(coulombCounterAnchorsAfterRest) {
+  CoulombCounter counter;
+  counter.begin(100000UL);
+  counter.anchor(12730);
+  unsigned long restedMs = 1000;
+  CHECK(!counter.addSample(0, 1000));
+  do {
+    restedMs += 1000;
+  } while (!counter.addSample(100, 1000)); // 100 mA is below C/200
+  CHECK_EQ(restedMs, CoulombCounter::REST_ANCHOR_MS);
+
+  // A load resets the rest time
+  counter.anchor(12200);
+  counter.addSample(0, CoulombCounter::REST_ANCHOR_MS - 1000);
+  CHECK(!counter.addSample(5000, 1000));
+  CHECK(!counter.addSample(0, 1000));
+}
+
+CHECK_CASE(openCircuitTableInterpolates) {
+  CHECK_EQ(CoulombCounter::permilleFromRestingVoltage(11000), 0);
+  CHECK_EQ(CoulombCounter::permilleFromRestingVoltage(12200), 500);
+  CHECK_EQ(CoulombCounter::permilleFromRestingVoltage(12260), 550);
+  CHECK_EQ(CoulombCounter::permilleFromRestingVoltage(12730), 1000);
+  CHECK_EQ(CoulombCounter::permilleFromRestingVoltage(13500), 1000);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// CURRENT SENSOR
+//////////////////////////////////////////////////////////
+CHECK_CASE(currentSensorScalesBothChips) {
+  for (int isIna226 = 0; isIna226 < 2; isIna226++) {
+    sim::reset();
+    Ina2xxModel model(isIna226 != 0, 0x41, 1.5f);
+    CurrentSensor sensor(isIna226 ? CurrentSensor::CHIP_INA226 : CurrentSensor::CHIP_INA219, 0x41, 1.5f);
+    CHECK(sensor.init());
+    CHECK_EQ(model.getConfig(), isIna226 ? 0x4325 : 0x29DD);
+
+    int32_t milliamps = 0;
+    model.setCurrentAmps(10.0f);
+    CHECK(sensor.readMilliamps(milliamps));
+    CHECK_EQ(milliamps, 10000);
+    model.setCurrentAmps(-5.0f); // Charging
+    CHECK(sensor.readMilliamps(milliamps));
+    CHECK_EQ(milliamps, -5000);
+  }
+
+  // Nothing on the bus
+  CurrentSensor missing(CurrentSensor::CHIP_INA226, 0x45, 1.5f);
+  int32_t milliamps = 0;
+  CHECK(!missing.init());
+  CHECK(!missing.readMilliamps(milliamps));
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// PROTECTOR
+//////////////////////////////////////////////////////////
+CHECK_CASE(protectorCutsOffOnCountedCharge) {
+  // 10 Ah battery resting at 12.3 V (about 58 %), 11.9 V under a 20 A
+  // load: the voltage never reaches 11.0 V, the charge drops below 20 %
+  // after about 3.9 Ah, 700 s
+  MeteredBattery battery;
+  battery.attach();
+  CurrentSensor sensor(CurrentSensor::CHIP_INA226, 0x40, 1.5f);
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  protector.setCurrentSensor(&sensor, 10.0f);
+  protector.setStateOfChargeCutoff(20);
+  protector.setCutoffInput(BatteryProtector::CUTOFF_INPUT_STATE_OF_CHARGE);
+  CHECK(protector.getStateOfChargePercent() >= 57);
+  CHECK(protector.getStateOfChargePercent() <= 59);
+
+  runUntil(protector, 1000);
+  CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+  CHECK(protector.getCurrentMilliamps() > 19900);
+  CHECK(protector.getCurrentMilliamps() < 20100);
+  // The boot closing measured the resistance with the real current
+  CHECK(protector.getInternalResistanceMilliohms() >= 15);
+  CHECK(protector.getInternalResistanceMilliohms() <= 25);
+
+  runUntil(protector, 800000);
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+  CHECK(battery.cutoffMs >= 680000);
+  CHECK(battery.cutoffMs <= 720000);
+  CHECK_EQ(protector.getStateOfChargePercent(), 19);
+}
+
+CHECK_CASE(protectorFallsBackToVoltageWithoutSensor) {
+  // Charge cutoff selected, but the sensor stops answering at 0.5 s:
+  // the voltage decides again, and 10.8 V under load cuts off
+  MeteredBattery battery;
+  battery.restVolts = 11.2f;
+  battery.ohms = 0.02f;
+  battery.attach();
+  CurrentSensor sensor(CurrentSensor::CHIP_INA226, 0x40, 1.5f);
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  protector.setCurrentSensor(&sensor, 100.0f);
+  protector.setStateOfChargeCutoff(0);
+  protector.setCutoffInput(BatteryProtector::CUTOFF_INPUT_STATE_OF_CHARGE);
+  runUntil(protector, 500);
+  CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+
+  sim::detachI2cDevice(0x40);
+  runUntil(protector, 2000);
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+  sim::attachI2cDevice(0x40, &battery.shunt);
+}
+//////////////////////////////////////////////////////////
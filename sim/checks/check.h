@@ -0,0 +1,49 @@
+#ifndef check_h
+#define check_h
+
+#include <stdio.h>
+
+//////////////////////////////////////////////////////////
+// CHECKS
+//
+// Minimal pass/fail assertions for `make check`. Each CHECK_CASE runs
+// on a freshly reset simulation (clock, pins, RTC memory, SystemClock);
+// a failed CHECK prints file:line and marks the case failed but lets it
+// continue, so one run reports every broken expectation.
+//
+//   CHECK_CASE(ringWrapsAround) {
+//     ...
+//     CHECK(ring.available() == 0);
+//     CHECK_EQ(value, 42);
+//   }
+//////////////////////////////////////////////////////////
+namespace check {
+
+  typedef void (*CaseFunction)();
+
+  struct Registration {
+    Registration(const char* name, CaseFunction function);
+  };
+
+  void fail(const char* file, int line, const char* expression);
+  void failEqual(const char* file, int line, const char* expression, long long actual, long long expected);
+
+}
+
+#define CHECK(condition) \
+  do { if (!(condition)) check::fail(__FILE__, __LINE__, #condition); } while (0)
+
+#define CHECK_EQ(actual, expected) \
+  do { \
+    long long _actual = (long long)(actual); \
+    long long _expected = (long long)(expected); \
+    if (_actual != _expected) check::failEqual(__FILE__, __LINE__, #actual " == " #expected, _actual, _expected); \
+  } while (0)
+
+#define CHECK_CASE(name) \
+  static void name(); \
+  static check::Registration name##Registration(#name, &name); \
+  static void name()
+//////////////////////////////////////////////////////////
+
+#endif
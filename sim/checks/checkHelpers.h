@@ -0,0 +1,38 @@
+#ifndef checkHelpers_h
+#define checkHelpers_h
+
+#include <string>
+#include "Arduino.h"
+#include "LiquidCrystal_I2C.h"
+#include "i2cBus.h"
+#include "simHal.h"
+
+//////////////////////////////////////////////////////////
+// CHECK HELPERS
+//
+// Shared by the check files that run a whole protector: the sketch's
+// loop, and the LCD as the user reads it.
+//////////////////////////////////////////////////////////
+
+// update() and idle() the way main.ino's loop() calls them, until the
+// simulated clock reaches untilMs (BatteryProtector or MultiBankProtector)
+template <typename Protector>
+void runUntil(Protector& protector, unsigned long untilMs) {
+  while (sim::nowUs() / 1000 < untilMs) {
+    protector.update();
+    protector.idle();
+  }
+}
+
+// One row of the 16x2 LCD model at address as it shows it
+inline std::string shownRow(uint8_t row, uint8_t address = 0x27) {
+  const Hd44780Model* lcd = static_cast<const Hd44780Model*>(sim::findI2cDevice(address));
+  std::string text;
+  for (uint8_t col = 0; col < 16; col++) {
+    text += lcd->ddram((row ? 0x40 : 0x00) + col);
+  }
+  return text;
+}
+//////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,296 @@
+//////////////////////////////////////////////////////////
+// CONFIG CHECKS
+//
+// The stored configuration block on the simulated flash: round trip,
+// fallback past a torn or foreign block, and the protector booting on,
+// editing and saving its configuration over Serial, ADC calibration
+// points included.
+//////////////////////////////////////////////////////////
+#include <string>
+#include "Arduino.h"
+#include "adcModel.h"
+#include "batteryProtector.h"
+#include "check.h"
+#include "checkHelpers.h"
+#include "configStore.h"
+#include "simHal.h"
+
+namespace {
+
+  const uint32_t CONFIG_SECTOR = 0x3E8; // Two sectors below the MQTT spool at the end of the filesystem area
+
+  ProtectorConfig testConfig() {
+    ProtectorConfig config;
+    memset(&config, 0, sizeof(config));
+    config.cutoffMillivolts = 11500;
+    config.rearmMillivolts = 12900;
+    config.rearmDelayMs = 30000;
+    config.dividerTopOhms = 100000;
+    config.dividerBottomOhms = 430000;
+    config.calibrationPpm = 1180000;
+    config.samplePeriodMs = 5;
+    return config;
+  }
+
+  bool sameConfig(const ProtectorConfig& a, const ProtectorConfig& b) {
+    return memcmp(&a, &b, sizeof(ProtectorConfig)) == 0;
+  }
+
+  // Clear bits in a stored word, as a write torn by a reset would leave it
+  void damageWord(uint32_t sector, uint16_t offset) {
+    uint32_t word = 0x0000FF00UL;
+    ESP.flashWrite(sector * ConfigStore::SECTOR_SIZE + offset, &word, sizeof(word));
+  }
+
+}
+
+
+//////////////////////////////////////////////////////////
+// CONFIG STORE
+//////////////////////////////////////////////////////////
+CHECK_CASE(configStoreRoundTrip) {
+  ProtectorConfig defaults = testConfig();
+  defaults.cutoffMillivolts = 11000;
+  {
+    ConfigStore store(CONFIG_SECTOR);
+    ProtectorConfig config = defaults;
+    CHECK(!store.load(config)); // Blank flash: the defaults stay
+    CHECK(sameConfig(config, defaults));
+    CHECK(store.save(testConfig()));
+    CHECK_EQ(store.getSequence(), 1);
+  }
+
+  ConfigStore store(CONFIG_SECTOR);
+  ProtectorConfig config = defaults;
+  CHECK(store.load(config));
+  CHECK(sameConfig(config, testConfig()));
+  CHECK_EQ(store.getSequence(), 1);
+
+  // Saves alternate between the two sectors; the newest wins
+  config.rearmDelayMs = 45000;
+  CHECK(store.save(config));
+  CHECK_EQ(sim::getFlashEraseCount(CONFIG_SECTOR), 1);
+  CHECK_EQ(sim::getFlashEraseCount(CONFIG_SECTOR + 1), 1);
+  ConfigStore reloaded(CONFIG_SECTOR);
+  ProtectorConfig loaded = defaults;
+  CHECK(reloaded.load(loaded));
+  CHECK_EQ(loaded.rearmDelayMs, 45000);
+  CHECK_EQ(reloaded.getSequence(), 2);
+}
+
+CHECK_CASE(configStoreFallsBackPastBadBlocks) {
+  ProtectorConfig defaults = testConfig();
+  defaults.cutoffMillivolts = 11000;
+  ProtectorConfig second = testConfig();
+  second.cutoffMillivolts = 11800;
+  {
+    ConfigStore store(CONFIG_SECTOR);
+    CHECK(store.save(testConfig())); // Sector 0
+    CHECK(store.save(second));       // Sector 1
+  }
+
+  // The newest block torn: the previous one loads
+  damageWord(CONFIG_SECTOR + 1, sizeof(ConfigBlockHeader));
+  ConfigStore store(CONFIG_SECTOR);
+  ProtectorConfig config = defaults;
+  CHECK(store.load(config));
+  CHECK(sameConfig(config, testConfig()));
+
+  // Both torn: nothing loads, the defaults stay
+  damageWord(CONFIG_SECTOR, sizeof(ConfigBlockHeader) + 8);
+  ConfigStore broken(CONFIG_SECTOR);
+  config = defaults;
+  CHECK(!broken.load(config));
+  CHECK(sameConfig(config, defaults));
+
+  // A block with sound CRC but values the protector cannot run on
+  ProtectorConfig inverted = testConfig();
+  inverted.rearmMillivolts = 10000; // Below the cutoff
+  CHECK(broken.save(inverted));
+  ConfigStore rejecting(CONFIG_SECTOR);
+  config = defaults;
+  CHECK(!rejecting.load(config));
+  CHECK(sameConfig(config, defaults));
+}
+
+CHECK_CASE(configStoreIgnoresOtherVersions) {
+  ConfigStore store(CONFIG_SECTOR);
+  CHECK(store.save(testConfig()));
+  // Version field (low half of the second header word) rewritten from 1 to 0
+  uint32_t word = 0xFFFF0000UL;
+  ESP.flashWrite(CONFIG_SECTOR * ConfigStore::SECTOR_SIZE + 4, &word, sizeof(word));
+  ConfigStore reloaded(CONFIG_SECTOR);
+  ProtectorConfig config = testConfig();
+  config.cutoffMillivolts = 11000;
+  CHECK(!reloaded.load(config));
+  CHECK_EQ(config.cutoffMillivolts, 11000);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// PROTECTOR CONFIGURATION
+//////////////////////////////////////////////////////////
+CHECK_CASE(protectorEditsSavesAndBootsOnStoredConfig) {
+  // 11.8 V: above the compiled cutoff, below the one set over Serial
+  AdcModel adc;
+  sim::setAnalogInput(A0, adc.rawFromVolts(11.8f));
+  sim::setSerialCapture(true);
+  {
+    BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+    CHECK(!protector.isConfigLoaded());
+    runUntil(protector, 1000);
+    CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+    sim::takeSerialOutput();
+
+    sim::sendSerialInput("c cutoff 12.05\n");
+    runUntil(protector, 2000);
+    std::string output = sim::takeSerialOutput();
+    CHECK(output.find("Config: cutoff 12.05V, rearm 12.80V") != std::string::npos);
+    CHECK(output.find("(not saved)") != std::string::npos);
+    CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+
+    // Rearm below the cutoff is refused and changes nothing
+    sim::sendSerialInput("c rearm 11.9\n");
+    runUntil(protector, 2100);
+    CHECK(sim::takeSerialOutput().find("out of range") != std::string::npos);
+    CHECK_EQ(protector.getConfig().rearmMillivolts, 12800);
+
+    sim::sendSerialInput("c save\n");
+    runUntil(protector, 3000);
+    CHECK(sim::takeSerialOutput().find("(saved #1)") != std::string::npos);
+    CHECK(!protector.isConfigSavePending());
+    sim::reboot();
+  }
+
+  // After the reset the stored cutoff decides the boot
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  CHECK(protector.isConfigLoaded());
+  CHECK_EQ(protector.getConfig().cutoffMillivolts, 12050);
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+  CHECK_EQ(protector.getDefaultConfig().cutoffMillivolts, 11000);
+  runUntil(protector, sim::nowUs() / 1000 + 500); // Wall clock: it kept running through the reset
+  CHECK(sim::takeSerialOutput().find("Config: cutoff 12.05V") != std::string::npos);
+}
+
+CHECK_CASE(protectorRunsWithoutFilesystemArea) {
+  // A flash layout with no filesystem area ("FS:none"): history log,
+  // configuration block and MQTT spool stay off, protection goes on
+  sim::setFilesystemSize(0);
+  AdcModel adc;
+  sim::setAnalogInput(A0, adc.rawFromVolts(12.6f));
+  sim::setSerialCapture(true);
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  CHECK(!protector.isConfigLoaded());
+  protector.setHistoryLog(true);
+  CHECK(sim::takeSerialOutput().find("ERROR: No flash area for the history log!") != std::string::npos);
+  runUntil(protector, 1000);
+  CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+
+  // Changes apply but cannot be kept
+  sim::sendSerialInput("c cutoff 11.5\n");
+  runUntil(protector, 1500);
+  sim::sendSerialInput("c save\n");
+  runUntil(protector, 2500);
+  CHECK(sim::takeSerialOutput().find("ERROR: No flash area for the configuration!") != std::string::npos);
+  CHECK_EQ(protector.getConfig().cutoffMillivolts, 11500);
+  uint32_t erases = 0;
+  for (uint32_t sector = 0; sector < sim::FLASH_SIZE / sim::FLASH_SECTOR_SIZE; sector++) {
+    erases += sim::getFlashEraseCount(sector);
+  }
+  CHECK_EQ(erases, 0UL);
+}
+
+CHECK_CASE(protectorCalibrationScalesReadings) {
+  AdcModel adc;
+  sim::setAnalogInput(A0, adc.rawFromVolts(12.6f));
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  runUntil(protector, 1000);
+  uint16_t before = protector.getBatteryMillivolts();
+  CHECK(before >= 12550 && before <= 12650);
+
+  // Calibration 1.20 to 1.26: the same counts read 5% higher
+  sim::sendSerialInput("c cal 1.26\n");
+  runUntil(protector, 2000);
+  CHECK_EQ(protector.getConfig().calibrationPpm, 1260000);
+  uint16_t after = protector.getBatteryMillivolts();
+  CHECK(after >= (uint32_t)before * 105 / 100 - 15 && after <= (uint32_t)before * 105 / 100 + 15);
+
+  // Sample period: the sampler follows
+  sim::sendSerialInput("c period 10\n");
+  runUntil(protector, 2200);
+  CHECK_EQ(protector.getConfig().samplePeriodMs, 10);
+  sim::sendSerialInput("c defaults\n");
+  runUntil(protector, 2400);
+  CHECK_EQ(protector.getConfig().calibrationPpm, 1200000);
+  CHECK_EQ(protector.getConfig().samplePeriodMs, 5);
+}
+
+CHECK_CASE(protectorCapturesAdcCalibrationPoints) {
+  // A unit reading ~0.2 V high near 11 V: offset and a bent curve
+  AdcModel adc;
+  adc.offsetCounts = 4.0f;
+  adc.bowCounts = 6.0f;
+  sim::setAnalogInput(A0, adc.rawFromVolts(11.5f));
+  sim::setSerialCapture(true);
+  {
+    BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+    runUntil(protector, 1000);
+    uint16_t uncalibrated = protector.getBatteryMillivolts();
+    CHECK(uncalibrated >= 11650 && uncalibrated <= 11800);
+    sim::takeSerialOutput();
+
+    // One point is not a calibration yet
+    sim::sendSerialInput("a 11.5\n");
+    runUntil(protector, 1100);
+    std::string output = sim::takeSerialOutput();
+    CHECK(output.find("V, divider until a second point, taken ") != std::string::npos);
+    CHECK(output.find("=11.500V") != std::string::npos);
+    CHECK_EQ(protector.getConfig().adcPointCount, 0);
+
+    // The bench supply steps up, a meter reads each voltage
+    const float volts[3] = { 12.5f, 13.5f, 14.5f };
+    const char* const commands[3] = { "a 12.5\n", "a 13.500\n", "a 14.5\n" };
+    for (uint8_t i = 0; i < 3; i++) {
+      sim::setAnalogInput(A0, adc.rawFromVolts(volts[i]));
+      runUntil(protector, 2000 + i * 1000);
+      sim::sendSerialInput(commands[i]);
+      runUntil(protector, 2100 + i * 1000);
+    }
+    output = sim::takeSerialOutput();
+    CHECK(output.find("V, points ") != std::string::npos);
+    CHECK(output.find("=14.500V (not saved)") != std::string::npos);
+    CHECK_EQ(protector.getConfig().adcPointCount, 4);
+
+    // Between the points the error is gone
+    sim::setAnalogInput(A0, adc.rawFromVolts(11.8f));
+    runUntil(protector, 6000);
+    uint16_t calibrated = protector.getBatteryMillivolts();
+    CHECK(calibrated >= 11780 && calibrated <= 11820);
+
+    // A point that would make the curve fall is refused
+    sim::sendSerialInput("a 15.0\n");
+    runUntil(protector, 6100);
+    CHECK(sim::takeSerialOutput().find("not taken") != std::string::npos);
+    CHECK_EQ(protector.getConfig().adcPointCount, 4);
+
+    sim::sendSerialInput("c save\n");
+    runUntil(protector, 7000);
+    CHECK(sim::takeSerialOutput().find(", adc 4 points (saved #1)") != std::string::npos);
+    sim::reboot();
+  }
+
+  // The table is rebuilt from the stored points before the first reading
+  unsigned long bootMs = (unsigned long)(sim::nowUs() / 1000);
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  CHECK_EQ(protector.getConfig().adcPointCount, 4);
+  runUntil(protector, bootMs + 1000);
+  uint16_t calibrated = protector.getBatteryMillivolts();
+  CHECK(calibrated >= 11780 && calibrated <= 11820);
+
+  sim::sendSerialInput("a clear\n");
+  runUntil(protector, bootMs + 2000);
+  CHECK(sim::takeSerialOutput().find("V, divider (no points)") != std::string::npos);
+  CHECK(protector.getBatteryMillivolts() > 11900);
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,298 @@
+//////////////////////////////////////////////////////////
+// CORE CHECKS
+//
+// SampleRing, the VoltageSensor filter stages and ADC table,
+// formatMillivolts and the cooperative scheduler.
+//////////////////////////////////////////////////////////
+#include "Arduino.h"
+#include "adcSampler.h"
+#include "basicHardware.h"
+#include "check.h"
+#include "pinMock.h"
+#include "scheduler.h"
+#include "simHal.h"
+
+namespace {
+
+  VoltageFilterConfig filterConfig(uint8_t oversample, uint8_t median, uint8_t emaShift) {
+    VoltageFilterConfig config;
+    config.oversampleCount = oversample;
+    config.medianWindow = median;
+    config.emaShift = emaShift;
+    return config;
+  }
+
+  struct TaskLog {
+    char order[16];
+    uint8_t length;
+  };
+
+  void logTaskA(void* arg) {
+    TaskLog* log = static_cast<TaskLog*>(arg);
+    log->order[log->length++] = 'A';
+  }
+
+  void logTaskB(void* arg) {
+    TaskLog* log = static_cast<TaskLog*>(arg);
+    log->order[log->length++] = 'B';
+  }
+
+  void busyTask(void* arg) {
+    sim::advanceBusyUs(*static_cast<unsigned long*>(arg));
+  }
+
+}
+
+
+//////////////////////////////////////////////////////////
+// SAMPLE RING
+//////////////////////////////////////////////////////////
+CHECK_CASE(ringKeepsOrderAcrossIndexWrap) {
+  SampleRing<uint16_t, 8> ring;
+  uint16_t value = 0;
+  // Run the free-running 16-bit indices through their wrap point
+  for (uint32_t i = 0; i < 70000; i++) {
+    CHECK(ring.push((uint16_t)i));
+    CHECK(ring.pop(value));
+    if (value != (uint16_t)i) {
+      CHECK_EQ(value, (uint16_t)i);
+      break;
+    }
+  }
+  CHECK_EQ(ring.available(), 0);
+  CHECK(!ring.pop(value));
+
+  for (uint16_t i = 0; i < 5; i++) {
+    ring.push(i);
+  }
+  CHECK_EQ(ring.available(), 5);
+  for (uint16_t i = 0; i < 5; i++) {
+    CHECK(ring.pop(value));
+    CHECK_EQ(value, i);
+  }
+}
+
+CHECK_CASE(ringCountsOverflowAndKeepsOldest) {
+  SampleRing<uint16_t, 4> ring;
+  for (uint16_t i = 0; i < 6; i++) {
+    ring.push(i);
+  }
+  CHECK_EQ(ring.available(), 4);
+  CHECK_EQ(ring.getOverflowCount(), 2);
+  uint16_t value = 0;
+  CHECK(ring.pop(value));
+  CHECK_EQ(value, 0);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// VOLTAGE FILTER
+//////////////////////////////////////////////////////////
+CHECK_CASE(oversamplingAveragesWithFractionBits) {
+  PinMock pin(A0);
+  VoltageSensor sensor(&pin, 100000.0f, 430000.0f, 1.20f);
+  sensor.init();
+  sensor.setFilter(filterConfig(4, 1, 0));
+  CHECK(!sensor.filterRaw(10));
+  CHECK(!sensor.filterRaw(11));
+  CHECK(!sensor.filterRaw(12));
+  CHECK(sensor.filterRaw(13));
+  CHECK_EQ(sensor.getFilteredReading().raw, (46 << VoltageSensor::RAW_FRACTION_BITS) / 4);
+}
+
+CHECK_CASE(medianRejectsIsolatedSpikes) {
+  PinMock pin(A0);
+  VoltageSensor sensor(&pin, 100000.0f, 430000.0f, 1.20f);
+  sensor.init();
+  sensor.setFilter(filterConfig(1, 5, 0));
+  const uint16_t input[] = { 700, 700, 1000, 700, 700, 200, 700, 1000, 1000, 700 };
+  for (size_t i = 0; i < sizeof(input) / sizeof(input[0]); i++) {
+    sensor.filterRaw(input[i]);
+    CHECK_EQ(sensor.getFilteredReading().raw, 700 << VoltageSensor::RAW_FRACTION_BITS);
+  }
+  // A level change longer than half the window gets through
+  sensor.filterRaw(500);
+  sensor.filterRaw(500);
+  CHECK_EQ(sensor.getFilteredReading().raw, 700 << VoltageSensor::RAW_FRACTION_BITS);
+  sensor.filterRaw(500);
+  CHECK_EQ(sensor.getFilteredReading().raw, 500 << VoltageSensor::RAW_FRACTION_BITS);
+}
+
+CHECK_CASE(emaSeedsFromFirstSampleAndConverges) {
+  PinMock pin(A0);
+  VoltageSensor sensor(&pin, 100000.0f, 430000.0f, 1.20f);
+  sensor.init();
+  sensor.setFilter(filterConfig(1, 1, 3));
+  CHECK(!sensor.hasFilteredReading());
+  sensor.filterRaw(800);
+  CHECK(sensor.hasFilteredReading());
+  CHECK_EQ(sensor.getFilteredReading().raw, 800 << VoltageSensor::RAW_FRACTION_BITS);
+  sensor.filterRaw(0);
+  CHECK_EQ(sensor.getFilteredReading().raw, 700 << VoltageSensor::RAW_FRACTION_BITS); // 1/8 of the step
+  for (int i = 0; i < 200; i++) {
+    sensor.filterRaw(0);
+  }
+  CHECK_EQ(sensor.getFilteredReading().raw, 0);
+}
+
+CHECK_CASE(thresholdCountsMatchFloatConversion) {
+  PinMock pin(A0);
+  VoltageSensor sensor(&pin, 100000.0f, 430000.0f, 1.20f);
+  sensor.init();
+  // "raw < threshold" must agree with "voltage < 11 V" for every count
+  uint16_t threshold = sensor.thresholdForVoltage(11.0f);
+  for (int raw = 0; raw <= 1023; raw++) {
+    bool below = sensor.convertRawToVolts(raw) < 11.0f;
+    if (below != ((uint16_t)(raw << VoltageSensor::RAW_FRACTION_BITS) < threshold)) {
+      CHECK_EQ(raw, -1);
+      break;
+    }
+  }
+  CHECK_EQ(sensor.minimumRawForVoltage(11.0f) << VoltageSensor::RAW_FRACTION_BITS,
+    (threshold + 15) & ~15);
+}
+
+CHECK_CASE(adcTableInterpolatesBetweenPoints) {
+  // Out of order or falling points are refused
+  const AdcCalibrationPoint falling[2] = { { 500, 11000 }, { 600, 10900 } };
+  const AdcCalibrationPoint unordered[2] = { { 600, 12600 }, { 500, 11000 } };
+  AdcCalibrationTable table;
+  CHECK(!table.build(falling, 2));
+  CHECK(!table.build(unordered, 2));
+  CHECK(!table.build(falling, 1));
+
+  const AdcCalibrationPoint points[3] = { { 500, 10000 }, { 600, 12000 }, { 700, 14500 } };
+  CHECK(table.build(points, 3));
+  CHECK_EQ(table.millivolts(500), 10000);
+  CHECK_EQ(table.millivolts(550), 11000);
+  CHECK_EQ(table.millivolts(600), 12000);
+  CHECK_EQ(table.millivolts(650), 13250);
+  // Outside the points the end segments carry on
+  CHECK_EQ(table.millivolts(0), 0);
+  CHECK_EQ(table.millivolts(450), 9000);
+  CHECK_EQ(table.millivolts(800), 17000);
+  CHECK_EQ(table.millivolts(1023), 22575);
+  CHECK(sizeof(AdcCalibrationTable) <= 40); // The points, not an entry per count
+
+  PinMock pin(A0);
+  VoltageSensor sensor(&pin, 100000.0f, 430000.0f, 1.20f);
+  sensor.init();
+  sensor.setCalibration(&table);
+  CHECK(sensor.isCalibrated());
+  CHECK_EQ(sensor.millivoltsFromRaw(550 << VoltageSensor::RAW_FRACTION_BITS), 11000);
+  CHECK_EQ(sensor.millivoltsFromRaw((550 << VoltageSensor::RAW_FRACTION_BITS) + 8), 11010); // Half a count: half the step
+  // Thresholds agree with the table conversion at every count and fraction
+  uint16_t threshold = sensor.thresholdForVoltage(11.005f);
+  for (uint16_t raw = 0; raw <= (1023 << VoltageSensor::RAW_FRACTION_BITS); raw++) {
+    if ((sensor.millivoltsFromRaw(raw) < 11005) != (raw < threshold)) {
+      CHECK_EQ(raw, 0xFFFF);
+      break;
+    }
+  }
+  CHECK_EQ(sensor.minimumRawForVoltage(11.005f), 551);
+  CHECK(sensor.convertRawToVolts(600) == 12.0f);
+
+  sensor.setCalibration(nullptr);
+  CHECK(!sensor.isCalibrated());
+  CHECK(sensor.convertRawToVolts(600) > 12.0f); // Divider: 1.20 x 3.3 V / 0.1887
+}
+
+CHECK_CASE(adcTableScalesNoiseBySlope) {
+  // 10 mV per count, 6 V at count 0: noise is counts times the slope,
+  // not the table's value for a count near 0
+  const AdcCalibrationPoint points[2] = { { 500, 11000 }, { 600, 12000 } };
+  AdcCalibrationTable table;
+  CHECK(table.build(points, 2));
+  PinMock pin(A0);
+  VoltageSensor plain(&pin, 100000.0f, 430000.0f, 1.20f);
+  VoltageSensor calibrated(&pin, 100000.0f, 430000.0f, 1.20f);
+  plain.setFilter(filterConfig(1, 1, 3));
+  calibrated.setFilter(filterConfig(1, 1, 3));
+  calibrated.setCalibration(&table);
+  for (uint16_t i = 0; i < 400; i++) {
+    uint16_t raw = (i & 1) ? 546 : 554;
+    plain.filterRaw(raw);
+    calibrated.filterRaw(raw);
+  }
+  VoltageReading reading = calibrated.getFilteredReading();
+  CHECK(reading.millivolts >= 11450 && reading.millivolts <= 11550);
+  // Same spread in counts: noise in the ratio of the two slopes
+  uint32_t plainNoise = plain.getFilteredReading().noiseMillivolts;
+  uint32_t plainMillivoltsPerCount = plain.millivoltsFromRaw(1000 << VoltageSensor::RAW_FRACTION_BITS) / 1000;
+  CHECK(reading.noiseMillivolts >= 20 && reading.noiseMillivolts <= 60);
+  CHECK(reading.noiseMillivolts * plainMillivoltsPerCount >= plainNoise * 10 - plainMillivoltsPerCount * 2);
+  CHECK(reading.noiseMillivolts * plainMillivoltsPerCount <= plainNoise * 10 + plainMillivoltsPerCount * 2);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FORMATTING
+//////////////////////////////////////////////////////////
+CHECK_CASE(formatMillivoltsRoundsToCentivolts) {
+  char text[8];
+  formatMillivolts(12345, text);
+  CHECK(strcmp(text, "12.35") == 0);
+  formatMillivolts(11004, text);
+  CHECK(strcmp(text, "11.00") == 0);
+  formatMillivolts(9994, text);
+  CHECK(strcmp(text, "9.99") == 0);
+  formatMillivolts(9995, text);
+  CHECK(strcmp(text, "10.00") == 0);
+  formatMillivolts(0, text);
+  CHECK(strcmp(text, "0.00") == 0);
+  formatMillivolts(65535, text);
+  CHECK(strcmp(text, "65.54") == 0);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// SCHEDULER
+//////////////////////////////////////////////////////////
+CHECK_CASE(schedulerRunsHighestPriorityFirst) {
+  Scheduler scheduler;
+  TaskLog log = { {0}, 0 };
+  scheduler.addTask("low", &logTaskB, &log, 10, 5);
+  scheduler.addTask("high", &logTaskA, &log, 10, 0);
+  scheduler.run();
+  CHECK_EQ(log.length, 2);
+  CHECK_EQ(log.order[0], 'A');
+  CHECK_EQ(log.order[1], 'B');
+
+  // Nothing is due until the next period
+  scheduler.run();
+  CHECK_EQ(log.length, 2);
+  CHECK_EQ(scheduler.msUntilNextDeadline(), 10);
+  sim::advanceUs(9500);
+  CHECK_EQ(scheduler.msUntilNextDeadline(), 1); // Rounded up, never 0 while nothing is due
+  sim::advanceUs(500);
+  CHECK_EQ(scheduler.msUntilNextDeadline(), 0);
+}
+
+CHECK_CASE(schedulerResyncsAfterMissedPeriod) {
+  Scheduler scheduler;
+  unsigned long workUs = 25000;
+  int8_t busy = scheduler.addTask("busy", &busyTask, &workUs, 10, 0);
+  scheduler.run();
+  const Scheduler::TaskStats* stats = scheduler.getStats(busy);
+  CHECK_EQ(stats->runs, 1);
+  CHECK_EQ(stats->missedPeriods, 1);
+  CHECK_EQ(stats->maxRunUs, 25000);
+  // Resynchronised one period after the overrun instead of catching up
+  CHECK_EQ(scheduler.msUntilNextDeadline(), 10);
+}
+
+CHECK_CASE(schedulerShorterPeriodTakesEffectNow) {
+  Scheduler scheduler;
+  TaskLog log = { {0}, 0 };
+  int8_t task = scheduler.addTask("slow", &logTaskA, &log, 1000, 0);
+  scheduler.run();
+  CHECK_EQ(scheduler.msUntilNextDeadline(), 1000);
+  scheduler.setPeriod(task, 20);
+  CHECK_EQ(scheduler.msUntilNextDeadline(), 20);
+  scheduler.setPeriod(task, 500); // Longer: the pending deadline stays
+  CHECK_EQ(scheduler.msUntilNextDeadline(), 20);
+}
+//////////////////////////////////////////////////////////
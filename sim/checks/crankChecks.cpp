@@ -0,0 +1,246 @@
+//////////////////////////////////////////////////////////
+// CRANK CHECKS
+//
+// TransientClassifier on hand-made dips, and BatteryProtector with the
+// ride-through on the crank trace set in sim/traces/crank: every trace
+// states what should happen, the table below holds it to that.
+//////////////////////////////////////////////////////////
+#include <string>
+#include "Arduino.h"
+#include "adcModel.h"
+#include "batteryProtector.h"
+#include "check.h"
+#include "simHal.h"
+#include "trace.h"
+#include "transientClassifier.h"
+
+namespace {
+
+  const uint8_t RELAY_PIN = 12; // BatteryProtector::PIN_RELAY_CONTROL
+  const unsigned long STEP_MS = 5;
+
+  // Feeds millivolts at 5 ms steps; returns the last verdict
+  TransientClassifier::Verdict hold(TransientClassifier& classifier, unsigned long& nowMs, uint16_t millivolts, unsigned long durationMs) {
+    TransientClassifier::Verdict verdict = classifier.getVerdict();
+    for (unsigned long end = nowMs + durationMs; nowMs < end; nowMs += STEP_MS) {
+      verdict = classifier.addSample(millivolts, nowMs);
+    }
+    return verdict;
+  }
+
+  struct CrankTrace {
+    const char* path;
+    bool expectCutoff;
+    unsigned long cutoffAfterMs; // Relay opening at or before this trace time
+    uint16_t transients;         // Dips ridden through
+  };
+
+  const CrankTrace CRANK_TRACES[] = {
+    { "traces/crank/crank_warm_start.csv", false, 0, 1 },
+    { "traces/crank/crank_cold_start.csv", false, 0, 1 },
+    { "traces/crank/crank_repeated_attempts.csv", false, 0, 3 },
+    { "traces/crank/load_inrush.csv", false, 0, 2 },
+    { "traces/crank/discharge_step.csv", true, 2000 + 3000 + 100, 0 }, // Dwell, then the next state run
+    { "traces/crank/collapse.csv", true, 2000 + 100 + 10, 0 },         // Collapse time
+    { "traces/crank/slow_discharge.csv", true, 150000 + 500, 0 },      // Filter delay only
+  };
+
+  // Replays the warm start, letting the sampler queue drainEveryMs of
+  // samples between updates; returns the ridden-through dip's reported
+  // duration in ms, -1 without one
+  long warmStartDipMs(unsigned long drainEveryMs) {
+    sim::reset();
+    SystemClock::reset();
+    Trace trace;
+    std::string error;
+    CHECK(trace.load("traces/crank/crank_warm_start.csv", error));
+    AdcModel adc;
+    sim::setAnalogInput(A0, adc.rawFromVolts(trace.voltsAt(0)));
+    int listener = sim::addTickListener([&](unsigned long nowMs) {
+      sim::setAnalogInput(A0, adc.rawFromVolts(trace.voltsAt(nowMs)));
+    });
+    sim::setSerialCapture(true);
+    BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+    protector.setTransientRideThrough(TransientClassifier::defaultConfig());
+    while (sim::nowUs() / 1000 < trace.durationMs()) {
+      protector.update();
+      if (drainEveryMs > 0) {
+        sim::advanceMs(drainEveryMs);
+      } else {
+        protector.idle();
+      }
+    }
+    sim::removeTickListener(listener);
+    CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+    CHECK_EQ(protector.getTransientCount(), 1);
+    std::string output = sim::takeSerialOutput();
+    size_t end = output.find("ms, recovery");
+    if (end == std::string::npos) {
+      return -1;
+    }
+    size_t start = output.rfind(' ', end);
+    return atol(output.substr(start + 1, end - start - 1).c_str());
+  }
+
+}
+
+
+//////////////////////////////////////////////////////////
+// CLASSIFIER
+//////////////////////////////////////////////////////////
+CHECK_CASE(classifierRidesThroughCrank) {
+  TransientClassifier classifier;
+  classifier.begin(TransientClassifier::defaultConfig(), 11000);
+  unsigned long nowMs = 0;
+  CHECK(hold(classifier, nowMs, 12500, 1000) == TransientClassifier::VERDICT_CLEAR);
+  CHECK(hold(classifier, nowMs, 8000, 20) == TransientClassifier::VERDICT_TRANSIENT);   // Inrush
+  CHECK(hold(classifier, nowMs, 10000, 1500) == TransientClassifier::VERDICT_TRANSIENT); // Cranking
+  CHECK(hold(classifier, nowMs, 14000, 100) == TransientClassifier::VERDICT_TRANSIENT);  // Settling
+  CHECK(hold(classifier, nowMs, 14000, 500) == TransientClassifier::VERDICT_CLEAR);
+  CHECK_EQ(classifier.getTransientCount(), 1);
+  CHECK_EQ(classifier.getSlowRecoveryCount(), 0);
+  CHECK_EQ(classifier.getLastDip().minMillivolts, 8000);
+  CHECK_EQ(classifier.getLastDip().durationMs, 1520);
+  CHECK_EQ(classifier.getLastDip().recoveryMillivoltsPerSecond, 0xFFFF); // One step out
+}
+
+CHECK_CASE(classifierSustainsSlowOnset) {
+  // Creeping across the threshold is a discharge, from the first sample
+  TransientClassifier classifier;
+  classifier.begin(TransientClassifier::defaultConfig(), 11000);
+  unsigned long nowMs = 0;
+  for (uint16_t millivolts = 11600; millivolts >= 11000; millivolts -= 10) {
+    hold(classifier, nowMs, millivolts, 100);
+  }
+  CHECK(hold(classifier, nowMs, 10990, 5) == TransientClassifier::VERDICT_SUSTAINED);
+  CHECK_EQ(classifier.getTransientCount(), 0);
+}
+
+CHECK_CASE(classifierBoundsRideThroughByDwell) {
+  TransientClassifier classifier;
+  TransientConfig config = TransientClassifier::defaultConfig();
+  config.dwellMs = 1000;
+  classifier.begin(config, 11000);
+  unsigned long nowMs = 0;
+  hold(classifier, nowMs, 12500, 1000);
+  CHECK(hold(classifier, nowMs, 10700, 1000) == TransientClassifier::VERDICT_TRANSIENT); // Last sample at 995 ms
+  CHECK(hold(classifier, nowMs, 10700, 5) == TransientClassifier::VERDICT_SUSTAINED);
+  // Back up: no transient counted for it
+  hold(classifier, nowMs, 12500, 100);
+  CHECK_EQ(classifier.getTransientCount(), 0);
+}
+
+CHECK_CASE(classifierSustainsCollapse) {
+  TransientClassifier classifier;
+  classifier.begin(TransientClassifier::defaultConfig(), 11000);
+  unsigned long nowMs = 0;
+  hold(classifier, nowMs, 12500, 1000);
+  // A short spike below the collapse level is still inrush
+  CHECK(hold(classifier, nowMs, 5500, 50) == TransientClassifier::VERDICT_TRANSIENT);
+  CHECK(hold(classifier, nowMs, 9500, 200) == TransientClassifier::VERDICT_TRANSIENT);
+  CHECK(hold(classifier, nowMs, 5500, 100) == TransientClassifier::VERDICT_TRANSIENT);
+  CHECK(hold(classifier, nowMs, 5500, 5) == TransientClassifier::VERDICT_SUSTAINED);
+}
+
+CHECK_CASE(classifierShortensDwellAfterSlowRecovery) {
+  TransientClassifier classifier;
+  classifier.begin(TransientClassifier::defaultConfig(), 11000);
+  unsigned long nowMs = 0;
+  hold(classifier, nowMs, 12500, 1000);
+  // 2 s dip, then a climb of 1 V/s out of it
+  hold(classifier, nowMs, 10500, 2000);
+  for (uint16_t millivolts = 10500; millivolts < 11600; millivolts += 5) {
+    hold(classifier, nowMs, millivolts, 5);
+  }
+  CHECK_EQ(classifier.getTransientCount(), 1);
+  CHECK_EQ(classifier.getSlowRecoveryCount(), 1);
+  CHECK(classifier.getLastDip().recoveryMillivoltsPerSecond < 2000);
+
+  // The next dip gets what is left of the 3 s after 2.7 s below 11.2 V
+  hold(classifier, nowMs, 11600, 100);
+  CHECK(hold(classifier, nowMs, 10500, 250) == TransientClassifier::VERDICT_TRANSIENT);
+  CHECK(hold(classifier, nowMs, 10500, 100) == TransientClassifier::VERDICT_SUSTAINED);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// CRANK TRACE SET
+//////////////////////////////////////////////////////////
+CHECK_CASE(crankTraceSetReplays) {
+  for (size_t i = 0; i < sizeof(CRANK_TRACES) / sizeof(CRANK_TRACES[0]); i++) {
+    const CrankTrace& expected = CRANK_TRACES[i];
+    sim::reset();
+    SystemClock::reset();
+    Trace trace;
+    std::string error;
+    CHECK(trace.load(expected.path, error));
+    if (trace.empty()) {
+      printf("  %s: %s\n", expected.path, error.c_str());
+      continue;
+    }
+
+    AdcModel adc;
+    sim::setAnalogInput(A0, adc.rawFromVolts(trace.voltsAt(0)));
+    int listener = sim::addTickListener([&](unsigned long nowMs) {
+      sim::setAnalogInput(A0, adc.rawFromVolts(trace.voltsAt(nowMs)));
+    });
+    unsigned long openedMs = 0;
+    sim::setWriteObserver([&](uint8_t pin, uint8_t val, unsigned long nowMs) {
+      if (pin == RELAY_PIN && val == HIGH && nowMs > 0 && openedMs == 0) {
+        openedMs = nowMs;
+      }
+    });
+
+    BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+    protector.setTransientRideThrough(TransientClassifier::defaultConfig());
+    while (sim::nowUs() / 1000 < trace.durationMs()) {
+      protector.update();
+      protector.idle();
+    }
+    if (expected.expectCutoff) {
+      CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+      CHECK(openedMs > 0);
+      CHECK(openedMs <= expected.cutoffAfterMs);
+    } else {
+      CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+      CHECK_EQ(openedMs, 0);
+    }
+    CHECK_EQ(protector.getTransientCount(), expected.transients);
+    if (openedMs > expected.cutoffAfterMs || protector.getTransientCount() != expected.transients) {
+      printf("  %s: relay opened at %lu ms, %u transients\n", expected.path, openedMs, (unsigned int)protector.getTransientCount());
+    }
+    sim::removeTickListener(listener);
+  }
+}
+
+CHECK_CASE(crankTimesDipsFromDelayedDrain) {
+  // loop() held up for 300 ms at a time: the queued samples keep their
+  // own sample times, so the dip lasts as long as with prompt draining
+  long promptMs = warmStartDipMs(0);
+  long delayedMs = warmStartDipMs(300);
+  CHECK(promptMs > 800);
+  CHECK(delayedMs >= promptMs - 10 && delayedMs <= promptMs + 10);
+  if (delayedMs < promptMs - 10 || delayedMs > promptMs + 10) {
+    printf("  dip %ld ms drained promptly, %ld ms drained every 300 ms\n", promptMs, delayedMs);
+  }
+}
+
+CHECK_CASE(rideThroughOffCutsOffOnCrank) {
+  // The same warm start without the classifier: the sampler trips
+  Trace trace;
+  std::string error;
+  CHECK(trace.load("traces/crank/crank_warm_start.csv", error));
+  AdcModel adc;
+  sim::setAnalogInput(A0, adc.rawFromVolts(trace.voltsAt(0)));
+  sim::addTickListener([&](unsigned long nowMs) {
+    sim::setAnalogInput(A0, adc.rawFromVolts(trace.voltsAt(nowMs)));
+  });
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  while (sim::nowUs() / 1000 < 2500) {
+    protector.update();
+    protector.idle();
+  }
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+}
+//////////////////////////////////////////////////////////
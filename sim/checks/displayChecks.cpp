@@ -0,0 +1,158 @@
+//////////////////////////////////////////////////////////
+// DISPLAY CHECKS
+//
+// Shadow-framebuffer LCD driver against the HD44780 model on the
+// simulated I2C bus: what reaches the glass, and how little is sent.
+//////////////////////////////////////////////////////////
+#include <string>
+#include "Arduino.h"
+#include "LiquidCrystal_I2C.h"
+#include "basicHardware.h"
+#include "check.h"
+#include "checkHelpers.h"
+#include "i2cBus.h"
+#include "simHal.h"
+
+namespace {
+
+  const uint8_t LCD_ADDRESS = 0x27;
+  const uint8_t COLUMNS = 16;
+  const uint8_t ROWS = 2;
+
+  const Hd44780Model* lcdModel() {
+    return static_cast<const Hd44780Model*>(sim::findI2cDevice(LCD_ADDRESS));
+  }
+
+  void drawStatus(Display& display, const char* volts) {
+    display.clear();
+    display.setCursor(0, 0);
+    display.print("Baterija: ");
+    display.print(volts);
+    display.print("V");
+    display.setCursor(0, 1);
+    display.print("Potrosac: ON");
+  }
+
+}
+
+
+//////////////////////////////////////////////////////////
+// SHADOW DIFF
+//////////////////////////////////////////////////////////
+CHECK_CASE(displayFirstFlushDrawsFrame) {
+  Display display(LCD_ADDRESS, COLUMNS, ROWS);
+  display.init();
+  drawStatus(display, "12.60");
+  display.flush();
+  CHECK(shownRow(0) == "Baterija: 12.60V");
+  CHECK(shownRow(1) == "Potrosac: ON    ");
+  // init() left the LCD blank with the cursor at home: blank cells are
+  // not sent again and only the second row needs a cursor move
+  CHECK_EQ(display.getLastRefreshStats().cellsWritten, 16 + 12);
+  CHECK_EQ(display.getLastRefreshStats().cursorMoves, 1);
+}
+
+CHECK_CASE(displaySendsOnlyChangedCells) {
+  Display display(LCD_ADDRESS, COLUMNS, ROWS);
+  display.init();
+  drawStatus(display, "12.60");
+  display.flush();
+
+  unsigned long dataBefore = lcdModel()->getDataCount();
+  drawStatus(display, "12.61");
+  display.flush();
+  CHECK(shownRow(0) == "Baterija: 12.61V");
+  CHECK_EQ(display.getLastRefreshStats().cellsWritten, 1);
+  CHECK_EQ(display.getLastRefreshStats().cursorMoves, 1);
+  CHECK_EQ(display.getLastRefreshStats().transactions, 1);
+  CHECK_EQ(lcdModel()->getDataCount() - dataBefore, 1);
+
+  // Same frame again: nothing on the bus
+  sim::resetI2cStats();
+  drawStatus(display, "12.61");
+  display.flush();
+  CHECK_EQ(display.getLastRefreshStats().cellsWritten, 0);
+  CHECK_EQ(display.getLastRefreshStats().transactions, 0);
+  CHECK_EQ(sim::getI2cStats().transactions, 0);
+}
+
+CHECK_CASE(displayBridgesShortGapsOnly) {
+  Display display(LCD_ADDRESS, COLUMNS, ROWS);
+  display.init();
+  drawStatus(display, "12.60");
+  display.flush();
+
+  // "12.60" -> "13.70": changes at columns 11 and 13, one unchanged cell
+  // in between is rewritten instead of moving the cursor
+  drawStatus(display, "13.70");
+  display.flush();
+  CHECK(shownRow(0) == "Baterija: 13.70V");
+  CHECK_EQ(display.getLastRefreshStats().cellsWritten, 3);
+  CHECK_EQ(display.getLastRefreshStats().cursorMoves, 1);
+
+  // "13.70" -> "03.71": columns 10 and 14, a gap of three needs a move
+  drawStatus(display, "03.71");
+  display.flush();
+  CHECK(shownRow(0) == "Baterija: 03.71V");
+  CHECK_EQ(display.getLastRefreshStats().cellsWritten, 2);
+  CHECK_EQ(display.getLastRefreshStats().cursorMoves, 2);
+}
+
+CHECK_CASE(displayBatchesIntoWireBuffer) {
+  Display display(LCD_ADDRESS, COLUMNS, ROWS);
+  display.init();
+  drawStatus(display, "12.60");
+  display.flush();
+  const DisplayRefreshStats& stats = display.getLastRefreshStats();
+  // 4 expander bytes per LCD byte, 8 LCD bytes per 32-byte transaction
+  unsigned long lcdBytes = stats.cellsWritten + stats.cursorMoves;
+  CHECK_EQ(stats.transactions, (lcdBytes + 7) / 8);
+  CHECK_EQ(stats.i2cBytes, lcdBytes * 4 + stats.transactions);
+}
+
+CHECK_CASE(displayInvalidateRedrawsEveryCell) {
+  Display display(LCD_ADDRESS, COLUMNS, ROWS);
+  display.init();
+  drawStatus(display, "12.60");
+  display.flush();
+
+  display.invalidate();
+  drawStatus(display, "12.60");
+  display.flush();
+  CHECK_EQ(display.getLastRefreshStats().cellsWritten, COLUMNS * ROWS);
+  CHECK_EQ(display.getLastRefreshStats().cursorMoves, ROWS);
+  CHECK(shownRow(1) == "Potrosac: ON    ");
+}
+
+CHECK_CASE(displayRedrawsAfterFailedTransfer) {
+  Display display(LCD_ADDRESS, COLUMNS, ROWS);
+  display.init();
+  drawStatus(display, "12.60");
+  display.flush();
+
+  // Backpack drops off the bus (NACK) during one refresh
+  sim::I2cDevice* device = sim::findI2cDevice(LCD_ADDRESS);
+  sim::detachI2cDevice(LCD_ADDRESS);
+  drawStatus(display, "12.61");
+  display.flush();
+  sim::attachI2cDevice(LCD_ADDRESS, device);
+  CHECK(shownRow(0) == "Baterija: 12.60V");
+
+  CHECK(display.isBusFault());
+  CHECK_EQ(display.getBusErrorCount(), 1);
+
+  // Nothing is sent until the recovery interval is over
+  sim::resetI2cStats();
+  display.flush();
+  CHECK_EQ(sim::getI2cStats().transactions, 0);
+
+  // Then the LCD is initialised again and the whole frame drawn
+  sim::advanceMs(1000);
+  display.flush();
+  CHECK(!display.isBusFault());
+  CHECK_EQ(display.getBusRecoveryCount(), 1);
+  CHECK_EQ(display.getLastRefreshStats().cellsWritten, 16 + 12);
+  CHECK(shownRow(0) == "Baterija: 12.61V");
+  CHECK(shownRow(1) == "Potrosac: ON    ");
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,314 @@
+//////////////////////////////////////////////////////////
+// HISTORY CHECKS
+//
+// Flash history log on the simulated NOR flash: encoding, recovery
+// after a reset, wear leveling across the sector ring, deferred erases
+// and the framed export, plus the protector's events in the log.
+//////////////////////////////////////////////////////////
+#include <string.h>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "adcModel.h"
+#include "batteryProtector.h"
+#include "check.h"
+#include "historyLog.h"
+#include "simHal.h"
+
+namespace {
+
+  const uint32_t FIRST_SECTOR = 0x200; // FS_PHYS_ADDR / 4096
+
+  // Export target with a fixed free TX buffer
+  class BufferPrint : public Print {
+    public:
+      BufferPrint(int room) : _room(room) {}
+      size_t write(uint8_t c) {
+        bytes.push_back(c);
+        return 1;
+      }
+      int availableForWrite() { return _room; }
+      using Print::write;
+
+      std::vector<uint8_t> bytes;
+
+    private:
+      int _room;
+  };
+
+  // Entries of every frame that passes its CRC; false on a bad or missing frame
+  bool decodeExport(const std::vector<uint8_t>& data, std::vector<HistoryEntry>& entries) {
+    size_t i = 0;
+    while (i + 4 <= data.size()) {
+      if (data[i] != '#' || data[i + 1] != 'H') {
+        i++; // Text between frames
+        continue;
+      }
+      size_t length = data[i + 2] | (data[i + 3] << 8);
+      if (length == 0) {
+        return true;
+      }
+      if (i + 4 + length + 2 > data.size()) {
+        return false;
+      }
+      const uint8_t* bytes = &data[i + 4];
+      if (HistoryLog::crc16(bytes, (uint16_t)length) != (bytes[length] | (bytes[length + 1] << 8))) {
+        return false;
+      }
+      HistorySectorHeader header;
+      memcpy(&header, bytes, sizeof(header));
+      HistoryDecoder decoder;
+      decoder.begin(header);
+      HistoryEntry entry;
+      for (size_t j = sizeof(header); j < length; j++) {
+        if (decoder.feed(bytes[j], entry)) {
+          entries.push_back(entry);
+        }
+      }
+      i += 4 + length + 2;
+    }
+    return false;
+  }
+
+  bool exportAll(HistoryLog& log, std::vector<HistoryEntry>& entries, int room = HistoryLog::EXPORT_CHUNK_BYTES) {
+    BufferPrint out(room);
+    if (!log.startExport()) {
+      return false;
+    }
+    while (log.exportStep(out)) {
+    }
+    return decodeExport(out.bytes, entries);
+  }
+
+  // Stand-in for the protector's sample stream: a slow sag with a few mV of noise
+  uint16_t sampleAt(uint32_t i) {
+    return (uint16_t)(12600 - i / 50 + (i * 7) % 11);
+  }
+
+}
+
+
+//////////////////////////////////////////////////////////
+// ENCODING
+//////////////////////////////////////////////////////////
+CHECK_CASE(historyRoundTripsSamplesAndEvents) {
+  HistoryLog log(FIRST_SECTOR, 4);
+  CHECK(log.begin());
+  log.addEvent(HISTORY_EVENT_BOOT);
+  log.addSample(12600, 1);
+  log.addSample(12590, 1);
+  log.addSample(10400, 1);  // Large drop: a multi-byte delta
+  log.addEvent(HISTORY_EVENT_CUTOFF);
+  log.addSample(13800, 3600); // After an hour without samples (deep sleep)
+  log.addEvent(HISTORY_EVENT_REARM);
+
+  std::vector<HistoryEntry> entries;
+  CHECK(exportAll(log, entries));
+  CHECK_EQ(entries.size(), 7);
+  if (entries.size() != 7) {
+    return;
+  }
+  CHECK(entries[0].kind == HistoryEntry::KIND_EVENT);
+  CHECK_EQ(entries[0].event, HISTORY_EVENT_BOOT);
+  CHECK_EQ(entries[1].millivolts, 12600);
+  CHECK_EQ(entries[1].seconds, 1);
+  CHECK_EQ(entries[2].millivolts, 12590);
+  CHECK_EQ(entries[3].millivolts, 10400);
+  CHECK_EQ(entries[4].event, HISTORY_EVENT_CUTOFF);
+  CHECK_EQ(entries[4].seconds, 3);
+  CHECK_EQ(entries[5].millivolts, 13800);
+  CHECK_EQ(entries[5].seconds, 3603);
+  CHECK_EQ(entries[6].event, HISTORY_EVENT_REARM);
+  CHECK_EQ(log.getSeconds(), 3603);
+}
+
+CHECK_CASE(historyPacksSmallDeltasInOneByte) {
+  HistoryLog log(FIRST_SECTOR, 4);
+  CHECK(log.begin());
+  log.addSample(12600, 1); // First sample: delta from 0
+  uint32_t before = log.getUsedBytes();
+  for (uint32_t i = 0; i < 2000; i++) {
+    log.addSample(sampleAt(i), 1);
+  }
+  CHECK_EQ(log.getUsedBytes() - before, 2000);
+
+  std::vector<HistoryEntry> entries;
+  CHECK(exportAll(log, entries));
+  CHECK_EQ(entries.size(), 2001);
+  CHECK_EQ(entries.back().millivolts, sampleAt(1999));
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FLASH
+//////////////////////////////////////////////////////////
+CHECK_CASE(historyContinuesAfterReset) {
+  {
+    HistoryLog log(FIRST_SECTOR, 4);
+    CHECK(log.begin());
+    for (uint32_t i = 0; i < 5000; i++) { // Into the second sector
+      log.addSample(sampleAt(i), 1);
+    }
+    log.addEvent(HISTORY_EVENT_CUTOFF); // Flushes the word in RAM
+    for (uint32_t i = 5000; i < 5006; i++) {
+      log.addSample(sampleAt(i), 1); // One word written, two samples still in RAM
+    }
+  }
+
+  // Power cycle: the samples of the unwritten word are gone
+  HistoryLog log(FIRST_SECTOR, 4);
+  CHECK(log.begin());
+  CHECK_EQ(log.getSeconds(), 5004);
+  log.addEvent(HISTORY_EVENT_BOOT);
+  log.addSample(11100, 10);
+
+  std::vector<HistoryEntry> entries;
+  CHECK(exportAll(log, entries));
+  CHECK_EQ(entries.size(), 5000 + 1 + 4 + 1 + 1);
+  for (size_t i = 1; i < entries.size(); i++) {
+    CHECK(entries[i].seconds >= entries[i - 1].seconds);
+  }
+  CHECK_EQ(entries.back().seconds, 5014);
+  CHECK_EQ(entries.back().millivolts, 11100);
+}
+
+CHECK_CASE(historyWearsSectorsEvenly) {
+  const uint16_t SECTORS = 4;
+  HistoryLog log(FIRST_SECTOR, SECTORS);
+  CHECK(log.begin());
+  // About ten passes over the ring
+  for (uint32_t i = 0; i < 10 * SECTORS * 4000UL; i++) {
+    log.addSample(sampleAt(i % 20000), 1);
+    if (i % 1000 == 0) {
+      log.maintain(true);
+    }
+  }
+  uint32_t minErases = 0xFFFFFFFFUL;
+  uint32_t maxErases = 0;
+  for (uint16_t i = 0; i < SECTORS; i++) {
+    uint32_t erases = sim::getFlashEraseCount(FIRST_SECTOR + i);
+    minErases = erases < minErases ? erases : minErases;
+    maxErases = erases > maxErases ? erases : maxErases;
+  }
+  CHECK(minErases >= 9);
+  CHECK(maxErases - minErases <= 1);
+  // Neighbouring flash is never touched
+  CHECK_EQ(sim::getFlashEraseCount(FIRST_SECTOR - 1), 0);
+  CHECK_EQ(sim::getFlashEraseCount(FIRST_SECTOR + SECTORS), 0);
+
+  // Oldest data went first; the rest is intact and in order
+  std::vector<HistoryEntry> entries;
+  CHECK(exportAll(log, entries));
+  CHECK(log.getUsedBytes() + HistoryLog::SECTOR_SIZE > log.getCapacityBytes());
+  CHECK(log.getUsedBytes() < log.getCapacityBytes() + HistoryLog::SECTOR_SIZE);
+  CHECK(entries.size() > (SECTORS - 2) * 4000UL);
+  CHECK_EQ(entries.back().seconds, log.getSeconds());
+}
+
+CHECK_CASE(historyDefersEraseUntilAllowed) {
+  HistoryLog log(FIRST_SECTOR, 2);
+  CHECK(log.begin());
+  // Sector 0 full, sector 1 filled past the point where sector 0 would
+  // be erased ahead of time, while the caller says a stall is not safe
+  for (uint32_t i = 0; i < 4080 + 3500; i++) {
+    log.addSample(sampleAt(i), 1);
+    log.maintain(false);
+  }
+  CHECK_EQ(sim::getFlashEraseCount(FIRST_SECTOR), 0);
+
+  uint64_t startUs = sim::nowUs();
+  log.maintain(true);
+  CHECK_EQ(sim::getFlashEraseCount(FIRST_SECTOR), 1);
+  CHECK(sim::nowUs() - startUs >= 40000); // The erase stalls here, not in addSample()
+
+  // Nothing left to do until the next sector fills up
+  log.maintain(true);
+  CHECK_EQ(sim::getFlashEraseCount(FIRST_SECTOR), 1);
+  CHECK_EQ(sim::getFlashEraseCount(FIRST_SECTOR + 1), 0);
+}
+
+CHECK_CASE(historyExportFitsTxBuffer) {
+  HistoryLog log(FIRST_SECTOR, 4);
+  CHECK(log.begin());
+  for (uint32_t i = 0; i < 6000; i++) {
+    log.addSample(sampleAt(i), 1);
+  }
+  const int ROOM = 40;
+  BufferPrint out(ROOM);
+  CHECK(log.startExport());
+  size_t steps = 0;
+  bool withinRoom = true;
+  size_t before = 0;
+  while (log.exportStep(out)) {
+    withinRoom = withinRoom && out.bytes.size() - before <= (size_t)ROOM;
+    before = out.bytes.size();
+    steps++;
+  }
+  CHECK(withinRoom);
+  CHECK(steps > 6000 / ROOM);
+  std::vector<HistoryEntry> entries;
+  CHECK(decodeExport(out.bytes, entries));
+  CHECK_EQ(entries.size(), 6000);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// PROTECTOR
+//////////////////////////////////////////////////////////
+CHECK_CASE(protectorLogsCutoffAndExportsOnCommand) {
+  AdcModel adc;
+  float volts = 12.6f;
+  sim::setAnalogInput(A0, adc.rawFromVolts(volts));
+  sim::addTickListener([&](unsigned long nowMs) {
+    sim::setAnalogInput(A0, adc.rawFromVolts(volts));
+  });
+
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  protector.setHistoryLog(true);
+  unsigned long endMs = 10000;
+  while (sim::nowUs() / 1000 < endMs) {
+    protector.update();
+    protector.idle();
+    if (sim::nowUs() / 1000 >= 5000) {
+      volts = 10.85f; // Below the cutoff, above the sampler's fast trip
+    }
+  }
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+
+  // 'h' on Serial streams the log between the status lines
+  sim::setSerialCapture(true);
+  sim::sendSerialInput("h");
+  endMs += 2000;
+  while (sim::nowUs() / 1000 < endMs) {
+    protector.update();
+    protector.idle();
+  }
+  CHECK(!protector.isHistoryExporting());
+  std::string output = sim::takeSerialOutput();
+  std::vector<uint8_t> data(output.begin(), output.end());
+  std::vector<HistoryEntry> entries;
+  CHECK(decodeExport(data, entries));
+
+  bool booted = false;
+  bool cutoff = false;
+  uint32_t cutoffSeconds = 0;
+  uint16_t lastMillivolts = 0;
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (entries[i].kind == HistoryEntry::KIND_EVENT) {
+      booted = booted || entries[i].event == HISTORY_EVENT_BOOT;
+      if (entries[i].event == HISTORY_EVENT_CUTOFF) {
+        cutoff = true;
+        cutoffSeconds = entries[i].seconds;
+      }
+    } else {
+      lastMillivolts = entries[i].millivolts;
+    }
+  }
+  CHECK(booted);
+  CHECK(cutoff);
+  CHECK(cutoffSeconds >= 4 && cutoffSeconds <= 6);
+  CHECK(lastMillivolts > 10750 && lastMillivolts < 10950);
+}
+//////////////////////////////////////////////////////////
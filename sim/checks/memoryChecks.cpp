@@ -0,0 +1,113 @@
+//////////////////////////////////////////////////////////
+// MEMORY CHECKS
+//
+// The protector is composed statically: building it, enabling the
+// history log and telemetry, and running it through a cutoff must not
+// touch the heap. Counted with a replacement operator new for this
+// check binary.
+//////////////////////////////////////////////////////////
+#include <stdlib.h>
+#include <new>
+#include <string>
+#include "Arduino.h"
+#include "adcModel.h"
+#include "bankHardware.h"
+#include "batteryProtector.h"
+#include "check.h"
+#include "checkHelpers.h"
+#include "multiBankProtector.h"
+#include "simHal.h"
+
+namespace {
+
+  unsigned long g_allocations = 0;
+
+}
+
+void* operator new(size_t size) {
+  g_allocations++;
+  void* memory = malloc(size ? size : 1);
+  if (!memory) {
+    throw std::bad_alloc();
+  }
+  return memory;
+}
+
+void operator delete(void* memory) noexcept {
+  free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+  free(memory);
+}
+
+
+//////////////////////////////////////////////////////////
+// PROTECTOR
+//////////////////////////////////////////////////////////
+CHECK_CASE(protectorNeverAllocates) {
+  AdcModel adc;
+  float volts = 12.6f;
+  sim::setAnalogInput(A0, adc.rawFromVolts(volts));
+  sim::addTickListener([&](unsigned long nowMs) {
+    sim::setAnalogInput(A0, adc.rawFromVolts(volts));
+  });
+
+  unsigned long before = g_allocations;
+  {
+    BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+    protector.setHistoryLog(true);
+    protector.setTelemetry(true);
+    runUntil(protector, 5000);
+    volts = 10.85f;
+    runUntil(protector, 10000);
+    CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+  }
+  CHECK_EQ(g_allocations - before, 0);
+}
+
+CHECK_CASE(protectorReportsMemoryOnCommand) {
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  sim::setSerialCapture(true);
+  sim::sendSerialInput("m");
+  runUntil(protector, 500);
+  std::string output = sim::takeSerialOutput();
+  CHECK(output.find("history log") != std::string::npos);
+  CHECK(output.find("total") != std::string::npos);
+}
+
+CHECK_CASE(protectorReportsSketchObjects) {
+  // The sensors main.ino keeps in statics are listed once attached
+  CurrentSensor current(CurrentSensor::CHIP_INA226, 0x40, 1.5f);
+  TemperatureSensor temperature(14);
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  sim::setSerialCapture(true);
+  protector.printMemoryReport(Serial);
+  std::string output = sim::takeSerialOutput();
+  CHECK(output.find("current sensor") == std::string::npos);
+  protector.setCurrentSensor(&current, 100.0f);
+  protector.setTemperatureSensor(&temperature, 18);
+  sim::takeSerialOutput();
+  protector.printMemoryReport(Serial);
+  output = sim::takeSerialOutput();
+  CHECK(output.find("current sensor   " + std::to_string(sizeof(CurrentSensor))) != std::string::npos);
+  CHECK(output.find("temp sensor      " + std::to_string(sizeof(TemperatureSensor))) != std::string::npos);
+}
+
+CHECK_CASE(multiBankReportsMemory) {
+  Ads1x15 adc(0x48);
+  Pcf8574 relays(0x20);
+  const BankConfig banks[] = {
+    { "house", &adc, 0, 0, 0.2f, 11.0f, 12.8f, 60000UL },
+    { "start", &adc, 1, 1, 0.2f, 11.8f, 12.8f, 60000UL }
+  };
+  MultiBankProtector protector(banks, 2, &relays);
+  sim::setSerialCapture(true);
+  protector.printMemoryReport(Serial);
+  std::string output = sim::takeSerialOutput();
+  CHECK(output.find("banks") != std::string::npos);
+  CHECK(output.find("total            " + std::to_string(sizeof(MultiBankProtector))) != std::string::npos);
+  CHECK(output.find("relay expander") != std::string::npos);
+  CHECK(output.find("bank adcs        1 ") != std::string::npos); // Both banks on one ADS1115
+}
+//////////////////////////////////////////////////////////
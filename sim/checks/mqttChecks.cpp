@@ -0,0 +1,463 @@
+//////////////////////////////////////////////////////////
+// MQTT CHECKS
+//
+// FlashSpool on the simulated NOR flash, and MqttPublisher against the
+// broker model on the simulated network: batches that decode with the
+// history tools, buffering through outages (RAM, then flash, across a
+// reboot), recovery from a broker that hangs, and a protector whose
+// cutoff does not wait for any of it.
+//////////////////////////////////////////////////////////
+#include <string.h>
+#include <vector>
+#include "Arduino.h"
+#include "adcModel.h"
+#include "batteryProtector.h"
+#include "check.h"
+#include "flashSpool.h"
+#include "mqttBroker.h"
+#include "mqttPublisher.h"
+#include "simHal.h"
+#include "tcpNet.h"
+
+namespace {
+
+  const uint32_t SPOOL_SECTOR = 0x300; // Inside the filesystem area
+  const uint8_t RELAY_PIN = 12;        // BatteryProtector::PIN_RELAY_CONTROL
+
+  MqttConfig testConfig(uint16_t batchSeconds) {
+    MqttConfig config = MqttPublisher::defaultConfig();
+    config.ssid = "test";
+    config.password = "secret";
+    config.batchSeconds = batchSeconds;
+    return config;
+  }
+
+  uint32_t brokerAddress() {
+    MqttConfig config = MqttPublisher::defaultConfig();
+    return sim::ipAddress(config.brokerAddress[0], config.brokerAddress[1], config.brokerAddress[2], config.brokerAddress[3]);
+  }
+
+  // The mqtt task's rhythm: update() every 100 ms, one sample per
+  // second of elapsed time (a sector erase moves the clock on by itself)
+  // half a second into it, so a batch closed by the last sample has time
+  // to be acknowledged before the call returns; millivolts = 12000 + seconds since start, so gaps and order show
+  void runPublisher(MqttPublisher& publisher, unsigned long ms, uint32_t& seconds) {
+    unsigned long startMs = (unsigned long)(sim::nowUs() / 1000);
+    unsigned long sampledMs = 0;
+    while (sim::nowUs() / 1000 < startMs + ms) {
+      sim::advanceMs(100);
+      if (sim::nowUs() / 1000 - startMs >= sampledMs + 500) {
+        sampledMs += 1000;
+        seconds++;
+        publisher.addSample((uint16_t)(12000 + seconds), 1);
+      }
+      publisher.update(true);
+    }
+  }
+
+  // Entries of one payload; false when it is not a valid batch
+  bool decodeBatch(const std::vector<uint8_t>& payload, HistorySectorHeader& header, std::vector<HistoryEntry>& entries) {
+    if (payload.size() < sizeof(header)) {
+      return false;
+    }
+    memcpy(&header, payload.data(), sizeof(header));
+    if (!HistoryDecoder::isValidHeader(header)) {
+      return false;
+    }
+    HistoryDecoder decoder;
+    decoder.begin(header);
+    HistoryEntry entry;
+    for (size_t i = sizeof(header); i < payload.size(); i++) {
+      if (decoder.feed(payload[i], entry)) {
+        entries.push_back(entry);
+      }
+    }
+    return decoder.isBetweenEntries();
+  }
+
+  // Sample millivolts of every message in arrival order, repeats of a
+  // batch (at-least-once delivery) left out; false on a bad payload
+  bool receivedSamples(const MqttBrokerModel& broker, std::vector<uint16_t>& samples) {
+    std::vector<std::vector<uint8_t> > seen;
+    for (size_t i = 0; i < broker.getMessages().size(); i++) {
+      const std::vector<uint8_t>& payload = broker.getMessages()[i].payload;
+      bool isRepeat = false;
+      for (size_t j = 0; j < seen.size(); j++) {
+        isRepeat = isRepeat || seen[j] == payload;
+      }
+      if (isRepeat) {
+        continue;
+      }
+      seen.push_back(payload);
+      HistorySectorHeader header;
+      std::vector<HistoryEntry> entries;
+      if (!decodeBatch(payload, header, entries)) {
+        return false;
+      }
+      for (size_t j = 0; j < entries.size(); j++) {
+        if (entries[j].kind == HistoryEntry::KIND_SAMPLE) {
+          samples.push_back(entries[j].millivolts);
+        }
+      }
+    }
+    return true;
+  }
+
+  // Every sample from first to last, once and in order
+  bool isContiguous(const std::vector<uint16_t>& samples, uint16_t first, uint16_t last) {
+    if (samples.size() != (size_t)(last - first + 1)) {
+      return false;
+    }
+    for (size_t i = 0; i < samples.size(); i++) {
+      if (samples[i] != first + i) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+}
+
+
+//////////////////////////////////////////////////////////
+// FLASH SPOOL
+//////////////////////////////////////////////////////////
+CHECK_CASE(spoolKeepsRecordsAcrossReboot) {
+  {
+    FlashSpool spool;
+    CHECK(spool.begin(SPOOL_SECTOR, 4));
+    for (uint8_t i = 0; i < 5; i++) {
+      uint8_t record[40];
+      memset(record, i, sizeof(record));
+      CHECK(spool.append(record, (uint16_t)(10 + i), false));
+    }
+    uint8_t data[FlashSpool::MAX_RECORD_BYTES];
+    CHECK_EQ(spool.peek(data, sizeof(data)), 10);
+    spool.remove();
+    CHECK_EQ(spool.getPendingCount(), 4);
+  }
+
+  sim::reboot();
+  FlashSpool spool;
+  CHECK(spool.begin(SPOOL_SECTOR, 4));
+  CHECK_EQ(spool.getPendingCount(), 4);
+  uint8_t data[FlashSpool::MAX_RECORD_BYTES];
+  for (uint8_t i = 1; i < 5; i++) {
+    CHECK_EQ(spool.peek(data, sizeof(data)), 10 + i);
+    CHECK_EQ(data[0], i);
+    spool.remove();
+  }
+  CHECK_EQ(spool.peek(data, sizeof(data)), 0);
+  CHECK_EQ(spool.getDroppedCount(), 0);
+
+  // Appends go on after the records already there
+  uint8_t record[3] = { 7, 8, 9 };
+  CHECK(spool.append(record, sizeof(record), false));
+  CHECK_EQ(spool.peek(data, sizeof(data)), 3);
+  CHECK_EQ(data[2], 9);
+}
+
+CHECK_CASE(spoolDropsOldestWhenFull) {
+  FlashSpool spool;
+  CHECK(spool.begin(SPOOL_SECTOR, 3));
+  // ~60 records per sector: five sectors' worth through a ring of three
+  uint32_t written = 0;
+  for (uint32_t i = 0; i < 300; i++) {
+    uint8_t record[56];
+    memset(record, 0, sizeof(record));
+    memcpy(record, &i, sizeof(i));
+    if (!spool.append(record, sizeof(record), false)) {
+      break; // No erase allowed: the spool says so instead of stalling
+    }
+    written++;
+  }
+  CHECK(written < 300);
+  CHECK_EQ(sim::getFlashEraseCount(SPOOL_SECTOR), 0);
+
+  for (uint32_t i = written; i < 300; i++) {
+    uint8_t record[56];
+    memset(record, 0, sizeof(record));
+    memcpy(record, &i, sizeof(i));
+    CHECK(spool.append(record, sizeof(record), true));
+  }
+  CHECK(spool.getDroppedCount() > 0);
+  CHECK_EQ(spool.getPendingCount() + spool.getDroppedCount(), 300);
+
+  // The newest records survived, oldest first
+  uint8_t data[FlashSpool::MAX_RECORD_BYTES];
+  uint32_t expected = (uint32_t)spool.getDroppedCount();
+  while (spool.peek(data, sizeof(data)) > 0) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    CHECK_EQ(value, expected);
+    expected++;
+    spool.remove();
+  }
+  CHECK_EQ(expected, 300);
+  CHECK_EQ(sim::getFlashEraseCount(SPOOL_SECTOR + 3), 0);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// PUBLISHER
+//////////////////////////////////////////////////////////
+CHECK_CASE(mqttPublishesDecodableBatches) {
+  MqttBrokerModel broker(brokerAddress());
+  MqttPublisher publisher;
+  MqttConfig config = testConfig(10);
+  publisher.begin(config, SPOOL_SECTOR, 4);
+  uint32_t seconds = 0;
+  runPublisher(publisher, 1000, seconds);
+  CHECK(!publisher.isConnected()); // Still associating
+
+  runPublisher(publisher, 39000, seconds);
+  CHECK(publisher.isConnected());
+  CHECK_EQ(broker.getConnectCount(), 1);
+  CHECK_EQ(broker.getKeepAliveSeconds(), 120);
+  CHECK_EQ(broker.getProtocolErrors(), 0);
+  CHECK_EQ(broker.getMessages().size(), 4);
+  CHECK_EQ(publisher.getPublishedBatches(), 4);
+  CHECK_EQ(publisher.getQueuedBatches(), 0);
+
+  for (size_t i = 0; i < broker.getMessages().size(); i++) {
+    const MqttBrokerModel::Message& message = broker.getMessages()[i];
+    CHECK(message.topic == config.topic);
+    CHECK(message.clientId == config.clientId);
+    CHECK_EQ(message.qos, 1);
+    CHECK(message.payload.size() < 40); // Ten samples of a slow ramp
+    HistorySectorHeader header;
+    std::vector<HistoryEntry> entries;
+    CHECK(decodeBatch(message.payload, header, entries));
+    CHECK_EQ(header.sequence, i);
+    CHECK_EQ(entries.size(), 10);
+    if (entries.size() == 10) {
+      CHECK_EQ(entries[0].seconds, i * 10 + 1);
+      CHECK_EQ(entries[9].millivolts, 12000 + i * 10 + 10);
+    }
+  }
+
+  // An event goes out at once, with the samples before it
+  publisher.addEvent(HISTORY_EVENT_CUTOFF);
+  unsigned long eventMs = (unsigned long)(sim::nowUs() / 1000);
+  runPublisher(publisher, 1000, seconds);
+  CHECK_EQ(broker.getMessages().size(), 5);
+  if (broker.getMessages().size() == 5) {
+    CHECK(broker.getMessages()[4].atMs - eventMs <= 200);
+    HistorySectorHeader header;
+    std::vector<HistoryEntry> entries;
+    CHECK(decodeBatch(broker.getMessages()[4].payload, header, entries));
+    CHECK(!entries.empty() && entries.back().kind == HistoryEntry::KIND_EVENT);
+    CHECK(!entries.empty() && entries.back().event == HISTORY_EVENT_CUTOFF);
+  }
+}
+
+CHECK_CASE(mqttPingsWhileIdle) {
+  MqttBrokerModel broker(brokerAddress());
+  MqttPublisher publisher;
+  MqttConfig config = testConfig(600); // Nothing to publish for ten minutes
+  config.keepAliveSeconds = 20;
+  publisher.begin(config, SPOOL_SECTOR, 4);
+  uint32_t seconds = 0;
+  runPublisher(publisher, 100000, seconds);
+  CHECK(publisher.isConnected());
+  CHECK_EQ(broker.getConnectCount(), 1);
+  CHECK(broker.getPingCount() >= 5);
+  CHECK(broker.getMessages().empty());
+}
+
+CHECK_CASE(mqttBuffersWhileOfflineAndDrainsInOrder) {
+  MqttBrokerModel broker(brokerAddress());
+  MqttPublisher publisher;
+  publisher.begin(testConfig(10), SPOOL_SECTOR, 4);
+  uint32_t seconds = 0;
+
+  // No access point for the first minute
+  sim::setAccessPoint(false);
+  runPublisher(publisher, 60000, seconds);
+  CHECK(!publisher.isConnected());
+  CHECK_EQ(publisher.getQueuedBatches(), 6);
+  CHECK(broker.getMessages().empty());
+  sim::setAccessPoint(true);
+  runPublisher(publisher, 20000, seconds);
+  CHECK_EQ(publisher.getQueuedBatches(), 0);
+  CHECK_EQ(broker.getMessages().size(), 8);
+
+  // The path past the access point fails while connected: segments are
+  // lost without a word, the missing PUBACK gives it away
+  sim::setLinkUp(false);
+  runPublisher(publisher, 60000, seconds);
+  CHECK(!publisher.isConnected());
+  CHECK(publisher.getClient().getDropCount() >= 1);
+  sim::setLinkUp(true);
+  runPublisher(publisher, 90000, seconds); // Up to a minute of back-off
+  CHECK(publisher.isConnected());
+  CHECK(broker.getConnectCount() >= 2);
+  CHECK_EQ(publisher.getQueuedBatches(), 0);
+  CHECK_EQ(publisher.getDroppedBatches(), 0);
+
+  std::vector<uint16_t> samples;
+  CHECK(receivedSamples(broker, samples));
+  CHECK(isContiguous(samples, 12001, 12000 + 230));
+  CHECK_EQ(broker.getProtocolErrors(), 0);
+}
+
+CHECK_CASE(mqttSpillsToFlashAndSurvivesReboot) {
+  MqttBrokerModel broker(brokerAddress());
+  sim::setAccessPoint(false);
+  uint32_t seconds = 0;
+  {
+    MqttPublisher publisher;
+    publisher.begin(testConfig(10), SPOOL_SECTOR, 16);
+    // ~30 bytes per batch: the RAM queue fills in under an hour
+    runPublisher(publisher, 2UL * 3600UL * 1000UL, seconds);
+    uint32_t closed = seconds / 10;
+    CHECK(publisher.getSpooledBatches() > 0);
+    CHECK(publisher.getQueuedBatches() > 0);
+    CHECK_EQ(publisher.getDroppedBatches(), 0);
+    CHECK_EQ(publisher.getSpooledBatches() + publisher.getQueuedBatches(), closed);
+    publisher.sync(); // As before a deep sleep: the open batch goes too
+    CHECK_EQ(publisher.getQueuedBatches(), 0);
+    CHECK_EQ(publisher.getSpooledBatches(), (seconds + 9) / 10);
+  }
+  uint32_t spooled = (seconds + 9) / 10;
+
+  // Spooled batches come back after the reboot and go out first
+  sim::reboot();
+  sim::setAccessPoint(true);
+  MqttPublisher publisher;
+  publisher.begin(testConfig(10), SPOOL_SECTOR, 16);
+  CHECK_EQ(publisher.getSpooledBatches(), spooled);
+  uint32_t after = seconds;
+  runPublisher(publisher, 300000, after);
+  uint32_t closedAfter = (after - seconds) / 10;
+  CHECK_EQ(publisher.getSpooledBatches(), 0);
+  CHECK_EQ(publisher.getQueuedBatches(), 0);
+  CHECK_EQ(publisher.getPublishedBatches(), spooled + closedAfter);
+  CHECK_EQ(publisher.getDroppedBatches(), 0);
+
+  std::vector<uint16_t> samples;
+  CHECK(receivedSamples(broker, samples));
+  CHECK(isContiguous(samples, 12001, (uint16_t)(12000 + seconds + closedAfter * 10)));
+}
+
+CHECK_CASE(mqttReconnectsAfterBrokerHangs) {
+  MqttBrokerModel broker(brokerAddress());
+  MqttPublisher publisher;
+  publisher.begin(testConfig(10), SPOOL_SECTOR, 4);
+  uint32_t seconds = 0;
+  runPublisher(publisher, 15000, seconds);
+  CHECK_EQ(broker.getMessages().size(), 1);
+
+  // Reads but answers nothing: PUBACK, then CONNACK time out
+  broker.setResponding(false);
+  runPublisher(publisher, 40000, seconds);
+  CHECK(!publisher.isConnected());
+  CHECK(publisher.getClient().getDropCount() >= 2);
+  CHECK(publisher.getQueuedBatches() >= 4);
+
+  broker.setResponding(true);
+  runPublisher(publisher, 60000, seconds);
+  CHECK(publisher.isConnected());
+  CHECK_EQ(publisher.getQueuedBatches(), 0);
+  CHECK(publisher.getClient().getConnectCount() >= 2);
+
+  // The unacknowledged batch was sent again: at least once, not lost
+  std::vector<uint16_t> samples;
+  CHECK(receivedSamples(broker, samples));
+  CHECK(isContiguous(samples, 12001, 12000 + 110));
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// PROTECTOR
+//////////////////////////////////////////////////////////
+CHECK_CASE(mqttProtectorCutsOffOnTimeWhileOffline) {
+  // Broker unreachable the whole time: the cutoff is as quick as without
+  // MQTT, and the event waits in the queue
+  MqttBrokerModel broker(brokerAddress());
+  sim::setLinkUp(false);
+  AdcModel adc;
+  sim::setAnalogInput(A0, adc.rawFromVolts(12.5f));
+  unsigned long openedMs = 0;
+  sim::setWriteObserver([&](uint8_t pin, uint8_t val, unsigned long nowMs) {
+    if (pin == RELAY_PIN && val == HIGH && nowMs > 0 && openedMs == 0) {
+      openedMs = nowMs;
+    }
+  });
+
+  MqttPublisher publisher;
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  protector.setMqttPublisher(&publisher, testConfig(10));
+  CHECK(sim::isRadioOn());
+  while (sim::nowUs() / 1000 < 30000) {
+    protector.update();
+    protector.idle();
+  }
+  CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+  CHECK(!publisher.isConnected());
+
+  sim::setAnalogInput(A0, adc.rawFromVolts(10.5f));
+  unsigned long dropMs = (unsigned long)(sim::nowUs() / 1000);
+  while (sim::nowUs() / 1000 < dropMs + 2000) {
+    protector.update();
+    protector.idle();
+  }
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+  CHECK(openedMs > dropMs);
+  CHECK(openedMs - dropMs <= 400);
+  CHECK(broker.getMessages().empty());
+  CHECK(publisher.getQueuedBatches() >= 3); // Boot event, a batch, the fast trip
+
+  // Back online: the events arrive in order
+  sim::setLinkUp(true);
+  while (sim::nowUs() / 1000 < dropMs + 90000) {
+    protector.update();
+    protector.idle();
+  }
+  std::vector<uint8_t> events;
+  for (size_t i = 0; i < broker.getMessages().size(); i++) {
+    HistorySectorHeader header;
+    std::vector<HistoryEntry> entries;
+    CHECK(decodeBatch(broker.getMessages()[i].payload, header, entries));
+    for (size_t j = 0; j < entries.size(); j++) {
+      if (entries[j].kind == HistoryEntry::KIND_EVENT) {
+        events.push_back(entries[j].event);
+      }
+    }
+  }
+  CHECK(events.size() >= 2);
+  if (events.size() >= 2) {
+    CHECK_EQ(events[0], HISTORY_EVENT_BOOT);
+    CHECK(events[1] == HISTORY_EVENT_FAST_TRIP || events[1] == HISTORY_EVENT_CUTOFF);
+  }
+}
+
+CHECK_CASE(mqttProtectorPublishesCutoffPromptly) {
+  MqttBrokerModel broker(brokerAddress());
+  AdcModel adc;
+  sim::setAnalogInput(A0, adc.rawFromVolts(12.5f));
+  MqttPublisher publisher;
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  protector.setMqttPublisher(&publisher, testConfig(60));
+  while (sim::nowUs() / 1000 < 10000) {
+    protector.update();
+    protector.idle();
+  }
+  CHECK(publisher.isConnected());
+  size_t before = broker.getMessages().size();
+
+  sim::setAnalogInput(A0, adc.rawFromVolts(10.5f));
+  unsigned long dropMs = (unsigned long)(sim::nowUs() / 1000);
+  while (sim::nowUs() / 1000 < dropMs + 2000) {
+    protector.update();
+    protector.idle();
+  }
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+  CHECK(broker.getMessages().size() > before);
+  if (broker.getMessages().size() > before) {
+    CHECK(broker.getMessages()[before].atMs - dropMs <= 1000);
+  }
+}
+//////////////////////////////////////////////////////////
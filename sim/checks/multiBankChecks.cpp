@@ -0,0 +1,224 @@
+//////////////////////////////////////////////////////////
+// MULTI-BANK CHECKS
+//
+// MultiBankProtector on the simulated board: banks read through the
+// ADS1115 model, relays on the PCF8574 model, and each bank's battery
+// sags when its own relay connects the load.
+//////////////////////////////////////////////////////////
+#include "Arduino.h"
+#include "bankDevices.h"
+#include "check.h"
+#include "checkHelpers.h"
+#include "multiBankProtector.h"
+#include "pinMock.h"
+#include "simHal.h"
+
+namespace {
+
+  const float DIVIDER_RATIO = 0.2f; // 100k/25k: 16.5 V full scale at 3.3 V
+
+  // One battery per bank on consecutive ADS1115 inputs and expander bits
+  struct BankBoard {
+    Ads1115Model adc;
+    Pcf8574Model expander;
+    Ads1x15 driver;
+    float restVolts[4] = { 12.6f, 12.6f, 12.6f, 12.6f };
+    float loadedVolts[4] = { 12.4f, 12.4f, 12.4f, 12.4f };
+    unsigned long openings[4] = { 0, 0, 0, 0 };
+    unsigned long lastOpenMs[4] = { 0, 0, 0, 0 };
+    int tickListener;
+
+    BankBoard() : adc(0x48), expander(0x20), driver(0x48) {
+      expander.setChangeObserver([this](uint8_t oldPort, uint8_t newPort) {
+        for (uint8_t i = 0; i < 4; i++) {
+          uint8_t mask = 1 << i;
+          if (!(oldPort & mask) && (newPort & mask)) {
+            openings[i]++;
+            lastOpenMs[i] = (unsigned long)(sim::nowUs() / 1000);
+          }
+        }
+        refresh();
+      });
+      refresh();
+      tickListener = sim::addTickListener([this](unsigned long nowMs) { refresh(); });
+    }
+
+    ~BankBoard() {
+      sim::removeTickListener(tickListener);
+    }
+
+    bool isClosed(uint8_t bank) { return !(expander.getPort() & (1 << bank)); }
+
+    void refresh() {
+      for (uint8_t i = 0; i < 4; i++) {
+        adc.setInputVolts(i, (isClosed(i) ? loadedVolts[i] : restVolts[i]) * DIVIDER_RATIO);
+      }
+    }
+
+    // Bank configs for the first count inputs: cutoff 11.0 V, rearm 12.8 V
+    void configure(BankConfig* configs, uint8_t count) {
+      static const char* names[4] = { "house", "start", "aux1", "aux2" };
+      for (uint8_t i = 0; i < count; i++) {
+        BankConfig config = { names[i], &driver, i, i, DIVIDER_RATIO, 11.0f, 12.8f, 3000UL };
+        configs[i] = config;
+      }
+    }
+  };
+
+}
+
+
+//////////////////////////////////////////////////////////
+// PER-BANK CUTOFF AND REARM
+//////////////////////////////////////////////////////////
+CHECK_CASE(banksCutOffIndependently) {
+  BankBoard board;
+  BankConfig configs[2];
+  board.configure(configs, 2);
+  Pcf8574 relays(0x20);
+  MultiBankProtector protector(configs, 2, &relays);
+  CHECK(board.isClosed(0));
+  CHECK(board.isClosed(1));
+
+  // The starter bank sags slowly below its cutoff, the house bank holds
+  runUntil(protector, 1000);
+  board.loadedVolts[1] = 10.9f;
+  runUntil(protector, 2000);
+  CHECK(protector.getState(0) == MultiBankProtector::STATE_ARMED);
+  CHECK(protector.getState(1) == MultiBankProtector::STATE_CUTOFF);
+  CHECK(board.isClosed(0));
+  CHECK(!board.isClosed(1));
+  CHECK_EQ(board.openings[0], 0);
+  CHECK_EQ(board.openings[1], 1);
+  // Filtered path: about ten readings of the bank, 10 ms apart
+  CHECK(board.lastOpenMs[1] - 1000 <= 200);
+}
+
+CHECK_CASE(bankRearmsOnItsOwn) {
+  BankBoard board;
+  board.restVolts[1] = 10.5f;
+  board.loadedVolts[1] = 10.3f;
+  BankConfig configs[2];
+  board.configure(configs, 2);
+  Pcf8574 relays(0x20);
+  MultiBankProtector protector(configs, 2, &relays);
+  CHECK(protector.getState(1) == MultiBankProtector::STATE_CUTOFF);
+  CHECK(!board.isClosed(1));
+
+  // Charged: countdown, trial under load, armed; bank 0 never blinks
+  runUntil(protector, 1000);
+  board.restVolts[1] = 13.2f;
+  board.loadedVolts[1] = 12.5f;
+  runUntil(protector, 3500);
+  CHECK(protector.getState(1) == MultiBankProtector::STATE_CUTOFF);
+  runUntil(protector, 5000);
+  CHECK(protector.getState(1) == MultiBankProtector::STATE_ARMED);
+  CHECK(board.isClosed(1));
+  CHECK(board.isClosed(0));
+  CHECK_EQ(board.openings[0], 0);
+}
+
+CHECK_CASE(bankRearmFailsUnderLoad) {
+  BankBoard board;
+  board.restVolts[0] = 13.2f;
+  board.loadedVolts[0] = 10.8f;
+  BankConfig configs[1];
+  board.configure(configs, 1);
+  Pcf8574 relays(0x20);
+  MultiBankProtector protector(configs, 1, &relays);
+
+  runUntil(protector, 1000);
+  CHECK(protector.getState(0) == MultiBankProtector::STATE_CUTOFF);
+  unsigned long openings = board.openings[0];
+
+  // The trial closing sags below the cutoff and is opened again
+  runUntil(protector, 5000);
+  CHECK(protector.getState(0) == MultiBankProtector::STATE_CUTOFF);
+  CHECK(!board.isClosed(0));
+  CHECK_EQ(board.openings[0], openings + 1);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// LATENCY AND FAULTS
+//////////////////////////////////////////////////////////
+CHECK_CASE(hardDropTripsWithinWorstCase) {
+  BankBoard board;
+  BankConfig configs[4];
+  board.configure(configs, 4);
+  Pcf8574 relays(0x20);
+  MultiBankProtector protector(configs, 4, &relays);
+  CHECK_EQ(protector.getWorstCaseTripMs(), 45);
+
+  // Every bank in turn, at a few phases of the round robin
+  unsigned long atMs = 500;
+  for (uint8_t bank = 0; bank < 4; bank++) {
+    for (uint8_t phase = 0; phase < 5; phase++) {
+      atMs += 1000 + phase * 3;
+      runUntil(protector, atMs);
+      board.loadedVolts[bank] = 9.0f;
+      board.refresh();
+      runUntil(protector, atMs + 100);
+      CHECK(protector.getState(bank) == MultiBankProtector::STATE_CUTOFF);
+      CHECK(board.lastOpenMs[bank] - atMs <= protector.getWorstCaseTripMs());
+      board.loadedVolts[bank] = 12.4f;
+      protector.rearm(bank);
+      atMs += 100;
+    }
+  }
+  CHECK_EQ(board.openings[0] + board.openings[1] + board.openings[2] + board.openings[3], 20);
+}
+
+CHECK_CASE(silentAdcOpensTheRelay) {
+  // No ADS1115 on the bus: the boot reading fails, the relay stays open
+  Pcf8574Model expander(0x20);
+  Ads1x15 missing(0x48);
+  BankConfig configs[1] = { { "house", &missing, 0, 0, DIVIDER_RATIO, 11.0f, 12.8f, 3000UL } };
+  Pcf8574 relays(0x20);
+  MultiBankProtector protector(configs, 1, &relays);
+  CHECK(protector.getState(0) == MultiBankProtector::STATE_CUTOFF);
+  CHECK(expander.getPort() & 1);
+  runUntil(protector, 5000);
+  CHECK(protector.getState(0) == MultiBankProtector::STATE_CUTOFF);
+  CHECK(expander.getPort() & 1);
+}
+
+CHECK_CASE(adcLossAfterArmingCutsOff) {
+  BankBoard board;
+  BankConfig configs[1];
+  board.configure(configs, 1);
+  Pcf8574 relays(0x20);
+  MultiBankProtector protector(configs, 1, &relays);
+  runUntil(protector, 500);
+  CHECK(board.isClosed(0));
+
+  // Unplug the ADC; keep the expander answering
+  sim::detachI2cDevice(0x48);
+  runUntil(protector, 600);
+  CHECK(protector.getState(0) == MultiBankProtector::STATE_CUTOFF);
+  CHECK(!board.isClosed(0));
+}
+
+CHECK_CASE(analogMuxSelectsAndScales) {
+  PinMock adcPin(A0);
+  PinMock select0(12);
+  PinMock select1(15);
+  PinMock select2(16);
+  AnalogMux mux(&adcPin, &select0, &select1, &select2);
+  CHECK_EQ(select0.getMode(), OUTPUT);
+
+  CHECK(mux.startConversion(5));
+  CHECK_EQ(select0.getOutputLevel(), HIGH);
+  CHECK_EQ(select1.getOutputLevel(), LOW);
+  CHECK_EQ(select2.getOutputLevel(), HIGH);
+
+  adcPin.setAnalogValue(1023);
+  uint16_t millivolts = 0;
+  CHECK(mux.readMillivolts(millivolts));
+  CHECK_EQ(millivolts, 3300);
+  adcPin.setAnalogValue(512);
+  CHECK(mux.readMillivolts(millivolts));
+  CHECK_EQ(millivolts, 1652);
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,119 @@
+//////////////////////////////////////////////////////////
+// PIN CHECKS
+//
+// FastPin against the simulated GPIO registers, and the templated
+// Relay, LED and Switch on either kind of pin: the virtual Pin (mocks)
+// and the compile-time FastPin give the same behaviour.
+//////////////////////////////////////////////////////////
+#include <vector>
+#include "Arduino.h"
+#include "basicHardware.h"
+#include "check.h"
+#include "pinMock.h"
+#include "simHal.h"
+
+namespace {
+
+  struct Write {
+    uint8_t pin;
+    uint8_t level;
+  };
+
+}
+
+
+//////////////////////////////////////////////////////////
+// FAST PIN
+//////////////////////////////////////////////////////////
+CHECK_CASE(fastPinWritesOnlyItsOwnBit) {
+  std::vector<Write> writes;
+  sim::setWriteObserver([&](uint8_t pin, uint8_t val, unsigned long nowMs) {
+    writes.push_back({ pin, val });
+  });
+  FastPin<12> relayPin;
+  FastPin<14> ledPin;
+  relayPin.setPinMode(OUTPUT);
+  ledPin.setPinMode(OUTPUT);
+  CHECK_EQ(sim::getPinMode(12), OUTPUT);
+
+  relayPin.doDigitalWrite(HIGH);
+  ledPin.doDigitalWrite(HIGH);
+  relayPin.doDigitalWrite(LOW);
+  CHECK_EQ(sim::getDigitalOutput(12), LOW);
+  CHECK_EQ(sim::getDigitalOutput(14), HIGH);
+  CHECK_EQ(writes.size(), 3);
+  if (writes.size() == 3) {
+    CHECK_EQ(writes[2].pin, 12);
+    CHECK_EQ(writes[2].level, LOW);
+  }
+  CHECK_EQ(relayPin.doDigitalRead(), LOW); // Outputs read back their level
+  CHECK_EQ(ledPin.doDigitalRead(), HIGH);
+  CHECK_EQ(ledPin.getPinAddress(), 14);
+}
+
+CHECK_CASE(fastPinReadsInputsAndRaisesEdges) {
+  FastPin<0> buttonPin;
+  buttonPin.setPinMode(INPUT_PULLUP);
+  sim::setDigitalInput(0, HIGH);
+  CHECK_EQ(buttonPin.doDigitalRead(), HIGH);
+  sim::setDigitalInput(0, LOW);
+  CHECK_EQ(buttonPin.doDigitalRead(), LOW);
+
+  int edges = 0;
+  CHECK(buttonPin.attachEdgeInterrupt([](void* arg) { (*(int*)arg)++; }, &edges));
+  sim::setDigitalInput(0, HIGH);
+  sim::setDigitalInput(0, LOW);
+  CHECK_EQ(edges, 2);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// COMPONENTS ON EITHER PIN
+//////////////////////////////////////////////////////////
+CHECK_CASE(relayAndLEDDriveBothPinKinds) {
+  PinMock mockPin(12);
+  Relay mockRelay(&mockPin);
+  FastPin<12> fastPin;
+  RelayT<FastPin<12> > fastRelay(&fastPin);
+  CHECK_EQ(mockPin.getOutputLevel(), HIGH); // Both start open
+  CHECK_EQ(sim::getDigitalOutput(12), HIGH);
+  mockRelay.turnOn();
+  fastRelay.turnOn();
+  CHECK_EQ(mockPin.getOutputLevel(), LOW);
+  CHECK_EQ(sim::getDigitalOutput(12), LOW);
+
+  PinMock mockLEDPin(14);
+  LED mockLED(&mockLEDPin);
+  FastPin<14> fastLEDPin;
+  LEDT<FastPin<14> > fastLED(&fastLEDPin);
+  mockLED.blink(100);
+  fastLED.blink(100);
+  for (int i = 0; i < 3; i++) {
+    sim::advanceMs(100);
+    mockLED.update();
+    fastLED.update();
+    CHECK_EQ(sim::getDigitalOutput(14), mockLEDPin.getOutputLevel());
+  }
+  CHECK_EQ(mockLEDPin.getWriteCount(), 4); // off() in the constructor, then three blinks
+}
+
+CHECK_CASE(switchOnFastPinReportsPress) {
+  sim::setDigitalInput(0, HIGH);
+  FastPin<0> pin;
+  SwitchT<FastPin<0> > button(&pin, 50, 1500);
+  CHECK(button.isInterruptDriven());
+  sim::setDigitalInput(0, LOW);
+  for (int i = 0; i < 20; i++) {
+    sim::advanceMs(10);
+    button.update();
+  }
+  CHECK(button.isPressed());
+  sim::setDigitalInput(0, HIGH);
+  for (int i = 0; i < 20; i++) {
+    sim::advanceMs(10);
+    button.update();
+  }
+  CHECK(button.takeEvent() == Switch::EVENT_SHORT_PRESS);
+}
+//////////////////////////////////////////////////////////
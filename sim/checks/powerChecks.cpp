@@ -0,0 +1,116 @@
+//////////////////////////////////////////////////////////
+// POWER CHECKS
+//
+// RTC user memory blocks kept across deep sleep, and SystemClock
+// keeping real time through light sleep.
+//////////////////////////////////////////////////////////
+#include "Arduino.h"
+#include "Esp.h"
+#include "check.h"
+#include "powerManager.h"
+#include "simHal.h"
+#include "systemClock.h"
+
+namespace {
+
+  const uint8_t OFFSET = PowerManager::RTC_FIRST_FREE_WORD;
+
+  struct Saved {
+    uint32_t counter;
+    uint16_t flags;
+    uint8_t state;
+  };
+
+}
+
+
+//////////////////////////////////////////////////////////
+// RTC MEMORY
+//////////////////////////////////////////////////////////
+CHECK_CASE(rtcBlockRoundTripsAcrossDeepSleep) {
+  PowerManager power;
+  Saved saved = { 123456, 0xBEEF, 7 };
+  CHECK(power.saveRtc(OFFSET, &saved, sizeof(saved)));
+
+  sim::DeepSleepReset request;
+  request.sleepUs = 5000000ULL;
+  sim::completeDeepSleep(request);
+  PowerManager woken;
+  CHECK(woken.wokeFromDeepSleep());
+  Saved loaded = { 0, 0, 0 };
+  CHECK(woken.loadRtc(OFFSET, &loaded, sizeof(loaded)));
+  CHECK_EQ(loaded.counter, 123456);
+  CHECK_EQ(loaded.flags, 0xBEEF);
+  CHECK_EQ(loaded.state, 7);
+}
+
+CHECK_CASE(rtcBlockRejectsGarbageAndCorruption) {
+  PowerManager power;
+  Saved loaded;
+  // Power-on RTC memory holds garbage: no valid block
+  CHECK(!power.loadRtc(OFFSET, &loaded, sizeof(loaded)));
+
+  Saved saved = { 42, 1, 2 };
+  CHECK(power.saveRtc(OFFSET, &saved, sizeof(saved)));
+  CHECK(power.loadRtc(OFFSET, &loaded, sizeof(loaded)));
+
+  // One flipped data bit fails the CRC
+  uint32_t word = 0;
+  CHECK(ESP.rtcUserMemoryRead(OFFSET + 3, &word, sizeof(word)));
+  word ^= 0x00000100UL;
+  CHECK(ESP.rtcUserMemoryWrite(OFFSET + 3, &word, sizeof(word)));
+  CHECK(!power.loadRtc(OFFSET, &loaded, sizeof(loaded)));
+
+  // A block of another size is not mistaken for this one
+  CHECK(power.saveRtc(OFFSET, &saved, sizeof(saved)));
+  uint8_t shorter[4];
+  CHECK(!power.loadRtc(OFFSET, shorter, sizeof(shorter)));
+}
+
+CHECK_CASE(rtcBlockStaysOutOfCoreReservedWords) {
+  PowerManager power;
+  Saved saved = { 1, 2, 3 };
+  // Words 0..31 carry the core's OTA command
+  CHECK(!power.saveRtc(0, &saved, sizeof(saved)));
+  CHECK(!power.saveRtc(OFFSET - 1, &saved, sizeof(saved)));
+  CHECK(!power.loadRtc(0, &saved, sizeof(saved)));
+  CHECK(power.saveRtc(OFFSET, &saved, sizeof(saved)));
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// SYSTEM CLOCK
+//////////////////////////////////////////////////////////
+CHECK_CASE(systemClockCarriesSubMillisecondCredit) {
+  unsigned long startMs = SystemClock::millis();
+  unsigned long startUs = SystemClock::micros();
+  SystemClock::creditSleep(600);
+  CHECK_EQ(SystemClock::millis() - startMs, 0);
+  CHECK_EQ(SystemClock::micros() - startUs, 600);
+  SystemClock::creditSleep(600); // Remainders add up to a whole millisecond
+  CHECK_EQ(SystemClock::millis() - startMs, 1);
+  CHECK_EQ(SystemClock::micros() - startUs, 1200);
+  SystemClock::creditSleep(2500000);
+  CHECK_EQ(SystemClock::millis() - startMs, 2501);
+  CHECK_EQ(SystemClock::getTotalSleptUs(), 2501200);
+}
+
+CHECK_CASE(systemClockFollowsWallTimeThroughLightSleep) {
+  PowerManager power;
+  power.begin();
+  power.setLowPower(true);
+  unsigned long startMs = SystemClock::millis();
+  uint64_t startWallUs = sim::nowUs();
+  for (int i = 0; i < 50; i++) {
+    power.idle(100, true);
+  }
+  // millis() stood still while asleep; SystemClock got the time credited
+  unsigned long elapsedMs = SystemClock::millis() - startMs;
+  unsigned long wallMs = (unsigned long)((sim::nowUs() - startWallUs) / 1000);
+  CHECK(SystemClock::getTotalSleptUs() > 4000000ULL);
+  CHECK(::millis() - startMs < 1000);
+  CHECK(elapsedMs + 1 >= wallMs && elapsedMs <= wallMs + 1);
+  CHECK(sim::getPowerStats().lightSleepUs > 4000000ULL);
+}
+//////////////////////////////////////////////////////////
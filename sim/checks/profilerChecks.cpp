@@ -0,0 +1,114 @@
+//////////////////////////////////////////////////////////
+// PROFILER CHECKS
+//
+// Log2 buckets and overrun counting of the stage profiler, and the
+// protector's per-stage profile on the simulated board, where only bus,
+// flash and UART time shows up in the cycle counter.
+//////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <string>
+#include "Arduino.h"
+#include "adcModel.h"
+#include "batteryProtector.h"
+#include "check.h"
+#include "checkHelpers.h"
+#include "profiler.h"
+#include "simHal.h"
+
+namespace {
+
+  // runs, mean and max of one row of the printed profile; false when missing
+  bool profileRow(const std::string& output, const char* stage, unsigned long& runs, unsigned long& meanUs, unsigned long& maxUs) {
+    std::string prefix = std::string("\n") + stage + " ";
+    size_t at = output.find(prefix);
+    if (at == std::string::npos) {
+      return false;
+    }
+    return sscanf(output.c_str() + at + prefix.size(), " %lu %lu %lu", &runs, &meanUs, &maxUs) == 3;
+  }
+
+}
+
+
+//////////////////////////////////////////////////////////
+// STAGE PROFILER
+//////////////////////////////////////////////////////////
+CHECK_CASE(profilerBucketsByPowerOfTwo) {
+  CHECK_EQ(StageProfiler::bucketFor(0), 0);
+  CHECK_EQ(StageProfiler::bucketFor(127), 0);
+  CHECK_EQ(StageProfiler::bucketFor(128), 1);
+  CHECK_EQ(StageProfiler::bucketFor(255), 1);
+  CHECK_EQ(StageProfiler::bucketFor(256), 2);
+  CHECK_EQ(StageProfiler::bucketFor(80000), 10); // 1 ms at 80 MHz: 2^16 to 2^17
+  CHECK_EQ(StageProfiler::bucketFor(0xFFFFFFFFUL), StageProfiler::BUCKET_COUNT - 1);
+
+  StageProfiler profiler;
+  profiler.setLoopBudget(400000); // 5 ms
+  profiler.add(StageProfiler::STAGE_LOOP, 100);
+  profiler.add(StageProfiler::STAGE_LOOP, 80000);
+  profiler.add(StageProfiler::STAGE_LOOP, 500000);
+  profiler.add(StageProfiler::STAGE_DISPLAY, 500000); // Not the loop: no overrun
+  const StageProfiler::StageStats& loop = profiler.getStats(StageProfiler::STAGE_LOOP);
+  CHECK_EQ(loop.runs, 3);
+  CHECK_EQ(loop.maxCycles, 500000);
+  CHECK_EQ(loop.totalCycles, 580100);
+  CHECK_EQ(loop.buckets[0], 1);
+  CHECK_EQ(loop.buckets[10], 1);
+  CHECK_EQ(loop.buckets[12], 1);
+  CHECK_EQ(profiler.getOverruns(), 1);
+
+  profiler.reset();
+  CHECK_EQ(profiler.getStats(StageProfiler::STAGE_LOOP).runs, 0);
+  CHECK_EQ(profiler.getOverruns(), 0);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// PROTECTOR PROFILE
+//////////////////////////////////////////////////////////
+CHECK_CASE(protectorProfilesStagesOnCommand) {
+  AdcModel adc;
+  sim::setAnalogInput(A0, adc.rawFromVolts(12.6f));
+  sim::addTickListener([&adc](unsigned long nowMs) {
+    sim::setAnalogInput(A0, adc.rawFromVolts(nowMs < 5000 ? 12.6f : 10.5f));
+  });
+  sim::setSerialCapture(true);
+  Display lcd(0x27, 16, 2);
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, &lcd);
+  runUntil(protector, 8000);
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+  sim::takeSerialOutput();
+
+  sim::sendSerialInput("p");
+  runUntil(protector, 8100);
+  std::string output = sim::takeSerialOutput();
+  unsigned long runs, meanUs, maxUs;
+  CHECK(profileRow(output, "adc", runs, meanUs, maxUs));
+  CHECK(runs >= 8000 / 5 - 10);
+  CHECK(profileRow(output, "button", runs, meanUs, maxUs));
+  CHECK(runs >= 8000 / 10 - 10);
+  CHECK(profileRow(output, "buzzer", runs, meanUs, maxUs));
+  CHECK(runs > 0);
+
+  // I2C at 100 kHz: a display refresh costs milliseconds of bus time
+  CHECK(profileRow(output, "display", runs, meanUs, maxUs));
+  CHECK(runs >= 8000 / 50 - 5);
+  CHECK(maxUs > 1000);
+
+  // One cutoff; the loop is at least as long as its longest stage
+  unsigned long cutoffRuns, cutoffMeanUs, cutoffMaxUs;
+  CHECK(profileRow(output, "cutoff", cutoffRuns, cutoffMeanUs, cutoffMaxUs));
+  CHECK_EQ(cutoffRuns, 1);
+  unsigned long loopRuns, loopMeanUs, loopMaxUs;
+  CHECK(profileRow(output, "loop", loopRuns, loopMeanUs, loopMaxUs));
+  CHECK(loopMaxUs >= maxUs);
+  CHECK(output.find("Loop overruns: ") != std::string::npos);
+  CHECK(output.find(" over 5000us") != std::string::npos);
+
+  protector.resetProfile();
+  protector.printProfile(Serial);
+  CHECK(profileRow(sim::takeSerialOutput(), "adc", runs, meanUs, maxUs));
+  CHECK_EQ(runs, 0);
+}
+//////////////////////////////////////////////////////////
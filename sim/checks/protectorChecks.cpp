@@ -0,0 +1,225 @@
+//////////////////////////////////////////////////////////
+// PROTECTOR CHECKS
+//
+// BatteryProtector end to end on the simulated board: a battery model
+// drives A0 from the relay state, and the loop from main.ino runs on the
+// virtual clock.
+//////////////////////////////////////////////////////////
+#include "Arduino.h"
+#include "adcModel.h"
+#include "batteryProtector.h"
+#include "check.h"
+#include "checkHelpers.h"
+#include "i2cBus.h"
+#include "simHal.h"
+#include "LiquidCrystal_I2C.h"
+
+namespace {
+
+  const uint8_t RELAY_PIN = 12; // BatteryProtector::PIN_RELAY_CONTROL
+  const uint8_t BUZZER_PIN = 13;
+
+  // Battery with a resting voltage and a (lower) voltage while the relay
+  // connects the load; optional dip for a time window, repeated every
+  // dipPeriodMs when that is set
+  struct BatteryModel {
+    AdcModel adc;
+    float restVolts = 12.6f;
+    float loadedVolts = 12.6f;
+    float dipVolts = 0.0f;
+    unsigned long dipStartMs = 0;
+    unsigned long dipEndMs = 0;
+    unsigned long dipPeriodMs = 0;
+
+    bool inDip(unsigned long nowMs) {
+      if (nowMs < dipStartMs) {
+        return false;
+      }
+      if (dipPeriodMs == 0) {
+        return nowMs < dipEndMs;
+      }
+      return (nowMs - dipStartMs) % dipPeriodMs < dipEndMs - dipStartMs;
+    }
+
+    float volts(unsigned long nowMs) {
+      if (inDip(nowMs)) {
+        return dipVolts;
+      }
+      bool loadConnected = sim::getPinMode(RELAY_PIN) == OUTPUT && sim::getDigitalOutput(RELAY_PIN) == LOW;
+      return loadConnected ? loadedVolts : restVolts;
+    }
+
+    void attach() {
+      sim::setAnalogInput(A0, adc.rawFromVolts(volts(0)));
+      sim::addTickListener([this](unsigned long nowMs) {
+        sim::setAnalogInput(A0, adc.rawFromVolts(volts(nowMs)));
+      });
+    }
+  };
+
+  // Relay edges and buzzer alarms seen on the pins, with their wall time
+  struct BoardLog {
+    unsigned long openings = 0;
+    unsigned long closings = 0;
+    unsigned long lastOpenMs = 0;
+    unsigned long lastCloseMs = 0;
+    unsigned long alarms = 0;
+    bool buzzing = false;
+
+    void attach() {
+      sim::setWriteObserver([this](uint8_t pin, uint8_t val, unsigned long nowMs) {
+        if (pin != RELAY_PIN) {
+          return;
+        }
+        if (val == HIGH) {
+          openings++;
+          lastOpenMs = nowMs;
+        } else {
+          closings++;
+          lastCloseMs = nowMs;
+        }
+      });
+      sim::addTickListener([this](unsigned long nowMs) {
+        bool tone = sim::getToneFrequency(BUZZER_PIN) != 0;
+        if (tone && !buzzing) {
+          alarms++;
+        }
+        buzzing = tone;
+      });
+    }
+  };
+
+}
+
+
+//////////////////////////////////////////////////////////
+// REARM UNDER LOAD
+//////////////////////////////////////////////////////////
+CHECK_CASE(rearmFailsWhenLoadSagsBelowCutoff) {
+  // Rests well above the rearm threshold, sags below cutoff under load
+  BatteryModel battery;
+  battery.restVolts = 13.5f;
+  battery.loadedVolts = 10.9f;
+  battery.attach();
+  BoardLog board;
+  board.attach();
+
+  BatteryProtector protector(11.0f, 12.8f, 6000UL, nullptr);
+  runUntil(protector, 3000);
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+  CHECK_EQ(board.alarms, 1);
+  unsigned long firstCutoffMs = board.lastOpenMs;
+
+  // Countdown expires, the trial closing is judged under load and fails
+  // silently: no "Rearm successful" followed by a cutoff alarm
+  runUntil(protector, 12000);
+  CHECK_EQ(board.closings, 2); // Boot arming plus the trial
+  CHECK(board.lastCloseMs > firstCutoffMs);
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+  CHECK_EQ(sim::getDigitalOutput(RELAY_PIN), HIGH);
+  CHECK_EQ(board.alarms, 1);
+  // The trial ends within the settle time plus one filtered reading
+  CHECK(board.lastOpenMs - board.lastCloseMs <= 200);
+}
+
+CHECK_CASE(rearmSucceedsWhenLoadedVoltageHolds) {
+  BatteryModel battery;
+  battery.restVolts = 13.5f;
+  battery.loadedVolts = 10.9f;
+  battery.attach();
+  BoardLog board;
+  board.attach();
+
+  BatteryProtector protector(11.0f, 12.8f, 6000UL, nullptr);
+  runUntil(protector, 3000);
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+
+  battery.loadedVolts = 12.2f; // Charger took over
+  runUntil(protector, 12000);
+  CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+  CHECK_EQ(sim::getDigitalOutput(RELAY_PIN), LOW);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// LOW POWER MODE
+//////////////////////////////////////////////////////////
+CHECK_CASE(lowPowerIgnoresShortDips) {
+  // 3 ms dips far below the trip level; the period drifts 1 ms against
+  // the 100 ms sample bursts, so every burst phase gets hit once
+  BatteryModel battery;
+  battery.dipVolts = 10.0f;
+  battery.dipStartMs = 2000;
+  battery.dipEndMs = 2003;
+  battery.dipPeriodMs = 201;
+  battery.attach();
+  BoardLog board;
+  board.attach();
+
+  BatteryProtector protector(11.0f, 12.8f, 6000UL, nullptr);
+  protector.setLowPowerMode(true);
+  unsigned long bootOpenings = board.openings; // Relay starts open until armed
+  runUntil(protector, 24000);
+  CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+  CHECK_EQ(board.openings, bootOpenings);
+  CHECK_EQ(board.alarms, 0);
+  // Dips switch to full rate only briefly: still mostly light sleep
+  sim::PowerStats power = sim::getPowerStats();
+  CHECK(power.lightSleepUs > 2 * power.awakeUs);
+}
+
+CHECK_CASE(lowPowerCutsOffPromptlyJustBelowThreshold) {
+  // Step to just below the cutoff, above the fast-trip level: the filter
+  // decides, at full rate once the first low burst is seen
+  BatteryModel battery;
+  battery.dipVolts = 10.8f;
+  battery.dipStartMs = 3000;
+  battery.dipEndMs = 60000;
+  battery.attach();
+  BoardLog board;
+  board.attach();
+
+  BatteryProtector protector(11.0f, 12.8f, 6000UL, nullptr);
+  protector.setLowPowerMode(true);
+  runUntil(protector, 6000);
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+  CHECK(board.lastOpenMs > 3000);
+  CHECK(board.lastOpenMs - 3000 <= 800);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FAST BOOT
+//////////////////////////////////////////////////////////
+CHECK_CASE(bootDecidesRelayBeforePeripherals) {
+  // setup() from main.ino: the protector first, then Serial and Wire; a
+  // battery above the cutoff closes the relay before any I2C traffic
+  BatteryModel battery;
+  battery.restVolts = 12.6f;
+  battery.loadedVolts = 12.5f;
+  battery.attach();
+  BoardLog board;
+  board.attach();
+  sim::setSerialCapture(true);
+  sim::resetI2cStats();
+
+  Display lcd(0x27, 16, 2);
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, &lcd);
+  CHECK_EQ(board.closings, 1);
+  CHECK(board.lastCloseMs <= 1);
+  CHECK(protector.getBootDecisionUs() < 1000);
+  CHECK_EQ(sim::getI2cStats().transactions, 0);
+  CHECK_EQ(sim::takeSerialOutput().size(), 0); // Nothing printed before Serial.begin()
+
+  // The report and the LCD follow from the tasks
+  runUntil(protector, 1000);
+  std::string output = sim::takeSerialOutput();
+  CHECK(output.find("Boot: relay decided") != std::string::npos);
+  CHECK(output.find("Battery Protector ready!") != std::string::npos);
+  const Hd44780Model* model = static_cast<const Hd44780Model*>(sim::findI2cDevice(0x27));
+  CHECK(model->getDataCount() > 0);
+  CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+}
+//////////////////////////////////////////////////////////
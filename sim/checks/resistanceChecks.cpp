@@ -0,0 +1,164 @@
+//////////////////////////////////////////////////////////
+// RESISTANCE CHECKS
+//
+// ResistanceEstimator arithmetic, and BatteryProtector learning the
+// internal resistance from its own relay steps on a battery model with
+// a resting voltage, a resistance and a load current.
+//////////////////////////////////////////////////////////
+#include "Arduino.h"
+#include "adcModel.h"
+#include "batteryProtector.h"
+#include "check.h"
+#include "checkHelpers.h"
+#include "resistanceEstimator.h"
+#include "simHal.h"
+
+namespace {
+
+  const uint8_t RELAY_PIN = 12; // BatteryProtector::PIN_RELAY_CONTROL
+
+  // Terminal voltage = resting voltage - I x R while the relay connects the load
+  struct ResistiveBattery {
+    AdcModel adc;
+    float restVolts = 12.4f;
+    float ohms = 0.05f;
+    float loadAmps = 10.0f;
+    unsigned long openings = 0;
+
+    float volts() {
+      bool loadConnected = sim::getPinMode(RELAY_PIN) == OUTPUT && sim::getDigitalOutput(RELAY_PIN) == LOW;
+      return loadConnected ? restVolts - loadAmps * ohms : restVolts;
+    }
+
+    void attach() {
+      sim::setAnalogInput(A0, adc.rawFromVolts(volts()));
+      sim::addTickListener([this](unsigned long nowMs) {
+        sim::setAnalogInput(A0, adc.rawFromVolts(volts()));
+      });
+      sim::setWriteObserver([this](uint8_t pin, uint8_t val, unsigned long nowMs) {
+        if (pin == RELAY_PIN && val == HIGH) {
+          openings++;
+        }
+        sim::setAnalogInput(A0, adc.rawFromVolts(volts()));
+      });
+    }
+  };
+
+}
+
+
+//////////////////////////////////////////////////////////
+// ESTIMATOR
+//////////////////////////////////////////////////////////
+CHECK_CASE(resistanceFromOneStep) {
+  ResistanceEstimator estimator;
+  CHECK(!estimator.hasEstimate());
+  CHECK_EQ(estimator.getSagMillivolts(10000), 0);
+
+  // 0.5 V across a 10 A step: 50 mOhm
+  CHECK(estimator.addStep(12400, 11900, 10000));
+  CHECK_EQ(estimator.getMilliohms(), 50);
+  CHECK_EQ(estimator.getSagMillivolts(10000), 500);
+  CHECK_EQ(estimator.getSagMillivolts(4000), 200);
+  CHECK_EQ(estimator.compensate(11000, 10000), 11500);
+}
+
+CHECK_CASE(resistanceAveragesSteps) {
+  ResistanceEstimator estimator;
+  CHECK(estimator.addStep(12400, 11900, 10000)); // 50 mOhm
+  CHECK(estimator.addStep(12400, 11500, 10000)); // 90 mOhm, weight 1/4
+  CHECK_EQ(estimator.getMilliohms(), 60);
+  CHECK_EQ(estimator.getStepCount(), 2);
+}
+
+CHECK_CASE(resistanceRejectsImplausibleSteps) {
+  ResistanceEstimator estimator;
+  CHECK(!estimator.addStep(12400, 12600, 10000)); // Voltage rose with the load: charger
+  CHECK(!estimator.addStep(12400, 11900, 50));    // Current step too small
+  CHECK(!estimator.addStep(12400, 6000, 10000));  // 640 mOhm: a loose terminal, not the battery
+  CHECK(!estimator.hasEstimate());
+  CHECK_EQ(estimator.getRejectedCount(), 3);
+
+  // The sag is capped however large the current
+  CHECK(estimator.addStep(12400, 11900, 10000));
+  CHECK_EQ(estimator.getSagMillivolts(60000), ResistanceEstimator::MAX_SAG_MILLIVOLTS);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// PROTECTOR
+//////////////////////////////////////////////////////////
+CHECK_CASE(protectorLearnsResistanceFromBootClosing) {
+  ResistiveBattery battery;
+  battery.attach();
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  protector.setNominalLoadCurrent(10.0f);
+  runUntil(protector, 1000);
+  CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+  CHECK(protector.getInternalResistanceMilliohms() >= 45);
+  CHECK(protector.getInternalResistanceMilliohms() <= 55);
+
+  // Without a nominal current there is nothing to estimate
+  sim::reset();
+  SystemClock::reset();
+  ResistiveBattery other;
+  other.attach();
+  BatteryProtector uncalibrated(11.0f, 12.8f, 60000UL, nullptr);
+  runUntil(uncalibrated, 1000);
+  CHECK_EQ(uncalibrated.getInternalResistanceMilliohms(), 0);
+}
+
+CHECK_CASE(compensatedCutoffRidesThroughHeavyDraw) {
+  // 12.0 V at rest, 11.5 V at the nominal 10 A; a 2 s draw of 25 A
+  // pulls the terminals to 10.75 V, below the cutoff
+  for (int compensated = 0; compensated < 2; compensated++) {
+    sim::reset();
+    SystemClock::reset();
+    ResistiveBattery battery;
+    battery.restVolts = 12.0f;
+    battery.attach();
+    BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+    protector.setNominalLoadCurrent(10.0f);
+    if (compensated) {
+      protector.setCutoffInput(BatteryProtector::CUTOFF_INPUT_COMPENSATED);
+    }
+    runUntil(protector, 1000);
+    CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+    battery.openings = 0; // The relay starts open at power-on
+
+    battery.loadAmps = 25.0f;
+    runUntil(protector, 3000);
+    battery.loadAmps = 10.0f;
+    runUntil(protector, 4000);
+    if (compensated) {
+      CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+      CHECK_EQ(battery.openings, 0);
+    } else {
+      CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+    }
+  }
+}
+
+CHECK_CASE(compensatedCutoffStillCatchesDischarge) {
+  ResistiveBattery battery;
+  battery.restVolts = 12.0f;
+  battery.attach();
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  protector.setNominalLoadCurrent(10.0f);
+  protector.setCutoffInput(BatteryProtector::CUTOFF_INPUT_COMPENSATED);
+  runUntil(protector, 1000);
+
+  // Resting voltage sinks below the cutoff: 10.9 V open circuit,
+  // 10.4 V at the terminals
+  battery.restVolts = 10.9f;
+  runUntil(protector, 2000);
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+  CHECK(protector.getCompensatedMillivolts() < 11000);
+
+  // The cutoff's own step refines the estimate
+  runUntil(protector, 3000);
+  CHECK(protector.getInternalResistanceMilliohms() >= 45);
+  CHECK(protector.getInternalResistanceMilliohms() <= 55);
+}
+//////////////////////////////////////////////////////////
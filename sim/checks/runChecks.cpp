@@ -0,0 +1,75 @@
+//////////////////////////////////////////////////////////
+// CHECK RUNNER
+//
+//   runChecks [filter]   run every case whose name contains filter
+//
+// Exit status is non-zero when any case failed.
+//////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "Arduino.h"
+#include "check.h"
+#include "simHal.h"
+#include "systemClock.h"
+
+namespace {
+
+  struct Case {
+    const char* name;
+    check::CaseFunction function;
+  };
+
+  std::vector<Case>& cases() {
+    static std::vector<Case> registered; // Filled by static initializers in every check file
+    return registered;
+  }
+
+  unsigned long g_failures = 0;
+
+}
+
+namespace check {
+
+  Registration :: Registration(const char* name, CaseFunction function) {
+    Case entry;
+    entry.name = name;
+    entry.function = function;
+    cases().push_back(entry);
+  }
+
+  void fail(const char* file, int line, const char* expression) {
+    printf("  %s:%d: CHECK(%s) failed\n", file, line, expression);
+    g_failures++;
+  }
+
+  void failEqual(const char* file, int line, const char* expression, long long actual, long long expected) {
+    printf("  %s:%d: CHECK_EQ(%s) failed: got %lld, expected %lld\n", file, line, expression, actual, expected);
+    g_failures++;
+  }
+
+}
+
+int main(int argc, char** argv) {
+  const char* filter = argc > 1 ? argv[1] : nullptr;
+  unsigned long run = 0;
+  unsigned long failedCases = 0;
+  for (size_t i = 0; i < cases().size(); i++) {
+    const Case& entry = cases()[i];
+    if (filter && !strstr(entry.name, filter)) {
+      continue;
+    }
+    sim::reset();
+    SystemClock::reset();
+    unsigned long failuresBefore = g_failures;
+    entry.function();
+    bool passed = g_failures == failuresBefore;
+    printf("%s %s\n", passed ? "PASS" : "FAIL", entry.name);
+    run++;
+    if (!passed) {
+      failedCases++;
+    }
+  }
+  printf("\n%lu checks, %lu failed\n", run, failedCases);
+  return failedCases == 0 ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+//////////////////////////////////////////////////////////
+// SWITCH CHECKS
+//
+// Test button gestures: debounce, short and long presses, transitions
+// that fall between two update() calls and edges the interrupt missed.
+//////////////////////////////////////////////////////////
+#include "Arduino.h"
+#include "basicHardware.h"
+#include "check.h"
+#include "pinMock.h"
+#include "simHal.h"
+
+namespace {
+
+  const uint8_t BUTTON_PIN = 0; // BatteryProtector::PIN_TEST_BUTTON
+  const unsigned long DEBOUNCE_MS = 50;
+  const unsigned long LONG_PRESS_MS = 1500;
+  const unsigned long UPDATE_PERIOD_MS = 10; // BatteryProtector::STATE_PERIOD_MS
+
+  // Pin whose interrupt delivery the check controls, to lose edges on purpose
+  class LossyPin : public PinMock {
+    public:
+      LossyPin() : PinMock(BUTTON_PIN), _handler(nullptr), _arg(nullptr) {}
+
+      bool attachEdgeInterrupt(void (*handler)(void*), void* arg) {
+        _handler = handler;
+        _arg = arg;
+        return true;
+      }
+
+      void setLevel(uint8_t level, bool deliverInterrupt) {
+        setInputLevel(level);
+        if (deliverInterrupt && _handler) {
+          _handler(_arg);
+        }
+      }
+
+    private:
+      void (*_handler)(void*);
+      void* _arg;
+  };
+
+  // update() at the state task period for ms milliseconds
+  void runFor(Switch& button, unsigned long ms) {
+    for (unsigned long elapsed = 0; elapsed < ms; elapsed += UPDATE_PERIOD_MS) {
+      sim::advanceMs(UPDATE_PERIOD_MS);
+      button.update();
+    }
+  }
+
+  // Contact bounce: a few fast toggles that settle on level
+  void bounceTo(uint8_t level) {
+    uint8_t other = level == LOW ? HIGH : LOW;
+    for (int i = 0; i < 3; i++) {
+      sim::setDigitalInput(BUTTON_PIN, level);
+      sim::advanceMs(1);
+      sim::setDigitalInput(BUTTON_PIN, other);
+      sim::advanceMs(1);
+    }
+    sim::setDigitalInput(BUTTON_PIN, level);
+  }
+
+}
+
+
+//////////////////////////////////////////////////////////
+// GESTURES
+//////////////////////////////////////////////////////////
+CHECK_CASE(switchReportsBouncyShortPress) {
+  sim::setDigitalInput(BUTTON_PIN, HIGH);
+  PinNative pin(BUTTON_PIN);
+  Switch button(&pin, DEBOUNCE_MS, LONG_PRESS_MS);
+  CHECK(button.isInterruptDriven());
+
+  bounceTo(LOW);
+  runFor(button, 200);
+  CHECK(button.isPressed());
+  CHECK(button.takeEvent() == Switch::EVENT_NONE);
+
+  bounceTo(HIGH);
+  runFor(button, 200);
+  CHECK(!button.isPressed());
+  CHECK(button.takeEvent() == Switch::EVENT_SHORT_PRESS);
+  CHECK(button.takeEvent() == Switch::EVENT_NONE);
+}
+
+CHECK_CASE(switchReportsLongPressWhileHeld) {
+  sim::setDigitalInput(BUTTON_PIN, HIGH);
+  PinNative pin(BUTTON_PIN);
+  Switch button(&pin, DEBOUNCE_MS, LONG_PRESS_MS);
+
+  bounceTo(LOW);
+  runFor(button, LONG_PRESS_MS - 100);
+  CHECK(button.takeEvent() == Switch::EVENT_NONE);
+  runFor(button, 200);
+  CHECK(button.takeEvent() == Switch::EVENT_LONG_PRESS);
+
+  // No short press on the release that ends a long press
+  bounceTo(HIGH);
+  runFor(button, 200);
+  CHECK(button.takeEvent() == Switch::EVENT_NONE);
+}
+
+CHECK_CASE(switchIgnoresGlitchShorterThanDebounce) {
+  sim::setDigitalInput(BUTTON_PIN, HIGH);
+  PinNative pin(BUTTON_PIN);
+  Switch button(&pin, DEBOUNCE_MS, LONG_PRESS_MS);
+
+  sim::setDigitalInput(BUTTON_PIN, LOW);
+  sim::advanceMs(3);
+  sim::setDigitalInput(BUTTON_PIN, HIGH);
+  runFor(button, 200);
+  CHECK(!button.isPressed());
+  CHECK(button.takeEvent() == Switch::EVENT_NONE);
+}
+
+CHECK_CASE(switchReportsWholePressBetweenUpdates) {
+  sim::setDigitalInput(BUTTON_PIN, HIGH);
+  PinNative pin(BUTTON_PIN);
+  Switch button(&pin, DEBOUNCE_MS, LONG_PRESS_MS);
+
+  // Updates stalled (low power task periods): press and release unseen
+  bounceTo(LOW);
+  sim::advanceMs(80);
+  bounceTo(HIGH);
+  sim::advanceMs(100);
+  button.update();
+  CHECK(!button.isPressed());
+  CHECK(button.takeEvent() == Switch::EVENT_SHORT_PRESS);
+}
+
+CHECK_CASE(switchReportsReleaseAndPressBetweenUpdates) {
+  sim::setDigitalInput(BUTTON_PIN, HIGH);
+  PinNative pin(BUTTON_PIN);
+  Switch button(&pin, DEBOUNCE_MS, LONG_PRESS_MS);
+
+  bounceTo(LOW);
+  runFor(button, 200);
+  CHECK(button.isPressed());
+
+  // Release and press again before the next update: the first press
+  // ended short, the second one is still held
+  bounceTo(HIGH);
+  sim::advanceMs(80);
+  bounceTo(LOW);
+  sim::advanceMs(100);
+  button.update();
+  CHECK(button.isPressed());
+  CHECK(button.takeEvent() == Switch::EVENT_SHORT_PRESS);
+  CHECK(button.takeEvent() == Switch::EVENT_NONE);
+
+  // The second press is timed from its own edge
+  runFor(button, LONG_PRESS_MS);
+  CHECK(button.takeEvent() == Switch::EVENT_LONG_PRESS);
+}
+
+CHECK_CASE(switchRecoversFromLostEdge) {
+  LossyPin pin;
+  pin.setLevel(HIGH, false);
+  Switch button(&pin, DEBOUNCE_MS, LONG_PRESS_MS);
+  CHECK(button.isInterruptDriven());
+
+  // Press delivered, release lost: the level alone ends the press
+  pin.setLevel(LOW, true);
+  runFor(button, 200);
+  CHECK(button.isPressed());
+  pin.setLevel(HIGH, false);
+  runFor(button, 200);
+  CHECK(!button.isPressed());
+  CHECK(button.takeEvent() == Switch::EVENT_SHORT_PRESS);
+
+  // Press lost entirely: still seen after the debounce time
+  pin.setLevel(LOW, false);
+  runFor(button, DEBOUNCE_MS - UPDATE_PERIOD_MS);
+  CHECK(!button.isPressed());
+  runFor(button, 2 * UPDATE_PERIOD_MS);
+  CHECK(button.isPressed());
+  pin.setLevel(HIGH, true);
+  runFor(button, 200);
+  CHECK(button.takeEvent() == Switch::EVENT_SHORT_PRESS);
+}
+
+CHECK_CASE(switchPollsPinsWithoutInterrupt) {
+  PinMock pin(BUTTON_PIN);
+  pin.setInputLevel(HIGH);
+  Switch button(&pin, DEBOUNCE_MS, LONG_PRESS_MS);
+  CHECK(!button.isInterruptDriven());
+
+  pin.setInputLevel(LOW);
+  runFor(button, 200);
+  CHECK(button.isPressed());
+  pin.setInputLevel(HIGH);
+  runFor(button, 200);
+  CHECK(button.takeEvent() == Switch::EVENT_SHORT_PRESS);
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,195 @@
+//////////////////////////////////////////////////////////
+// TELEMETRY CHECKS
+//
+// COBS framing, the non-blocking TX queue against the simulated UART
+// FIFO, and the protector's records in a Serial capture.
+//////////////////////////////////////////////////////////
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "adcModel.h"
+#include "batteryProtector.h"
+#include "check.h"
+#include "historyLog.h"
+#include "simHal.h"
+#include "telemetry.h"
+
+namespace {
+
+  // Records that pass their CRC, in order; text between frames is skipped
+  std::vector<std::vector<uint8_t> > decodeFrames(const std::string& capture) {
+    std::vector<std::vector<uint8_t> > records;
+    size_t start = 0;
+    for (size_t i = 0; i <= capture.size(); i++) {
+      if (i < capture.size() && capture[i] != 0) {
+        continue;
+      }
+      size_t length = i - start;
+      if (length > 0 && length <= Telemetry::MAX_FRAME_BYTES) {
+        uint8_t record[Telemetry::MAX_FRAME_BYTES];
+        size_t recordLength = Telemetry::cobsDecode((const uint8_t*)capture.data() + start, length, record);
+        if (recordLength >= 4 &&
+            HistoryLog::crc16(record, recordLength - 2) == (record[recordLength - 2] | (record[recordLength - 1] << 8))) {
+          records.push_back(std::vector<uint8_t>(record, record + recordLength - 2));
+        }
+      }
+      start = i + 1;
+    }
+    return records;
+  }
+
+  // Pump at the telemetry task period until the queue is empty
+  void pumpAll(Telemetry& telemetry) {
+    while (telemetry.getQueued() > 0) {
+      telemetry.pump(Serial);
+      sim::advanceMs(10);
+    }
+  }
+
+}
+
+
+//////////////////////////////////////////////////////////
+// FRAMING
+//////////////////////////////////////////////////////////
+CHECK_CASE(cobsRoundTripsZerosAndLongRuns) {
+  std::vector<uint8_t> data;
+  data.push_back(0);
+  for (int i = 0; i < 300; i++) {
+    data.push_back((uint8_t)(i % 255 + 1)); // Longer than one COBS block
+  }
+  data.push_back(0);
+  data.push_back(0);
+  data.push_back(7);
+
+  std::vector<uint8_t> encoded(data.size() + data.size() / 254 + 1);
+  size_t encodedLength = Telemetry::cobsEncode(data.data(), data.size(), encoded.data());
+  CHECK(encodedLength <= encoded.size());
+  bool hasZero = false;
+  for (size_t i = 0; i < encodedLength; i++) {
+    hasZero = hasZero || encoded[i] == 0;
+  }
+  CHECK(!hasZero);
+
+  std::vector<uint8_t> decoded(data.size());
+  CHECK_EQ(Telemetry::cobsDecode(encoded.data(), encodedLength, decoded.data()), data.size());
+  CHECK(decoded == data);
+
+  // A delimiter inside a frame is malformed
+  encoded[3] = 0;
+  CHECK_EQ(Telemetry::cobsDecode(encoded.data(), encodedLength, decoded.data()), 0);
+}
+
+CHECK_CASE(telemetryRecordsHaveFixedLayout) {
+  Telemetry telemetry;
+  sim::setSerialCapture(true);
+  telemetry.sendSample(0x01020304UL, 12600, 12, 0, TELEMETRY_FLAG_LOW_POWER);
+  telemetry.sendEvent(5000, HISTORY_EVENT_CUTOFF, 10990);
+  pumpAll(telemetry);
+
+  std::vector<std::vector<uint8_t> > records = decodeFrames(sim::takeSerialOutput());
+  CHECK_EQ(records.size(), 2);
+  if (records.size() != 2) {
+    return;
+  }
+  const uint8_t sample[] = { TELEMETRY_SAMPLE, 0, 0x04, 0x03, 0x02, 0x01, 0x38, 0x31, 12, 0, 0, TELEMETRY_FLAG_LOW_POWER };
+  CHECK(records[0] == std::vector<uint8_t>(sample, sample + sizeof(sample)));
+  const uint8_t event[] = { TELEMETRY_EVENT, 1, 0x88, 0x13, 0, 0, HISTORY_EVENT_CUTOFF, 0xEE, 0x2A };
+  CHECK(records[1] == std::vector<uint8_t>(event, event + sizeof(event)));
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// TX QUEUE
+//////////////////////////////////////////////////////////
+CHECK_CASE(serialWritesStallOnFullFifo) {
+  // The problem the queue solves: 600 bytes straight to Serial at
+  // 115200 baud wait for ~470 bytes to drain (~40 ms)
+  std::string line(600, 'x');
+  Serial.print(line.c_str());
+  CHECK(sim::getSerialStallUs() > 35000);
+  CHECK(sim::getSerialStallUs() < 45000);
+}
+
+CHECK_CASE(telemetryQueueNeverBlocks) {
+  Telemetry telemetry;
+  sim::setSerialCapture(true);
+  std::string line(600, 'x');
+  telemetry.print(line.c_str());
+  for (int i = 0; i < 20; i++) {
+    telemetry.sendSample(i * 100, 12600, 5, 0, 0);
+  }
+  pumpAll(telemetry);
+  CHECK_EQ(sim::getSerialStallUs(), 0);
+  CHECK_EQ(telemetry.getDroppedFrames(), 0);
+  CHECK_EQ(telemetry.getDroppedTextBytes(), 0);
+  std::string capture = sim::takeSerialOutput();
+  CHECK_EQ(capture.compare(0, line.size(), line), 0);
+  CHECK_EQ(decodeFrames(capture).size(), 20);
+}
+
+CHECK_CASE(telemetryDropsWholeFramesWhenFull) {
+  Telemetry telemetry;
+  sim::setSerialCapture(true);
+  std::string text(Telemetry::QUEUE_SIZE - 10, 't');
+  telemetry.print(text.c_str());
+  telemetry.sendEvent(1, HISTORY_EVENT_BOOT, 12600);  // Does not fit: dropped
+  CHECK_EQ(telemetry.getDroppedFrames(), 1);
+  CHECK_EQ(telemetry.getQueued(), Telemetry::QUEUE_SIZE - 10);
+  telemetry.print("0123456789abc"); // Text is cut at the queue end
+  CHECK_EQ(telemetry.getDroppedTextBytes(), 3);
+
+  pumpAll(telemetry);
+  telemetry.sendEvent(2, HISTORY_EVENT_CUTOFF, 10900);
+  pumpAll(telemetry);
+  std::vector<std::vector<uint8_t> > records = decodeFrames(sim::takeSerialOutput());
+  CHECK_EQ(records.size(), 1);
+  if (records.size() == 1) {
+    CHECK_EQ(records[0][1], 1); // Sequence gap shows the lost frame
+  }
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// PROTECTOR
+//////////////////////////////////////////////////////////
+CHECK_CASE(protectorStreamsRecordsWithoutStalling) {
+  AdcModel adc;
+  float volts = 12.6f;
+  sim::setAnalogInput(A0, adc.rawFromVolts(volts));
+  sim::addTickListener([&](unsigned long nowMs) {
+    sim::setAnalogInput(A0, adc.rawFromVolts(volts));
+  });
+
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  protector.setTelemetry(true);
+  uint64_t bootStallUs = sim::getSerialStallUs();
+  sim::setSerialCapture(true);
+  while (sim::nowUs() / 1000 < 10000) {
+    protector.update();
+    protector.idle();
+    if (sim::nowUs() / 1000 >= 5000) {
+      volts = 10.85f;
+    }
+  }
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+  CHECK_EQ(sim::getSerialStallUs(), bootStallUs);
+
+  std::string capture = sim::takeSerialOutput();
+  CHECK(capture.find("CUTOFF: Battery voltage") != std::string::npos); // Text log still there
+  std::vector<std::vector<uint8_t> > records = decodeFrames(capture);
+  unsigned long samples = 0;
+  bool cutoff = false;
+  for (size_t i = 0; i < records.size(); i++) {
+    if (records[i][0] == TELEMETRY_SAMPLE) {
+      samples++;
+    } else if (records[i][0] == TELEMETRY_EVENT && records[i][6] == HISTORY_EVENT_CUTOFF) {
+      cutoff = true;
+    }
+  }
+  CHECK(cutoff);
+  CHECK(samples >= 95 && samples <= 101); // One per 100 ms
+}
+//////////////////////////////////////////////////////////
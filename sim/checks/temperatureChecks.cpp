@@ -0,0 +1,239 @@
+//////////////////////////////////////////////////////////
+// TEMPERATURE CHECKS
+//
+// The DS18B20 driver rejecting bad scratchpads and never waiting out a
+// conversion, and the protector moving its thresholds with the battery
+// temperature, only when it has moved, and back when the sensor is gone.
+//////////////////////////////////////////////////////////
+#include <string>
+#include "Arduino.h"
+#include "adcModel.h"
+#include "batteryProtector.h"
+#include "check.h"
+#include "checkHelpers.h"
+#include "mqttPublisher.h"
+#include "oneWireBus.h"
+#include "sensorDevices.h"
+#include "simHal.h"
+
+namespace {
+
+  const uint8_t PIN_SENSOR = 14;
+
+  unsigned long cutoffMillivolts(BatteryProtector& protector) {
+    return (unsigned long)(protector.getVoltageCutoffThreshold() * 1000.0f + 0.5f);
+  }
+
+}
+
+
+//////////////////////////////////////////////////////////
+// DS18B20 DRIVER
+//////////////////////////////////////////////////////////
+CHECK_CASE(temperatureSensorConvertsWithoutBlocking) {
+  Ds18b20Model model(PIN_SENSOR);
+  model.setCelsius(-10.5f);
+  TemperatureSensor sensor(PIN_SENSOR);
+  sim::resetOneWireStats();
+  uint64_t startUs = sim::nowUs();
+  CHECK(sensor.startConversion());
+  // Reset and two bytes: a couple of milliseconds, not the 750 ms conversion
+  CHECK(sim::nowUs() - startUs < 3000);
+  CHECK(sensor.isConverting());
+  CHECK(!sensor.isConversionDone());
+  sim::advanceUs(740000);
+  CHECK(!sensor.isConversionDone());
+  sim::advanceUs(10000);
+  CHECK(sensor.isConversionDone());
+
+  startUs = sim::nowUs();
+  int16_t sixteenths = 0;
+  CHECK(sensor.readSixteenths(sixteenths));
+  CHECK_EQ(sixteenths, -168);
+  CHECK(sim::nowUs() - startUs < 8000);
+  CHECK(!sensor.isConverting());
+  CHECK_EQ(model.getConversionCount(), 1UL);
+  CHECK_EQ(sim::getOneWireStats().resets, 2UL);
+}
+
+CHECK_CASE(temperatureSensorRejectsBadScratchpads) {
+  int16_t sixteenths = 0;
+  {
+    // Nobody on the pin
+    TemperatureSensor sensor(PIN_SENSOR);
+    CHECK(!sensor.startConversion());
+    CHECK(!sensor.readSixteenths(sixteenths));
+  }
+  {
+    // The library drives GPIO0..15: a sensor on GPIO16 never answers
+    Ds18b20Model unreachable(16);
+    TemperatureSensor sensor(16);
+    CHECK(!sensor.startConversion());
+  }
+  Ds18b20Model model(PIN_SENSOR);
+  TemperatureSensor sensor(PIN_SENSOR);
+  // Power-on scratchpad: 85 C until a conversion has run
+  CHECK(!sensor.readSixteenths(sixteenths));
+
+  model.setCelsius(20.0f);
+  CHECK(sensor.startConversion());
+  sim::advanceUs(750000);
+  model.setCorruptNextRead(true);
+  CHECK(!sensor.readSixteenths(sixteenths));
+  CHECK(sensor.readSixteenths(sixteenths));
+  CHECK_EQ(sixteenths, 320);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// THRESHOLD COMPENSATION
+//////////////////////////////////////////////////////////
+CHECK_CASE(temperatureLowersThresholdsInTheCold) {
+  AdcModel adc;
+  sim::setAnalogInput(A0, adc.rawFromVolts(12.6f));
+  sim::setSerialCapture(true);
+  Ds18b20Model model(PIN_SENSOR);
+  model.setCelsius(-10.0f);
+  TemperatureSensor sensor(PIN_SENSOR);
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  protector.setTemperatureSensor(&sensor, 18);
+  CHECK(sim::takeSerialOutput().find("Temperature compensation: thresholds 18mV lower per C below 25C") != std::string::npos);
+  CHECK(!protector.hasTemperature());
+  runUntil(protector, 1000);
+  CHECK(protector.hasTemperature());
+  CHECK_EQ(protector.getTemperatureSixteenths(), -160);
+  // 35 C below the reference at 18 mV/C
+  CHECK_EQ(protector.getTemperatureOffsetMillivolts(), -630);
+  CHECK_EQ(cutoffMillivolts(protector), 10370UL);
+
+  // 10.8 V under load in the cold is not an empty battery
+  sim::setAnalogInput(A0, adc.rawFromVolts(10.8f));
+  runUntil(protector, 8000);
+  CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+  protector.printStatus();
+  CHECK(sim::takeSerialOutput().find(" | Temp: -10.0C | Threshold: 10.37V") != std::string::npos);
+
+  // Below the compensated cutoff it still trips
+  sim::setAnalogInput(A0, adc.rawFromVolts(10.2f));
+  runUntil(protector, 15000);
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+}
+
+CHECK_CASE(temperatureUncompensatedCutsOffAtSameVoltage) {
+  // The same run without the sensor
+  AdcModel adc;
+  sim::setAnalogInput(A0, adc.rawFromVolts(12.6f));
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  runUntil(protector, 1000);
+  sim::setAnalogInput(A0, adc.rawFromVolts(10.8f));
+  runUntil(protector, 8000);
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+}
+
+CHECK_CASE(temperatureRecomputesOnlyOnChange) {
+  AdcModel adc;
+  sim::setAnalogInput(A0, adc.rawFromVolts(12.6f));
+  Ds18b20Model model(PIN_SENSOR);
+  model.setCelsius(25.0f);
+  TemperatureSensor sensor(PIN_SENSOR);
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  protector.setTemperatureSensor(&sensor, 18);
+  unsigned long startMs = (unsigned long)(sim::nowUs() / 1000); // After the boot decision
+  runUntil(protector, startMs + 1500);
+  CHECK_EQ(protector.getTemperatureOffsetMillivolts(), 0);
+
+  // 0.4 C is 7 mV: under the step, the thresholds stay where they are
+  model.setCelsius(25.4f);
+  runUntil(protector, startMs + 11500);
+  CHECK_EQ(model.getConversionCount(), 2UL);
+  CHECK_EQ(protector.getTemperatureSixteenths(), 406);
+  CHECK_EQ(protector.getTemperatureOffsetMillivolts(), 0);
+  CHECK_EQ(cutoffMillivolts(protector), 11000UL);
+
+  // 40 C: higher thresholds, clamped at 50 C above that
+  model.setCelsius(40.0f);
+  runUntil(protector, startMs + 21500);
+  CHECK_EQ(protector.getTemperatureOffsetMillivolts(), 270);
+  CHECK_EQ(cutoffMillivolts(protector), 11270UL);
+  model.setCelsius(70.0f);
+  runUntil(protector, startMs + 31500);
+  CHECK_EQ(protector.getTemperatureOffsetMillivolts(), 450);
+
+  // A conversion every 10 s, at 250 ms polls
+  CHECK_EQ(model.getConversionCount(), 4UL);
+}
+
+CHECK_CASE(temperatureFallsBackWhenSensorIsLost) {
+  AdcModel adc;
+  sim::setAnalogInput(A0, adc.rawFromVolts(12.6f));
+  sim::setSerialCapture(true);
+  Ds18b20Model model(PIN_SENSOR);
+  model.setCelsius(0.0f);
+  TemperatureSensor sensor(PIN_SENSOR);
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  protector.setTemperatureSensor(&sensor, 18);
+  unsigned long startMs = (unsigned long)(sim::nowUs() / 1000); // After the boot decision
+  runUntil(protector, startMs + 1500);
+  CHECK_EQ(protector.getTemperatureOffsetMillivolts(), -450);
+
+  // One bad CRC is ridden out
+  model.setCorruptNextRead(true);
+  runUntil(protector, startMs + 11500);
+  CHECK(protector.hasTemperature());
+  CHECK_EQ(protector.getTemperatureOffsetMillivolts(), -450);
+  runUntil(protector, startMs + 21500);
+  CHECK_EQ(model.getConversionCount(), 3UL);
+
+  // Three conversions missed in a row: the configured thresholds again
+  sim::detachOneWireDevice(PIN_SENSOR);
+  sim::takeSerialOutput();
+  runUntil(protector, startMs + 41500);
+  CHECK(protector.hasTemperature());
+  CHECK_EQ(protector.getTemperatureOffsetMillivolts(), -450);
+  runUntil(protector, startMs + 51500);
+  CHECK(!protector.hasTemperature());
+  CHECK_EQ(protector.getTemperatureOffsetMillivolts(), 0);
+  CHECK_EQ(cutoffMillivolts(protector), 11000UL);
+  std::string output = sim::takeSerialOutput();
+  CHECK(output.find("ERROR: Temperature sensor not answering, thresholds as configured.") != std::string::npos);
+  protector.printStatus();
+  CHECK(sim::takeSerialOutput().find(" | Temp: -- | ") != std::string::npos);
+
+  sim::attachOneWireDevice(PIN_SENSOR, &model);
+  runUntil(protector, startMs + 61500);
+  CHECK(sim::takeSerialOutput().find("Temperature sensor answering again.") != std::string::npos);
+  CHECK(protector.hasTemperature());
+  CHECK_EQ(protector.getTemperatureOffsetMillivolts(), -450);
+}
+
+CHECK_CASE(temperatureTaskFitsWithEveryOption) {
+  // The temperature task is the tenth with every option on: each one
+  // gets a scheduler slot, and none is reported missing
+  AdcModel adc;
+  sim::setAnalogInput(A0, adc.rawFromVolts(12.6f));
+  sim::setSerialCapture(true);
+  Ds18b20Model model(PIN_SENSOR);
+  TemperatureSensor temperature(PIN_SENSOR);
+  CurrentSensor current(CurrentSensor::CHIP_INA226, 0x40, 1.5f);
+  MqttPublisher publisher;
+  MqttConfig config = MqttPublisher::defaultConfig();
+  config.ssid = "test";
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  protector.setHistoryLog(true);
+  protector.setMqttPublisher(&publisher, config);
+  protector.setCurrentSensor(&current, 100.0f);
+  protector.setTemperatureSensor(&temperature, 18);
+  protector.setTelemetry(true);
+  runUntil(protector, (unsigned long)(sim::nowUs() / 1000) + 1500);
+  CHECK(protector.hasTemperature());
+  std::string output = sim::takeSerialOutput();
+  CHECK(output.find("No scheduler slot") == std::string::npos);
+  protector.printSchedulerStats(Serial);
+  output = sim::takeSerialOutput();
+  const char* names[] = { "sample", "state", "buzzer", "leds", "display", "history", "mqtt", "current", "temperature", "telemetry" };
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    CHECK(output.find(std::string("\n") + names[i] + " ") != std::string::npos);
+  }
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,64 @@
+//////////////////////////////////////////////////////////
+// TRACE CHECKS
+//
+// Loading recorded voltage traces in both formats and reading them back
+// with the zero-order hold traceReplay drives A0 with.
+//////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <string>
+#include "check.h"
+#include "trace.h"
+
+namespace {
+
+  std::string writeFile(const char* name, const void* data, size_t length) {
+    std::string path = std::string("/tmp/") + name;
+    FILE* file = fopen(path.c_str(), "wb");
+    fwrite(data, 1, length, file);
+    fclose(file);
+    return path;
+  }
+
+}
+
+
+//////////////////////////////////////////////////////////
+// TRACE LOADING
+//////////////////////////////////////////////////////////
+CHECK_CASE(traceCsvSkipsHeaderAndComments) {
+  const char text[] = "# comment\ntime_ms,volts\n0,12.600\n5000,12.600\n5000,10.800\n20000,13.600\n";
+  std::string path = writeFile("traceChecks.csv", text, sizeof(text) - 1);
+  Trace trace;
+  std::string error;
+  CHECK(trace.load(path.c_str(), error));
+  CHECK_EQ(trace.size(), 4);
+  CHECK_EQ(trace.durationMs(), 20000UL);
+  // Held until the next point; a repeated time is a step
+  CHECK(trace.voltsAt(0) == 12.6f);
+  CHECK(trace.voltsAt(4999) == 12.6f);
+  CHECK(trace.voltsAt(5000) == 10.8f);
+  CHECK(trace.voltsAt(19999) == 10.8f);
+  CHECK(trace.voltsAt(20000) == 13.6f);
+  remove(path.c_str());
+}
+
+CHECK_CASE(traceBinaryReadsPackedRecords) {
+  // { uint32_t timeMs; uint16_t millivolts; } little-endian, 6 bytes each
+  const unsigned char records[] = {
+    0x00, 0x00, 0x00, 0x00, 0x38, 0x31,  // 0 ms, 12600 mV
+    0xE8, 0x03, 0x00, 0x00, 0xF8, 0x2A   // 1000 ms, 11000 mV
+  };
+  std::string path = writeFile("traceChecks.bin", records, sizeof(records));
+  Trace trace;
+  std::string error;
+  CHECK(trace.load(path.c_str(), error));
+  CHECK_EQ(trace.size(), 2);
+  CHECK(trace.voltsAt(999) == 12.6f);
+  CHECK(trace.voltsAt(1000) == 11.0f);
+  remove(path.c_str());
+
+  Trace missing;
+  CHECK(!missing.load("/tmp/traceChecksMissing.csv", error));
+  CHECK(!error.empty());
+}
+//////////////////////////////////////////////////////////
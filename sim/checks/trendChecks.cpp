@@ -0,0 +1,144 @@
+//////////////////////////////////////////////////////////
+// TREND CHECKS
+//
+// TrendEstimator's running sums against a regression recomputed from
+// scratch, duration formatting, and BatteryProtector's time to cutoff
+// on the LCD and in printStatus() for a battery running down.
+//////////////////////////////////////////////////////////
+#include <string>
+#include "Arduino.h"
+#include "LiquidCrystal_I2C.h"
+#include "adcModel.h"
+#include "basicHardware.h"
+#include "batteryProtector.h"
+#include "check.h"
+#include "checkHelpers.h"
+#include "i2cBus.h"
+#include "simHal.h"
+#include "trendEstimator.h"
+
+namespace {
+
+  // Slope x 1000 of the last count values, recomputed in full
+  int32_t referenceSlopeMilli(const uint16_t* values, uint32_t total, uint32_t count) {
+    int64_t sumX = 0;
+    int64_t sumY = 0;
+    int64_t sumXY = 0;
+    int64_t sumXX = 0;
+    for (uint32_t x = 0; x < count; x++) {
+      int64_t y = values[total - count + x];
+      sumX += x;
+      sumY += y;
+      sumXY += x * y;
+      sumXX += x * x;
+    }
+    int64_t n = count;
+    return (int32_t)((n * sumXY - sumX * sumY) * 1000 / (n * sumXX - sumX * sumX));
+  }
+
+}
+
+
+//////////////////////////////////////////////////////////
+// ESTIMATOR
+//////////////////////////////////////////////////////////
+CHECK_CASE(trendFitsLine) {
+  TrendEstimator trend;
+  // 3 mV per interval down, well past one window
+  for (uint16_t k = 0; k < 100; k++) {
+    trend.addSample(12000 - 3 * k);
+  }
+  CHECK_EQ(trend.getCount(), TrendEstimator::WINDOW);
+  CHECK_EQ(trend.getSlopeMilliPerInterval(), -3000);
+  // Newest 11703 mV: 703 mV to go at 3 mV per interval
+  CHECK_EQ(trend.getIntervalsTo(11000), 234);
+  CHECK_EQ(trend.getIntervalsTo(11703), 0);
+  CHECK_EQ(trend.getIntervalsTo(12000), 0); // Already past it
+}
+
+CHECK_CASE(trendRunningSumsMatchRecompute) {
+  // Noisy discharge: the O(1) update must agree with a full refit at
+  // every sample, while filling and long after the window wrapped
+  static uint16_t values[1000];
+  uint32_t seed = 12345;
+  TrendEstimator trend;
+  for (uint32_t i = 0; i < 1000; i++) {
+    seed = seed * 1103515245UL + 12345UL;
+    values[i] = (uint16_t)(12600 - i / 2 + (seed >> 16) % 40);
+    trend.addSample(values[i]);
+    uint32_t count = i + 1 < TrendEstimator::WINDOW ? i + 1 : TrendEstimator::WINDOW;
+    if (count >= TrendEstimator::MIN_SAMPLES) {
+      CHECK_EQ(trend.getSlopeMilliPerInterval(), referenceSlopeMilli(values, i + 1, count));
+    }
+  }
+}
+
+CHECK_CASE(trendGivesNoEstimateWhenNotFalling) {
+  TrendEstimator trend;
+  for (uint8_t k = 0; k < TrendEstimator::MIN_SAMPLES - 1; k++) {
+    trend.addSample(12000 - 10 * k);
+  }
+  CHECK_EQ(trend.getIntervalsTo(11000), TrendEstimator::NO_ESTIMATE); // Too few samples
+  trend.reset();
+  for (uint8_t k = 0; k < 20; k++) {
+    trend.addSample(12000);
+  }
+  CHECK_EQ(trend.getIntervalsTo(11000), TrendEstimator::NO_ESTIMATE); // Flat
+  trend.reset();
+  for (uint8_t k = 0; k < 20; k++) {
+    trend.addSample(12000 + k);
+  }
+  CHECK_EQ(trend.getIntervalsTo(11000), TrendEstimator::NO_ESTIMATE); // Charging
+}
+
+CHECK_CASE(durationFormatsForLcd) {
+  char text[7];
+  formatDuration(59, text);
+  CHECK(std::string(text) == "<1m");
+  formatDuration(60 * 7 + 30, text);
+  CHECK(std::string(text) == "7m");
+  formatDuration(60 * 40, text);
+  CHECK(std::string(text) == "40m");
+  formatDuration(3600 * 2 + 60 * 5, text);
+  CHECK(std::string(text) == "2h05m");
+  formatDuration(3600 * 12 + 60 * 59, text);
+  CHECK(std::string(text) == "12h");
+  formatDuration(3600UL * 2000, text);
+  CHECK(std::string(text) == "999h");
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// PROTECTOR
+//////////////////////////////////////////////////////////
+CHECK_CASE(protectorPredictsTimeToCutoff) {
+  // 12.4 V falling 1 mV/s: 11.0 V at 1400 s
+  AdcModel adc;
+  sim::setAnalogInput(A0, adc.rawFromVolts(12.4f));
+  sim::addTickListener([&adc](unsigned long nowMs) {
+    sim::setAnalogInput(A0, adc.rawFromVolts(12.4f - nowMs / 1000000.0f));
+  });
+  Display lcd(0x27, 16, 2);
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, &lcd);
+  runUntil(protector, 30000);
+  CHECK_EQ(protector.getSecondsToCutoff(), TrendEstimator::NO_ESTIMATE); // Two samples so far
+  CHECK(shownRow(1) == "Potrosac: ON    ");
+
+  runUntil(protector, 300000);
+  uint32_t seconds = protector.getSecondsToCutoff();
+  CHECK(seconds >= 1070);
+  CHECK(seconds <= 1130);
+  CHECK(shownRow(1) == "Gasim za: ~18m  " || shownRow(1) == "Gasim za: ~19m  ");
+
+  sim::setSerialCapture(true);
+  protector.printStatus();
+  CHECK(sim::takeSerialOutput().find("Cutoff in: ~1") != std::string::npos);
+
+  // Cut off: no prediction, the relay state is back
+  runUntil(protector, 1500000);
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+  CHECK_EQ(protector.getSecondsToCutoff(), TrendEstimator::NO_ESTIMATE);
+  CHECK(shownRow(1) == "Potrosac: OFF   ");
+}
+//////////////////////////////////////////////////////////
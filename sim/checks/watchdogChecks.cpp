@@ -0,0 +1,328 @@
+//////////////////////////////////////////////////////////
+// WATCHDOG CHECKS
+//
+// The loop watchdog opening the relay from its interrupt while a pass
+// hangs on a stuck I2C bus, its record across a watchdog reset, the loop
+// period statistics, and the display getting its bus back.
+//////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <string>
+#include "Arduino.h"
+#include "Wire.h"
+#include "adcModel.h"
+#include "batteryProtector.h"
+#include "check.h"
+#include "checkHelpers.h"
+#include "i2cBus.h"
+#include "simHal.h"
+
+namespace {
+
+  const uint8_t PIN_RELAY = 12; // HIGH: load disconnected
+  const uint8_t LCD_ADDRESS = 0x27;
+  const uint8_t COLUMNS = 16;
+
+  // 12.6 V, then 50 mV down and back every second from fromMs: the display has
+  // something to send once a second
+  void stepVoltageFrom(AdcModel& adc, unsigned long fromMs) {
+    sim::setAnalogInput(A0, adc.rawFromVolts(12.6f));
+    sim::addTickListener([&adc, fromMs](unsigned long nowMs) {
+      float volts = nowMs < fromMs ? 12.6f : 12.6f - 0.05f * ((nowMs - fromMs) / 1000 % 2);
+      sim::setAnalogInput(A0, adc.rawFromVolts(volts));
+    });
+  }
+
+  WatchdogConfig watchdogConfig(uint8_t safeState) {
+    WatchdogConfig config;
+    config.timeoutMs = 1000;
+    config.safeState = safeState;
+    return config;
+  }
+
+  struct LoopRow {
+    unsigned long passes, meanUs, maxUs, jitterMeanUs, jitterMaxUs, deadlineMisses;
+  };
+
+  // The two lines of printLoopStats(); false when missing
+  bool loopRow(const std::string& output, LoopRow& row) {
+    size_t at = output.find("Loop: ");
+    if (at == std::string::npos) {
+      return false;
+    }
+    return sscanf(output.c_str() + at, "Loop: %lu passes, period mean/max %lu/%luus, jitter mean/max %lu/%luus Deadline misses: %lu",
+                  &row.passes, &row.meanUs, &row.maxUs, &row.jitterMeanUs, &row.jitterMaxUs, &row.deadlineMisses) == 6;
+  }
+
+  // Thrown where the SDK's soft watchdog would reset the chip
+  struct SoftWatchdogReset {};
+
+  // Answers nothing: holds the bus until the soft watchdog fires
+  class HangingDevice : public sim::I2cDevice {
+    public:
+      void onWrite(const uint8_t* data, size_t length) {
+        (void)data;
+        (void)length;
+        sim::advanceBusyUs(3200000);
+        throw SoftWatchdogReset();
+      }
+  };
+
+}
+
+
+//////////////////////////////////////////////////////////
+// LOOP WATCHDOG
+//////////////////////////////////////////////////////////
+CHECK_CASE(watchdogOpensRelayDuringStuckClock) {
+  // Plain Wire.begin() keeps the core's 150 ms clock stretch limit: a
+  // held SCL stalls the display refresh for 1.5 s
+  Wire.begin();
+  AdcModel adc;
+  stepVoltageFrom(adc, 3000);
+  sim::setSerialCapture(true);
+  Display lcd(LCD_ADDRESS, COLUMNS, 2);
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, &lcd);
+  protector.setLoopWatchdog(watchdogConfig(LoopWatchdog::SAFE_RELAY_OPEN));
+  runUntil(protector, 3000);
+  CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+  CHECK(sim::takeSerialOutput().find("Loop watchdog: relay open after 1000ms") != std::string::npos);
+
+  unsigned long openedAtMs = 0;
+  sim::setWriteObserver([&openedAtMs](uint8_t pin, uint8_t val, unsigned long nowMs) {
+    if (pin == PIN_RELAY && val == HIGH && openedAtMs == 0) {
+      openedAtMs = nowMs;
+    }
+  });
+  sim::setI2cFault(sim::I2C_FAULT_SCL_STUCK);
+  unsigned long hungFromMs = 0;
+  unsigned long hungUntilMs = 0;
+  while (sim::nowUs() / 1000 < 6000 && hungUntilMs == 0) {
+    unsigned long startMs = (unsigned long)(sim::nowUs() / 1000);
+    protector.update();
+    unsigned long endMs = (unsigned long)(sim::nowUs() / 1000);
+    if (endMs - startMs >= 1000) {
+      hungFromMs = startMs;
+      hungUntilMs = endMs;
+    }
+    protector.idle();
+  }
+  CHECK(hungUntilMs - hungFromMs >= 1500);
+  // Opened by the interrupt 1 s into the pass, long before it returned
+  CHECK(openedAtMs >= hungFromMs + 999 && openedAtMs <= hungFromMs + 1001);
+  CHECK(openedAtMs < hungUntilMs);
+  CHECK_EQ(sim::getDigitalOutput(PIN_RELAY), HIGH);
+  CHECK_EQ(sim::getFlashCallsFromInterrupt(), 0UL); // Record stored without the SDK
+
+  // The next pass brings the state machine in line
+  sim::setWriteObserver(sim::WriteObserver());
+  runUntil(protector, hungUntilMs + 100);
+  std::string output = sim::takeSerialOutput();
+  CHECK(output.find("WATCHDOG: loop stalled 15") != std::string::npos);
+  CHECK(output.find("in task 'display', relay open.") != std::string::npos);
+  CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+  CHECK_EQ(sim::getDigitalOutput(PIN_RELAY), HIGH);
+
+  sim::sendSerialInput("w");
+  runUntil(protector, hungUntilMs + 200);
+  output = sim::takeSerialOutput();
+  CHECK(output.find("watchdog trips: 1 (1000ms, relay open)") != std::string::npos);
+  CHECK(output.find("Deadline misses: 0") == std::string::npos);
+}
+
+CHECK_CASE(watchdogClosedSafeStateKeepsLoadOnThroughHang) {
+  Wire.begin();
+  AdcModel adc;
+  stepVoltageFrom(adc, 3000);
+  sim::setSerialCapture(true);
+  Display lcd(LCD_ADDRESS, COLUMNS, 2);
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, &lcd);
+  protector.setLoopWatchdog(watchdogConfig(LoopWatchdog::SAFE_RELAY_CLOSED));
+  runUntil(protector, 3000);
+  sim::setI2cFault(sim::I2C_FAULT_SCL_STUCK);
+  runUntil(protector, 6000);
+  CHECK(sim::takeSerialOutput().find("in task 'display', relay closed.") != std::string::npos);
+  CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+  CHECK_EQ(sim::getDigitalOutput(PIN_RELAY), LOW);
+}
+
+CHECK_CASE(watchdogRecordExplainsResetAtNextBoot) {
+  AdcModel adc;
+  stepVoltageFrom(adc, 3000);
+  sim::setSerialCapture(true);
+  HangingDevice hanging;
+  {
+    Display lcd(LCD_ADDRESS, COLUMNS, 2);
+    BatteryProtector protector(11.0f, 12.8f, 60000UL, &lcd);
+    protector.setLoopWatchdog(watchdogConfig(LoopWatchdog::SAFE_RELAY_OPEN));
+    runUntil(protector, 3000);
+    sim::attachI2cDevice(LCD_ADDRESS, &hanging);
+    bool reset = false;
+    try {
+      runUntil(protector, 6000);
+    } catch (const SoftWatchdogReset&) {
+      reset = true;
+    }
+    CHECK(reset);
+    CHECK_EQ(sim::getDigitalOutput(PIN_RELAY), HIGH);
+    CHECK_EQ(sim::getFlashCallsFromInterrupt(), 0UL);
+    sim::detachI2cDevice(LCD_ADDRESS);
+    sim::resetByWatchdog();
+  }
+  sim::takeSerialOutput();
+
+  // Battery fine, but the last boot hung with the relay opened: it stays open
+  unsigned long bootMs = (unsigned long)(sim::nowUs() / 1000);
+  {
+    BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+    CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+    CHECK_EQ(sim::getDigitalOutput(PIN_RELAY), HIGH);
+    runUntil(protector, bootMs + 500);
+    std::string output = sim::takeSerialOutput();
+    CHECK(output.find("Relay kept open after the watchdog reset.") != std::string::npos);
+    CHECK(output.find("Watchdog: reset after the loop hung in task 'display' at ") != std::string::npos);
+    CHECK(protector.getState() == BatteryProtector::STATE_CUTOFF);
+    sim::resetByWatchdog();
+  }
+
+  // The record was read once: another watchdog reset has no loop record
+  bootMs = (unsigned long)(sim::nowUs() / 1000);
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+  runUntil(protector, bootMs + 500);
+  CHECK(sim::takeSerialOutput().find("(no loop record)") != std::string::npos);
+}
+
+CHECK_CASE(watchdogMeasuresLoopPeriodAndDeadlineMisses) {
+  AdcModel adc;
+  sim::setAnalogInput(A0, adc.rawFromVolts(12.6f));
+  sim::setSerialCapture(true);
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, nullptr);
+  protector.setLoopWatchdog(watchdogConfig(LoopWatchdog::SAFE_RELAY_OPEN));
+  runUntil(protector, 2000);
+  sim::takeSerialOutput();
+  protector.printLoopStats(Serial);
+  LoopRow before;
+  CHECK(loopRow(sim::takeSerialOutput(), before));
+  // The loop wakes every 5 ms sample period
+  CHECK(before.passes >= 2000 / 5 - 20);
+  CHECK(before.meanUs >= 4900 && before.meanUs <= 5200);
+  CHECK(before.maxUs < 30000);
+
+  // One pass stalled for 30 ms: three sample periods
+  sim::advanceBusyUs(30000);
+  runUntil(protector, 2100);
+  sim::sendSerialInput("w");
+  runUntil(protector, 2200);
+  std::string output = sim::takeSerialOutput();
+  LoopRow after;
+  CHECK(loopRow(output, after));
+  CHECK(after.maxUs >= 30000);
+  CHECK(after.jitterMaxUs >= 25000);
+  CHECK_EQ(after.deadlineMisses, before.deadlineMisses + 1);
+  CHECK(output.find(" over 10000us, watchdog trips: 0 (1000ms, relay open)") != std::string::npos);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// I2C BUS RECOVERY
+//////////////////////////////////////////////////////////
+CHECK_CASE(displayClearsStuckDataLine) {
+  Display display(LCD_ADDRESS, COLUMNS, 2);
+  display.beginBus(100000);
+  display.init();
+  display.setCursor(0, 0);
+  display.print("Baterija: 12.60V");
+  display.flush();
+
+  // A slave stopped mid-byte holds SDA: transfers fail at the START
+  sim::setI2cFault(sim::I2C_FAULT_SDA_STUCK);
+  display.setCursor(0, 0);
+  display.print("Baterija: 12.61V");
+  display.flush();
+  CHECK(display.isBusFault());
+
+  // Clocked free by the bus clear, then initialised and redrawn
+  sim::advanceMs(1000);
+  display.flush();
+  CHECK(sim::getI2cFault() == sim::I2C_FAULT_NONE);
+  CHECK(!display.isBusFault());
+  CHECK_EQ(display.getBusErrorCount(), 1);
+  CHECK_EQ(display.getBusRecoveryCount(), 1);
+  CHECK(shownRow(0) == "Baterija: 12.61V");
+}
+
+CHECK_CASE(displayBoundsStuckClockStalls) {
+  Display display(LCD_ADDRESS, COLUMNS, 2);
+  display.beginBus(100000);
+  display.init();
+  display.setCursor(0, 0);
+  display.print("Baterija: 12.60V");
+  display.flush();
+
+  // 1 ms per clock instead of 150 ms: the failed transfer costs ~10 ms
+  sim::setI2cFault(sim::I2C_FAULT_SCL_STUCK);
+  display.setCursor(0, 0);
+  display.print("Baterija: 12.61V");
+  uint64_t startUs = sim::nowUs();
+  display.flush();
+  CHECK(display.isBusFault());
+  CHECK(sim::nowUs() - startUs <= 12000);
+
+  // A held clock cannot be cleared from here: the attempt gives up at once
+  sim::advanceMs(1000);
+  startUs = sim::nowUs();
+  display.flush();
+  CHECK(display.isBusFault());
+  CHECK(sim::nowUs() - startUs <= 100);
+  CHECK_EQ(display.getBusRecoveryCount(), 0);
+}
+
+CHECK_CASE(displayKeepsBusSettingsThroughLcdInit) {
+  // The library's init() calls Wire.begin(), which resets both
+  Display display(LCD_ADDRESS, COLUMNS, 2);
+  display.beginBus(400000);
+  display.init();
+  CHECK_EQ(Wire.getClock(), 400000UL);
+  CHECK_EQ(Wire.getClockStretchLimit(), 1000UL);
+
+  display.setCursor(0, 0);
+  display.print("Baterija: 12.60V");
+  sim::setI2cFault(sim::I2C_FAULT_SDA_STUCK);
+  display.flush();
+  CHECK(display.isBusFault());
+  sim::advanceMs(1000);
+  display.flush();
+  CHECK_EQ(display.getBusRecoveryCount(), 1);
+  CHECK_EQ(Wire.getClock(), 400000UL);
+  CHECK_EQ(Wire.getClockStretchLimit(), 1000UL);
+}
+
+CHECK_CASE(protectorRidesOutDisplayBusFault) {
+  AdcModel adc;
+  stepVoltageFrom(adc, 3000);
+  sim::setSerialCapture(true);
+  Display lcd(LCD_ADDRESS, COLUMNS, 2);
+  BatteryProtector protector(11.0f, 12.8f, 60000UL, &lcd);
+  lcd.beginBus(100000);
+  protector.setLoopWatchdog(watchdogConfig(LoopWatchdog::SAFE_RELAY_OPEN));
+  runUntil(protector, 3000);
+  sim::takeSerialOutput();
+
+  sim::setI2cFault(sim::I2C_FAULT_SCL_STUCK);
+  runUntil(protector, 8000);
+  std::string output = sim::takeSerialOutput();
+  CHECK(output.find("ERROR: Display not answering on I2C") != std::string::npos);
+  CHECK(output.find("WATCHDOG") == std::string::npos);
+  CHECK(protector.getState() == BatteryProtector::STATE_ARMED);
+  protector.printStatus();
+  CHECK(sim::takeSerialOutput().find(" | LCD: bus fault") != std::string::npos);
+
+  // Device power-cycled: the next attempt brings the LCD back
+  sim::setI2cFault(sim::I2C_FAULT_NONE);
+  runUntil(protector, 10000);
+  CHECK(sim::takeSerialOutput().find("Display: I2C bus recovered.") != std::string::npos);
+  CHECK(!lcd.isBusFault());
+  CHECK(shownRow(1) == "Potrosac: ON    ");
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,260 @@
+#include <vector>
+#include "Arduino.h"
+#include "ESP8266WiFi.h"
+#include "simHal.h"
+#include "user_interface.h"
+
+EspClass ESP;
+ESP8266WiFiClass WiFi;
+uint32_t g_simRtcUserMemory[128];
+uint32_t g_simFsPhysSize = 0x1FA000;
+
+
+//////////////////////////////////////////////////////////
+// SIMULATED CHIP STATE
+//////////////////////////////////////////////////////////
+namespace {
+
+  const uint32_t RTC_CALIBRATION_Q12 = 22528; // 5.5 us per RTC tick
+  const size_t RTC_USER_WORDS = 128;          // 512 bytes of user RTC memory
+
+  rst_info g_resetInfo;
+  bool g_radioOn = true;
+  WiFiMode_t g_wifiMode = WIFI_STA;
+
+  sleep_type g_sleepType = NONE_SLEEP_T;
+  bool g_fpmOpen = false;
+  uint32_t g_pendingLightSleepUs = 0;
+  fpm_wakeup_cb g_wakeupCallback = nullptr;
+
+  RFMode g_deepSleepRfMode = RF_DEFAULT;
+
+  // SPI flash timing (typical values of the 25Q32 parts on D1 Mini boards)
+  const uint32_t FLASH_ERASE_US = 45000;
+  const uint32_t FLASH_WRITE_US_PER_WORD = 10;
+  const uint32_t FLASH_READ_BYTES_PER_US = 16;
+
+  std::vector<uint8_t> g_flash(sim::FLASH_SIZE, 0xFF);
+  std::vector<uint32_t> g_flashEraseCounts(sim::FLASH_SIZE / sim::FLASH_SECTOR_SIZE, 0);
+
+  bool flashRangeValid(uint32_t address, size_t size) {
+    return (address & 3) == 0 && (size & 3) == 0 && address <= sim::FLASH_SIZE && size <= sim::FLASH_SIZE - address;
+  }
+
+}
+
+namespace sim {
+
+  void resetChip() {
+    // Power-on: RTC memory holds garbage, the modem starts up
+    for (size_t i = 0; i < RTC_USER_WORDS; i++) {
+      g_simRtcUserMemory[i] = 0xA5A5A5A5UL ^ (uint32_t)i;
+    }
+    memset(&g_resetInfo, 0, sizeof(g_resetInfo));
+    g_resetInfo.reason = REASON_DEFAULT_RST;
+    g_radioOn = true;
+    g_wifiMode = WIFI_STA;
+    g_sleepType = NONE_SLEEP_T;
+    g_fpmOpen = false;
+    g_pendingLightSleepUs = 0;
+    g_wakeupCallback = nullptr;
+  }
+
+  bool isRadioOn() {
+    return g_radioOn;
+  }
+
+  void eraseFlash() {
+    std::fill(g_flash.begin(), g_flash.end(), 0xFF);
+    std::fill(g_flashEraseCounts.begin(), g_flashEraseCounts.end(), 0);
+  }
+
+  void setFilesystemSize(uint32_t bytes) {
+    g_simFsPhysSize = bytes;
+  }
+
+  uint32_t getFlashEraseCount(uint32_t sector) {
+    return sector < g_flashEraseCounts.size() ? g_flashEraseCounts[sector] : 0;
+  }
+
+  bool runPendingLightSleep() {
+    if (g_pendingLightSleepUs == 0) {
+      return false;
+    }
+    uint32_t sleepUs = g_pendingLightSleepUs;
+    g_pendingLightSleepUs = 0;
+    advanceLightSleepUs(sleepUs);
+    if (g_wakeupCallback) {
+      g_wakeupCallback();
+    }
+    return true;
+  }
+
+  void completeDeepSleep(const DeepSleepReset& request) {
+    advanceDeepSleepUs(request.sleepUs);
+    reboot();
+    memset(&g_resetInfo, 0, sizeof(g_resetInfo));
+    g_resetInfo.reason = REASON_DEEP_SLEEP_AWAKE;
+    g_radioOn = g_deepSleepRfMode != RF_DISABLED;
+    g_sleepType = NONE_SLEEP_T;
+    g_fpmOpen = false;
+    g_pendingLightSleepUs = 0;
+    g_wakeupCallback = nullptr;
+  }
+
+  void resetByWatchdog() {
+    reboot();
+    memset(&g_resetInfo, 0, sizeof(g_resetInfo));
+    g_resetInfo.reason = REASON_SOFT_WDT_RST;
+    g_radioOn = true;
+    g_sleepType = NONE_SLEEP_T;
+    g_fpmOpen = false;
+    g_pendingLightSleepUs = 0;
+    g_wakeupCallback = nullptr;
+  }
+
+  struct ChipInit {
+    ChipInit() { resetChip(); }
+  } g_chipInit;
+
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FAKE NON-OS SDK (sleep, RTC, reset info)
+//////////////////////////////////////////////////////////
+void wifi_fpm_set_sleep_type(enum sleep_type type) {
+  g_sleepType = type;
+}
+
+void wifi_fpm_open(void) {
+  g_fpmOpen = true;
+}
+
+void wifi_fpm_close(void) {
+  g_fpmOpen = false;
+}
+
+int8_t wifi_fpm_do_sleep(uint32_t sleep_time_in_us) {
+  if (!g_fpmOpen || g_sleepType != LIGHT_SLEEP_T) {
+    return -1;
+  }
+  g_pendingLightSleepUs = sleep_time_in_us;
+  return 0;
+}
+
+void wifi_fpm_set_wakeup_cb(fpm_wakeup_cb cb) {
+  g_wakeupCallback = cb;
+}
+
+uint32_t system_get_rtc_time(void) {
+  return (uint32_t)((sim::nowUs() << 12) / RTC_CALIBRATION_Q12);
+}
+
+uint32_t system_rtc_clock_cali_proc(void) {
+  return RTC_CALIBRATION_Q12;
+}
+
+struct rst_info* system_get_rst_info(void) {
+  return &g_resetInfo;
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FAKE ESP CLASS
+//////////////////////////////////////////////////////////
+void EspClass :: deepSleep(uint64_t time_us, RFMode mode) {
+  g_deepSleepRfMode = mode;
+  sim::DeepSleepReset request;
+  request.sleepUs = time_us;
+  throw request;
+}
+
+bool EspClass :: rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size) {
+  sim::noteFlashCall();
+  if (offset >= RTC_USER_WORDS || offset * 4 + size > RTC_USER_WORDS * 4) {
+    return false;
+  }
+  memcpy(data, &g_simRtcUserMemory[offset], size);
+  return true;
+}
+
+bool EspClass :: rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size) {
+  sim::noteFlashCall();
+  if (offset >= RTC_USER_WORDS || offset * 4 + size > RTC_USER_WORDS * 4) {
+    return false;
+  }
+  memcpy(&g_simRtcUserMemory[offset], data, size);
+  return true;
+}
+
+struct rst_info* EspClass :: getResetInfoPtr() {
+  return &g_resetInfo;
+}
+
+uint32_t EspClass :: getCycleCount() {
+  return (uint32_t)(sim::nowUs() * 80);
+}
+
+bool EspClass :: flashEraseSector(uint32_t sector) {
+  sim::noteFlashCall();
+  if (sector >= sim::FLASH_SIZE / sim::FLASH_SECTOR_SIZE) {
+    return false;
+  }
+  memset(&g_flash[sector * sim::FLASH_SECTOR_SIZE], 0xFF, sim::FLASH_SECTOR_SIZE);
+  g_flashEraseCounts[sector]++;
+  sim::advanceBusyUs(FLASH_ERASE_US);
+  return true;
+}
+
+bool EspClass :: flashWrite(uint32_t address, const uint32_t* data, size_t size) {
+  sim::noteFlashCall();
+  if (!flashRangeValid(address, size)) {
+    return false;
+  }
+  // NOR flash: programming only clears bits
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; i++) {
+    g_flash[address + i] &= bytes[i];
+  }
+  sim::advanceBusyUs(FLASH_WRITE_US_PER_WORD * (size / 4));
+  return true;
+}
+
+bool EspClass :: flashRead(uint32_t address, uint32_t* data, size_t size) {
+  sim::noteFlashCall();
+  if (!flashRangeValid(address, size)) {
+    return false;
+  }
+  memcpy(data, &g_flash[address], size);
+  sim::advanceBusyUs(size / FLASH_READ_BYTES_PER_US);
+  return true;
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FAKE ESP8266WIFI
+//////////////////////////////////////////////////////////
+bool ESP8266WiFiClass :: mode(WiFiMode_t mode) {
+  g_wifiMode = mode;
+  return true;
+}
+
+WiFiMode_t ESP8266WiFiClass :: getMode() {
+  return g_wifiMode;
+}
+
+bool ESP8266WiFiClass :: forceSleepBegin(uint32_t sleepUs) {
+  (void)sleepUs;
+  g_radioOn = false;
+  return true;
+}
+
+bool ESP8266WiFiClass :: forceSleepWake() {
+  g_radioOn = true;
+  return true;
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,22 @@
+#ifndef flash_hal_h
+#define flash_hal_h
+
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////
+// FAKE FLASH LAYOUT
+//
+// The core derives these from the linker script of the selected flash
+// layout; the simulated board uses "4MB (FS:2MB OTA:~1019KB)". As in
+// the core, where they come from linker symbols, the size is not a
+// compile-time constant: sim::setFilesystemSize() picks another layout.
+//////////////////////////////////////////////////////////
+extern uint32_t g_simFsPhysSize;
+
+#define FS_PHYS_ADDR ((uint32_t)0x200000)
+#define FS_PHYS_SIZE g_simFsPhysSize
+#define FS_PHYS_PAGE ((uint32_t)0x100)
+#define FS_PHYS_BLOCK ((uint32_t)0x2000)
+//////////////////////////////////////////////////////////
+
+#endif
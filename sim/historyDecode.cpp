@@ -0,0 +1,107 @@
+//////////////////////////////////////////////////////////
+// HISTORY DECODE
+//
+// Turns a history log export (the bytes the firmware sends after 'h' on
+// Serial, or traceReplay --history) back into samples and events.
+// Everything between frames, such as status lines in a serial capture,
+// is skipped; frames with a bad CRC are reported and dropped.
+//
+//   historyDecode <capture.bin>
+//
+// Output is CSV: "seconds,volts" per sample and "seconds,event,name"
+// per event, in log time (seconds the logger ran, across reboots).
+//////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "Arduino.h"
+#include "historyLog.h"
+
+namespace {
+
+  bool readFile(const char* path, std::vector<uint8_t>& data) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+      return false;
+    }
+    uint8_t buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+      data.insert(data.end(), buffer, buffer + count);
+    }
+    fclose(file);
+    return true;
+  }
+
+  void decodeSector(const uint8_t* bytes, size_t length) {
+    HistorySectorHeader header;
+    if (length < sizeof(header)) {
+      return;
+    }
+    memcpy(&header, bytes, sizeof(header));
+    if (!HistoryDecoder::isValidHeader(header)) {
+      fprintf(stderr, "skipping sector with a bad header\n");
+      return;
+    }
+    HistoryDecoder decoder;
+    decoder.begin(header);
+    HistoryEntry entry;
+    for (size_t i = sizeof(header); i < length; i++) {
+      if (!decoder.feed(bytes[i], entry)) {
+        continue;
+      }
+      if (entry.kind == HistoryEntry::KIND_SAMPLE) {
+        printf("%lu,%u.%03u\n", (unsigned long)entry.seconds, entry.millivolts / 1000, entry.millivolts % 1000);
+      } else {
+        printf("%lu,event,%s\n", (unsigned long)entry.seconds, HistoryDecoder::eventName(entry.event));
+      }
+    }
+  }
+
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: historyDecode <capture.bin>\n");
+    return 2;
+  }
+  std::vector<uint8_t> data;
+  if (!readFile(argv[1], data)) {
+    fprintf(stderr, "cannot read %s\n", argv[1]);
+    return 1;
+  }
+
+  unsigned long frames = 0;
+  unsigned long badFrames = 0;
+  bool complete = false;
+  size_t i = 0;
+  while (i + 4 <= data.size() && !complete) {
+    if (data[i] != '#' || data[i + 1] != 'H') {
+      i++;
+      continue;
+    }
+    size_t length = data[i + 2] | (data[i + 3] << 8);
+    if (length == 0) {
+      complete = true;
+      break;
+    }
+    if (length > HistoryLog::SECTOR_SIZE || i + 4 + length + 2 > data.size()) {
+      i++; // Not a frame after all, or cut off
+      continue;
+    }
+    const uint8_t* bytes = &data[i + 4];
+    uint16_t crc = bytes[length] | (bytes[length + 1] << 8);
+    if (HistoryLog::crc16(bytes, (uint16_t)length) != crc) {
+      badFrames++;
+      i++;
+      continue;
+    }
+    decodeSector(bytes, length);
+    frames++;
+    i += 4 + length + 2;
+  }
+
+  fprintf(stderr, "%lu sectors decoded, %lu with a bad CRC%s\n", frames, badFrames,
+    complete ? "" : ", end marker missing (export incomplete)");
+  return badFrames == 0 && complete ? 0 : 1;
+}
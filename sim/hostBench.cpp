@@ -0,0 +1,203 @@
+//////////////////////////////////////////////////////////
+// HOST BENCH
+//
+// Google Benchmark suite for the hot paths of the firmware, run on the
+// host against the simulated board:
+//
+//   Sensor*     VoltageSensor on a PinMock: conversions per second
+//               (items_per_second) for the float and the integer path,
+//               the ADC calibration table, the filter pipeline and a
+//               full oversampled read
+//   Protector*  one BatteryProtector::update() pass of the main.ino
+//               loop, timed around update() only (the simulator's
+//               clock and idle() are not counted); steady armed, and
+//               cycling through cutoff and rearm
+//   Display*    one Display::flush() against the HD44780 model; the
+//               counters are I2C bytes, transactions and cells per
+//               refresh, the same on the chip as here
+//
+// Host nanoseconds are not ESP8266 cycles, but they move together with
+// the code: the suite is for comparing builds. Machine-readable output:
+//
+//   make -C sim bench          (writes sim/build/bench.json)
+//   sim/build/hostBench --benchmark_format=json
+//////////////////////////////////////////////////////////
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include "Arduino.h"
+#include "adcModel.h"
+#include "basicHardware.h"
+#include "batteryProtector.h"
+#include "i2cBus.h"
+#include "pinMock.h"
+#include "simHal.h"
+
+namespace {
+
+  const float DIVIDER_TOP_OHMS = 100000.0f;
+  const float DIVIDER_BOTTOM_OHMS = 430000.0f;
+  const float CALIBRATION = 1.20f;
+
+  // The firmware's filter (BatteryProtector FILTER_*)
+  VoltageFilterConfig firmwareFilter() {
+    VoltageFilterConfig filter;
+    filter.oversampleCount = 4;
+    filter.medianWindow = 5;
+    filter.emaShift = 3;
+    return filter;
+  }
+
+  // Raw counts around 12 V with a little noise, in a fixed cycle
+  uint16_t rawSample(uint32_t i) {
+    static const int8_t NOISE[8] = { 0, 2, -1, 3, -2, 1, -3, 0 };
+    return (uint16_t)(812 + NOISE[i & 7]);
+  }
+
+}
+
+
+//////////////////////////////////////////////////////////
+// VOLTAGE SENSOR
+//////////////////////////////////////////////////////////
+static void SensorConvertRawToVolts(benchmark::State& state) {
+  PinMock pin;
+  VoltageSensor sensor(&pin, DIVIDER_TOP_OHMS, DIVIDER_BOTTOM_OHMS, CALIBRATION);
+  uint32_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(sensor.convertRawToVolts(rawSample(i++)));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(SensorConvertRawToVolts);
+
+static void SensorMillivoltsFromRaw(benchmark::State& state) {
+  PinMock pin;
+  VoltageSensor sensor(&pin, DIVIDER_TOP_OHMS, DIVIDER_BOTTOM_OHMS, CALIBRATION);
+  uint32_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(sensor.millivoltsFromRaw((uint16_t)(rawSample(i++) << VoltageSensor::RAW_FRACTION_BITS)));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(SensorMillivoltsFromRaw);
+
+static void SensorMillivoltsFromTable(benchmark::State& state) {
+  // The same conversion through an ADC calibration table
+  static const AdcCalibrationPoint POINTS[4] = { { 540, 11500 }, { 588, 12500 }, { 635, 13500 }, { 682, 14500 } };
+  static AdcCalibrationTable table; // 2 KB: off the stack
+  table.build(POINTS, 4);
+  PinMock pin;
+  VoltageSensor sensor(&pin, DIVIDER_TOP_OHMS, DIVIDER_BOTTOM_OHMS, CALIBRATION);
+  sensor.setCalibration(&table);
+  uint32_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(sensor.millivoltsFromRaw((uint16_t)(rawSample(i++) << VoltageSensor::RAW_FRACTION_BITS)));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(SensorMillivoltsFromTable);
+
+static void SensorFilterRaw(benchmark::State& state) {
+  // One raw sample into the oversample/median/EMA pipeline
+  PinMock pin;
+  VoltageSensor sensor(&pin, DIVIDER_TOP_OHMS, DIVIDER_BOTTOM_OHMS, CALIBRATION);
+  sensor.setFilter(firmwareFilter());
+  uint32_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(sensor.filterRaw(rawSample(i++)));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(SensorFilterRaw);
+
+static void SensorReadFiltered(benchmark::State& state) {
+  // The boot read: oversampleCount analogRead()s through the pipeline
+  PinMock pin;
+  pin.setAnalogValue(812);
+  VoltageSensor sensor(&pin, DIVIDER_TOP_OHMS, DIVIDER_BOTTOM_OHMS, CALIBRATION);
+  sensor.init();
+  sensor.setFilter(firmwareFilter());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(sensor.readFiltered());
+  }
+  state.SetItemsProcessed(state.iterations() * firmwareFilter().oversampleCount);
+}
+BENCHMARK(SensorReadFiltered);
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// PROTECTOR STATE MACHINE
+//////////////////////////////////////////////////////////
+static void ProtectorUpdate(benchmark::State& state) {
+  // Argument 0: steady 12.6 V, armed. Argument 1: 10.5 V and 13.2 V in
+  // turn every 3 s with a 1 s rearm delay, so cutoffs and rearms recur
+  bool cycling = state.range(0) != 0;
+  sim::reset();
+  AdcModel adc;
+  sim::setAnalogInput(A0, adc.rawFromVolts(12.6f));
+  if (cycling) {
+    sim::addTickListener([&adc](unsigned long nowMs) {
+      sim::setAnalogInput(A0, adc.rawFromVolts((nowMs / 3000) % 2 ? 10.5f : 13.2f));
+    });
+  }
+  BatteryProtector protector(11.0f, 12.8f, 1000UL, nullptr);
+  unsigned long passes = 0;
+  for (auto _ : state) {
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    protector.update();
+    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+    state.SetIterationTime(std::chrono::duration<double>(end - start).count());
+    protector.idle(); // Clock to the next deadline; the sampler timer fires on the way
+    passes++;
+  }
+  state.SetItemsProcessed(passes);
+  state.counters["sim_us_per_pass"] = benchmark::Counter((double)sim::nowUs(), benchmark::Counter::kAvgIterations); // Virtual time idle() slept through
+  sim::reset(); // Timers pointing at the protector go before it does
+}
+BENCHMARK(ProtectorUpdate)->Arg(0)->Arg(1)->UseManualTime();
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// DISPLAY RENDERING
+//////////////////////////////////////////////////////////
+static void DisplayRefresh(benchmark::State& state) {
+  // Argument 0: the status screen with the voltage changing in the last
+  // digit (the usual once-per-second refresh). Argument 1: every cell
+  // redrawn (after invalidate(), as after a bus error)
+  bool full = state.range(0) != 0;
+  sim::reset();
+  Display display(0x27, 16, 2);
+  display.init();
+  static const char* const VOLTS[2] = { "12.61", "12.62" };
+  uint64_t bytes = 0;
+  uint64_t transactions = 0;
+  uint64_t cells = 0;
+  uint32_t i = 0;
+  for (auto _ : state) {
+    display.clear();
+    display.setCursor(0, 0);
+    display.print("Baterija: ");
+    display.print(VOLTS[i++ & 1]);
+    display.print("V");
+    display.setCursor(0, 1);
+    display.print("Potrosac: ON");
+    if (full) {
+      display.invalidate();
+    }
+    display.flush();
+    const DisplayRefreshStats& stats = display.getLastRefreshStats();
+    bytes += stats.i2cBytes;
+    transactions += stats.transactions;
+    cells += stats.cellsWritten;
+  }
+  state.counters["i2c_bytes_per_refresh"] = benchmark::Counter((double)bytes, benchmark::Counter::kAvgIterations);
+  state.counters["transactions_per_refresh"] = benchmark::Counter((double)transactions, benchmark::Counter::kAvgIterations);
+  state.counters["cells_per_refresh"] = benchmark::Counter((double)cells, benchmark::Counter::kAvgIterations);
+  sim::reset();
+}
+BENCHMARK(DisplayRefresh)->Arg(0)->Arg(1);
+//////////////////////////////////////////////////////////
+
+BENCHMARK_MAIN();
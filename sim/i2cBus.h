@@ -0,0 +1,62 @@
+#ifndef i2cBus_h
+#define i2cBus_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////
+// SIMULATED I2C BUS
+//
+// Devices attach at a 7-bit address and see every write transaction
+// the firmware sends through the fake Wire. The bus keeps traffic
+// statistics and charges bus time to the virtual clock (without firing
+// timers, like a blocking transfer on the real chip).
+//
+// Bus faults stand for a device holding a line low:
+//   SDA stuck  a slave stopped mid-byte. The master cannot send a START:
+//              transactions fail at once (status 4). Clocking SCL by hand
+//              (GPIO, open drain) releases it after a few pulses.
+//   SCL stuck  a slave stretching the clock forever. Every clock the core
+//              sends waits its clock stretch limit (150 ms by default)
+//              first: about 10 of those per transaction, then status 2.
+//              Only power-cycling the device clears it.
+// The fault shows on the SDA/SCL input levels (digitalRead).
+//////////////////////////////////////////////////////////
+namespace sim {
+
+  class I2cDevice {
+    public:
+      virtual ~I2cDevice() {}
+      virtual void onWrite(const uint8_t* data, size_t length) = 0;
+      virtual size_t onRead(uint8_t* data, size_t length) { return 0; }
+  };
+
+  enum I2cFault {
+    I2C_FAULT_NONE,
+    I2C_FAULT_SDA_STUCK,
+    I2C_FAULT_SCL_STUCK
+  };
+
+  struct I2cStats {
+    unsigned long transactions;
+    unsigned long bytes;      // On the wire, including the address byte
+    unsigned long long busUs; // Bus time at the configured clock
+  };
+
+  void attachI2cDevice(uint8_t address, I2cDevice* device);
+  void detachI2cDevice(uint8_t address);
+  I2cDevice* findI2cDevice(uint8_t address);
+  I2cStats getI2cStats();
+  void resetI2cStats();
+  void setI2cFault(I2cFault fault); // sim::reset() clears it
+  I2cFault getI2cFault();
+
+  // Accounting hooks used by the fake Wire and the pin shim
+  void chargeI2cTransaction(size_t bytesOnWire, uint32_t clockHz);
+  uint8_t chargeI2cFault(uint32_t clockStretchLimitUs); // 0 on a free bus, else the time lost is charged and the status returned
+  void onI2cLineChange(uint8_t pin); // pinMode()/digitalWrite() on SDA or SCL
+
+}
+//////////////////////////////////////////////////////////
+
+#endif
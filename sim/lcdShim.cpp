@@ -0,0 +1,201 @@
+#include "LiquidCrystal_I2C.h"
+#include "Wire.h"
+#include "simHal.h"
+
+namespace {
+
+  // PCF8574 backpack wiring
+  const uint8_t PORT_RS = 0x01;
+  const uint8_t PORT_EN = 0x04;
+  const uint8_t PORT_BACKLIGHT = 0x08;
+
+  const uint8_t ROW_OFFSETS[LiquidCrystal_I2C::MAX_ROWS] = { 0x00, 0x40, 0x14, 0x54 };
+
+}
+
+
+//////////////////////////////////////////////////////////
+// HD44780 MODEL
+//////////////////////////////////////////////////////////
+Hd44780Model :: Hd44780Model() {
+  memset(_ddram, ' ', sizeof(_ddram));
+  _address = 0;
+  _lastPort = 0;
+  _fourBitMode = false;
+  _haveHighNibble = false;
+  _highNibble = 0;
+  _writingCgram = false;
+  _commandCount = 0;
+  _dataCount = 0;
+}
+
+void Hd44780Model :: onWrite(const uint8_t* data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    uint8_t port = data[i];
+    if ((_lastPort & PORT_EN) && !(port & PORT_EN)) {
+      // Controller samples D4..D7 and Rs on the falling edge of En
+      _latch(_lastPort >> 4, (_lastPort & PORT_RS) != 0);
+    }
+    _lastPort = port;
+  }
+}
+
+void Hd44780Model :: _latch(uint8_t nibble, bool isData) {
+  if (!_fourBitMode) {
+    _execute(nibble << 4, isData);
+    return;
+  }
+  if (!_haveHighNibble) {
+    _highNibble = nibble;
+    _haveHighNibble = true;
+    return;
+  }
+  _haveHighNibble = false;
+  _execute((_highNibble << 4) | nibble, isData);
+}
+
+void Hd44780Model :: _execute(uint8_t value, bool isData) {
+  if (isData) {
+    _dataCount++;
+    if (_writingCgram) {
+      return; // Custom glyphs are not modelled
+    }
+    _ddram[_address] = (char)value;
+    _address = (_address + 1) & (DDRAM_SIZE - 1);
+    return;
+  }
+
+  _commandCount++;
+  if (value & 0x80) {
+    // Set DDRAM address
+    _address = value & (DDRAM_SIZE - 1);
+    _writingCgram = false;
+  } else if (value & 0x40) {
+    // Set CGRAM address
+    _writingCgram = true;
+  } else if (value & 0x20) {
+    // Function set: DL bit selects the interface width
+    _fourBitMode = (value & 0x10) == 0;
+    _haveHighNibble = false;
+  } else if (value == 0x01) {
+    // Clear display
+    memset(_ddram, ' ', sizeof(_ddram));
+    _address = 0;
+    _writingCgram = false;
+  } else if ((value & 0xFE) == 0x02) {
+    // Return home
+    _address = 0;
+    _writingCgram = false;
+  }
+  // Entry mode, display control and shift are accepted and ignored
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FAKE LIQUIDCRYSTAL_I2C
+//////////////////////////////////////////////////////////
+LiquidCrystal_I2C :: LiquidCrystal_I2C(uint8_t address, uint8_t columns, uint8_t rows) {
+  _address = address;
+  _columns = columns > MAX_COLUMNS ? MAX_COLUMNS : columns;
+  _rows = rows > MAX_ROWS ? MAX_ROWS : rows;
+  _backlightValue = PORT_BACKLIGHT;
+  sim::attachI2cDevice(_address, &_model);
+}
+
+LiquidCrystal_I2C :: ~LiquidCrystal_I2C() {
+  if (sim::findI2cDevice(_address) == &_model) {
+    sim::detachI2cDevice(_address);
+  }
+}
+
+void LiquidCrystal_I2C :: init() {
+  // Same power-on sequence as the library (HD44780 datasheet, figure 24),
+  // which starts with Wire.begin()
+  Wire.begin();
+  _expanderWrite(_backlightValue);
+  _write4bits(0x03 << 4);
+  sim::advanceBusyUs(4500);
+  _write4bits(0x03 << 4);
+  sim::advanceBusyUs(4500);
+  _write4bits(0x03 << 4);
+  sim::advanceBusyUs(150);
+  _write4bits(0x02 << 4);
+  _command(0x20 | (_rows > 1 ? 0x08 : 0x00)); // Function set: 4-bit, lines, 5x8
+  _command(0x08 | 0x04);                      // Display on, cursor off, blink off
+  clear();
+  _command(0x04 | 0x02);                      // Entry mode: left to right, no shift
+  home();
+}
+
+void LiquidCrystal_I2C :: backlight() {
+  _backlightValue = PORT_BACKLIGHT;
+  _expanderWrite(0);
+}
+
+void LiquidCrystal_I2C :: noBacklight() {
+  _backlightValue = 0;
+  _expanderWrite(0);
+}
+
+void LiquidCrystal_I2C :: clear() {
+  _command(0x01);
+  sim::advanceBusyUs(2000);
+}
+
+void LiquidCrystal_I2C :: home() {
+  _command(0x02);
+  sim::advanceBusyUs(2000);
+}
+
+void LiquidCrystal_I2C :: setCursor(uint8_t col, uint8_t row) {
+  if (row >= _rows) {
+    row = _rows - 1;
+  }
+  _command(0x80 | (col + ROW_OFFSETS[row]));
+}
+
+size_t LiquidCrystal_I2C :: write(uint8_t c) {
+  _send(c, PORT_RS);
+  return 1;
+}
+
+const char* LiquidCrystal_I2C :: rowText(uint8_t row) const {
+  _rowBuffer[0] = '\0';
+  if (row >= _rows) {
+    return _rowBuffer;
+  }
+  for (uint8_t col = 0; col < _columns; col++) {
+    _rowBuffer[col] = _model.ddram(ROW_OFFSETS[row] + col);
+  }
+  _rowBuffer[_columns] = '\0';
+  return _rowBuffer;
+}
+
+void LiquidCrystal_I2C :: _command(uint8_t value) {
+  _send(value, 0);
+}
+
+void LiquidCrystal_I2C :: _send(uint8_t value, uint8_t mode) {
+  _write4bits((value & 0xF0) | mode);
+  _write4bits(((value << 4) & 0xF0) | mode);
+}
+
+void LiquidCrystal_I2C :: _write4bits(uint8_t value) {
+  _expanderWrite(value);
+  _pulseEnable(value);
+}
+
+void LiquidCrystal_I2C :: _expanderWrite(uint8_t value) {
+  Wire.beginTransmission(_address);
+  Wire.write((uint8_t)(value | _backlightValue));
+  Wire.endTransmission();
+}
+
+void LiquidCrystal_I2C :: _pulseEnable(uint8_t value) {
+  _expanderWrite(value | PORT_EN);
+  sim::advanceBusyUs(1);  // Enable pulse must be >450 ns
+  _expanderWrite(value & ~PORT_EN);
+  sim::advanceBusyUs(50); // Commands need >37 us to settle
+}
+//////////////////////////////////////////////////////////
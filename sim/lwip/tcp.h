@@ -0,0 +1,74 @@
+#ifndef lwip_tcp_h
+#define lwip_tcp_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////
+// FAKE LWIP RAW TCP API
+//
+// The subset of lwIP 2 the firmware uses, with the same callback rules:
+// callbacks run from the network stack between sketch code (here: from
+// the virtual clock while the CPU is awake, see tcpNet.h), never inside
+// a tcp_* call (except tcp_abort(), which reports ERR_ABRT at once);
+// after the error callback the pcb is gone. Only IPv4.
+//////////////////////////////////////////////////////////
+typedef int8_t err_t;
+typedef uint8_t u8_t;
+typedef uint16_t u16_t;
+
+#define ERR_OK 0
+#define ERR_MEM -1
+#define ERR_TIMEOUT -3
+#define ERR_RTE -4
+#define ERR_VAL -6
+#define ERR_USE -8
+#define ERR_ISCONN -10
+#define ERR_CONN -11
+#define ERR_ABRT -13
+#define ERR_RST -14
+#define ERR_CLSD -15
+#define ERR_ARG -16
+
+#define TCP_WRITE_FLAG_COPY 0x01
+#define TCP_WRITE_FLAG_MORE 0x02
+
+struct ip_addr_t {
+  uint32_t addr; // Network byte order
+};
+
+#define IP_ADDR4(ipaddr, a, b, c, d) \
+  ((ipaddr)->addr = (uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+struct pbuf {
+  struct pbuf* next;
+  void* payload;
+  u16_t tot_len;
+  u16_t len;
+};
+
+struct tcp_pcb;
+
+typedef err_t (*tcp_connected_fn)(void* arg, struct tcp_pcb* tpcb, err_t err);
+typedef err_t (*tcp_recv_fn)(void* arg, struct tcp_pcb* tpcb, struct pbuf* p, err_t err);
+typedef err_t (*tcp_sent_fn)(void* arg, struct tcp_pcb* tpcb, u16_t len);
+typedef void (*tcp_err_fn)(void* arg, err_t err);
+
+struct tcp_pcb* tcp_new(void);
+void tcp_arg(struct tcp_pcb* pcb, void* arg);
+void tcp_recv(struct tcp_pcb* pcb, tcp_recv_fn recv);
+void tcp_sent(struct tcp_pcb* pcb, tcp_sent_fn sent);
+void tcp_err(struct tcp_pcb* pcb, tcp_err_fn err);
+err_t tcp_connect(struct tcp_pcb* pcb, const ip_addr_t* ipaddr, u16_t port, tcp_connected_fn connected);
+err_t tcp_write(struct tcp_pcb* pcb, const void* dataptr, u16_t len, u8_t apiflags);
+err_t tcp_output(struct tcp_pcb* pcb);
+u16_t tcp_sndbuf(struct tcp_pcb* pcb);
+void tcp_recved(struct tcp_pcb* pcb, u16_t len);
+err_t tcp_close(struct tcp_pcb* pcb);
+void tcp_abort(struct tcp_pcb* pcb);
+
+u8_t pbuf_free(struct pbuf* p);
+u16_t pbuf_copy_partial(const struct pbuf* p, void* dataptr, u16_t len, u16_t offset);
+//////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,194 @@
+#include "mqttBroker.h"
+#include "simHal.h"
+
+namespace {
+
+  const uint8_t PACKET_CONNECT = 1;
+  const uint8_t PACKET_CONNACK = 2;
+  const uint8_t PACKET_PUBLISH = 3;
+  const uint8_t PACKET_PUBACK = 4;
+  const uint8_t PACKET_PINGREQ = 12;
+  const uint8_t PACKET_PINGRESP = 13;
+  const uint8_t PACKET_DISCONNECT = 14;
+
+  // Length-prefixed string at body[offset]; false when it runs past the end
+  bool readString(const uint8_t* body, size_t length, size_t& offset, std::string& text) {
+    if (offset + 2 > length) {
+      return false;
+    }
+    size_t size = ((size_t)body[offset] << 8) | body[offset + 1];
+    if (offset + 2 + size > length) {
+      return false;
+    }
+    text.assign((const char*)body + offset + 2, size);
+    offset += 2 + size;
+    return true;
+  }
+
+}
+
+
+//////////////////////////////////////////////////////////
+// MQTT BROKER MODEL
+//////////////////////////////////////////////////////////
+MqttBrokerModel :: MqttBrokerModel(uint32_t address, uint16_t port) {
+  _address = address;
+  _port = port;
+  _isResponding = true;
+  _connects = 0;
+  _pings = 0;
+  _protocolErrors = 0;
+  _keepAliveSeconds = 0;
+  sim::attachTcpServer(_address, _port, this);
+}
+
+MqttBrokerModel :: ~MqttBrokerModel() {
+  sim::detachTcpServer(_address, _port);
+}
+
+bool MqttBrokerModel :: hasSession() const {
+  for (std::map<int, Session>::const_iterator it = _sessions.begin(); it != _sessions.end(); ++it) {
+    if (it->second.isConnected) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool MqttBrokerModel :: onAccept(int connection) {
+  Session session;
+  session.isConnected = false;
+  _sessions[connection] = session;
+  return true;
+}
+
+void MqttBrokerModel :: onReceive(int connection, const uint8_t* data, size_t length) {
+  std::map<int, Session>::iterator found = _sessions.find(connection);
+  if (found == _sessions.end()) {
+    return;
+  }
+  Session& session = found->second;
+  session.received.insert(session.received.end(), data, data + length);
+
+  // Whole packets: fixed header, remaining length (varint), body
+  while (session.received.size() >= 2) {
+    size_t remaining = 0;
+    size_t headerBytes = 1;
+    uint8_t shift = 0;
+    bool complete = false;
+    while (headerBytes < session.received.size() && headerBytes <= 4) {
+      uint8_t byte = session.received[headerBytes++];
+      remaining |= (size_t)(byte & 0x7F) << shift;
+      shift += 7;
+      if (!(byte & 0x80)) {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete) {
+      if (headerBytes > 4) {
+        _protocolErrors++;
+        _sessions.erase(found);
+        sim::resetTcp(connection);
+      }
+      return;
+    }
+    if (session.received.size() < headerBytes + remaining) {
+      return;
+    }
+    uint8_t type = session.received[0] >> 4;
+    uint8_t flags = session.received[0] & 0x0F;
+    std::vector<uint8_t> body(session.received.begin() + headerBytes, session.received.begin() + headerBytes + remaining);
+    session.received.erase(session.received.begin(), session.received.begin() + headerBytes + remaining);
+    if (!_handlePacket(connection, session, type, flags, body.data(), body.size())) {
+      _protocolErrors++;
+      _sessions.erase(found);
+      sim::resetTcp(connection);
+      return;
+    }
+    if (type == PACKET_DISCONNECT) {
+      _sessions.erase(found);
+      sim::closeTcp(connection);
+      return;
+    }
+  }
+}
+
+void MqttBrokerModel :: onClose(int connection) {
+  _sessions.erase(connection);
+}
+
+bool MqttBrokerModel :: _handlePacket(int connection, Session& session, uint8_t type, uint8_t flags, const uint8_t* body, size_t length) {
+  if (!session.isConnected && type != PACKET_CONNECT) {
+    return false; // CONNECT comes first
+  }
+  switch (type) {
+    case PACKET_CONNECT: {
+      size_t offset = 0;
+      std::string protocol;
+      if (session.isConnected || !readString(body, length, offset, protocol) || protocol != "MQTT" || offset + 4 > length) {
+        return false;
+      }
+      uint8_t level = body[offset];
+      uint8_t connectFlags = body[offset + 1];
+      uint16_t keepAlive = (uint16_t)((body[offset + 2] << 8) | body[offset + 3]);
+      offset += 4;
+      if (level != 4 || (connectFlags & 0x01) || !readString(body, length, offset, session.clientId)) {
+        return false;
+      }
+      // Will, user name and password are not used by the firmware
+      if (connectFlags & 0xC4) {
+        return false;
+      }
+      session.isConnected = true;
+      _keepAliveSeconds = keepAlive;
+      _connects++;
+      const uint8_t connack[] = { PACKET_CONNACK << 4, 2, 0, 0 };
+      _reply(connection, connack, sizeof(connack));
+      return true;
+    }
+    case PACKET_PUBLISH: {
+      Message message;
+      size_t offset = 0;
+      message.qos = (flags >> 1) & 0x03;
+      message.isDuplicate = (flags & 0x08) != 0;
+      if (message.qos > 1 || !readString(body, length, offset, message.topic)) {
+        return false;
+      }
+      uint16_t packetId = 0;
+      if (message.qos > 0) {
+        if (offset + 2 > length) {
+          return false;
+        }
+        packetId = (uint16_t)((body[offset] << 8) | body[offset + 1]);
+        offset += 2;
+      }
+      message.clientId = session.clientId;
+      message.payload.assign(body + offset, body + length);
+      message.atMs = (unsigned long)(sim::nowUs() / 1000);
+      _messages.push_back(message);
+      if (message.qos > 0) {
+        const uint8_t puback[] = { PACKET_PUBACK << 4, 2, (uint8_t)(packetId >> 8), (uint8_t)(packetId & 0xFF) };
+        _reply(connection, puback, sizeof(puback));
+      }
+      return true;
+    }
+    case PACKET_PINGREQ: {
+      _pings++;
+      const uint8_t pingresp[] = { PACKET_PINGRESP << 4, 0 };
+      _reply(connection, pingresp, sizeof(pingresp));
+      return true;
+    }
+    case PACKET_DISCONNECT:
+      return true;
+    default:
+      return false; // Nothing else is expected from a publisher
+  }
+}
+
+void MqttBrokerModel :: _reply(int connection, const uint8_t* data, size_t length) {
+  if (_isResponding) {
+    sim::sendTcp(connection, data, length);
+  }
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,67 @@
+#ifndef mqttBroker_h
+#define mqttBroker_h
+
+#include <map>
+#include <string>
+#include <vector>
+#include "tcpNet.h"
+
+//////////////////////////////////////////////////////////
+// MQTT BROKER MODEL
+//
+// Local broker stand-in for the simulated network: listens at an
+// address and port while it exists and speaks the MQTT 3.1.1 subset
+// the firmware uses (CONNECT, PUBLISH at QoS 0/1, PINGREQ, DISCONNECT).
+// Every PUBLISH is kept for inspection. With setResponding(false) it
+// still reads but answers nothing, like a broker that hung.
+//////////////////////////////////////////////////////////
+class MqttBrokerModel : public sim::TcpServer {
+  public:
+    struct Message {
+      std::string clientId;
+      std::string topic;
+      std::vector<uint8_t> payload;
+      uint8_t qos;
+      bool isDuplicate;
+      unsigned long atMs; // Wall time of arrival
+    };
+
+    MqttBrokerModel(uint32_t address, uint16_t port = 1883);
+    ~MqttBrokerModel();
+
+    void setResponding(bool responding) { _isResponding = responding; }
+    const std::vector<Message>& getMessages() const { return _messages; }
+    void clearMessages() { _messages.clear(); }
+    unsigned long getConnectCount() const { return _connects; }       // CONNECTs accepted
+    unsigned long getPingCount() const { return _pings; }
+    unsigned long getProtocolErrors() const { return _protocolErrors; } // Malformed packets (connection reset)
+    uint16_t getKeepAliveSeconds() const { return _keepAliveSeconds; } // From the last CONNECT
+    bool hasSession() const; // A client is connected and past CONNECT
+
+    bool onAccept(int connection);
+    void onReceive(int connection, const uint8_t* data, size_t length);
+    void onClose(int connection);
+
+  private:
+    struct Session {
+      std::vector<uint8_t> received; // Bytes of the packet being assembled
+      bool isConnected;
+      std::string clientId;
+    };
+
+    uint32_t _address;
+    uint16_t _port;
+    bool _isResponding;
+    std::map<int, Session> _sessions;
+    std::vector<Message> _messages;
+    unsigned long _connects;
+    unsigned long _pings;
+    unsigned long _protocolErrors;
+    uint16_t _keepAliveSeconds;
+
+    bool _handlePacket(int connection, Session& session, uint8_t type, uint8_t flags, const uint8_t* body, size_t length);
+    void _reply(int connection, const uint8_t* data, size_t length);
+};
+//////////////////////////////////////////////////////////
+
+#endif
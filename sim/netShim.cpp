@@ -0,0 +1,486 @@
+#include <map>
+#include <vector>
+#include "Arduino.h"
+#include "ESP8266WiFi.h"
+#include "lwip/tcp.h"
+#include "simHal.h"
+#include "tcpNet.h"
+
+//////////////////////////////////////////////////////////
+// SIMULATED NETWORK STATE
+//////////////////////////////////////////////////////////
+struct tcp_pcb {
+  enum State {
+    STATE_NEW,
+    STATE_SYN_SENT,
+    STATE_ESTABLISHED
+  };
+  int id;
+  State state;
+  void* arg;
+  tcp_connected_fn connected;
+  tcp_recv_fn recv;
+  tcp_sent_fn sent;
+  tcp_err_fn err;
+  std::vector<uint8_t> unsent; // Written, waiting for tcp_output()
+  u16_t unacked;               // Sent, waiting for the ACK
+};
+
+namespace {
+
+  const u16_t SND_BUF = 1072;              // TCP_SND_BUF of the core's default lwIP build (2 x 536 MSS)
+  const unsigned long SYN_TIMEOUT_MS = 18000; // lwIP gives up after its SYN retries
+
+  enum SegmentKind {
+    SEGMENT_SYN,        // Client to server
+    SEGMENT_SYN_ACK,    // Server to client
+    SEGMENT_SYN_TIMEOUT,
+    SEGMENT_DATA,       // Client to server
+    SEGMENT_ACK,        // Server to client, for SEGMENT_DATA
+    SEGMENT_REPLY,      // Server to client
+    SEGMENT_FIN,        // Server to client
+    SEGMENT_RST         // Server to client
+  };
+
+  struct Segment {
+    uint64_t dueUs;
+    SegmentKind kind;
+    int connection;
+    std::vector<uint8_t> data;
+  };
+
+  struct Connection {
+    tcp_pcb* pcb;            // nullptr once the client let go
+    sim::TcpServer* server;  // nullptr when nothing listened
+    bool isStalled;          // A segment was lost: nothing gets through any more
+    uint64_t serverKey;      // Address and port connected to
+  };
+
+  std::map<uint64_t, sim::TcpServer*> g_servers; // address << 16 | port
+  std::map<int, Connection> g_connections;
+  std::vector<Segment> g_segments;
+  int g_nextConnection = 1;
+  sim::NetworkStats g_stats;
+
+  bool g_accessPointUp = true;
+  bool g_linkUp = true;
+  unsigned long g_latencyMs = 10;
+  unsigned long g_associationMs = 2000;
+  bool g_persistent = true;
+  bool g_isStationWanted = false;
+  bool g_isAssociated = false;
+  uint64_t g_associateAtUs = 0; // 0: no association under way
+
+  uint64_t serverKey(uint32_t address, uint16_t port) {
+    return ((uint64_t)address << 16) | port;
+  }
+
+  bool isStationUp() {
+    return g_isAssociated && sim::isRadioOn() && (WiFi.getMode() & WIFI_STA);
+  }
+
+  void schedule(SegmentKind kind, int connection, const uint8_t* data = nullptr, size_t length = 0) {
+    Segment segment;
+    segment.dueUs = sim::nowUs() + (uint64_t)g_latencyMs * 1000;
+    segment.kind = kind;
+    segment.connection = connection;
+    if (data) {
+      segment.data.assign(data, data + length);
+    }
+    g_segments.push_back(segment);
+  }
+
+  // A segment leaving either end: lost while the link or the station is
+  // down, and then the connection never recovers
+  bool transmit(SegmentKind kind, int connection, const uint8_t* data = nullptr, size_t length = 0) {
+    std::map<int, Connection>::iterator found = g_connections.find(connection);
+    if (found == g_connections.end() || found->second.isStalled) {
+      return false;
+    }
+    if (!g_linkUp || !isStationUp()) {
+      found->second.isStalled = true;
+      g_stats.lostSegments++;
+      return false;
+    }
+    schedule(kind, connection, data, length);
+    return true;
+  }
+
+  void freePcb(tcp_pcb* pcb) {
+    std::map<int, Connection>::iterator found = g_connections.find(pcb->id);
+    if (found != g_connections.end()) {
+      found->second.pcb = nullptr;
+      if (found->second.server) {
+        found->second.server->onClose(pcb->id);
+        found->second.server = nullptr;
+      }
+    }
+    delete pcb;
+  }
+
+  void failPcb(tcp_pcb* pcb, err_t err) {
+    tcp_err_fn callback = pcb->err;
+    void* arg = pcb->arg;
+    freePcb(pcb);
+    if (callback) {
+      callback(arg, err);
+    }
+  }
+
+  void deliver(const Segment& segment) {
+    std::map<int, Connection>::iterator found = g_connections.find(segment.connection);
+    if (found == g_connections.end()) {
+      return;
+    }
+    Connection& connection = found->second;
+    tcp_pcb* pcb = connection.pcb;
+    if (connection.isStalled && segment.kind != SEGMENT_SYN_TIMEOUT) {
+      return;
+    }
+
+    switch (segment.kind) {
+      case SEGMENT_SYN: {
+        std::map<uint64_t, sim::TcpServer*>::iterator server = g_servers.find(connection.serverKey);
+        if (server == g_servers.end() || !server->second->onAccept(segment.connection)) {
+          schedule(SEGMENT_RST, segment.connection);
+          return;
+        }
+        g_stats.connects++;
+        connection.server = server->second;
+        schedule(SEGMENT_SYN_ACK, segment.connection);
+        return;
+      }
+      case SEGMENT_DATA:
+        if (connection.server) {
+          g_stats.clientBytes += segment.data.size();
+          connection.server->onReceive(segment.connection, segment.data.data(), segment.data.size());
+          if (g_connections.count(segment.connection) && !g_connections[segment.connection].isStalled) {
+            uint16_t length = (uint16_t)segment.data.size();
+            schedule(SEGMENT_ACK, segment.connection, (const uint8_t*)&length, sizeof(length));
+          }
+        }
+        return;
+      default:
+        break;
+    }
+
+    // Everything else arrives at the firmware
+    if (!pcb) {
+      return;
+    }
+    switch (segment.kind) {
+      case SEGMENT_SYN_ACK:
+        if (pcb->state == tcp_pcb::STATE_SYN_SENT) {
+          pcb->state = tcp_pcb::STATE_ESTABLISHED;
+          if (pcb->connected) {
+            pcb->connected(pcb->arg, pcb, ERR_OK);
+          }
+        }
+        break;
+      case SEGMENT_SYN_TIMEOUT:
+        if (pcb->state == tcp_pcb::STATE_SYN_SENT) {
+          failPcb(pcb, ERR_ABRT);
+        }
+        break;
+      case SEGMENT_ACK: {
+        uint16_t length;
+        memcpy(&length, segment.data.data(), sizeof(length));
+        pcb->unacked -= length;
+        if (pcb->sent) {
+          pcb->sent(pcb->arg, pcb, length);
+        }
+        break;
+      }
+      case SEGMENT_REPLY:
+        if (pcb->recv) {
+          g_stats.serverBytes += segment.data.size();
+          pbuf* p = new pbuf;
+          p->next = nullptr;
+          p->payload = new uint8_t[segment.data.size()];
+          memcpy(p->payload, segment.data.data(), segment.data.size());
+          p->tot_len = (u16_t)segment.data.size();
+          p->len = p->tot_len;
+          pcb->recv(pcb->arg, pcb, p, ERR_OK); // The callback owns p from here
+        }
+        break;
+      case SEGMENT_FIN:
+        if (pcb->recv) {
+          pcb->recv(pcb->arg, pcb, nullptr, ERR_OK);
+        }
+        break;
+      case SEGMENT_RST:
+        connection.server = nullptr;
+        failPcb(pcb, ERR_RST);
+        break;
+      default:
+        break;
+    }
+  }
+
+}
+
+namespace sim {
+
+  uint32_t ipAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+    ip_addr_t address;
+    IP_ADDR4(&address, a, b, c, d);
+    return address.addr;
+  }
+
+  void attachTcpServer(uint32_t address, uint16_t port, TcpServer* server) {
+    g_servers[serverKey(address, port)] = server;
+  }
+
+  void detachTcpServer(uint32_t address, uint16_t port) {
+    TcpServer* server = g_servers[serverKey(address, port)];
+    g_servers.erase(serverKey(address, port));
+    for (std::map<int, Connection>::iterator it = g_connections.begin(); it != g_connections.end(); ++it) {
+      if (it->second.server == server) {
+        it->second.server = nullptr;
+        it->second.isStalled = true; // Host gone: silence, like a crashed broker
+      }
+    }
+  }
+
+  void sendTcp(int connection, const uint8_t* data, size_t length) {
+    transmit(SEGMENT_REPLY, connection, data, length);
+  }
+
+  void closeTcp(int connection) {
+    transmit(SEGMENT_FIN, connection);
+  }
+
+  void resetTcp(int connection) {
+    transmit(SEGMENT_RST, connection);
+  }
+
+  void setAccessPoint(bool up) {
+    g_accessPointUp = up;
+    if (!up) {
+      g_isAssociated = false;
+      g_associateAtUs = 0;
+    }
+  }
+
+  void setLinkUp(bool up) {
+    g_linkUp = up;
+  }
+
+  void setNetworkLatencyMs(unsigned long ms) {
+    g_latencyMs = ms;
+  }
+
+  void setAssociationMs(unsigned long ms) {
+    g_associationMs = ms;
+  }
+
+  NetworkStats getNetworkStats() {
+    return g_stats;
+  }
+
+  void runNetwork(unsigned long nowMs) {
+    // Station: joins (and rejoins, like the core's auto-reconnect) while
+    // the access point is up and the modem is on
+    bool canAssociate = g_isStationWanted && g_accessPointUp && sim::isRadioOn() && (WiFi.getMode() & WIFI_STA);
+    if (!canAssociate) {
+      g_isAssociated = false;
+      g_associateAtUs = 0;
+    } else if (!g_isAssociated) {
+      if (g_associateAtUs == 0) {
+        g_associateAtUs = sim::nowUs() + (uint64_t)g_associationMs * 1000;
+      } else if (sim::nowUs() >= g_associateAtUs) {
+        g_isAssociated = true;
+        g_associateAtUs = 0;
+      }
+    }
+
+    // Segments in the order they were sent; callbacks may send more
+    std::vector<Segment> due;
+    for (size_t i = 0; i < g_segments.size();) {
+      if (g_segments[i].dueUs <= sim::nowUs()) {
+        due.push_back(g_segments[i]);
+        g_segments.erase(g_segments.begin() + i);
+      } else {
+        i++;
+      }
+    }
+    for (size_t i = 0; i < due.size(); i++) {
+      deliver(due[i]);
+    }
+  }
+
+  void resetNetwork(bool powerCycle) {
+    // Client pcbs die with the chip; servers see the connections drop
+    for (std::map<int, Connection>::iterator it = g_connections.begin(); it != g_connections.end(); ++it) {
+      if (it->second.server) {
+        it->second.server->onClose(it->first);
+      }
+      delete it->second.pcb;
+    }
+    g_connections.clear();
+    g_segments.clear();
+    g_isStationWanted = false;
+    g_isAssociated = false;
+    g_associateAtUs = 0;
+    if (powerCycle) {
+      g_stats = NetworkStats();
+      g_accessPointUp = true;
+      g_linkUp = true;
+      g_latencyMs = 10;
+      g_associationMs = 2000;
+      g_persistent = true;
+    }
+  }
+
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FAKE ESP8266WIFI (station)
+//////////////////////////////////////////////////////////
+void ESP8266WiFiClass :: persistent(bool persistent) {
+  g_persistent = persistent;
+}
+
+wl_status_t ESP8266WiFiClass :: begin(const char* ssid, const char* passphrase) {
+  (void)ssid;
+  (void)passphrase;
+  g_isStationWanted = true;
+  g_isAssociated = false;
+  g_associateAtUs = 0;
+  return WL_DISCONNECTED;
+}
+
+bool ESP8266WiFiClass :: disconnect(bool wifiOff) {
+  g_isStationWanted = false;
+  g_isAssociated = false;
+  g_associateAtUs = 0;
+  if (wifiOff) {
+    mode(WIFI_OFF);
+  }
+  return true;
+}
+
+wl_status_t ESP8266WiFiClass :: status() {
+  if (isStationUp()) {
+    return WL_CONNECTED;
+  }
+  return g_isStationWanted && !g_accessPointUp ? WL_NO_SSID_AVAIL : WL_DISCONNECTED;
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FAKE LWIP RAW TCP API
+//////////////////////////////////////////////////////////
+struct tcp_pcb* tcp_new(void) {
+  tcp_pcb* pcb = new tcp_pcb;
+  pcb->id = g_nextConnection++;
+  pcb->state = tcp_pcb::STATE_NEW;
+  pcb->arg = nullptr;
+  pcb->connected = nullptr;
+  pcb->recv = nullptr;
+  pcb->sent = nullptr;
+  pcb->err = nullptr;
+  pcb->unacked = 0;
+  return pcb;
+}
+
+void tcp_arg(struct tcp_pcb* pcb, void* arg) {
+  pcb->arg = arg;
+}
+
+void tcp_recv(struct tcp_pcb* pcb, tcp_recv_fn recv) {
+  pcb->recv = recv;
+}
+
+void tcp_sent(struct tcp_pcb* pcb, tcp_sent_fn sent) {
+  pcb->sent = sent;
+}
+
+void tcp_err(struct tcp_pcb* pcb, tcp_err_fn err) {
+  pcb->err = err;
+}
+
+err_t tcp_connect(struct tcp_pcb* pcb, const ip_addr_t* ipaddr, u16_t port, tcp_connected_fn connected) {
+  if (pcb->state != tcp_pcb::STATE_NEW) {
+    return ERR_ISCONN;
+  }
+  if (!isStationUp()) {
+    return ERR_RTE; // No interface up
+  }
+  pcb->connected = connected;
+  pcb->state = tcp_pcb::STATE_SYN_SENT;
+  Connection connection;
+  connection.pcb = pcb;
+  connection.server = nullptr;
+  connection.isStalled = false;
+  connection.serverKey = serverKey(ipaddr->addr, port);
+  g_connections[pcb->id] = connection;
+  // A lost SYN is retried by lwIP until it gives up; so is an unanswered one
+  transmit(SEGMENT_SYN, pcb->id);
+  Segment timeout;
+  timeout.dueUs = sim::nowUs() + (uint64_t)SYN_TIMEOUT_MS * 1000;
+  timeout.kind = SEGMENT_SYN_TIMEOUT;
+  timeout.connection = pcb->id;
+  g_segments.push_back(timeout);
+  return ERR_OK;
+}
+
+err_t tcp_write(struct tcp_pcb* pcb, const void* dataptr, u16_t len, u8_t apiflags) {
+  if (pcb->state != tcp_pcb::STATE_ESTABLISHED) {
+    return ERR_CONN;
+  }
+  if (len > tcp_sndbuf(pcb)) {
+    return ERR_MEM;
+  }
+  const uint8_t* bytes = static_cast<const uint8_t*>(dataptr);
+  pcb->unsent.insert(pcb->unsent.end(), bytes, bytes + len);
+  return ERR_OK;
+}
+
+err_t tcp_output(struct tcp_pcb* pcb) {
+  if (pcb->unsent.empty()) {
+    return ERR_OK;
+  }
+  pcb->unacked += (u16_t)pcb->unsent.size();
+  transmit(SEGMENT_DATA, pcb->id, pcb->unsent.data(), pcb->unsent.size());
+  pcb->unsent.clear();
+  return ERR_OK;
+}
+
+u16_t tcp_sndbuf(struct tcp_pcb* pcb) {
+  return SND_BUF - pcb->unacked - (u16_t)pcb->unsent.size();
+}
+
+void tcp_recved(struct tcp_pcb* pcb, u16_t len) {
+  (void)pcb;
+  (void)len; // The window is not modelled
+}
+
+err_t tcp_close(struct tcp_pcb* pcb) {
+  freePcb(pcb); // The FIN reaches the server at once; lwIP keeps the pcb, the caller may not
+  return ERR_OK;
+}
+
+void tcp_abort(struct tcp_pcb* pcb) {
+  // Like lwIP, the error callback hears about it (ERR_ABRT) before this returns
+  failPcb(pcb, ERR_ABRT);
+}
+
+u8_t pbuf_free(struct pbuf* p) {
+  delete[] static_cast<uint8_t*>(p->payload);
+  delete p;
+  return 1;
+}
+
+u16_t pbuf_copy_partial(const struct pbuf* p, void* dataptr, u16_t len, u16_t offset) {
+  if (offset >= p->tot_len) {
+    return 0;
+  }
+  u16_t count = p->tot_len - offset < len ? p->tot_len - offset : len;
+  memcpy(dataptr, static_cast<const uint8_t*>(p->payload) + offset, count);
+  return count;
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,43 @@
+#ifndef oneWireBus_h
+#define oneWireBus_h
+
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////
+// SIMULATED 1-WIRE BUS
+//
+// One device per pin sees the resets and bytes the firmware sends
+// through the fake OneWire library and answers its read slots. Bus time
+// is charged to the virtual clock as blocking work, like the library's
+// bit-banged slots with interrupts off: ~960 us per reset, ~520 us per
+// byte (8 slots of ~65 us).
+//////////////////////////////////////////////////////////
+namespace sim {
+
+  class OneWireDevice {
+    public:
+      virtual ~OneWireDevice() {}
+      virtual void onReset() = 0; // Presence pulse follows
+      virtual void onWrite(uint8_t value) = 0;
+      virtual uint8_t onRead() = 0;
+  };
+
+  struct OneWireStats {
+    unsigned long resets;
+    unsigned long bytes;      // Written and read
+    unsigned long long busUs;
+  };
+
+  void attachOneWireDevice(uint8_t pin, OneWireDevice* device);
+  void detachOneWireDevice(uint8_t pin);
+  OneWireDevice* findOneWireDevice(uint8_t pin);
+  OneWireStats getOneWireStats();
+  void resetOneWireStats();
+
+  // Accounting hook used by the fake OneWire
+  void chargeOneWire(unsigned long resets, unsigned long bytes);
+
+}
+//////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,108 @@
+#include <map>
+#include "OneWire.h"
+#include "oneWireBus.h"
+#include "simHal.h"
+
+
+//////////////////////////////////////////////////////////
+// SIMULATED 1-WIRE BUS
+//////////////////////////////////////////////////////////
+namespace {
+
+  std::map<uint8_t, sim::OneWireDevice*> g_devices;
+  sim::OneWireStats g_stats = { 0, 0, 0 };
+
+  const uint32_t RESET_US = 960; // 480 us low, 480 us presence window
+  const uint32_t BYTE_US = 520;  // 8 slots of ~65 us
+
+}
+
+namespace sim {
+
+  void attachOneWireDevice(uint8_t pin, OneWireDevice* device) {
+    g_devices[pin] = device;
+  }
+
+  void detachOneWireDevice(uint8_t pin) {
+    g_devices.erase(pin);
+  }
+
+  OneWireDevice* findOneWireDevice(uint8_t pin) {
+    if (pin >= 16) {
+      return nullptr;
+    }
+    std::map<uint8_t, OneWireDevice*>::iterator it = g_devices.find(pin);
+    return it == g_devices.end() ? nullptr : it->second;
+  }
+
+  OneWireStats getOneWireStats() {
+    return g_stats;
+  }
+
+  void resetOneWireStats() {
+    g_stats.resets = 0;
+    g_stats.bytes = 0;
+    g_stats.busUs = 0;
+  }
+
+  void chargeOneWire(unsigned long resets, unsigned long bytes) {
+    unsigned long long busUs = (unsigned long long)resets * RESET_US + (unsigned long long)bytes * BYTE_US;
+    g_stats.resets += resets;
+    g_stats.bytes += bytes;
+    g_stats.busUs += busUs;
+    advanceBusyUs(busUs);
+  }
+
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FAKE ONEWIRE LIBRARY
+//////////////////////////////////////////////////////////
+uint8_t OneWire :: reset() {
+  sim::chargeOneWire(1, 0);
+  sim::OneWireDevice* device = sim::findOneWireDevice(_pin);
+  if (!device) {
+    return 0;
+  }
+  device->onReset();
+  return 1;
+}
+
+void OneWire :: skip() {
+  write(0xCC);
+}
+
+void OneWire :: write(uint8_t value, uint8_t power) {
+  (void)power;
+  sim::chargeOneWire(0, 1);
+  sim::OneWireDevice* device = sim::findOneWireDevice(_pin);
+  if (device) {
+    device->onWrite(value);
+  }
+}
+
+uint8_t OneWire :: read() {
+  sim::chargeOneWire(0, 1);
+  sim::OneWireDevice* device = sim::findOneWireDevice(_pin);
+  return device ? device->onRead() : 0xFF;
+}
+
+uint8_t OneWire :: crc8(const uint8_t* data, uint8_t length) {
+  // x^8 + x^5 + x^4 + 1, least significant bit first
+  uint8_t crc = 0;
+  while (length--) {
+    uint8_t byte = *data++;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      uint8_t mix = (crc ^ byte) & 0x01;
+      crc >>= 1;
+      if (mix) {
+        crc ^= 0x8C;
+      }
+      byte >>= 1;
+    }
+  }
+  return crc;
+}
+//////////////////////////////////////////////////////////
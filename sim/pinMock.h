@@ -0,0 +1,49 @@
+#ifndef pinMock_h
+#define pinMock_h
+
+#include "Arduino.h"
+#include "basicHardware.h"
+
+//////////////////////////////////////////////////////////
+// PIN MOCK
+//
+// Self-contained Pin that never touches the shim's GPIO table.
+// Harnesses set the input side directly and inspect what the
+// component under test wrote.
+//////////////////////////////////////////////////////////
+class PinMock : public Pin {
+  public:
+    PinMock(uint8_t pinAddress = 0) {
+      _pinAddress = pinAddress;
+      _mode = INPUT;
+      _outputLevel = LOW;
+      _inputLevel = HIGH;
+      _analogValue = 0;
+      _writeCount = 0;
+      _analogReadCount = 0;
+    }
+
+    void setPinMode(uint8_t mode) { _mode = mode; }
+    void doDigitalWrite(uint8_t val) { _outputLevel = val; _writeCount++; }
+    int doDigitalRead() { return _inputLevel; }
+    int doAnalogRead() { _analogReadCount++; return _analogValue; }
+
+    // Harness side
+    void setInputLevel(uint8_t level) { _inputLevel = level; }
+    void setAnalogValue(int value) { _analogValue = value < 0 ? 0 : (value > 1023 ? 1023 : value); }
+    uint8_t getMode() const { return _mode; }
+    uint8_t getOutputLevel() const { return _outputLevel; }
+    unsigned long getWriteCount() const { return _writeCount; }
+    unsigned long getAnalogReadCount() const { return _analogReadCount; }
+
+  private:
+    uint8_t _mode;
+    uint8_t _outputLevel;
+    uint8_t _inputLevel;
+    int _analogValue;
+    unsigned long _writeCount;
+    unsigned long _analogReadCount;
+};
+//////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,133 @@
+#include <string.h>
+#include "OneWire.h"
+#include "sensorDevices.h"
+#include "simHal.h"
+
+//////////////////////////////////////////////////////////
+// INA219 / INA226 MODEL
+//////////////////////////////////////////////////////////
+Ina2xxModel :: Ina2xxModel(bool isIna226, uint8_t address, float shuntMilliohms) {
+  _isIna226 = isIna226;
+  _address = address;
+  _shuntMilliohms = shuntMilliohms;
+  _amps = 0.0f;
+  _pointer = 0;
+  _config = isIna226 ? 0x4127 : 0x399F; // Power-on defaults
+  _reads = 0;
+  sim::attachI2cDevice(_address, this);
+}
+
+Ina2xxModel :: ~Ina2xxModel() {
+  sim::detachI2cDevice(_address);
+}
+
+void Ina2xxModel :: onWrite(const uint8_t* data, size_t length) {
+  if (length == 0) {
+    return;
+  }
+  _pointer = data[0];
+  if (_pointer == 0x00 && length >= 3) {
+    _config = (uint16_t)((data[1] << 8) | data[2]);
+  }
+}
+
+size_t Ina2xxModel :: onRead(uint8_t* data, size_t length) {
+  uint16_t value = 0;
+  if (_pointer == 0x00) {
+    value = _config;
+  } else if (_pointer == 0x01) {
+    value = (uint16_t)_shuntCounts();
+    _reads++;
+  }
+  if (length > 0) {
+    data[0] = (uint8_t)(value >> 8);
+  }
+  if (length > 1) {
+    data[1] = (uint8_t)(value & 0xFF);
+  }
+  return length < 2 ? length : 2;
+}
+
+int16_t Ina2xxModel :: _shuntCounts() const {
+  float microvolts = _amps * _shuntMilliohms * 1000.0f;
+  float counts = microvolts / (_isIna226 ? 2.5f : 10.0f);
+  float limit = _isIna226 ? 32767.0f : 8000.0f; // INA219 at +-80 mV
+  counts = counts > limit ? limit : (counts < -limit ? -limit : counts);
+  return (int16_t)(counts < 0.0f ? counts - 0.5f : counts + 0.5f);
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// DS18B20 MODEL
+//////////////////////////////////////////////////////////
+Ds18b20Model :: Ds18b20Model(uint8_t pin) {
+  _pin = pin;
+  _celsius = 25.0f;
+  _phase = PHASE_IDLE;
+  // Power-on scratchpad: 85 C, alarm registers, 12-bit configuration
+  const uint8_t powerOn[8] = { 0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10 };
+  memcpy(_scratchpad, powerOn, sizeof(powerOn));
+  _scratchpad[8] = OneWire::crc8(_scratchpad, 8);
+  _readIndex = 0;
+  _isConverting = false;
+  _conversionDoneUs = 0;
+  _corruptNextRead = false;
+  _conversions = 0;
+  sim::attachOneWireDevice(_pin, this);
+}
+
+Ds18b20Model :: ~Ds18b20Model() {
+  sim::detachOneWireDevice(_pin);
+}
+
+void Ds18b20Model :: onReset() {
+  _finishConversion();
+  _phase = PHASE_ROM;
+}
+
+void Ds18b20Model :: onWrite(uint8_t value) {
+  _finishConversion();
+  if (_phase == PHASE_ROM) {
+    _phase = value == 0xCC ? PHASE_FUNCTION : PHASE_IDLE;
+  } else if (_phase == PHASE_FUNCTION) {
+    if (value == 0x44) {
+      _isConverting = true;
+      _conversionDoneUs = sim::nowUs() + CONVERSION_US;
+      _phase = PHASE_IDLE;
+    } else if (value == 0xBE) {
+      _readIndex = 0;
+      _phase = PHASE_READ;
+    } else {
+      _phase = PHASE_IDLE;
+    }
+  }
+}
+
+uint8_t Ds18b20Model :: onRead() {
+  _finishConversion();
+  if (_phase == PHASE_READ && _readIndex < sizeof(_scratchpad)) {
+    uint8_t value = _scratchpad[_readIndex++];
+    if (_readIndex == sizeof(_scratchpad) && _corruptNextRead) {
+      _corruptNextRead = false;
+      value ^= 0x01;
+    }
+    return value;
+  }
+  return _isConverting ? 0x00 : 0xFF; // Conversion status in the read slots
+}
+
+void Ds18b20Model :: _finishConversion() {
+  if (!_isConverting || sim::nowUs() < _conversionDoneUs) {
+    return;
+  }
+  _isConverting = false;
+  _conversions++;
+  // Sixteenths of a degree, two's complement
+  float sixteenths = _celsius * 16.0f;
+  int16_t counts = (int16_t)(sixteenths < 0.0f ? sixteenths - 0.5f : sixteenths + 0.5f);
+  _scratchpad[0] = (uint8_t)(counts & 0xFF);
+  _scratchpad[1] = (uint8_t)((uint16_t)counts >> 8);
+  _scratchpad[8] = OneWire::crc8(_scratchpad, 8);
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,84 @@
+#ifndef sensorDevices_h
+#define sensorDevices_h
+
+#include "i2cBus.h"
+#include "oneWireBus.h"
+
+//////////////////////////////////////////////////////////
+// SENSOR DEVICES
+//
+// Models of the optional battery sensors. Each attaches itself to the
+// simulated bus, at its I2C address or its 1-Wire pin, while it exists.
+//////////////////////////////////////////////////////////
+
+// INA219 / INA226 shunt monitor: the shunt voltage register follows
+// setCurrentAmps() through the shunt resistance, quantised to the chip's
+// LSB and clamped to its range. Conversions are instant; the firmware
+// reads far slower than the chip converts.
+class Ina2xxModel : public sim::I2cDevice {
+  public:
+    Ina2xxModel(bool isIna226, uint8_t address = 0x40, float shuntMilliohms = 1.5f);
+    ~Ina2xxModel();
+
+    void setCurrentAmps(float amps) { _amps = amps; }
+    uint16_t getConfig() const { return _config; }
+    unsigned long getReadCount() const { return _reads; }
+
+    void onWrite(const uint8_t* data, size_t length);
+    size_t onRead(uint8_t* data, size_t length);
+
+  private:
+    bool _isIna226;
+    uint8_t _address;
+    float _shuntMilliohms;
+    float _amps;
+    uint8_t _pointer;
+    uint16_t _config;
+    unsigned long _reads;
+
+    int16_t _shuntCounts() const;
+};
+
+// DS18B20 on a 1-Wire pin, externally powered, 12-bit resolution. Convert
+// T (0x44) latches setCelsius() into the scratchpad 750 ms later; until
+// then read slots return 0 and the scratchpad keeps the previous result
+// (85 C after power-up). Read Scratchpad (0xBE) returns the 9 bytes with
+// their CRC. Only Skip ROM (0xCC) addressing is modelled.
+class Ds18b20Model : public sim::OneWireDevice {
+  public:
+    static const unsigned long CONVERSION_US = 750000;
+
+    Ds18b20Model(uint8_t pin);
+    ~Ds18b20Model();
+
+    void setCelsius(float celsius) { _celsius = celsius; }
+    void setCorruptNextRead(bool corrupt) { _corruptNextRead = corrupt; } // One scratchpad read with a bad CRC
+    unsigned long getConversionCount() const { return _conversions; }
+
+    void onReset();
+    void onWrite(uint8_t value);
+    uint8_t onRead();
+
+  private:
+    enum Phase {
+      PHASE_ROM,      // After a reset: waiting for the ROM command
+      PHASE_FUNCTION, // Addressed: waiting for the function command
+      PHASE_READ,     // Shifting out the scratchpad
+      PHASE_IDLE      // Until the next reset
+    };
+
+    uint8_t _pin;
+    float _celsius;
+    Phase _phase;
+    uint8_t _scratchpad[9];
+    uint8_t _readIndex;
+    bool _isConverting;
+    uint64_t _conversionDoneUs;
+    bool _corruptNextRead;
+    unsigned long _conversions;
+
+    void _finishConversion();
+};
+//////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef simHal_h
+#define simHal_h
+
+#include <functional>
+#include <string>
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////
+// SIMULATION CONTROL
+//
+// Host-only API for driving the Arduino shim: a virtual clock that
+// advances only when the firmware calls delay() (or the harness calls
+// advanceMs()), and the electrical state of every GPIO.
+//
+// nowUs() is wall time. The firmware's millis()/micros() restart at 0
+// on every boot and stand still during forced light sleep, like on the
+// chip.
+//////////////////////////////////////////////////////////
+namespace sim {
+
+  // Thrown out of ESP.deepSleep(): the harness catches it, calls
+  // completeDeepSleep() and runs setup() again
+  struct DeepSleepReset {
+    uint64_t sleepUs;
+  };
+
+  // Wall time spent per power state (ground truth for energy models)
+  struct PowerStats {
+    uint64_t awakeRadioUs;
+    uint64_t awakeUs;
+    uint64_t lightSleepUs;
+    uint64_t deepSleepUs;
+  };
+
+  static const uint8_t PIN_COUNT = 32;
+  static const uint32_t FLASH_SIZE = 0x400000;     // 4 MB (D1 Mini)
+  static const uint32_t FLASH_SECTOR_SIZE = 0x1000;
+
+  typedef std::function<void(unsigned long nowMs)> TickListener;
+  typedef std::function<void(uint8_t pin, uint8_t val, unsigned long nowMs)> WriteObserver;
+
+  // Reset clock, pins, listeners and flash to the state of a fresh board
+  void reset();
+
+  // Virtual clock
+  uint64_t nowUs();
+  void advanceUs(uint64_t us);
+  void advanceMs(unsigned long ms); // Steps 1 ms at a time, firing tick listeners
+  void advanceBusyUs(uint64_t us); // Blocking work: moves the clock without firing anything
+  void advanceLightSleepUs(uint64_t us); // Tick listeners only; the firmware clock stands still
+  int addTickListener(TickListener listener);
+  void removeTickListener(int id);
+
+  // Pin state
+  void setAnalogInput(uint8_t pin, int value); // Clamped to 0..1023
+  void setDigitalInput(uint8_t pin, uint8_t level); // Fires an attached interrupt on change
+  uint8_t getDigitalOutput(uint8_t pin);
+  uint8_t getPinMode(uint8_t pin);
+  unsigned int getToneFrequency(uint8_t pin); // 0 when silent
+  void setWriteObserver(WriteObserver observer);
+
+  // Serial output leaves through a TX FIFO drained at the baud rate; it
+  // goes to stdout only when echo is enabled, and is kept
+  // for takeSerialOutput() while capture is enabled; input is queued for
+  // Serial.read()
+  void setSerialEcho(bool enabled);
+  void setSerialCapture(bool enabled);
+  std::string takeSerialOutput(); // Captured bytes since the last call
+  uint64_t getSerialStallUs(); // Time writes waited for room in the 128-byte TX FIFO
+  void sendSerialInput(const char* text);
+
+  // SPI flash (kept across reboots and deep sleep; reset() erases it)
+  void eraseFlash();
+  uint32_t getFlashEraseCount(uint32_t sector);
+  void setFilesystemSize(uint32_t bytes); // FS_PHYS_SIZE of the flash layout, 0 for one without a filesystem; reset() restores 2024 KB
+
+  // Interrupt context: timer0 and pin handlers run inside it. The SDK's
+  // RTC and flash calls are in flash on the chip, which an interrupt
+  // cannot rely on; calls made from an interrupt are counted here
+  bool isInInterrupt();
+  uint32_t getFlashCallsFromInterrupt();
+
+  // Chip power state
+  void completeDeepSleep(const DeepSleepReset& request); // Sleep, then reboot with RTC memory kept
+  void resetByWatchdog(); // The SDK's soft watchdog fired: reboot with RTC memory kept
+  bool isRadioOn();
+  PowerStats getPowerStats();
+
+  // Hooks between the shim files
+  void reboot(); // Clock back to 0, timers and interrupts cleared, pins to inputs
+  void advanceDeepSleepUs(uint64_t us); // Tick listeners only, charged as deep sleep
+  bool runPendingLightSleep(); // Called by delay(); true when a forced light sleep ran
+  void resetChip(); // Power-on state of RTC memory, radio and reset reason
+  void noteFlashCall(); // Called by shim functions that run from flash on the chip
+
+}
+//////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef tcpNet_h
+#define tcpNet_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////
+// SIMULATED NETWORK
+//
+// One access point and the hosts behind it. The firmware joins with
+// WiFi.begin() and talks TCP through the fake lwIP raw API; servers
+// (like MqttBrokerModel) listen at an address and port and see each
+// connection as a byte stream. Segments take the configured one-way
+// latency and are delivered from the virtual clock while the CPU is
+// awake, the way the SDK runs lwIP between sketch code.
+//
+// Outages come in two kinds: setAccessPoint(false) drops the station
+// (the SDK reports the disconnect, lwIP aborts nothing by itself), and
+// setLinkUp(false) silently loses every segment past the access point,
+// like a dead uplink: connects and data go unanswered.
+//////////////////////////////////////////////////////////
+namespace sim {
+
+  class TcpServer {
+    public:
+      virtual ~TcpServer() {}
+      virtual bool onAccept(int connection) { return true; } // false refuses (reset)
+      virtual void onReceive(int connection, const uint8_t* data, size_t length) = 0;
+      virtual void onClose(int connection) {} // Closed or reset by the client, or lost
+  };
+
+  struct NetworkStats {
+    unsigned long connects;     // SYNs that reached a server
+    unsigned long clientBytes;  // Delivered to servers
+    unsigned long serverBytes;  // Delivered to the firmware
+    unsigned long lostSegments; // Dropped while the link was down
+  };
+
+  uint32_t ipAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d); // As lwIP's IP_ADDR4 stores it
+  void attachTcpServer(uint32_t address, uint16_t port, TcpServer* server);
+  void detachTcpServer(uint32_t address, uint16_t port);
+
+  // Server side of a connection
+  void sendTcp(int connection, const uint8_t* data, size_t length);
+  void closeTcp(int connection); // Orderly close (the client's recv sees NULL)
+  void resetTcp(int connection); // The client's error callback sees ERR_RST
+
+  void setAccessPoint(bool up);
+  void setLinkUp(bool up);
+  void setNetworkLatencyMs(unsigned long ms); // One way; default 10 ms
+  void setAssociationMs(unsigned long ms);    // WiFi.begin() to connected; default 2000 ms
+  NetworkStats getNetworkStats();
+
+  // Hooks between the shim files
+  void runNetwork(unsigned long nowMs); // Deliver what is due (CPU awake)
+  void resetNetwork(bool powerCycle);   // Reboot: connections and association drop; power cycle: settings too
+
+}
+//////////////////////////////////////////////////////////
+
+#endif
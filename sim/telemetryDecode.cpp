@@ -0,0 +1,163 @@
+//////////////////////////////////////////////////////////
+// TELEMETRY DECODE
+//
+// Splits a Serial capture of a unit running with SERIAL_TELEMETRY into
+// its binary records and the text log around them. Every run of bytes
+// between two 0x00 delimiters is either one COBS frame (passes its CRC)
+// or text.
+//
+//   telemetryDecode [--text] <capture.bin>
+//
+// Output is CSV, one record per line:
+//   sample,time_ms,volts,noise_mv,state,flags
+//   event,time_ms,volts,name
+//   config,cutoff_volts,rearm_volts,rearm_delay_ms
+// --text also prints the text lines, prefixed with "# ". A summary with
+// frame, CRC-failure and sequence-gap counts goes to stderr.
+//////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "Arduino.h"
+#include "historyLog.h"
+#include "telemetry.h"
+
+namespace {
+
+  struct Counts {
+    unsigned long frames = 0;
+    unsigned long badFrames = 0;
+    unsigned long lostFrames = 0;
+  };
+
+  uint16_t getUint16(const uint8_t* data) {
+    return (uint16_t)(data[0] | (data[1] << 8));
+  }
+
+  uint32_t getUint32(const uint8_t* data) {
+    return getUint16(data) | ((uint32_t)getUint16(data + 2) << 16);
+  }
+
+  void printVolts(uint16_t millivolts) {
+    printf("%u.%03u", millivolts / 1000, millivolts % 1000);
+  }
+
+  void printText(const uint8_t* data, size_t length, bool showText) {
+    if (!showText) {
+      return;
+    }
+    bool lineStart = true;
+    for (size_t i = 0; i < length; i++) {
+      if (data[i] == '\r') {
+        continue;
+      }
+      if (lineStart) {
+        fputs("# ", stdout);
+      }
+      fputc(data[i], stdout);
+      lineStart = data[i] == '\n';
+    }
+    if (!lineStart) {
+      fputc('\n', stdout);
+    }
+  }
+
+  // A frame is a record when it decodes and passes the CRC
+  bool printRecord(const uint8_t* frame, size_t length, Counts& counts, bool& haveSequence, uint8_t& nextSequence) {
+    uint8_t record[Telemetry::MAX_FRAME_BYTES];
+    if (length > sizeof(record)) {
+      return false;
+    }
+    size_t recordLength = Telemetry::cobsDecode(frame, length, record);
+    if (recordLength < 4 || HistoryLog::crc16(record, recordLength - 2) != getUint16(record + recordLength - 2)) {
+      return false;
+    }
+    recordLength -= 2;
+    if (haveSequence && record[1] != nextSequence) {
+      counts.lostFrames += (uint8_t)(record[1] - nextSequence);
+    }
+    haveSequence = true;
+    nextSequence = record[1] + 1;
+    counts.frames++;
+
+    const uint8_t* payload = record + 2;
+    if (record[0] == TELEMETRY_SAMPLE && recordLength == 2 + 10) {
+      printf("sample,%lu,", (unsigned long)getUint32(payload));
+      printVolts(getUint16(payload + 4));
+      printf(",%u,%u,%u\n", getUint16(payload + 6), payload[8], payload[9]);
+    } else if (record[0] == TELEMETRY_EVENT && recordLength == 2 + 7) {
+      printf("event,%lu,", (unsigned long)getUint32(payload));
+      printVolts(getUint16(payload + 5));
+      printf(",%s\n", HistoryDecoder::eventName(payload[4]));
+    } else if (record[0] == TELEMETRY_CONFIG && recordLength == 2 + 8) {
+      printf("config,");
+      printVolts(getUint16(payload));
+      printf(",");
+      printVolts(getUint16(payload + 2));
+      printf(",%lu\n", (unsigned long)getUint32(payload + 4));
+    } else {
+      printf("unknown,%u\n", record[0]);
+    }
+    return true;
+  }
+
+}
+
+int main(int argc, char** argv) {
+  bool showText = false;
+  const char* path = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--text") == 0) {
+      showText = true;
+    } else if (argv[i][0] != '-' && !path) {
+      path = argv[i];
+    } else {
+      path = nullptr;
+      break;
+    }
+  }
+  if (!path) {
+    fprintf(stderr, "usage: telemetryDecode [--text] <capture.bin>\n");
+    return 2;
+  }
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "cannot read %s\n", path);
+    return 1;
+  }
+  std::vector<uint8_t> data;
+  uint8_t buffer[4096];
+  size_t count;
+  while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    data.insert(data.end(), buffer, buffer + count);
+  }
+  fclose(file);
+
+  Counts counts;
+  bool haveSequence = false;
+  uint8_t nextSequence = 0;
+  size_t start = 0;
+  for (size_t i = 0; i <= data.size(); i++) {
+    if (i < data.size() && data[i] != 0) {
+      continue;
+    }
+    size_t length = i - start;
+    if (length > 0 && !printRecord(&data[start], length, counts, haveSequence, nextSequence)) {
+      // Text, or a frame that was cut or corrupted on the line
+      bool looksLikeText = true;
+      for (size_t j = start; j < i && looksLikeText; j++) {
+        looksLikeText = data[j] == '\n' || data[j] == '\r' || (data[j] >= 0x20 && data[j] < 0x7F);
+      }
+      if (looksLikeText) {
+        printText(&data[start], length, showText);
+      } else {
+        counts.badFrames++;
+      }
+    }
+    start = i + 1;
+  }
+
+  fprintf(stderr, "%lu records, %lu bad frames, %lu lost (sequence gaps)\n",
+    counts.frames, counts.badFrames, counts.lostFrames);
+  return counts.badFrames == 0 ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "trace.h"
+
+//////////////////////////////////////////////////////////
+// VOLTAGE TRACE
+//////////////////////////////////////////////////////////
+bool Trace :: load(const char* path, std::string& error) {
+  _points.clear();
+  _cursor = 0;
+
+  size_t length = strlen(path);
+  bool ok;
+  if (length > 4 && strcmp(path + length - 4, ".bin") == 0) {
+    ok = _loadBinary(path, error);
+  } else {
+    ok = _loadCsv(path, error);
+  }
+  if (!ok) {
+    return false;
+  }
+  if (_points.empty()) {
+    error = "trace contains no samples";
+    return false;
+  }
+
+  // Replay relies on monotonic time
+  std::stable_sort(_points.begin(), _points.end(),
+    [](const TracePoint& a, const TracePoint& b) { return a.timeMs < b.timeMs; });
+  return true;
+}
+
+bool Trace :: _loadCsv(const char* path, std::string& error) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    error = std::string("cannot open ") + path;
+    return false;
+  }
+
+  char line[256];
+  unsigned long lineNumber = 0;
+  while (fgets(line, sizeof(line), file)) {
+    lineNumber++;
+    char* cursor = line;
+    while (*cursor == ' ' || *cursor == '\t') {
+      cursor++;
+    }
+    if (*cursor == '#' || *cursor == '\n' || *cursor == '\r' || *cursor == '\0') {
+      continue;
+    }
+
+    char* end;
+    double timeMs = strtod(cursor, &end);
+    if (end == cursor) {
+      if (_points.empty()) {
+        continue; // Header line
+      }
+      fclose(file);
+      error = "malformed line " + std::to_string(lineNumber);
+      return false;
+    }
+    cursor = end;
+    while (*cursor == ',' || *cursor == ' ' || *cursor == '\t' || *cursor == ';') {
+      cursor++;
+    }
+    double volts = strtod(cursor, &end);
+    if (end == cursor) {
+      fclose(file);
+      error = "missing voltage on line " + std::to_string(lineNumber);
+      return false;
+    }
+
+    TracePoint point;
+    point.timeMs = (unsigned long)timeMs;
+    point.volts = (float)volts;
+    _points.push_back(point);
+  }
+
+  fclose(file);
+  return true;
+}
+
+bool Trace :: _loadBinary(const char* path, std::string& error) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    error = std::string("cannot open ") + path;
+    return false;
+  }
+
+  uint8_t record[6];
+  while (fread(record, 1, sizeof(record), file) == sizeof(record)) {
+    TracePoint point;
+    point.timeMs = (unsigned long)record[0] | ((unsigned long)record[1] << 8) |
+                   ((unsigned long)record[2] << 16) | ((unsigned long)record[3] << 24);
+    point.volts = (float)((unsigned int)record[4] | ((unsigned int)record[5] << 8)) / 1000.0f;
+    _points.push_back(point);
+  }
+
+  fclose(file);
+  return true;
+}
+
+float Trace :: voltsAt(unsigned long timeMs) {
+  if (_points.empty()) {
+    return 0.0f;
+  }
+  while (_cursor + 1 < _points.size() && _points[_cursor + 1].timeMs <= timeMs) {
+    _cursor++;
+  }
+  return _points[_cursor].volts;
+}
+//////////////////////////////////////////////////////////
@@ -0,0 +1,45 @@
+#ifndef trace_h
+#define trace_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////
+// VOLTAGE TRACE
+//
+// Recorded battery voltage over time. Two on-disk formats:
+//   CSV:    "time_ms,volts" per line; '#' comments and a
+//           non-numeric header line are skipped
+//   Binary: packed little-endian records of
+//           { uint32_t timeMs; uint16_t millivolts; } (6 bytes),
+//           selected by a ".bin" file extension
+// Between points the voltage is held (zero-order hold).
+//////////////////////////////////////////////////////////
+struct TracePoint {
+  unsigned long timeMs;
+  float volts;
+};
+
+class Trace {
+  public:
+    bool load(const char* path, std::string& error);
+    bool empty() const { return _points.empty(); }
+    size_t size() const { return _points.size(); }
+    unsigned long durationMs() const { return _points.empty() ? 0 : _points.back().timeMs; }
+    const std::vector<TracePoint>& points() const { return _points; }
+
+    // Voltage at timeMs; queries must be monotonic between rewind() calls
+    float voltsAt(unsigned long timeMs);
+    void rewind() { _cursor = 0; }
+
+  private:
+    std::vector<TracePoint> _points;
+    size_t _cursor = 0;
+
+    bool _loadCsv(const char* path, std::string& error);
+    bool _loadBinary(const char* path, std::string& error);
+};
+//////////////////////////////////////////////////////////
+
+#endif
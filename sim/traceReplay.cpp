@@ -0,0 +1,562 @@
+//////////////////////////////////////////////////////////
+// TRACE REPLAY
+//
+// Runs the real BatteryProtector against a recorded voltage trace on
+// the virtual clock and reports cutoff / rearm latency per event.
+//
+//   traceReplay [options] <trace.csv|trace.bin>
+//     --cutoff V          cutoff threshold (default 11.0)
+//     --rearm V           rearm threshold (default 12.8)
+//     --rearm-delay S     rearm delay in seconds (default 60)
+//     --loop-ms N         fixed delay() at the end of loop() (default: sleep
+//                         until the next task is due, like main.ino)
+//     --stats             print scheduler task statistics and the stage profile
+//     --display           attach the 16x2 LCD and report I2C cost per refresh
+//     --low-power         light sleep between 100 ms sample bursts
+//     --deep-sleep        deep sleep while cut off (restarts the firmware on wake-up)
+//     --power             compare the firmware energy model with simulated power states
+//     --ride-through      ride through crank and inrush dips (TransientClassifier
+//                         defaults; replay the set in sim/traces/crank)
+//     --noise N           peak ADC noise in counts (default 0)
+//     --sensor-only       replay through a bare VoltageSensor on a PinMock, 5 ms samples
+//     --oversample N      sensor-only filter: samples per decimated sample (default 4)
+//     --median N          sensor-only filter: median window (default 5)
+//     --ema-shift N       sensor-only filter: EMA weight 1/2^N (default 3)
+//     --history FILE      enable the flash history log and export it to FILE after
+//                         the run (decode with historyDecode)
+//     --telemetry FILE    enable binary telemetry and save the Serial output to
+//                         FILE (decode with telemetryDecode)
+//     --verbose           echo firmware Serial output
+//////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include "Arduino.h"
+#include "LiquidCrystal_I2C.h"
+#include "Wire.h"
+#include "basicHardware.h"
+#include "batteryProtector.h"
+#include "adcModel.h"
+#include "i2cBus.h"
+#include "pinMock.h"
+#include "simHal.h"
+#include "systemClock.h"
+#include "trace.h"
+
+namespace {
+
+  const uint8_t RELAY_PIN = 12; // D6, BatteryProtector::PIN_RELAY_CONTROL
+
+  struct Options {
+    float cutoffVolts = 11.0f;
+    float rearmVolts = 12.8f;
+    unsigned long rearmDelayMs = 60000UL;
+    unsigned long loopMs = 0; // 0: BatteryProtector::getIdleMs()
+    bool stats = false;
+    bool display = false;
+    bool lowPower = false;
+    bool deepSleep = false;
+    bool power = false;
+    bool rideThrough = false;
+    int noiseCounts = 0;
+    bool sensorOnly = false;
+    VoltageFilterConfig filter = { 4, 5, 3 }; // BatteryProtector's defaults
+    bool verbose = false;
+    const char* historyPath = nullptr;
+    const char* telemetryPath = nullptr;
+    const char* tracePath = nullptr;
+  };
+
+  struct LatencyEvent {
+    const char* kind;
+    unsigned long crossingMs;
+    unsigned long actionMs;
+    float volts; // Trace voltage when the relay switched
+  };
+
+  struct LatencyStats {
+    unsigned long count = 0;
+    unsigned long minMs = 0;
+    unsigned long maxMs = 0;
+    unsigned long long sumMs = 0;
+
+    void add(unsigned long latencyMs) {
+      if (count == 0 || latencyMs < minMs) minMs = latencyMs;
+      if (latencyMs > maxMs) maxMs = latencyMs;
+      sumMs += latencyMs;
+      count++;
+    }
+
+    void print(const char* label) const {
+      if (count == 0) {
+        printf("%-7s events: 0\n", label);
+        return;
+      }
+      printf("%-7s events: %lu  latency ms min %lu / mean %.1f / max %lu\n",
+        label, count, minMs, (double)sumMs / count, maxMs);
+    }
+  };
+
+  // Print that writes straight to stdout, independent of Serial echo
+  class ConsolePrint : public Print {
+    public:
+      size_t write(uint8_t c) {
+        if (c != '\r') {
+          fputc(c, stdout);
+        }
+        return 1;
+      }
+      using Print::write;
+  };
+
+  // Print into a binary file, as a serial capture would be saved
+  class FilePrint : public Print {
+    public:
+      FilePrint(FILE* file) : _file(file) {}
+      size_t write(uint8_t c) {
+        return fputc(c, _file) == EOF ? 0 : 1;
+      }
+      int availableForWrite() { return HistoryLog::EXPORT_CHUNK_BYTES; }
+      using Print::write;
+
+    private:
+      FILE* _file;
+  };
+
+  // Tracks threshold crossings in the trace and the relay edges that answer them.
+  // A crossing is judged on the noise-free ADC count against the firmware's
+  // own threshold counts: within one count of the threshold the true
+  // voltage cannot tell which side the firmware sees.
+  class EventTracker {
+    public:
+      EventTracker(const Options& options, const AdcModel& adc) : _options(options), _adc(adc) {
+        _adc.noiseCounts = 0;
+        float ratio = adc.rTopOhms / (adc.rTopOhms + adc.rBottomOhms);
+        _cutoffCounts = VoltageSensor::thresholdCounts(options.cutoffVolts, ratio, adc.calibrationFactor, VoltageSensor::RAW_FRACTION_BITS);
+        _rearmCounts = VoltageSensor::thresholdCounts(options.rearmVolts, ratio, adc.calibrationFactor, VoltageSensor::RAW_FRACTION_BITS);
+      }
+
+      void start(bool relayOpen) {
+        _relayOpen = relayOpen;
+      }
+
+      void onSample(unsigned long nowMs, float volts) {
+        _lastVolts = volts;
+        uint16_t counts = (uint16_t)(_adc.rawFromVolts(volts) << VoltageSensor::RAW_FRACTION_BITS);
+        if (!_relayOpen) {
+          if (counts < _cutoffCounts) {
+            if (!_cutoffPending) {
+              _cutoffPending = true;
+              _cutoffCrossingMs = nowMs;
+            }
+          } else if (_cutoffPending) {
+            _cutoffPending = false; // Dip ended before the relay reacted
+            _missedDips++;
+          }
+        } else {
+          if (counts >= _rearmCounts) {
+            if (!_rearmPending) {
+              _rearmPending = true;
+              _rearmCrossingMs = nowMs;
+            }
+          } else {
+            _rearmPending = false;
+          }
+        }
+      }
+
+      void onRelayWrite(uint8_t level, unsigned long nowMs) {
+        bool open = level == HIGH; // Inverted logic: HIGH disconnects the load
+        if (open == _relayOpen) {
+          return;
+        }
+        _relayOpen = open;
+        if (open) {
+          if (_cutoffPending) {
+            _record("cutoff", _cutoffCrossingMs, nowMs);
+            _cutoff.add(nowMs - _cutoffCrossingMs);
+          } else {
+            // Opened while the noise-free ADC count was still above the
+            // threshold: noise or a fast trip on a transient
+            _record("early", nowMs, nowMs);
+            _earlyCutoffs++;
+          }
+          _cutoffPending = false;
+          _rearmPending = false;
+        } else {
+          if (_rearmPending) {
+            _record("rearm", _rearmCrossingMs, nowMs);
+            _rearm.add(nowMs - _rearmCrossingMs);
+          }
+          _rearmPending = false;
+          _cutoffPending = false;
+        }
+      }
+
+      void report() const {
+        for (size_t i = 0; i < _events.size(); i++) {
+          const LatencyEvent& event = _events[i];
+          printf("%-7s crossing %10lu ms  relay %10lu ms  latency %6lu ms  at %.3f V\n",
+            event.kind, event.crossingMs, event.actionMs, event.actionMs - event.crossingMs, event.volts);
+        }
+        printf("\n");
+        _cutoff.print("cutoff");
+        _rearm.print("rearm");
+        if (_cutoffPending) {
+          printf("pending cutoff since %lu ms at end of trace\n", _cutoffCrossingMs);
+        }
+        printf("dips shorter than the response time: %lu\n", _missedDips);
+        printf("relay openings above the cutoff threshold: %lu\n", _earlyCutoffs);
+      }
+
+    private:
+      const Options& _options;
+      AdcModel _adc;
+      uint16_t _cutoffCounts;
+      uint16_t _rearmCounts;
+      bool _relayOpen = false;
+      bool _cutoffPending = false;
+      bool _rearmPending = false;
+      unsigned long _cutoffCrossingMs = 0;
+      unsigned long _rearmCrossingMs = 0;
+      unsigned long _missedDips = 0;
+      unsigned long _earlyCutoffs = 0;
+      float _lastVolts = 0.0f;
+      LatencyStats _cutoff;
+      LatencyStats _rearm;
+      std::vector<LatencyEvent> _events;
+
+      void _record(const char* kind, unsigned long crossingMs, unsigned long actionMs) {
+        LatencyEvent event;
+        event.kind = kind;
+        event.crossingMs = crossingMs;
+        event.actionMs = actionMs;
+        event.volts = _lastVolts;
+        _events.push_back(event);
+      }
+  };
+
+  void usage() {
+    fprintf(stderr,
+      "usage: traceReplay [--cutoff V] [--rearm V] [--rearm-delay S] [--loop-ms N] [--stats] [--display]\n"
+      "                   [--low-power] [--deep-sleep] [--power] [--ride-through]\n"
+      "                   [--noise N] [--sensor-only [--oversample N] [--median N] [--ema-shift N]]\n"
+      "                   [--history FILE] [--telemetry FILE] [--verbose] <trace.csv|trace.bin>\n");
+  }
+
+  bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+      const char* arg = argv[i];
+      bool hasValue = i + 1 < argc;
+      if (strcmp(arg, "--cutoff") == 0 && hasValue) {
+        options.cutoffVolts = (float)atof(argv[++i]);
+      } else if (strcmp(arg, "--rearm") == 0 && hasValue) {
+        options.rearmVolts = (float)atof(argv[++i]);
+      } else if (strcmp(arg, "--rearm-delay") == 0 && hasValue) {
+        options.rearmDelayMs = (unsigned long)(atof(argv[++i]) * 1000.0);
+      } else if (strcmp(arg, "--loop-ms") == 0 && hasValue) {
+        options.loopMs = strtoul(argv[++i], nullptr, 10);
+      } else if (strcmp(arg, "--history") == 0 && hasValue) {
+        options.historyPath = argv[++i];
+      } else if (strcmp(arg, "--telemetry") == 0 && hasValue) {
+        options.telemetryPath = argv[++i];
+      } else if (strcmp(arg, "--noise") == 0 && hasValue) {
+        options.noiseCounts = atoi(argv[++i]);
+      } else if (strcmp(arg, "--oversample") == 0 && hasValue) {
+        options.filter.oversampleCount = (uint8_t)atoi(argv[++i]);
+      } else if (strcmp(arg, "--median") == 0 && hasValue) {
+        options.filter.medianWindow = (uint8_t)atoi(argv[++i]);
+      } else if (strcmp(arg, "--ema-shift") == 0 && hasValue) {
+        options.filter.emaShift = (uint8_t)atoi(argv[++i]);
+      } else if (strcmp(arg, "--sensor-only") == 0) {
+        options.sensorOnly = true;
+      } else if (strcmp(arg, "--stats") == 0) {
+        options.stats = true;
+      } else if (strcmp(arg, "--display") == 0) {
+        options.display = true;
+      } else if (strcmp(arg, "--low-power") == 0) {
+        options.lowPower = true;
+      } else if (strcmp(arg, "--deep-sleep") == 0) {
+        options.deepSleep = true;
+      } else if (strcmp(arg, "--power") == 0) {
+        options.power = true;
+      } else if (strcmp(arg, "--ride-through") == 0) {
+        options.rideThrough = true;
+      } else if (strcmp(arg, "--verbose") == 0) {
+        options.verbose = true;
+      } else if (arg[0] != '-' && !options.tracePath) {
+        options.tracePath = arg;
+      } else {
+        return false;
+      }
+    }
+    return options.tracePath != nullptr;
+  }
+
+  // Mean, 99th percentile and max of a set of absolute errors
+  void printErrors(const char* label, std::vector<float>& errors) {
+    double sum = 0.0;
+    for (size_t i = 0; i < errors.size(); i++) {
+      sum += errors[i];
+    }
+    std::vector<float>::iterator p99 = errors.begin() + errors.size() * 99 / 100;
+    std::nth_element(errors.begin(), p99, errors.end());
+    float maxError = *std::max_element(errors.begin(), errors.end());
+    printf("%-8s error V mean %.4f / p99 %.4f / max %.4f\n", label, sum / errors.size(), *p99, maxError);
+  }
+
+  int replaySensorOnly(Trace& trace, const Options& options) {
+    AdcModel adc;
+    adc.noiseCounts = options.noiseCounts;
+    PinMock pin(A0);
+    VoltageSensor rawSensor(&pin, adc.rTopOhms, adc.rBottomOhms, adc.calibrationFactor);
+    VoltageSensor filteredSensor(&pin, adc.rTopOhms, adc.rBottomOhms, adc.calibrationFactor);
+    rawSensor.init();
+    filteredSensor.init();
+    filteredSensor.setFilter(options.filter);
+
+    // One raw sample every SENSOR_SAMPLE_PERIOD_MS, like the firmware's
+    // sampler; each sample is compared with the trace voltage at that time.
+    // Filter lag right after a step in the trace is reported apart from
+    // the settled error, which is what threshold margins depend on.
+    const unsigned long SENSOR_SAMPLE_PERIOD_MS = 5;
+    const float STEP_VOLTS = 0.1f;        // A trace change this large starts a settling window
+    const unsigned long SETTLE_MS = 1000; // About six EMA time constants at the default filter
+    std::vector<float> rawErrors;
+    std::vector<float> settledErrors;
+    std::vector<float> stepErrors;
+    double sumNoise = 0.0;
+    unsigned long steps = 0;
+    bool settling = false;
+    unsigned long stepMs = 0;
+    float previousVolts = trace.voltsAt(0);
+    trace.rewind();
+    for (unsigned long nowMs = 0; nowMs <= trace.durationMs(); nowMs += SENSOR_SAMPLE_PERIOD_MS) {
+      float volts = trace.voltsAt(nowMs);
+      if (fabsf(volts - previousVolts) >= STEP_VOLTS) {
+        settling = true;
+        stepMs = nowMs;
+        steps++;
+      }
+      previousVolts = volts;
+      if (settling && nowMs - stepMs >= SETTLE_MS) {
+        settling = false;
+      }
+      pin.setAnalogValue(adc.rawFromVolts(volts));
+      rawErrors.push_back(fabsf(rawSensor.readVoltageInVolts() - volts));
+      if (filteredSensor.filterRaw((uint16_t)pin.doAnalogRead())) {
+        VoltageReading reading = filteredSensor.getFilteredReading();
+        float error = fabsf(reading.millivolts / 1000.0f - volts);
+        (settling ? stepErrors : settledErrors).push_back(error);
+        sumNoise += reading.noiseMillivolts / 1000.0;
+      }
+    }
+    if (settledErrors.empty()) {
+      fprintf(stderr, "trace too short for one settled filtered sample\n");
+      return 1;
+    }
+
+    printf("samples: %zu raw, %zu filtered (every %lu ms)\n", rawErrors.size(), settledErrors.size() + stepErrors.size(),
+      SENSOR_SAMPLE_PERIOD_MS * filteredSensor.getFilter().oversampleCount);
+    printErrors("raw", rawErrors);
+    printErrors("filtered", settledErrors);
+    if (!stepErrors.empty()) {
+      printf("(%lu steps of %.1f V or more; filtered error within %lu ms after them:)\n", steps, STEP_VOLTS, SETTLE_MS);
+      printErrors("settling", stepErrors);
+    }
+    printf("noise estimate mean %.4f V\n", sumNoise / (settledErrors.size() + stepErrors.size()));
+    return 0;
+  }
+
+  void reportDisplay(Display& display) {
+    const DisplayRefreshStats& total = display.getTotalRefreshStats();
+    uint32_t refreshes = display.getRefreshCount();
+    sim::I2cStats bus = sim::getI2cStats();
+    printf("\ndisplay: %u refreshes\n", refreshes);
+    if (refreshes > 0) {
+      printf("  per refresh: %.1f cells, %.1f cursor moves, %.1f I2C bytes in %.2f transactions, %.0f us\n",
+        (double)total.cellsWritten / refreshes, (double)total.cursorMoves / refreshes,
+        (double)total.i2cBytes / refreshes, (double)total.transactions / refreshes,
+        (double)total.busyMicros / refreshes);
+    }
+    printf("  bus total: %lu bytes in %lu transactions, %.1f ms at %u Hz\n",
+      bus.bytes, bus.transactions, bus.busUs / 1000.0, Wire.getClock());
+    // Read back from the HD44780 model what actually reached the glass
+    const Hd44780Model* lcd = static_cast<const Hd44780Model*>(sim::findI2cDevice(0x27));
+    for (uint8_t row = 0; lcd && row < 2; row++) {
+      char text[17];
+      for (uint8_t col = 0; col < 16; col++) {
+        text[col] = lcd->ddram((row ? 0x40 : 0x00) + col);
+      }
+      text[16] = '\0';
+      printf("  lcd row %u: [%s]\n", row, text);
+    }
+  }
+
+  void reportPower(BatteryProtector& protector, unsigned long boots) {
+    ConsolePrint console;
+    printf("\nfirmware energy model (%lu boots):\n", boots);
+    protector.printPowerStats(console);
+
+    // Same currents applied to the time the simulated chip really spent
+    // in each state; a mismatch means the firmware books time wrongly
+    sim::PowerStats truth = sim::getPowerStats();
+    const uint64_t stateUs[EnergyModel::POWER_STATE_COUNT] = {
+      truth.awakeRadioUs, truth.awakeUs, truth.lightSleepUs, truth.deepSleepUs
+    };
+    double totalUs = 0.0;
+    double microAmpUs = 0.0;
+    printf("\nsimulated chip:\n");
+    for (uint8_t i = 0; i < EnergyModel::POWER_STATE_COUNT; i++) {
+      EnergyModel::PowerState state = (EnergyModel::PowerState)i;
+      printf("  %-12s %10.1f s\n", EnergyModel::stateName(state), stateUs[i] / 1e6);
+      totalUs += stateUs[i];
+      microAmpUs += (double)stateUs[i] * EnergyModel::currentMicroAmps(state);
+    }
+    if (totalUs > 0.0) {
+      printf("  average current %.0f uA, charge %.0f uAh\n", microAmpUs / totalUs, microAmpUs / 3.6e9);
+    }
+  }
+
+  // Let the firmware stream its history log into a file, like 'h' on Serial
+  bool exportHistory(BatteryProtector& protector, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+      fprintf(stderr, "cannot write %s\n", path);
+      return false;
+    }
+    FilePrint out(file);
+    bool started = protector.startHistoryExport(out);
+    while (protector.isHistoryExporting()) {
+      protector.update();
+      protector.idle();
+    }
+    fclose(file);
+    if (started) {
+      printf("history exported to %s\n", path);
+    }
+    return started;
+  }
+
+  bool saveSerialCapture(const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+      fprintf(stderr, "cannot write %s\n", path);
+      return false;
+    }
+    std::string output = sim::takeSerialOutput();
+    fwrite(output.data(), 1, output.size(), file);
+    fclose(file);
+    printf("serial output (%zu bytes) saved to %s\n", output.size(), path);
+    return true;
+  }
+
+  int replayProtector(Trace& trace, const Options& options) {
+    AdcModel adc;
+    adc.noiseCounts = options.noiseCounts;
+    sim::reset();
+    sim::setSerialEcho(options.verbose);
+    sim::setSerialCapture(options.telemetryPath != nullptr);
+
+    // Drive A0 from the trace on every simulated millisecond
+    sim::setAnalogInput(A0, adc.rawFromVolts(trace.voltsAt(0)));
+    EventTracker tracker(options, adc);
+    sim::addTickListener([&](unsigned long nowMs) {
+      float volts = trace.voltsAt(nowMs);
+      sim::setAnalogInput(A0, adc.rawFromVolts(volts));
+      tracker.onSample(nowMs, volts);
+    });
+
+    // setup() from main.ino; runs again after every deep sleep
+    Display* display = nullptr;
+    BatteryProtector* protector = nullptr;
+    unsigned long boots = 0;
+    std::function<void()> boot = [&]() {
+      display = options.display ? new Display(0x27, 16, 2) : nullptr;
+      protector = new BatteryProtector(options.cutoffVolts, options.rearmVolts, options.rearmDelayMs, display);
+      protector->setLowPowerMode(options.lowPower);
+      protector->setDeepSleepInCutoff(options.deepSleep);
+      protector->setTelemetry(options.telemetryPath != nullptr);
+      protector->setHistoryLog(options.historyPath != nullptr);
+      if (options.rideThrough) {
+        protector->setTransientRideThrough(TransientClassifier::defaultConfig());
+      }
+      boots++;
+    };
+    boot();
+    sim::resetI2cStats(); // Count refreshes only, not the LCD power-on sequence
+
+    tracker.start(sim::getDigitalOutput(RELAY_PIN) == HIGH);
+    sim::setWriteObserver([&](uint8_t pin, uint8_t val, unsigned long nowMs) {
+      if (pin == RELAY_PIN) {
+        tracker.onRelayWrite(val, nowMs);
+      }
+    });
+
+    std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+    unsigned long endMs = trace.durationMs();
+    while (sim::nowUs() / 1000 < endMs) {
+      try {
+        protector->update();
+        if (options.loopMs > 0) {
+          delay(options.loopMs);
+        } else {
+          protector->idle();
+        }
+      } catch (const sim::DeepSleepReset& request) {
+        // The chip restarts: RAM objects are gone, RTC memory survives
+        sim::completeDeepSleep(request);
+        SystemClock::reset();
+        boot();
+      }
+    }
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    tracker.report();
+    if (options.stats) {
+      ConsolePrint console;
+      printf("\n");
+      protector->printSchedulerStats(console);
+      printf("\n");
+      protector->printProfile(console);
+      printf("serial: %.1f ms waiting for the TX FIFO\n\n", sim::getSerialStallUs() / 1000.0);
+    }
+    if (display) {
+      reportDisplay(*display);
+    }
+    if (options.power) {
+      reportPower(*protector, boots);
+    }
+    if (options.historyPath && !exportHistory(*protector, options.historyPath)) {
+      return 1;
+    }
+    if (options.telemetryPath && !saveSerialCapture(options.telemetryPath)) {
+      return 1;
+    }
+    printf("simulated %.1f s in %.3f s wall (%.0fx real time)\n",
+      endMs / 1000.0, wallSeconds, wallSeconds > 0.0 ? endMs / 1000.0 / wallSeconds : 0.0);
+    return 0;
+  }
+
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    usage();
+    return 2;
+  }
+
+  Trace trace;
+  std::string error;
+  if (!trace.load(options.tracePath, error)) {
+    fprintf(stderr, "traceReplay: %s\n", error.c_str());
+    return 1;
+  }
+
+  return options.sensorOnly ? replaySensorOnly(trace, options) : replayProtector(trace, options);
+}
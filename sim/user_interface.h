@@ -0,0 +1,89 @@
+#ifndef user_interface_h
+#define user_interface_h
+
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////
+// FAKE NON-OS SDK (os_timer)
+//
+// Software timers fire from the virtual clock in simHal, once per
+// simulated millisecond at most, after the tick listeners ran.
+//////////////////////////////////////////////////////////
+typedef void os_timer_func_t(void* timer_arg);
+
+typedef struct _ETSTIMER_ {
+  struct _ETSTIMER_* timer_next;
+  uint32_t timer_expire;
+  uint32_t timer_period;
+  os_timer_func_t* timer_func;
+  void* timer_arg;
+} os_timer_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void os_timer_setfn(os_timer_t* ptimer, os_timer_func_t* pfunction, void* parg);
+void os_timer_arm(os_timer_t* ptimer, uint32_t milliseconds, bool repeat_flag);
+void os_timer_disarm(os_timer_t* ptimer);
+
+#ifdef __cplusplus
+}
+#endif
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FAKE NON-OS SDK (sleep, RTC, reset info)
+//
+// A forced light sleep requested with wifi_fpm_do_sleep() starts at the
+// next delay(); the firmware clock stands still while tick listeners
+// keep running. The RTC timer counts wall time.
+//////////////////////////////////////////////////////////
+enum sleep_type {
+  NONE_SLEEP_T = 0,
+  LIGHT_SLEEP_T,
+  MODEM_SLEEP_T
+};
+
+enum rst_reason {
+  REASON_DEFAULT_RST = 0,
+  REASON_WDT_RST = 1,
+  REASON_EXCEPTION_RST = 2,
+  REASON_SOFT_WDT_RST = 3,
+  REASON_SOFT_RESTART = 4,
+  REASON_DEEP_SLEEP_AWAKE = 5,
+  REASON_EXT_SYS_RST = 6
+};
+
+struct rst_info {
+  uint32_t reason;
+  uint32_t exccause;
+  uint32_t epc1;
+  uint32_t epc2;
+  uint32_t epc3;
+  uint32_t excvaddr;
+  uint32_t depc;
+};
+
+typedef void (*fpm_wakeup_cb)(void);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void wifi_fpm_set_sleep_type(enum sleep_type type);
+void wifi_fpm_open(void);
+void wifi_fpm_close(void);
+int8_t wifi_fpm_do_sleep(uint32_t sleep_time_in_us);
+void wifi_fpm_set_wakeup_cb(fpm_wakeup_cb cb);
+uint32_t system_get_rtc_time(void);
+uint32_t system_rtc_clock_cali_proc(void); // us per RTC tick, 12 fractional bits
+struct rst_info* system_get_rst_info(void);
+
+#ifdef __cplusplus
+}
+#endif
+//////////////////////////////////////////////////////////
+
+#endif
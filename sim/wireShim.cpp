@@ -0,0 +1,178 @@
+#include <map>
+#include "Arduino.h"
+#include "Wire.h"
+#include "i2cBus.h"
+#include "simHal.h"
+
+TwoWire Wire;
+
+
+//////////////////////////////////////////////////////////
+// SIMULATED I2C BUS
+//////////////////////////////////////////////////////////
+namespace {
+
+  std::map<uint8_t, sim::I2cDevice*> g_devices;
+  sim::I2cStats g_stats = { 0, 0, 0 };
+  sim::I2cFault g_fault = sim::I2C_FAULT_NONE;
+  bool g_sclDrivenLow = false; // By the master, through GPIO
+  uint8_t g_releaseClocks = 0;
+
+  const uint8_t SDA_RELEASE_CLOCKS = 5; // Pulses until the slave finishes its byte and lets go
+  const uint32_t START_FAILURE_US = 10;   // Checking SDA before the START
+
+  bool isDrivenLow(uint8_t pin) {
+    return sim::getPinMode(pin) == OUTPUT && sim::getDigitalOutput(pin) == LOW;
+  }
+
+}
+
+namespace sim {
+
+  void attachI2cDevice(uint8_t address, I2cDevice* device) {
+    g_devices[address] = device;
+  }
+
+  void detachI2cDevice(uint8_t address) {
+    g_devices.erase(address);
+  }
+
+  I2cDevice* findI2cDevice(uint8_t address) {
+    std::map<uint8_t, I2cDevice*>::iterator it = g_devices.find(address);
+    return it == g_devices.end() ? nullptr : it->second;
+  }
+
+  I2cStats getI2cStats() {
+    return g_stats;
+  }
+
+  void resetI2cStats() {
+    g_stats.transactions = 0;
+    g_stats.bytes = 0;
+    g_stats.busUs = 0;
+  }
+
+  void setI2cFault(I2cFault fault) {
+    g_fault = fault;
+    g_releaseClocks = 0;
+    setDigitalInput(SDA, fault == I2C_FAULT_SDA_STUCK ? LOW : HIGH);
+    setDigitalInput(SCL, fault == I2C_FAULT_SCL_STUCK ? LOW : HIGH);
+  }
+
+  I2cFault getI2cFault() {
+    return g_fault;
+  }
+
+  void onI2cLineChange(uint8_t pin) {
+    if (pin != SCL) {
+      return;
+    }
+    bool low = isDrivenLow(SCL);
+    bool rising = g_sclDrivenLow && !low;
+    g_sclDrivenLow = low;
+    if (rising && g_fault == I2C_FAULT_SDA_STUCK && ++g_releaseClocks >= SDA_RELEASE_CLOCKS) {
+      setI2cFault(I2C_FAULT_NONE);
+    }
+  }
+
+  uint8_t chargeI2cFault(uint32_t clockStretchLimitUs) {
+    switch (g_fault) {
+      case I2C_FAULT_SDA_STUCK:
+        g_stats.transactions++;
+        advanceBusyUs(START_FAILURE_US);
+        return 4;
+      case I2C_FAULT_SCL_STUCK:
+        // 9 clocks of the address byte and the STOP, each stretched out
+        g_stats.transactions++;
+        g_stats.busUs += 10ULL * clockStretchLimitUs;
+        advanceBusyUs(10ULL * clockStretchLimitUs);
+        return 2;
+      case I2C_FAULT_NONE:
+        break;
+    }
+    return 0;
+  }
+
+  void chargeI2cTransaction(size_t bytesOnWire, uint32_t clockHz) {
+    // 9 clocks per byte (8 data + ACK) plus start and stop conditions
+    unsigned long long busUs = ((unsigned long long)bytesOnWire * 9 + 2) * 1000000ULL / clockHz;
+    g_stats.transactions++;
+    g_stats.bytes += bytesOnWire;
+    g_stats.busUs += busUs;
+    advanceBusyUs(busUs);
+  }
+
+}
+//////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////
+// FAKE TWOWIRE (I2C)
+//////////////////////////////////////////////////////////
+void TwoWire :: beginTransmission(uint8_t address) {
+  _txAddress = address;
+  _txLength = 0;
+  _txOverflow = false;
+}
+
+size_t TwoWire :: write(uint8_t data) {
+  if (_txLength >= BUFFER_LENGTH) {
+    _txOverflow = true;
+    return 0;
+  }
+  _txBuffer[_txLength++] = data;
+  return 1;
+}
+
+size_t TwoWire :: write(const uint8_t* data, size_t length) {
+  size_t written = 0;
+  while (written < length && write(data[written])) {
+    written++;
+  }
+  return written;
+}
+
+uint8_t TwoWire :: endTransmission(bool sendStop) {
+  (void)sendStop;
+  if (_txOverflow) {
+    return 1;
+  }
+  uint8_t faultStatus = sim::chargeI2cFault(_clockStretchLimitUs);
+  if (faultStatus != 0) {
+    return faultStatus;
+  }
+  sim::chargeI2cTransaction(_txLength + 1, _clock);
+  sim::I2cDevice* device = sim::findI2cDevice(_txAddress);
+  if (!device) {
+    return 2;
+  }
+  device->onWrite(_txBuffer, _txLength);
+  return 0;
+}
+
+uint8_t TwoWire :: requestFrom(uint8_t address, uint8_t quantity, bool sendStop) {
+  (void)sendStop;
+  _rxIndex = 0;
+  _rxLength = 0;
+  if (quantity > BUFFER_LENGTH) {
+    quantity = BUFFER_LENGTH;
+  }
+  if (sim::chargeI2cFault(_clockStretchLimitUs) != 0) {
+    return 0;
+  }
+  sim::chargeI2cTransaction(quantity + 1, _clock);
+  sim::I2cDevice* device = sim::findI2cDevice(address);
+  if (device) {
+    _rxLength = device->onRead(_rxBuffer, quantity);
+  }
+  return (uint8_t)_rxLength;
+}
+
+int TwoWire :: available() {
+  return (int)(_rxLength - _rxIndex);
+}
+
+int TwoWire :: read() {
+  return _rxIndex < _rxLength ? _rxBuffer[_rxIndex++] : -1;
+}
+//////////////////////////////////////////////////////////